@@ -0,0 +1,468 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AESNI
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define HAVE_ARMV8_CE
+#endif
+
+#include "aes.h"
+
+static const uint8_t sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+void aes128_expand(struct aes128_key *k, const uint8_t *key)
+{
+	static const uint8_t rcon[10] = {
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+	};
+	uint8_t *w = &k->rk[0][0];
+	unsigned int i;
+
+	memcpy(w, key, AES_BLOCK);
+	for (i = 4; i < 44; i++) {
+		uint8_t t[4];
+
+		memcpy(t, w + 4 * (i - 1), 4);
+		if (i % 4 == 0) {
+			uint8_t t0 = t[0];
+
+			t[0] = sbox[t[1]] ^ rcon[i / 4 - 1];
+			t[1] = sbox[t[2]];
+			t[2] = sbox[t[3]];
+			t[3] = sbox[t0];
+		}
+		w[4 * i + 0] = w[4 * (i - 4) + 0] ^ t[0];
+		w[4 * i + 1] = w[4 * (i - 4) + 1] ^ t[1];
+		w[4 * i + 2] = w[4 * (i - 4) + 2] ^ t[2];
+		w[4 * i + 3] = w[4 * (i - 4) + 3] ^ t[3];
+	}
+}
+
+static const uint8_t zero_block[AES_BLOCK];
+
+static inline unsigned int cbc_blocks(const struct aes_cbc_lane *l)
+{
+	return (l->first != NULL) + l->body_blocks + 1;
+}
+
+/* block j of a chain; lanes that are done get zeroes and discard the result */
+static inline const uint8_t *cbc_block(const struct aes_cbc_lane *l, unsigned int j)
+{
+	if (l->first != NULL) {
+		if (j == 0)
+			return l->first;
+		j--;
+	}
+	if (j < l->body_blocks)
+		return l->body + j * AES_BLOCK;
+	return j == l->body_blocks ? l->last : zero_block;
+}
+
+/*
+ * Portable: the usual 32-bit table implementation, one 1 KiB table that
+ * combines SubBytes and MixColumns, rotated for the other three rows.
+ * Table lookups leak timing through the cache; it is a fallback for CPUs
+ * without AES instructions, not a hardened implementation.
+ */
+
+static uint32_t te[256];
+
+static inline uint32_t ror32(uint32_t x, unsigned int n)
+{
+	return x >> n | x << (32 - n);
+}
+
+static inline uint32_t get_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+__attribute__((constructor)) static void te_init(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < 256; i++) {
+		uint32_t s = sbox[i];
+		uint32_t s2 = (s << 1) ^ (s & 0x80 ? 0x11b : 0);
+
+		te[i] = s2 << 24 | s << 16 | s << 8 | (s2 ^ s);
+	}
+}
+
+static void portable_encrypt(const struct aes128_key *k, const uint8_t *in, uint8_t *out)
+{
+	uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+	unsigned int r;
+
+	s0 = get_be32(in + 0) ^ get_be32(k->rk[0] + 0);
+	s1 = get_be32(in + 4) ^ get_be32(k->rk[0] + 4);
+	s2 = get_be32(in + 8) ^ get_be32(k->rk[0] + 8);
+	s3 = get_be32(in + 12) ^ get_be32(k->rk[0] + 12);
+
+	for (r = 1; r < 10; r++) {
+		const uint8_t *rk = k->rk[r];
+
+		t0 = te[s0 >> 24] ^ ror32(te[(s1 >> 16) & 0xff], 8) ^
+			ror32(te[(s2 >> 8) & 0xff], 16) ^ ror32(te[s3 & 0xff], 24) ^ get_be32(rk + 0);
+		t1 = te[s1 >> 24] ^ ror32(te[(s2 >> 16) & 0xff], 8) ^
+			ror32(te[(s3 >> 8) & 0xff], 16) ^ ror32(te[s0 & 0xff], 24) ^ get_be32(rk + 4);
+		t2 = te[s2 >> 24] ^ ror32(te[(s3 >> 16) & 0xff], 8) ^
+			ror32(te[(s0 >> 8) & 0xff], 16) ^ ror32(te[s1 & 0xff], 24) ^ get_be32(rk + 8);
+		t3 = te[s3 >> 24] ^ ror32(te[(s0 >> 16) & 0xff], 8) ^
+			ror32(te[(s1 >> 8) & 0xff], 16) ^ ror32(te[s2 & 0xff], 24) ^ get_be32(rk + 12);
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+
+#define LAST(a, b, c, d) \
+	((uint32_t)sbox[(a) >> 24] << 24 | (uint32_t)sbox[((b) >> 16) & 0xff] << 16 | \
+	 (uint32_t)sbox[((c) >> 8) & 0xff] << 8 | sbox[(d) & 0xff])
+	put_be32(out + 0, LAST(s0, s1, s2, s3) ^ get_be32(k->rk[10] + 0));
+	put_be32(out + 4, LAST(s1, s2, s3, s0) ^ get_be32(k->rk[10] + 4));
+	put_be32(out + 8, LAST(s2, s3, s0, s1) ^ get_be32(k->rk[10] + 8));
+	put_be32(out + 12, LAST(s3, s0, s1, s2) ^ get_be32(k->rk[10] + 12));
+#undef LAST
+}
+
+static void portable_encrypt_lanes(const struct aes128_key *const *k,
+	uint8_t (*blk)[AES_BLOCK], unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		portable_encrypt(k[i], blk[i], blk[i]);
+}
+
+static void portable_cbc_mac_lanes(struct aes_cbc_lane *l, unsigned int n)
+{
+	unsigned int i, j, k, blocks;
+
+	for (i = 0; i < n; i++) {
+		blocks = cbc_blocks(&l[i]);
+		memset(l[i].mac, 0, AES_BLOCK);
+		for (j = 0; j < blocks; j++) {
+			const uint8_t *m = cbc_block(&l[i], j);
+
+			for (k = 0; k < AES_BLOCK; k++)
+				l[i].mac[k] ^= m[k];
+			portable_encrypt(l[i].key, l[i].mac, l[i].mac);
+		}
+	}
+}
+
+static int portable_supported(void)
+{
+	return 1;
+}
+
+#ifdef HAVE_AESNI
+#define AESNI __attribute__((target("aes,sse2")))
+
+static inline __attribute__((always_inline)) AESNI void aesni_lanes(
+	const struct aes128_key *const *k, uint8_t (*blk)[AES_BLOCK], const unsigned int n)
+{
+	__m128i s[AES_LANES];
+	unsigned int i, r;
+
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++)
+		s[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)blk[i]),
+			_mm_load_si128((const __m128i *)k[i]->rk[0]));
+	for (r = 1; r < 10; r++) {
+#pragma GCC unroll 8
+		for (i = 0; i < n; i++)
+			s[i] = _mm_aesenc_si128(s[i], _mm_load_si128((const __m128i *)k[i]->rk[r]));
+	}
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++) {
+		s[i] = _mm_aesenclast_si128(s[i], _mm_load_si128((const __m128i *)k[i]->rk[10]));
+		_mm_storeu_si128((__m128i *)blk[i], s[i]);
+	}
+}
+
+static AESNI void aesni_encrypt(const struct aes128_key *k, const uint8_t *in, uint8_t *out)
+{
+	uint8_t blk[1][AES_BLOCK];
+
+	memcpy(blk[0], in, AES_BLOCK);
+	aesni_lanes(&k, blk, 1);
+	memcpy(out, blk[0], AES_BLOCK);
+}
+
+static AESNI void aesni_encrypt_lanes(const struct aes128_key *const *k,
+	uint8_t (*blk)[AES_BLOCK], unsigned int n)
+{
+	/* fixed lane counts so that the states stay in registers */
+	if (n == AES_LANES) {
+		aesni_lanes(k, blk, AES_LANES);
+		return;
+	}
+	if (n & 4) {
+		aesni_lanes(k, blk, 4);
+		k += 4;
+		blk += 4;
+	}
+	if (n & 2) {
+		aesni_lanes(k, blk, 2);
+		k += 2;
+		blk += 2;
+	}
+	if (n & 1)
+		aesni_lanes(k, blk, 1);
+}
+
+static inline __attribute__((always_inline)) AESNI void aesni_cbc(struct aes_cbc_lane *l,
+	const unsigned int n)
+{
+	__m128i x[AES_LANES], y[AES_LANES];
+	unsigned int blocks[AES_LANES], i, j, r, max = 0;
+
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++) {
+		x[i] = _mm_setzero_si128();
+		blocks[i] = cbc_blocks(&l[i]);
+		if (blocks[i] > max)
+			max = blocks[i];
+	}
+	for (j = 0; j < max; j++) {
+#pragma GCC unroll 8
+		for (i = 0; i < n; i++)
+			y[i] = _mm_xor_si128(_mm_xor_si128(x[i],
+				_mm_loadu_si128((const __m128i *)cbc_block(&l[i], j))),
+				_mm_load_si128((const __m128i *)l[i].key->rk[0]));
+		for (r = 1; r < 10; r++) {
+#pragma GCC unroll 8
+			for (i = 0; i < n; i++)
+				y[i] = _mm_aesenc_si128(y[i],
+					_mm_load_si128((const __m128i *)l[i].key->rk[r]));
+		}
+#pragma GCC unroll 8
+		for (i = 0; i < n; i++) {
+			y[i] = _mm_aesenclast_si128(y[i],
+				_mm_load_si128((const __m128i *)l[i].key->rk[10]));
+			if (j < blocks[i])
+				x[i] = y[i];
+		}
+	}
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++)
+		_mm_storeu_si128((__m128i *)l[i].mac, x[i]);
+}
+
+static AESNI void aesni_cbc_mac_lanes(struct aes_cbc_lane *l, unsigned int n)
+{
+	if (n == AES_LANES) {
+		aesni_cbc(l, AES_LANES);
+		return;
+	}
+	if (n & 4) {
+		aesni_cbc(l, 4);
+		l += 4;
+	}
+	if (n & 2) {
+		aesni_cbc(l, 2);
+		l += 2;
+	}
+	if (n & 1)
+		aesni_cbc(l, 1);
+}
+
+static int aesni_supported(void)
+{
+	return __builtin_cpu_supports("aes");
+}
+#endif
+
+#ifdef HAVE_ARMV8_CE
+#define ARMV8_CE __attribute__((target("+crypto")))
+
+static inline __attribute__((always_inline)) ARMV8_CE void armv8_lanes(
+	const struct aes128_key *const *k, uint8_t (*blk)[AES_BLOCK], const unsigned int n)
+{
+	uint8x16_t s[AES_LANES];
+	unsigned int i, r;
+
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++)
+		s[i] = vld1q_u8(blk[i]);
+	/* AESE adds the round key before SubBytes, so the rounds shift by one */
+	for (r = 0; r < 9; r++) {
+#pragma GCC unroll 8
+		for (i = 0; i < n; i++)
+			s[i] = vaesmcq_u8(vaeseq_u8(s[i], vld1q_u8(k[i]->rk[r])));
+	}
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++) {
+		s[i] = veorq_u8(vaeseq_u8(s[i], vld1q_u8(k[i]->rk[9])), vld1q_u8(k[i]->rk[10]));
+		vst1q_u8(blk[i], s[i]);
+	}
+}
+
+static ARMV8_CE void armv8_encrypt(const struct aes128_key *k, const uint8_t *in, uint8_t *out)
+{
+	uint8_t blk[1][AES_BLOCK];
+
+	memcpy(blk[0], in, AES_BLOCK);
+	armv8_lanes(&k, blk, 1);
+	memcpy(out, blk[0], AES_BLOCK);
+}
+
+static ARMV8_CE void armv8_encrypt_lanes(const struct aes128_key *const *k,
+	uint8_t (*blk)[AES_BLOCK], unsigned int n)
+{
+	if (n == AES_LANES) {
+		armv8_lanes(k, blk, AES_LANES);
+		return;
+	}
+	if (n & 4) {
+		armv8_lanes(k, blk, 4);
+		k += 4;
+		blk += 4;
+	}
+	if (n & 2) {
+		armv8_lanes(k, blk, 2);
+		k += 2;
+		blk += 2;
+	}
+	if (n & 1)
+		armv8_lanes(k, blk, 1);
+}
+
+static inline __attribute__((always_inline)) ARMV8_CE void armv8_cbc(struct aes_cbc_lane *l,
+	const unsigned int n)
+{
+	uint8x16_t x[AES_LANES], y[AES_LANES];
+	unsigned int blocks[AES_LANES], i, j, r, max = 0;
+
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++) {
+		x[i] = vdupq_n_u8(0);
+		blocks[i] = cbc_blocks(&l[i]);
+		if (blocks[i] > max)
+			max = blocks[i];
+	}
+	for (j = 0; j < max; j++) {
+#pragma GCC unroll 8
+		for (i = 0; i < n; i++)
+			y[i] = veorq_u8(x[i], vld1q_u8(cbc_block(&l[i], j)));
+		for (r = 0; r < 9; r++) {
+#pragma GCC unroll 8
+			for (i = 0; i < n; i++)
+				y[i] = vaesmcq_u8(vaeseq_u8(y[i], vld1q_u8(l[i].key->rk[r])));
+		}
+#pragma GCC unroll 8
+		for (i = 0; i < n; i++) {
+			y[i] = veorq_u8(vaeseq_u8(y[i], vld1q_u8(l[i].key->rk[9])),
+				vld1q_u8(l[i].key->rk[10]));
+			if (j < blocks[i])
+				x[i] = y[i];
+		}
+	}
+#pragma GCC unroll 8
+	for (i = 0; i < n; i++)
+		vst1q_u8(l[i].mac, x[i]);
+}
+
+static ARMV8_CE void armv8_cbc_mac_lanes(struct aes_cbc_lane *l, unsigned int n)
+{
+	if (n == AES_LANES) {
+		armv8_cbc(l, AES_LANES);
+		return;
+	}
+	if (n & 4) {
+		armv8_cbc(l, 4);
+		l += 4;
+	}
+	if (n & 2) {
+		armv8_cbc(l, 2);
+		l += 2;
+	}
+	if (n & 1)
+		armv8_cbc(l, 1);
+}
+
+static int armv8_supported(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
+#endif
+
+static const struct {
+	struct aes_impl impl;
+	int (*supported)(void);
+} impls[] = {
+#ifdef HAVE_AESNI
+	{ { "aesni", aesni_encrypt, aesni_encrypt_lanes, aesni_cbc_mac_lanes }, aesni_supported },
+#endif
+#ifdef HAVE_ARMV8_CE
+	{ { "armv8", armv8_encrypt, armv8_encrypt_lanes, armv8_cbc_mac_lanes }, armv8_supported },
+#endif
+	{ { "portable", portable_encrypt, portable_encrypt_lanes, portable_cbc_mac_lanes },
+	  portable_supported },
+};
+
+#define NUM_IMPLS	(sizeof(impls) / sizeof(impls[0]))
+
+const struct aes_impl *aes_impl_best(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_IMPLS; i++) {
+		if (impls[i].supported())
+			return &impls[i].impl;
+	}
+	return NULL;
+}
+
+const struct aes_impl *aes_impl_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NUM_IMPLS; i++) {
+		if (strcmp(impls[i].impl.name, name) == 0)
+			return impls[i].supported() ? &impls[i].impl : NULL;
+	}
+	return NULL;
+}
+
+unsigned int aes_impl_list(const struct aes_impl **list, unsigned int max)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < NUM_IMPLS && n < max; i++) {
+		if (impls[i].supported())
+			list[n++] = &impls[i].impl;
+	}
+	return n;
+}
@@ -0,0 +1,61 @@
+#ifndef AES_H
+#define AES_H
+
+#include <stdint.h>
+
+/*
+ * AES-128 encryption only, which is all CMAC and CTR mode need. The key
+ * schedule is expanded once; the block function is picked at run time:
+ * AES-NI on x86, the ARMv8 crypto extensions on arm64, and a portable
+ * table-driven implementation everywhere else.
+ *
+ * The lane functions work on up to AES_LANES independent blocks or CBC-MAC
+ * chains, each under its own key, in lockstep. One block at a time is
+ * bound by the latency of the AES round instruction; interleaving
+ * independent ones keeps the unit busy, which is where a batch of MICs
+ * gets its speed.
+ */
+
+#define AES_BLOCK	16
+#define AES_LANES	8
+
+struct aes128_key {
+	_Alignas(16) uint8_t rk[11][AES_BLOCK];
+};
+
+/*
+ * A CBC-MAC chain over an optional first block, body_blocks whole blocks
+ * and a last block, the way CMAC splits a message once the last block has
+ * been padded and xored with its subkey.
+ */
+struct aes_cbc_lane {
+	const struct aes128_key *key;
+	const uint8_t *first;
+	const uint8_t *body;
+	unsigned int body_blocks;
+	const uint8_t *last;
+	uint8_t mac[AES_BLOCK];
+};
+
+struct aes_impl {
+	const char *name;
+	void (*encrypt)(const struct aes128_key *k, const uint8_t *in, uint8_t *out);
+	/* in place, n at most AES_LANES */
+	void (*encrypt_lanes)(const struct aes128_key *const *k, uint8_t (*blk)[AES_BLOCK],
+		unsigned int n);
+	/* n at most AES_LANES */
+	void (*cbc_mac_lanes)(struct aes_cbc_lane *l, unsigned int n);
+};
+
+void aes128_expand(struct aes128_key *k, const uint8_t *key);
+
+/* the fastest implementation this CPU supports */
+const struct aes_impl *aes_impl_best(void);
+
+/* by name, or NULL when unknown or not supported by this CPU */
+const struct aes_impl *aes_impl_find(const char *name);
+
+/* all compiled-in implementations the CPU supports, fastest first */
+unsigned int aes_impl_list(const struct aes_impl **impls, unsigned int max);
+
+#endif
@@ -0,0 +1,94 @@
+#include <stddef.h>
+
+#include "airtime.h"
+
+/* 500 kHz divided by these gives the LoRa bandwidths */
+#define BW_DIVIDERS(X)	X(64) X(48) X(32) X(24) X(16) X(12) X(8) X(4) X(2) X(1)
+
+/* 2^sf / (500 kHz / div) in ns */
+#define SYM_NS(sf, div)	(((uint64_t)(div) * 2000) << (sf))
+#define SYM_ROW(div)	{ SYM_NS(5, div), SYM_NS(6, div), SYM_NS(7, div), \
+			  SYM_NS(8, div), SYM_NS(9, div), SYM_NS(10, div), \
+			  SYM_NS(11, div), SYM_NS(12, div) },
+#define BW_HZ(div)	500000 / (div),
+
+/* nominal values, as radios and regional parameters name them */
+const uint32_t lora_bw_hz[LORA_NUM_BW] = {
+	7800, 10400, 15600, 20800, 31250, 41700, 62500, 125000, 250000, 500000,
+};
+
+static const uint32_t bw_exact_hz[LORA_NUM_BW] = { BW_DIVIDERS(BW_HZ) };
+
+static const uint64_t sym_ns[LORA_NUM_BW][LORA_SF_MAX - LORA_SF_MIN + 1] = {
+	BW_DIVIDERS(SYM_ROW)
+};
+
+/* the radio turns LDRO on once a symbol takes 16 ms or longer */
+#define LDRO_SYM_NS	16000000ull
+
+static const struct eu868_band eu868_bands[] = {
+	{ "h1.3",	863000000, 865000000, 1 },
+	{ "g",		865000000, 868000000, 10 },
+	{ "g1",		868000000, 868600000, 10 },
+	{ "g2",		868700000, 869200000, 1 },
+	{ "g3",		869400000, 869650000, 100 },
+	{ "g4",		869700000, 870000000, 10 },
+};
+
+int lora_bw_index(uint32_t hz)
+{
+	unsigned int i;
+
+	for (i = 0; i < LORA_NUM_BW; i++) {
+		if (hz == lora_bw_hz[i] || hz == bw_exact_hz[i])
+			return i;
+	}
+	return -1;
+}
+
+uint64_t lora_symbol_ns(unsigned int sf, unsigned int bw)
+{
+	return sym_ns[bw][sf - LORA_SF_MIN];
+}
+
+int lora_ldro(const struct lora_params *p)
+{
+	if (p->ldro >= 0)
+		return p->ldro;
+	return lora_symbol_ns(p->sf, p->bw) >= LDRO_SYM_NS;
+}
+
+unsigned int lora_payload_symbols(const struct lora_params *p, unsigned int len)
+{
+	int de = lora_ldro(p);
+	int num, den;
+
+	num = 8 * len - 4 * p->sf + 16 * !!p->crc + 20 * !p->implicit_header;
+	/* SF5 and SF6 do without the 8 symbol offset but add to the preamble */
+	if (p->sf > 6)
+		num += 8;
+	den = 4 * (p->sf - 2 * de);
+	if (num <= 0)
+		return 8;
+	return 8 + (num + den - 1) / den * (p->cr + 4);
+}
+
+uint64_t lora_airtime_ns(const struct lora_params *p, unsigned int len)
+{
+	/* in quarter symbols, for the 4.25 symbols after the preamble */
+	uint64_t quarters = 4 * p->preamble + (p->sf > 6 ? 17 : 25);
+
+	quarters += 4 * lora_payload_symbols(p, len);
+	return quarters * lora_symbol_ns(p->sf, p->bw) / 4;
+}
+
+const struct eu868_band *eu868_band_find(uint32_t hz)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(eu868_bands) / sizeof(eu868_bands[0]); i++) {
+		if (hz >= eu868_bands[i].lo_hz && hz < eu868_bands[i].hi_hz)
+			return &eu868_bands[i];
+	}
+	return NULL;
+}
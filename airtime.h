@@ -0,0 +1,50 @@
+#ifndef AIRTIME_H
+#define AIRTIME_H
+
+#include <stdint.h>
+
+/*
+ * LoRa time on air as in the SX127x/SX126x datasheets. All LoRa bandwidths
+ * are 500 kHz divided by an integer, so symbol times are exact in ns and
+ * the result needs no floating point.
+ */
+
+#define LORA_SF_MIN	5
+#define LORA_SF_MAX	12
+#define LORA_NUM_BW	10
+
+struct lora_params {
+	unsigned int sf;
+	/* index into lora_bw_hz[], see lora_bw_index() */
+	unsigned int bw;
+	/* coding rate 4/(4 + cr), cr 1..4 */
+	unsigned int cr;
+	unsigned int preamble;
+	int implicit_header;
+	int crc;
+	/* low data rate optimization: 0 off, 1 on, -1 as the radio picks it */
+	int ldro;
+};
+
+extern const uint32_t lora_bw_hz[LORA_NUM_BW];
+
+int lora_bw_index(uint32_t hz);
+uint64_t lora_symbol_ns(unsigned int sf, unsigned int bw);
+int lora_ldro(const struct lora_params *p);
+unsigned int lora_payload_symbols(const struct lora_params *p, unsigned int len);
+uint64_t lora_airtime_ns(const struct lora_params *p, unsigned int len);
+
+/*
+ * EU868 sub-bands of ETSI EN 300 220 with their duty cycle limits, in
+ * permille of the observation period.
+ */
+struct eu868_band {
+	const char *name;
+	uint32_t lo_hz;
+	uint32_t hi_hz;
+	unsigned int permille;
+};
+
+const struct eu868_band *eu868_band_find(uint32_t hz);
+
+#endif
@@ -0,0 +1,583 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "ifcache.h"
+#include "proto.h"
+#include "rxfilter.h"
+#include "include/linux/lora.h"
+#include "include/linux/enocean.h"
+
+/*
+ * Every protocol gets its own PF_PACKET socket with a TPACKET_V3 RX ring.
+ * The kernel fills whole blocks and only wakes us up once a block is
+ * retired (full or timed out), so a busy radio costs one poll() per block
+ * rather than one recvfrom() per frame. Frames are written as pcapng
+ * enhanced packet blocks with a Linux cooked (SLL) header in front, which
+ * keeps the ETH_P_* protocol visible to the reader.
+ */
+
+#define RING_BLOCK_SIZE		(1 << 16)
+#define RING_BLOCK_NR		32
+#define RING_FRAME_SIZE		2048
+#define RING_BLOCK_TMO_MS	10
+
+#define LINKTYPE_LINUX_SLL	113
+#define SLL_HDR_LEN		16
+
+#define PCAPNG_SHB		0x0A0D0D0A
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1A2B3C4D
+
+#define OPT_ENDOFOPT		0
+#define OPT_IF_NAME		2
+#define OPT_IF_TSRESOL		9
+
+struct rx_ring {
+	int skt;
+	const struct proto *proto;
+	const struct ifcache_entry *e;
+	unsigned char *map;
+	unsigned int block;
+};
+
+struct pcapng_out {
+	const char *path;
+	FILE *f;
+	unsigned int file_no;
+	uint64_t limit;
+	uint64_t written;
+	/* pcapng interface ids are per file, indexed by ifindex here */
+	int *if_ids;
+	unsigned int num_if_ids;
+	unsigned int next_if_id;
+};
+
+static volatile sig_atomic_t stop;
+static struct ifcache ifc;
+static struct rxfilter filter;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static int out_write(struct pcapng_out *o, const void *buf, size_t len)
+{
+	if (fwrite(buf, 1, len, o->f) != len) {
+		int err = errno;
+		fprintf(stderr, "write failed: %s\n", strerror(err));
+		return -1;
+	}
+	o->written += len;
+	return 0;
+}
+
+static int out_block(struct pcapng_out *o, uint32_t type, const void *body,
+	size_t len, const void *data, size_t data_len, const void *opts,
+	size_t opts_len)
+{
+	static const unsigned char zero[4];
+	size_t pad = (4 - (data_len & 3)) & 3;
+	uint32_t total = 12 + len + data_len + pad + opts_len;
+
+	if (out_write(o, &type, 4) || out_write(o, &total, 4) ||
+	    out_write(o, body, len) ||
+	    (data_len && out_write(o, data, data_len)) ||
+	    (pad && out_write(o, zero, pad)) ||
+	    (opts_len && out_write(o, opts, opts_len)) ||
+	    out_write(o, &total, 4))
+		return -1;
+	return 0;
+}
+
+static int out_open(struct pcapng_out *o)
+{
+	struct {
+		uint32_t magic;
+		uint16_t major;
+		uint16_t minor;
+		int64_t section_len;
+	} shb = { PCAPNG_BYTE_ORDER, 1, 0, -1 };
+	char name[4096];
+
+	if (strcmp(o->path, "-") == 0) {
+		o->f = stdout;
+	} else {
+		if (o->file_no == 0)
+			snprintf(name, sizeof(name), "%s", o->path);
+		else
+			snprintf(name, sizeof(name), "%s.%u", o->path, o->file_no);
+		o->f = fopen(name, "w");
+		if (o->f == NULL) {
+			int err = errno;
+			fprintf(stderr, "%s: %s\n", name, strerror(err));
+			return -1;
+		}
+	}
+	setvbuf(o->f, NULL, _IOFBF, 1 << 20);
+
+	o->written = 0;
+	o->next_if_id = 0;
+	memset(o->if_ids, 0xff, o->num_if_ids * sizeof(*o->if_ids));
+
+	return out_block(o, PCAPNG_SHB, &shb, sizeof(shb), NULL, 0, NULL, 0);
+}
+
+static int out_close(struct pcapng_out *o)
+{
+	int ret = 0;
+
+	if (o->f == NULL)
+		return 0;
+	if (o->f == stdout)
+		ret = fflush(o->f);
+	else
+		ret = fclose(o->f);
+	o->f = NULL;
+	return ret == 0 ? 0 : -1;
+}
+
+static int out_rotate(struct pcapng_out *o)
+{
+	if (out_close(o) < 0)
+		return -1;
+	o->file_no++;
+	return out_open(o);
+}
+
+static int out_if_id(struct pcapng_out *o, int ifindex)
+{
+	struct {
+		uint16_t linktype;
+		uint16_t reserved;
+		uint32_t snaplen;
+	} idb = { LINKTYPE_LINUX_SLL, 0, 0 };
+	unsigned char opts[4 + IFNAMSIZ + 8 + 4];
+	const struct ifcache_entry *e;
+	char name[IFNAMSIZ];
+	uint16_t code, len;
+	size_t off = 0;
+
+	if (ifindex < 0)
+		return -1;
+	/* interfaces created after startup have ifindexes beyond the table */
+	if ((unsigned int)ifindex >= o->num_if_ids) {
+		unsigned int num = ifindex + 1;
+		int *ids = realloc(o->if_ids, num * sizeof(*ids));
+
+		if (ids == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+		memset(ids + o->num_if_ids, 0xff, (num - o->num_if_ids) * sizeof(*ids));
+		o->if_ids = ids;
+		o->num_if_ids = num;
+	}
+	if (o->if_ids[ifindex] >= 0)
+		return o->if_ids[ifindex];
+
+	e = ifcache_find_index(&ifc, ifindex);
+	if (e != NULL)
+		snprintf(name, sizeof(name), "%s", e->name);
+	else
+		snprintf(name, sizeof(name), "if%d", ifindex);
+
+	code = OPT_IF_NAME;
+	len = strlen(name);
+	memcpy(opts + off, &code, 2);
+	memcpy(opts + off + 2, &len, 2);
+	memset(opts + off + 4, 0, (len + 3) & ~3);
+	memcpy(opts + off + 4, name, len);
+	off += 4 + ((len + 3) & ~3);
+
+	/* nanosecond timestamps */
+	code = OPT_IF_TSRESOL;
+	len = 1;
+	memcpy(opts + off, &code, 2);
+	memcpy(opts + off + 2, &len, 2);
+	memset(opts + off + 4, 0, 4);
+	opts[off + 4] = 9;
+	off += 8;
+
+	memset(opts + off, 0, 4);
+	off += 4;
+
+	if (out_block(o, PCAPNG_IDB, &idb, sizeof(idb), NULL, 0, opts, off) < 0)
+		return -1;
+
+	o->if_ids[ifindex] = o->next_if_id++;
+	return o->if_ids[ifindex];
+}
+
+static int out_packet(struct pcapng_out *o, const struct tpacket3_hdr *ppd,
+	const struct sockaddr_ll *sll, const unsigned char *data)
+{
+	struct {
+		uint32_t if_id;
+		uint32_t ts_high;
+		uint32_t ts_low;
+		uint32_t caplen;
+		uint32_t len;
+		unsigned char sll[SLL_HDR_LEN];
+	} epb;
+	uint64_t ts;
+	uint16_t v;
+	int id;
+
+	if (o->limit && o->written >= o->limit && o->f != stdout &&
+	    out_rotate(o) < 0)
+		return -1;
+
+	id = out_if_id(o, sll->sll_ifindex);
+	if (id < 0)
+		return -1;
+
+	ts = (uint64_t)ppd->tp_sec * 1000000000ull + ppd->tp_nsec;
+	epb.if_id = id;
+	epb.ts_high = ts >> 32;
+	epb.ts_low = ts;
+	epb.caplen = SLL_HDR_LEN + ppd->tp_snaplen;
+	epb.len = SLL_HDR_LEN + ppd->tp_len;
+
+	memset(epb.sll, 0, sizeof(epb.sll));
+	v = htons(sll->sll_pkttype);
+	memcpy(epb.sll + 0, &v, 2);
+	v = htons(sll->sll_hatype);
+	memcpy(epb.sll + 2, &v, 2);
+	v = htons(sll->sll_halen > 8 ? 8 : sll->sll_halen);
+	memcpy(epb.sll + 4, &v, 2);
+	memcpy(epb.sll + 6, sll->sll_addr, sll->sll_halen > 8 ? 8 : sll->sll_halen);
+	memcpy(epb.sll + 14, &sll->sll_protocol, 2);
+
+	return out_block(o, PCAPNG_EPB, &epb, sizeof(epb), data, ppd->tp_snaplen,
+		NULL, 0);
+}
+
+static int ring_open(struct rx_ring *r)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll addr;
+	int version = TPACKET_V3;
+
+	r->skt = socket(PF_PACKET, SOCK_DGRAM, htons(r->proto->eth_p));
+	if (r->skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	if (setsockopt(r->skt, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+		int err = errno;
+		fprintf(stderr, "PACKET_VERSION failed: %s\n", strerror(err));
+		goto err;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCK_NR;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = RING_BLOCK_NR * (RING_BLOCK_SIZE / RING_FRAME_SIZE);
+	req.tp_retire_blk_tov = RING_BLOCK_TMO_MS;
+	req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+	if (setsockopt(r->skt, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1) {
+		int err = errno;
+		fprintf(stderr, "PACKET_RX_RING failed: %s\n", strerror(err));
+		goto err;
+	}
+
+	r->map = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_NR, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_LOCKED, r->skt, 0);
+	if (r->map == MAP_FAILED) {
+		/* MAP_LOCKED needs RLIMIT_MEMLOCK headroom, so retry without */
+		r->map = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_NR, PROT_READ | PROT_WRITE,
+			MAP_SHARED, r->skt, 0);
+	}
+	if (r->map == MAP_FAILED) {
+		int err = errno;
+		fprintf(stderr, "mmap failed: %s\n", strerror(err));
+		goto err;
+	}
+
+	if (rxfilter_attach(r->skt, &filter, r->proto->eth_p) < 0) {
+		munmap(r->map, RING_BLOCK_SIZE * RING_BLOCK_NR);
+		goto err;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(r->proto->eth_p);
+	addr.sll_ifindex = r->e ? r->e->ifindex : 0;
+	if (bind(r->skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "bind failed: %s\n", strerror(err));
+		munmap(r->map, RING_BLOCK_SIZE * RING_BLOCK_NR);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	close(r->skt);
+	r->skt = -1;
+	return -1;
+}
+
+static void ring_close(struct rx_ring *r)
+{
+	if (r->skt < 0)
+		return;
+	munmap(r->map, RING_BLOCK_SIZE * RING_BLOCK_NR);
+	close(r->skt);
+	r->skt = -1;
+}
+
+/*
+ * Hand every ready block to the writer and give it back to the kernel.
+ * At most max frames are written (0: no limit). Returns the number of
+ * frames written, or -1 on output errors.
+ */
+static long ring_drain(struct rx_ring *r, struct pcapng_out *o, unsigned long max)
+{
+	long frames = 0;
+
+	for (;;) {
+		struct tpacket_block_desc *bd =
+			(void *)(r->map + r->block * RING_BLOCK_SIZE);
+		struct tpacket3_hdr *ppd;
+		unsigned int i;
+
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+		      TP_STATUS_USER))
+			return frames;
+
+		ppd = (void *)((unsigned char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts && (max == 0 || frames < max); i++) {
+			const struct sockaddr_ll *sll = (void *)((unsigned char *)ppd +
+				TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+			if (out_packet(o, ppd, sll, (unsigned char *)ppd + ppd->tp_net) < 0)
+				return -1;
+			frames++;
+			ppd = (void *)((unsigned char *)ppd + ppd->tp_next_offset);
+		}
+
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+			__ATOMIC_RELEASE);
+		r->block = (r->block + 1) % RING_BLOCK_NR;
+		if (max && frames == max)
+			return frames;
+	}
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s -w file|- [-C megabytes] [-c count] [-p proto[,proto...]] [-f filter]\n"
+		"       [ifname|pattern ...]\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const struct proto *sel[PROTO_MAX];
+	const struct ifcache_entry *e;
+	struct pcapng_out out;
+	struct rx_ring *rings;
+	struct pollfd *pfds;
+	struct sigaction sa;
+	unsigned int i, num_rings = 0;
+	int j, num_sel = 0;
+	unsigned long count = 0, frames = 0;
+	unsigned long long drops = 0, seen = 0;
+	char *endptr;
+	int opt, ret = 0;
+
+	memset(&out, 0, sizeof(out));
+
+	while ((opt = getopt(argc, argv, "w:C:c:p:f:")) != -1) {
+		switch (opt) {
+		case 'w':
+			out.path = optarg;
+			break;
+		case 'C':
+			out.limit = strtoull(optarg, &endptr, 0) << 20;
+			if (*endptr != '\0' || out.limit == 0)
+				return usage(argv[0]);
+			break;
+		case 'c':
+			count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'p':
+			num_sel = proto_parse_list(optarg, sel);
+			if (num_sel <= 0)
+				return usage(argv[0]);
+			break;
+		case 'f':
+			if (rxfilter_parse(&filter, optarg) < 0)
+				return 2;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (out.path == NULL)
+		return usage(argv[0]);
+	if (num_sel == 0)
+		num_sel = proto_all(sel);
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+
+	rings = calloc((ifc.num + 1) * num_sel, sizeof(*rings));
+	pfds = calloc((ifc.num + 1) * num_sel, sizeof(*pfds));
+	out.num_if_ids = 1;
+	for (i = 0; i < ifc.num; i++) {
+		if ((unsigned int)ifc.entries[i].ifindex >= out.num_if_ids)
+			out.num_if_ids = ifc.entries[i].ifindex + 1;
+	}
+	out.if_ids = calloc(out.num_if_ids, sizeof(*out.if_ids));
+	if (rings == NULL || pfds == NULL || out.if_ids == NULL) {
+		ret = 1;
+		goto out;
+	}
+
+	if (optind == argc) {
+		/* ifindex 0: every interface */
+		for (j = 0; j < num_sel; j++) {
+			rings[num_rings].proto = sel[j];
+			if (ring_open(&rings[num_rings]) == 0)
+				num_rings++;
+			else
+				ret = 1;
+		}
+	}
+	for (; optind < argc; optind++) {
+		const char *name = argv[optind];
+		int found = 0;
+
+		/* a pattern may mix LoRa and EnOcean interfaces, so no type filter */
+		for (e = ifcache_next(&ifc, NULL, name, -1); e != NULL;
+		     e = ifcache_next(&ifc, e, name, -1)) {
+			if (ifcache_is_pattern(name) && e->type != ARPHRD_LORA &&
+			    e->type != ARPHRD_ENOCEAN)
+				continue;
+			found = 1;
+			/* the same interface named twice gets one set of rings */
+			for (i = 0; i < num_rings; i++) {
+				if (rings[i].e == e)
+					break;
+			}
+			if (i < num_rings)
+				continue;
+			if (num_rings + num_sel > (ifc.num + 1) * num_sel) {
+				fprintf(stderr, "too many interfaces\n");
+				ret = 1;
+				break;
+			}
+			for (j = 0; j < num_sel; j++) {
+				rings[num_rings].proto = sel[j];
+				rings[num_rings].e = e;
+				if (ring_open(&rings[num_rings]) == 0)
+					num_rings++;
+				else
+					ret = 1;
+			}
+		}
+		if (!found) {
+			fprintf(stderr, "%s: no such device\n", name);
+			ret = 1;
+		}
+	}
+	if (num_rings == 0) {
+		ret = 1;
+		goto out;
+	}
+
+	if (out_open(&out) < 0) {
+		ret = 1;
+		goto close;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	for (i = 0; i < num_rings; i++) {
+		pfds[i].fd = rings[i].skt;
+		pfds[i].events = POLLIN | POLLERR;
+	}
+
+	while (!stop && (count == 0 || frames < count)) {
+		int n = poll(pfds, num_rings, -1);
+
+		if (n == -1) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(err));
+			ret = 1;
+			break;
+		}
+
+		for (i = 0; i < num_rings; i++) {
+			long got;
+
+			if (pfds[i].revents == 0)
+				continue;
+			got = ring_drain(&rings[i], &out, count ? count - frames : 0);
+			if (got < 0) {
+				ret = 1;
+				stop = 1;
+				break;
+			}
+			frames += got;
+			if (count && frames == count)
+				break;
+		}
+	}
+
+	if (out_close(&out) < 0)
+		ret = 1;
+
+	for (i = 0; i < num_rings; i++) {
+		struct tpacket_stats_v3 st;
+		socklen_t len = sizeof(st);
+
+		if (getsockopt(rings[i].skt, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0) {
+			seen += st.tp_packets;
+			drops += st.tp_drops;
+		}
+	}
+	fprintf(stderr, "%lu frames captured, %llu received, %llu dropped, %u files\n",
+		frames, seen, drops, out.file_no + 1);
+
+close:
+	for (i = 0; i < num_rings; i++)
+		ring_close(&rings[i]);
+out:
+	free(out.if_ids);
+	free(pfds);
+	free(rings);
+	ifcache_free(&ifc);
+	return ret;
+}
@@ -0,0 +1,323 @@
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "hist.h"
+#include "mix.h"
+
+#define NUM_GENS	3
+/* stamp of a table that belongs to no generation */
+#define GEN_NONE	UINT64_MAX
+
+#define BEST_VALID	(1ull << 63)
+
+/* at a load factor of one half, longer runs only happen when overloaded */
+#define MAX_PROBE	64
+
+struct slot {
+	/* frame hash, 0 while free */
+	_Atomic uint64_t key;
+	/* BEST_VALID | biased RSSI << 32 | ifindex, 0 until the data is in */
+	_Atomic uint64_t best;
+	atomic_uint copies;
+	uint16_t len;
+	uint16_t eth_p;
+	uint64_t first_ts;
+	unsigned char data[DEDUP_DATA_MAX];
+} __attribute__((aligned(64)));
+
+struct table {
+	_Alignas(64) _Atomic uint64_t gen;
+	/* inserters currently looking at this table */
+	atomic_uint users;
+	_Alignas(64) atomic_uint used;
+	struct slot *slots;
+	/* slot indices in the order they were claimed */
+	uint32_t *order;
+};
+
+struct dedup {
+	uint64_t window;
+	unsigned int mask;
+	struct table tables[NUM_GENS];
+	_Alignas(64) atomic_ulong full;
+	atomic_ulong late;
+	/* only touched by the flushing thread */
+	_Alignas(64) uint64_t next_gen;
+	int started;
+	struct dedup_stats st;
+};
+
+static inline uint64_t pack_best(int rssi, int ifindex)
+{
+	return BEST_VALID | (uint64_t)(uint16_t)(rssi + 32768) << 32 | (uint32_t)ifindex;
+}
+
+static inline int best_rssi(uint64_t best)
+{
+	return (int)((best >> 32) & 0xffff) - 32768;
+}
+
+static uint64_t frame_hash(const unsigned char *data, unsigned int len, uint16_t eth_p)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ ((uint64_t)eth_p << 32 | len);
+	uint64_t w;
+	unsigned int i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+		h ^= h >> 29;
+	}
+	if (i < len) {
+		w = 0;
+		memcpy(&w, data + i, len - i);
+		h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+	}
+	h = mix64(h);
+	return h != 0 ? h : 1;
+}
+
+struct dedup *dedup_create(uint64_t window_ns, unsigned int capacity)
+{
+	struct dedup *d;
+	unsigned int n = 1, i;
+
+	/* keep the load factor at or below one half */
+	while (n < 2 * capacity)
+		n <<= 1;
+
+	if (window_ns == 0 || posix_memalign((void **)&d, 64, sizeof(*d)))
+		return NULL;
+	memset(d, 0, sizeof(*d));
+	d->window = window_ns;
+	d->mask = n - 1;
+
+	for (i = 0; i < NUM_GENS; i++) {
+		struct table *t = &d->tables[i];
+
+		atomic_init(&t->gen, GEN_NONE);
+		if (posix_memalign((void **)&t->slots, 64, (size_t)n * sizeof(*t->slots)) ||
+		    (t->order = calloc(n, sizeof(*t->order))) == NULL) {
+			dedup_destroy(d);
+			return NULL;
+		}
+		memset(t->slots, 0, (size_t)n * sizeof(*t->slots));
+	}
+	return d;
+}
+
+void dedup_destroy(struct dedup *d)
+{
+	unsigned int i;
+
+	if (d == NULL)
+		return;
+	for (i = 0; i < NUM_GENS; i++) {
+		free(d->tables[i].slots);
+		free(d->tables[i].order);
+	}
+	free(d);
+}
+
+static struct table *table_get(struct dedup *d, uint64_t gen)
+{
+	struct table *t = &d->tables[gen % NUM_GENS];
+
+	/* pairs with the stamp store and users check in emit_table() */
+	atomic_fetch_add(&t->users, 1);
+	if (atomic_load(&t->gen) != gen) {
+		atomic_fetch_sub_explicit(&t->users, 1, memory_order_release);
+		return NULL;
+	}
+	return t;
+}
+
+static void table_put(struct table *t)
+{
+	atomic_fetch_sub_explicit(&t->users, 1, memory_order_release);
+}
+
+static void merge(struct slot *s, int rssi, int ifindex)
+{
+	uint64_t best = atomic_load_explicit(&s->best, memory_order_relaxed);
+	uint64_t val = pack_best(rssi, ifindex);
+
+	while (rssi > best_rssi(best) &&
+	       !atomic_compare_exchange_weak(&s->best, &best, val))
+		;
+	atomic_fetch_add_explicit(&s->copies, 1, memory_order_relaxed);
+}
+
+/* returns DEDUP_NEW, DEDUP_DUP, DEDUP_FULL, or -1 when not found and !claim */
+static int lookup(struct table *t, unsigned int mask, uint64_t h,
+	const unsigned char *data, unsigned int len, uint16_t eth_p,
+	int rssi, int ifindex, uint64_t now, int claim)
+{
+	unsigned int idx = h & mask, probe;
+
+	for (probe = 0; probe <= mask && probe < MAX_PROBE; probe++, idx = (idx + 1) & mask) {
+		struct slot *s = &t->slots[idx];
+		uint64_t key = atomic_load_explicit(&s->key, memory_order_acquire);
+
+		if (key == 0) {
+			if (!claim)
+				return -1;
+			if (atomic_compare_exchange_strong(&s->key, &key, h)) {
+				s->len = len;
+				s->eth_p = eth_p;
+				s->first_ts = now;
+				memcpy(s->data, data, len);
+				atomic_store_explicit(&s->copies, 1, memory_order_relaxed);
+				atomic_store_explicit(&s->best, pack_best(rssi, ifindex),
+					memory_order_release);
+				t->order[atomic_fetch_add_explicit(&t->used, 1,
+					memory_order_relaxed)] = idx;
+				return DEDUP_NEW;
+			}
+			/* someone else got it first, key now holds theirs */
+		}
+
+		if (key != h)
+			continue;
+		/* same hash: wait for the winner to finish copying, then compare */
+		while (atomic_load_explicit(&s->best, memory_order_acquire) == 0)
+			cpu_relax();
+		if (s->len == len && s->eth_p == eth_p && memcmp(s->data, data, len) == 0) {
+			merge(s, rssi, ifindex);
+			return DEDUP_DUP;
+		}
+	}
+	return claim ? DEDUP_FULL : -1;
+}
+
+int dedup_insert(struct dedup *d, const unsigned char *data, unsigned int len,
+	uint16_t eth_p, int rssi, int ifindex, uint64_t now)
+{
+	uint64_t gen = now / d->window;
+	uint64_t h;
+	struct table *t;
+	int ret;
+
+	if (len > DEDUP_DATA_MAX)
+		return -EINVAL;
+	h = frame_hash(data, len, eth_p);
+
+	if (gen > 0 && (t = table_get(d, gen - 1)) != NULL) {
+		ret = lookup(t, d->mask, h, data, len, eth_p, rssi, ifindex, now, 0);
+		table_put(t);
+		if (ret == DEDUP_DUP)
+			return ret;
+	}
+
+	t = table_get(d, gen);
+	if (t == NULL) {
+		atomic_fetch_add_explicit(&d->late, 1, memory_order_relaxed);
+		return DEDUP_LATE;
+	}
+	ret = lookup(t, d->mask, h, data, len, eth_p, rssi, ifindex, now, 1);
+	table_put(t);
+	if (ret == DEDUP_FULL)
+		atomic_fetch_add_explicit(&d->full, 1, memory_order_relaxed);
+	return ret;
+}
+
+static unsigned int emit_table(struct dedup *d, struct table *t, dedup_emit_cb cb,
+	void *user)
+{
+	unsigned int i, n;
+
+	atomic_store(&t->gen, GEN_NONE);
+	while (atomic_load(&t->users) != 0)
+		cpu_relax();
+
+	n = atomic_load_explicit(&t->used, memory_order_acquire);
+	for (i = 0; i < n; i++) {
+		struct slot *s = &t->slots[t->order[i]];
+		uint64_t best = atomic_load_explicit(&s->best, memory_order_relaxed);
+		struct dedup_frame f = {
+			.data = s->data,
+			.len = s->len,
+			.eth_p = s->eth_p,
+			.rssi = best_rssi(best),
+			.ifindex = (int)(uint32_t)best,
+			.copies = atomic_load_explicit(&s->copies, memory_order_relaxed),
+			.first_ts = s->first_ts,
+		};
+
+		if (cb != NULL)
+			cb(user, &f);
+		d->st.duplicates += f.copies - 1;
+		atomic_store_explicit(&s->best, 0, memory_order_relaxed);
+		atomic_store_explicit(&s->key, 0, memory_order_relaxed);
+	}
+	atomic_store_explicit(&t->used, 0, memory_order_relaxed);
+
+	d->st.inserted += n;
+	d->st.emitted += n;
+	if (n > d->st.max_used)
+		d->st.max_used = n;
+	return n;
+}
+
+unsigned int dedup_flush(struct dedup *d, uint64_t now, dedup_emit_cb cb, void *user)
+{
+	uint64_t gen = now / d->window, g;
+	unsigned int n = 0;
+
+	if (!d->started) {
+		d->next_gen = gen;
+		d->started = 1;
+	}
+
+	/* an inserter at gen only looks back as far as gen - 1 */
+	for (; d->next_gen + 2 <= gen; d->next_gen++) {
+		struct table *t = &d->tables[d->next_gen % NUM_GENS];
+
+		if (atomic_load(&t->gen) == d->next_gen)
+			n += emit_table(d, t, cb, user);
+	}
+
+	/* the tables for gen and gen + 1 were emitted above or are fresh */
+	for (g = gen; g <= gen + 1; g++) {
+		struct table *t = &d->tables[g % NUM_GENS];
+
+		if (atomic_load(&t->gen) != g)
+			atomic_store(&t->gen, g);
+	}
+	return n;
+}
+
+unsigned int dedup_drain(struct dedup *d, dedup_emit_cb cb, void *user)
+{
+	unsigned int i, n = 0;
+	uint64_t gen;
+
+	/* oldest first, so frames come out in the order they arrived */
+	for (gen = d->next_gen; gen < d->next_gen + NUM_GENS; gen++) {
+		for (i = 0; i < NUM_GENS; i++) {
+			struct table *t = &d->tables[i];
+
+			if (atomic_load(&t->gen) == gen)
+				n += emit_table(d, t, cb, user);
+		}
+	}
+	d->started = 0;
+	return n;
+}
+
+void dedup_get_stats(const struct dedup *d, struct dedup_stats *st)
+{
+	*st = d->st;
+	st->full = atomic_load_explicit(&d->full, memory_order_relaxed);
+	st->late = atomic_load_explicit(&d->late, memory_order_relaxed);
+}
+
+size_t dedup_memory(const struct dedup *d)
+{
+	size_t slots = (size_t)d->mask + 1;
+
+	return sizeof(*d) + NUM_GENS * slots * (sizeof(struct slot) + sizeof(uint32_t));
+}
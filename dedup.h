@@ -0,0 +1,79 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Uplink deduplication for gateways where several radios hear the same
+ * transmission. Receive threads insert every frame; frames with the same
+ * protocol and payload that arrive within a window are merged, keeping the
+ * metadata of the copy with the best RSSI. A single thread calls
+ * dedup_flush(), which emits each merged frame once, between one and two
+ * windows after its first copy arrived.
+ *
+ * Time is cut into generations one window long, each with its own
+ * open-addressing table. Inserts go to the current generation and look
+ * for matches in the previous one. Slots are claimed with a compare and
+ * swap, so receive threads never block each other; a duplicate only
+ * waits if it lands while the first copy is still being copied in.
+ */
+
+#define DEDUP_DATA_MAX	256
+
+enum {
+	DEDUP_NEW,
+	DEDUP_DUP,
+	/* the table for the current generation is full */
+	DEDUP_FULL,
+	/* dedup_flush() has not prepared the current generation yet */
+	DEDUP_LATE,
+};
+
+struct dedup_frame {
+	const unsigned char *data;
+	unsigned int len;
+	uint16_t eth_p;
+	int rssi;
+	int ifindex;
+	unsigned int copies;
+	uint64_t first_ts;
+};
+
+struct dedup_stats {
+	uint64_t inserted;
+	uint64_t duplicates;
+	uint64_t emitted;
+	uint64_t full;
+	uint64_t late;
+	unsigned int max_used;
+};
+
+typedef void (*dedup_emit_cb)(void *user, const struct dedup_frame *f);
+
+struct dedup;
+
+/* capacity is the number of distinct frames per window, rounded up */
+struct dedup *dedup_create(uint64_t window_ns, unsigned int capacity);
+void dedup_destroy(struct dedup *d);
+
+/* now is CLOCK_MONOTONIC ns, as from hist_now_ns(); safe from any thread */
+int dedup_insert(struct dedup *d, const unsigned char *data, unsigned int len,
+	uint16_t eth_p, int rssi, int ifindex, uint64_t now);
+
+/*
+ * Emit the generations that can no longer see duplicates and prepare the
+ * next one. Call it once before the first insert and then at least once
+ * per window, always from the same thread. Returns the number emitted.
+ */
+unsigned int dedup_flush(struct dedup *d, uint64_t now, dedup_emit_cb cb, void *user);
+
+/* emit everything regardless of age, e.g. at shutdown */
+unsigned int dedup_drain(struct dedup *d, dedup_emit_cb cb, void *user);
+
+void dedup_get_stats(const struct dedup *d, struct dedup_stats *st);
+
+/* bytes allocated, which bounds the memory use for any traffic */
+size_t dedup_memory(const struct dedup *d);
+
+#endif
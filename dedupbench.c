@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dedup.h"
+#include "hist.h"
+#include "mix.h"
+
+/*
+ * Feeds the dedup engine from one thread per simulated radio. Every uplink
+ * is heard by one radio and, with the given probability, by each of the
+ * others, each copy with its own RSSI. The main thread flushes as a
+ * gateway would and checks that every uplink comes out exactly once with
+ * the best RSSI any radio saw.
+ */
+
+#define MAX_RADIOS	16
+#define ETH_P_LORAWAN	0x80FB
+
+struct bench_opts {
+	unsigned int radios;
+	unsigned long uplinks;
+	unsigned int pct;
+	unsigned long rate;
+	uint64_t window;
+	unsigned int capacity;
+	unsigned int len;
+};
+
+struct radio_thread {
+	pthread_t thread;
+	unsigned int index;
+	const struct bench_opts *o;
+	struct dedup *d;
+	pthread_barrier_t *start;
+	uint64_t t0;
+	unsigned long inserted;
+	unsigned long counts[4];
+	volatile int done;
+};
+
+struct verify {
+	const struct bench_opts *o;
+	unsigned char *seen;
+	unsigned long twice;
+	unsigned long best_ok;
+	struct hist lat;
+};
+
+static int heard(const struct bench_opts *o, unsigned long id, unsigned int radio)
+{
+	if (radio == id % o->radios)
+		return 1;
+	return mix64(id * MAX_RADIOS + radio) % 100 < o->pct;
+}
+
+static int rssi_of(unsigned long id, unsigned int radio)
+{
+	return -130 + (int)((mix64(id * MAX_RADIOS + radio) >> 8) % 110);
+}
+
+static int best_rssi(const struct bench_opts *o, unsigned long id)
+{
+	int best = -1000;
+	unsigned int r;
+
+	for (r = 0; r < o->radios; r++) {
+		if (heard(o, id, r) && rssi_of(id, r) > best)
+			best = rssi_of(id, r);
+	}
+	return best;
+}
+
+static void build_frame(unsigned char *buf, unsigned int len, unsigned long id)
+{
+	unsigned int i;
+
+	memset(buf, 0, len);
+	buf[0] = 0x40;
+	for (i = 0; i < 4 && 1 + i < len; i++)
+		buf[1 + i] = id >> (8 * i);
+	for (i = 5; i < len; i++)
+		buf[i] = id * 31 + i;
+}
+
+static unsigned long frame_id(const unsigned char *buf, unsigned int len)
+{
+	unsigned long id = 0;
+	unsigned int i;
+
+	for (i = 0; i < 4 && 1 + i < len; i++)
+		id |= (unsigned long)buf[1 + i] << (8 * i);
+	return id;
+}
+
+static void wait_until(uint64_t t)
+{
+	uint64_t now = hist_now_ns();
+
+	if (t > now + 50000) {
+		struct timespec ts = {
+			.tv_sec = (t - now) / 1000000000ull,
+			.tv_nsec = (t - now) % 1000000000ull,
+		};
+
+		nanosleep(&ts, NULL);
+	}
+}
+
+static void *radio_main(void *arg)
+{
+	struct radio_thread *rt = arg;
+	const struct bench_opts *o = rt->o;
+	unsigned char buf[DEDUP_DATA_MAX];
+	unsigned long id;
+	int ret;
+
+	pthread_barrier_wait(rt->start);
+	for (id = 0; id < o->uplinks; id++) {
+		if (!heard(o, id, rt->index))
+			continue;
+		if (o->rate != 0)
+			wait_until(rt->t0 + id * 1000000000ull / o->rate);
+		build_frame(buf, o->len, id);
+		ret = dedup_insert(rt->d, buf, o->len, ETH_P_LORAWAN,
+			rssi_of(id, rt->index), rt->index + 1, hist_now_ns());
+		if (ret >= 0 && ret < 4)
+			rt->counts[ret]++;
+		rt->inserted++;
+	}
+	rt->done = 1;
+	return NULL;
+}
+
+static void on_emit(void *user, const struct dedup_frame *f)
+{
+	struct verify *v = user;
+	unsigned long id = frame_id(f->data, f->len);
+
+	hist_add(&v->lat, hist_now_ns() - f->first_ts);
+	if (id >= v->o->uplinks)
+		return;
+	if (v->seen[id]++)
+		v->twice++;
+	if (f->rssi == best_rssi(v->o, id))
+		v->best_ok++;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-t radios] [-n uplinks] [-p percent] [-r uplinks/s] [-w window-ms]\n"
+		"       [-C capacity] [-l len]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.radios = 4,
+		.uplinks = 200000,
+		.pct = 50,
+		.rate = 50000,
+		.window = 200000000,
+		.capacity = 16384,
+		.len = 23,
+	};
+	struct radio_thread rts[MAX_RADIOS];
+	unsigned long frames = 0, counts[4] = { 0 }, missing = 0, id;
+	pthread_barrier_t start;
+	struct dedup_stats st;
+	struct verify v;
+	struct dedup *d;
+	uint64_t t0, t1, cpu;
+	unsigned int i, r;
+	char *endptr;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "t:n:p:r:w:C:l:")) != -1) {
+		switch (opt) {
+		case 't':
+			o.radios = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.radios == 0 || o.radios > MAX_RADIOS)
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.uplinks = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.uplinks == 0)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.pct = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.pct > 100)
+				return usage(argv[0]);
+			break;
+		case 'r':
+			o.rate = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'w':
+			o.window = strtoull(optarg, &endptr, 0) * 1000000;
+			if (*endptr != '\0' || o.window == 0)
+				return usage(argv[0]);
+			break;
+		case 'C':
+			o.capacity = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.capacity == 0)
+				return usage(argv[0]);
+			break;
+		case 'l':
+			o.len = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.len < 5 || o.len > DEDUP_DATA_MAX)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		return usage(argv[0]);
+
+	d = dedup_create(o.window, o.capacity);
+	memset(&v, 0, sizeof(v));
+	v.o = &o;
+	v.seen = calloc(o.uplinks, 1);
+	if (d == NULL || v.seen == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	hist_init(&v.lat);
+
+	dedup_flush(d, hist_now_ns(), on_emit, &v);
+	pthread_barrier_init(&start, NULL, o.radios + 1);
+	for (r = 0; r < o.radios; r++) {
+		memset(&rts[r], 0, sizeof(rts[r]));
+		rts[r].index = r;
+		rts[r].o = &o;
+		rts[r].d = d;
+		rts[r].start = &start;
+		ret = pthread_create(&rts[r].thread, NULL, radio_main, &rts[r]);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+			return 1;
+		}
+	}
+
+	t0 = hist_now_ns();
+	cpu = hist_cpu_ns(RUSAGE_SELF);
+	for (r = 0; r < o.radios; r++)
+		rts[r].t0 = t0;
+	pthread_barrier_wait(&start);
+
+	/* flush four times a window until every radio is through */
+	for (;;) {
+		struct timespec ts = {
+			.tv_sec = o.window / 4 / 1000000000ull,
+			.tv_nsec = o.window / 4 % 1000000000ull,
+		};
+		int done = 1;
+
+		nanosleep(&ts, NULL);
+		dedup_flush(d, hist_now_ns(), on_emit, &v);
+		for (r = 0; r < o.radios; r++) {
+			if (!rts[r].done)
+				done = 0;
+		}
+		if (done)
+			break;
+	}
+	for (r = 0; r < o.radios; r++) {
+		pthread_join(rts[r].thread, NULL);
+		frames += rts[r].inserted;
+	}
+	t1 = hist_now_ns();
+	dedup_drain(d, on_emit, &v);
+	cpu = hist_cpu_ns(RUSAGE_SELF) - cpu;
+
+	for (r = 0; r < o.radios; r++) {
+		for (i = 0; i < 4; i++)
+			counts[i] += rts[r].counts[i];
+	}
+	for (id = 0; id < o.uplinks; id++) {
+		if (!v.seen[id])
+			missing++;
+	}
+	dedup_get_stats(d, &st);
+
+	printf("%u radios, %lu uplinks heard %lu times, window %llu ms\n",
+		o.radios, o.uplinks, frames, (unsigned long long)o.window / 1000000);
+	printf("%lu frames in %.3f s: %.0f frames/s, %.0f ns CPU per frame\n",
+		frames, (t1 - t0) / 1e9, frames * 1e9 / (t1 - t0), (double)cpu / frames);
+	printf("new %lu, duplicate %lu, table full %lu, late %lu\n",
+		counts[DEDUP_NEW], counts[DEDUP_DUP], counts[DEDUP_FULL], counts[DEDUP_LATE]);
+	printf("emitted %llu: %lu missing, %lu twice, best RSSI kept for %.2f%%\n",
+		(unsigned long long)st.emitted, missing, v.twice,
+		st.emitted ? 100.0 * v.best_ok / st.emitted : 0);
+	printf("memory %.1f MiB for -C %u, most distinct frames in a window %u\n",
+		dedup_memory(d) / 1048576.0, o.capacity, st.max_used);
+	hist_print("first>emit", &v.lat);
+	if (counts[DEDUP_FULL] != 0)
+		printf("raise -C above the distinct frames per window to stop table full\n");
+
+	pthread_barrier_destroy(&start);
+	dedup_destroy(d);
+	free(v.seen);
+	return 0;
+}
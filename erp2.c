@@ -0,0 +1,212 @@
+#include <errno.h>
+#include <string.h>
+
+#include "erp2.h"
+
+#define CRC8_POLY	0x07
+#define SLICES		8
+
+/* crc_tables[k][x]: the CRC of byte x followed by k zero bytes */
+static uint8_t crc_tables[SLICES][256];
+
+__attribute__((constructor)) static void crc_init(void)
+{
+	unsigned int i, j, k;
+
+	for (i = 0; i < 256; i++) {
+		uint8_t c = i;
+
+		for (j = 0; j < 8; j++)
+			c = c & 0x80 ? (c << 1) ^ CRC8_POLY : c << 1;
+		crc_tables[0][i] = c;
+	}
+	for (k = 1; k < SLICES; k++) {
+		for (i = 0; i < 256; i++)
+			crc_tables[k][i] = crc_tables[0][crc_tables[k - 1][i]];
+	}
+}
+
+static inline uint8_t crc8_update(uint8_t crc, const uint8_t *p, unsigned int len)
+{
+	const uint8_t (*t)[256] = crc_tables;
+
+	/* the CRC is linear, so eight bytes combine from eight lookups */
+	for (; len >= SLICES; len -= SLICES, p += SLICES) {
+		crc = t[7][crc ^ p[0]] ^ t[6][p[1]] ^ t[5][p[2]] ^ t[4][p[3]] ^
+			t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+	}
+	while (len--)
+		crc = t[0][crc ^ *p++];
+	return crc;
+}
+
+uint8_t erp2_crc8(const uint8_t *buf, unsigned int len)
+{
+	return crc8_update(0, buf, len);
+}
+
+uint8_t erp2_crc8_bytewise(const uint8_t *buf, unsigned int len)
+{
+	uint8_t crc = 0;
+
+	while (len--)
+		crc = crc_tables[0][crc ^ *buf++];
+	return crc;
+}
+
+uint8_t erp2_crc8_bitwise(const uint8_t *buf, unsigned int len)
+{
+	uint8_t crc = 0;
+	unsigned int i;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 0x80 ? (crc << 1) ^ CRC8_POLY : crc << 1;
+	}
+	return crc;
+}
+
+void erp2_crc8_batch(const uint8_t *const *buf, const unsigned int *len, uint8_t *crc,
+	unsigned int n)
+{
+	unsigned int i;
+
+	/*
+	 * Telegrams do not depend on each other, so the CPU already overlaps
+	 * their lookups; what is left is to have the next ones in cache.
+	 */
+	for (i = 0; i < n; i++) {
+		if (i + ERP2_PREFETCH < n)
+			__builtin_prefetch(buf[i + ERP2_PREFETCH]);
+		crc[i] = crc8_update(0, buf[i], len[i]);
+	}
+}
+
+unsigned int erp2_verify_batch(const uint8_t *const *buf, const unsigned int *len,
+	uint8_t *ok, unsigned int n)
+{
+	unsigned int i, valid = 0;
+
+	/* the CRC over a telegram and its own CRC is zero */
+	erp2_crc8_batch(buf, len, ok, n);
+	for (i = 0; i < n; i++) {
+		ok[i] = ok[i] == 0 && len[i] >= 2;
+		valid += ok[i];
+	}
+	return valid;
+}
+
+int erp2_id_len(uint8_t addr, unsigned int *dst_len)
+{
+	*dst_len = 0;
+	switch (addr) {
+	case ERP2_ADDR_ID24:
+		return 3;
+	case ERP2_ADDR_ID32:
+		return 4;
+	case ERP2_ADDR_ID32_DST:
+		*dst_len = 4;
+		return 4;
+	case ERP2_ADDR_ID48:
+		return 6;
+	default:
+		return -1;
+	}
+}
+
+static uint64_t get_be(const uint8_t *p, unsigned int n)
+{
+	uint64_t v = 0;
+
+	while (n--)
+		v = v << 8 | *p++;
+	return v;
+}
+
+static void put_be(uint8_t *p, uint64_t v, unsigned int n)
+{
+	while (n--) {
+		p[n] = v;
+		v >>= 8;
+	}
+}
+
+int erp2_parse(struct erp2_telegram *t, const uint8_t *buf, unsigned int len)
+{
+	unsigned int off = 1, dst_len;
+	int id_len;
+
+	/* header and CRC at least */
+	if (len < 2)
+		return -EINVAL;
+	if (erp2_crc8(buf, len) != 0)
+		return -EBADMSG;
+
+	memset(t, 0, sizeof(*t));
+	t->addr = buf[0] >> ERP2_ADDR_SHIFT;
+	t->type = buf[0] & ERP2_TYPE_MASK;
+	len--;
+
+	if (buf[0] & ERP2_EXT_HDR) {
+		if (off >= len)
+			return -EINVAL;
+		t->ext_hdr = 1;
+		t->repeat = buf[off] >> ERP2_REPEAT_SHIFT;
+		t->opt_len = buf[off] & ERP2_OPT_LEN_MASK;
+		off++;
+	}
+	if (t->type == ERP2_TYPE_EXT) {
+		if (off >= len)
+			return -EINVAL;
+		t->ext_type = buf[off++];
+	}
+
+	id_len = erp2_id_len(t->addr, &dst_len);
+	if (id_len < 0 || off + id_len + dst_len + t->opt_len > len)
+		return -EINVAL;
+	t->id = get_be(buf + off, id_len);
+	off += id_len;
+	t->dst = get_be(buf + off, dst_len);
+	off += dst_len;
+
+	t->data = buf + off;
+	t->data_len = len - off - t->opt_len;
+	t->opt = t->data + t->data_len;
+	return 0;
+}
+
+int erp2_build(uint8_t *buf, unsigned int size, const struct erp2_telegram *t)
+{
+	int ext_hdr = t->ext_hdr || t->repeat != 0 || t->opt_len != 0;
+	unsigned int len, off = 1, dst_len;
+	int id_len = erp2_id_len(t->addr, &dst_len);
+
+	if (id_len < 0 || t->type > ERP2_TYPE_MASK || t->repeat > 15 ||
+	    t->opt_len > ERP2_OPT_LEN_MASK || (id_len < 8 && t->id >> (8 * id_len) != 0))
+		return -EINVAL;
+
+	len = 1 + ext_hdr + (t->type == ERP2_TYPE_EXT) + id_len + dst_len +
+		t->data_len + t->opt_len + 1;
+	if (len > size || len > ERP2_MAX_LEN)
+		return -ENOSPC;
+
+	buf[0] = t->addr << ERP2_ADDR_SHIFT | (ext_hdr ? ERP2_EXT_HDR : 0) | t->type;
+	if (ext_hdr)
+		buf[off++] = t->repeat << ERP2_REPEAT_SHIFT | t->opt_len;
+	if (t->type == ERP2_TYPE_EXT)
+		buf[off++] = t->ext_type;
+	put_be(buf + off, t->id, id_len);
+	off += id_len;
+	put_be(buf + off, t->dst, dst_len);
+	off += dst_len;
+	if (t->data_len != 0)
+		memcpy(buf + off, t->data, t->data_len);
+	off += t->data_len;
+	if (t->opt_len != 0)
+		memcpy(buf + off, t->opt, t->opt_len);
+	off += t->opt_len;
+
+	buf[off] = crc8_update(0, buf, off);
+	return len;
+}
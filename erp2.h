@@ -0,0 +1,99 @@
+#ifndef ERP2_H
+#define ERP2_H
+
+#include <stdint.h>
+
+/*
+ * EnOcean Radio Protocol 2 telegrams as they travel on ETH_P_ERP2 sockets:
+ * header, optional extended header and extended telegram type, originator
+ * and destination IDs, data, optional data and a CRC8 (x^8 + x^2 + x + 1,
+ * initial value 0) over everything before it.
+ *
+ * ERP2 header byte: address control in bits 7-5, extended header flag in
+ * bit 4, telegram type in bits 3-0. An extended header byte and, for
+ * telegram type 0xf, an extended telegram type byte precede the
+ * originator ID.
+ */
+
+#define ERP2_ADDR_SHIFT		5
+#define ERP2_ADDR_ID24		0
+#define ERP2_ADDR_ID32		1
+#define ERP2_ADDR_ID32_DST	2
+#define ERP2_ADDR_ID48		3
+#define ERP2_EXT_HDR		0x10
+#define ERP2_TYPE_MASK		0x0f
+#define ERP2_TYPE_EXT		0x0f
+
+#define ERP2_TYPE_RPS		0x0
+#define ERP2_TYPE_1BS		0x1
+#define ERP2_TYPE_4BS		0x2
+#define ERP2_TYPE_SMART_ACK	0x3
+#define ERP2_TYPE_VLD		0x4
+#define ERP2_TYPE_UTE		0x5
+#define ERP2_TYPE_MSC		0x6
+
+/* extended header: repeater count in bits 7-4, optional data length in 3-0 */
+#define ERP2_REPEAT_SHIFT	4
+#define ERP2_OPT_LEN_MASK	0x0f
+
+/* the drivers take telegrams of up to this many bytes, CRC included */
+#define ERP2_MAX_LEN		64
+/* how far ahead the batch functions prefetch telegrams */
+#define ERP2_PREFETCH		8
+
+/*
+ * A telegram. Parsing points data and opt into the buffer; building takes
+ * them from wherever they are. The extended header is sent when repeat or
+ * opt_len is not zero or ext_hdr is set.
+ */
+struct erp2_telegram {
+	uint8_t addr;
+	uint8_t type;
+	/* for ERP2_TYPE_EXT */
+	uint8_t ext_type;
+	uint8_t ext_hdr;
+	uint8_t repeat;
+	uint64_t id;
+	uint32_t dst;
+	const uint8_t *data;
+	unsigned int data_len;
+	const uint8_t *opt;
+	unsigned int opt_len;
+};
+
+/* length of the ID fields for an address control value, -1 if reserved */
+int erp2_id_len(uint8_t addr, unsigned int *dst_len);
+
+/*
+ * Returns 0, -EINVAL when the telegram is truncated or uses a reserved
+ * address control value, or -EBADMSG when its CRC is wrong.
+ */
+int erp2_parse(struct erp2_telegram *t, const uint8_t *buf, unsigned int len);
+
+/* returns the length including the CRC, -EINVAL or -ENOSPC */
+int erp2_build(uint8_t *buf, unsigned int size, const struct erp2_telegram *t);
+
+/*
+ * CRC8 with a 256-entry table per byte position, eight bytes per step.
+ * The CRC over a telegram including its CRC byte is 0 when it is intact.
+ */
+uint8_t erp2_crc8(const uint8_t *buf, unsigned int len);
+
+/* one byte at a time through a single table, for comparison */
+uint8_t erp2_crc8_bytewise(const uint8_t *buf, unsigned int len);
+
+/* shift and xor per bit, the way load test scripts tend to do it */
+uint8_t erp2_crc8_bitwise(const uint8_t *buf, unsigned int len);
+
+/*
+ * CRCs of n buffers at once, prefetching ERP2_PREFETCH telegrams ahead so
+ * that buffers scattered over a ring or a pool are in cache in time.
+ */
+void erp2_crc8_batch(const uint8_t *const *buf, const unsigned int *len, uint8_t *crc,
+	unsigned int n);
+
+/* sets ok[i] for every intact telegram and returns how many are */
+unsigned int erp2_verify_batch(const uint8_t *const *buf, const unsigned int *len,
+	uint8_t *ok, unsigned int n);
+
+#endif
@@ -0,0 +1,252 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "erp2.h"
+#include "hist.h"
+
+/*
+ * Builds a set of ERP2 telegrams the way a load test would, damages a
+ * share of them, then checks them with each CRC8 implementation and
+ * reports telegrams/s. Every implementation has to find exactly the
+ * damaged ones.
+ */
+
+#define SLOT_SIZE	ERP2_MAX_LEN
+
+enum {
+	MIX_RPS,
+	MIX_1BS,
+	MIX_4BS,
+	MIX_VLD,
+	MIX_ALL,
+};
+
+static const char *const mix_names[] = { "rps", "1bs", "4bs", "vld", "mix" };
+
+struct bench_opts {
+	unsigned int count;
+	int mix;
+	unsigned int vld_len;
+	unsigned int batch;
+	unsigned int bad_pct;
+};
+
+struct telegrams {
+	uint8_t *slots;
+	const uint8_t **bufs;
+	unsigned int *lens;
+	uint8_t *ok;
+	unsigned long bytes;
+	unsigned long damaged;
+};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 16;
+}
+
+static int build_all(const struct bench_opts *o, struct telegrams *tg)
+{
+	static const uint8_t type[] = {
+		ERP2_TYPE_RPS, ERP2_TYPE_1BS, ERP2_TYPE_4BS, ERP2_TYPE_VLD,
+	};
+	static const unsigned int data_len[] = { 1, 1, 4, 0 };
+	uint8_t data[ERP2_MAX_LEN];
+	uint64_t t0 = hist_now_ns();
+	unsigned int i, j;
+
+	for (i = 0; i < o->count; i++) {
+		int kind = o->mix == MIX_ALL ? (int)(i % 4) : o->mix;
+		struct erp2_telegram t = {
+			.type = type[kind],
+			.data = data,
+			.data_len = kind == MIX_VLD ? o->vld_len : data_len[kind],
+		};
+		uint8_t *slot = tg->slots + (size_t)i * SLOT_SIZE;
+		int len;
+
+		/* mostly 32 bit IDs, some 24 bit and some addressed ones */
+		t.addr = i % 8 == 7 ? ERP2_ADDR_ID32_DST : i % 8 == 6 ? ERP2_ADDR_ID24 : ERP2_ADDR_ID32;
+		t.id = (t.addr == ERP2_ADDR_ID24 ? 0x800000 : 0x01800000) + i % 0x10000;
+		t.dst = 0x0181abcd;
+		for (j = 0; j < t.data_len; j++)
+			data[j] = i + j;
+
+		len = erp2_build(slot, SLOT_SIZE, &t);
+		if (len < 0) {
+			fprintf(stderr, "erp2_build failed: %s\n", strerror(-len));
+			return -1;
+		}
+		tg->bufs[i] = slot;
+		tg->lens[i] = len;
+		tg->bytes += len;
+	}
+	t0 = hist_now_ns() - t0;
+	printf("built %u %s telegrams, %.1f bytes on average, in %.3f s: %.0f telegrams/s\n",
+		o->count, mix_names[o->mix], (double)tg->bytes / o->count, t0 / 1e9,
+		o->count * 1e9 / t0);
+
+	for (i = 0; i < o->count; i++) {
+		if (rng() % 100 < o->bad_pct) {
+			uint8_t *slot = tg->slots + (size_t)i * SLOT_SIZE;
+
+			/* any error of up to 8 bits in a row gets caught */
+			slot[rng() % tg->lens[i]] ^= 1 + rng() % 255;
+			tg->damaged++;
+		}
+	}
+	return 0;
+}
+
+static void report(const char *name, const struct bench_opts *o, const struct telegrams *tg,
+	uint64_t ns, unsigned long valid, double base_ns)
+{
+	printf("%-9s %10.0f telegrams/s %8.1f MB/s %6.1f ns each %6.2fx  %lu intact\n",
+		name, o->count * 1e9 / ns, tg->bytes * 1e3 / ns, (double)ns / o->count,
+		base_ns / ns, valid);
+}
+
+static int check(const char *name, const struct telegrams *tg, unsigned long valid,
+	unsigned int count)
+{
+	if (valid == count - tg->damaged)
+		return 0;
+	fprintf(stderr, "%s: %lu intact, expected %lu\n", name, valid, count - tg->damaged);
+	return -1;
+}
+
+static int bench(const struct bench_opts *o, struct telegrams *tg)
+{
+	static const struct {
+		const char *name;
+		uint8_t (*crc8)(const uint8_t *buf, unsigned int len);
+	} scalar[] = {
+		{ "bitwise", erp2_crc8_bitwise },
+		{ "bytewise", erp2_crc8_bytewise },
+		{ "slice8", erp2_crc8 },
+	};
+	struct erp2_telegram t;
+	unsigned long valid;
+	uint64_t t0, base = 0;
+	unsigned int i, k, n;
+
+	for (k = 0; k < sizeof(scalar) / sizeof(scalar[0]); k++) {
+		valid = 0;
+		t0 = hist_now_ns();
+		for (i = 0; i < o->count; i++)
+			valid += scalar[k].crc8(tg->bufs[i], tg->lens[i]) == 0;
+		t0 = hist_now_ns() - t0;
+		if (base == 0)
+			base = t0;
+		report(scalar[k].name, o, tg, t0, valid, base);
+		if (check(scalar[k].name, tg, valid, o->count))
+			return -1;
+	}
+
+	valid = 0;
+	t0 = hist_now_ns();
+	for (i = 0; i < o->count; i += n) {
+		n = o->count - i < o->batch ? o->count - i : o->batch;
+		valid += erp2_verify_batch(tg->bufs + i, tg->lens + i, tg->ok + i, n);
+	}
+	t0 = hist_now_ns() - t0;
+	report("batch", o, tg, t0, valid, base);
+	if (check("batch", tg, valid, o->count))
+		return -1;
+
+	/* parsing checks the CRC first, so damaged ones stop there */
+	valid = 0;
+	t0 = hist_now_ns();
+	for (i = 0; i < o->count; i++)
+		valid += erp2_parse(&t, tg->bufs[i], tg->lens[i]) == 0;
+	t0 = hist_now_ns() - t0;
+	report("parse", o, tg, t0, valid, base);
+	return check("parse", tg, valid, o->count);
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-t rps|1bs|4bs|vld|mix] [-l vld-len] [-b batch] [-e bad-pct]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.count = 1000000,
+		.mix = MIX_ALL,
+		.vld_len = 8,
+		.batch = 64,
+		.bad_pct = 1,
+	};
+	struct telegrams tg;
+	char *endptr;
+	int opt, i, ret;
+
+	while ((opt = getopt(argc, argv, "n:t:l:b:e:")) != -1) {
+		switch (opt) {
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.count == 0)
+				return usage(argv[0]);
+			break;
+		case 't':
+			for (i = 0; i <= MIX_ALL; i++) {
+				if (strcmp(optarg, mix_names[i]) == 0)
+					break;
+			}
+			if (i > MIX_ALL)
+				return usage(argv[0]);
+			o.mix = i;
+			break;
+		case 'l':
+			o.vld_len = strtoul(optarg, &endptr, 0);
+			/* header, ext header, two IDs and the CRC take 11 at most */
+			if (*endptr != '\0' || o.vld_len > ERP2_MAX_LEN - 11)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0)
+				return usage(argv[0]);
+			break;
+		case 'e':
+			o.bad_pct = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.bad_pct > 100)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		return usage(argv[0]);
+
+	memset(&tg, 0, sizeof(tg));
+	tg.slots = malloc((size_t)o.count * SLOT_SIZE);
+	tg.bufs = calloc(o.count, sizeof(*tg.bufs));
+	tg.lens = calloc(o.count, sizeof(*tg.lens));
+	tg.ok = calloc(o.count, sizeof(*tg.ok));
+	if (tg.slots == NULL || tg.bufs == NULL || tg.lens == NULL || tg.ok == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	ret = build_all(&o, &tg) || bench(&o, &tg);
+
+	free(tg.ok);
+	free(tg.lens);
+	free(tg.bufs);
+	free(tg.slots);
+	return ret;
+}
@@ -0,0 +1,988 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <sys/timerfd.h>
+
+#include "airtime.h"
+#include "xport.h"
+#include "include/linux/enocean.h"
+#include "include/linux/lora.h"
+#include "include/linux/nlfsk.h"
+#include "include/linux/nllora.h"
+
+/*
+ * The fake radio: xport's in-process backend.
+ *
+ * It has loraN interfaces, which speak both the nllora and the nlfsk
+ * family like an SX127x, fskN interfaces that only speak nlfsk, and
+ * enoceanN interfaces. Each interface transmits one frame at a time.
+ * LoRa frames take their airtime from airtime.c, other frames take their
+ * bytes plus FAKE_FSK_OVERHEAD at the bit rate. Frames queue behind
+ * each other up to the queue depth. Beyond that a blocking socket sleeps
+ * until the oldest frame is done and a non-blocking one gets EAGAIN, and
+ * its fd, a timerfd, turns readable at the time there is room again.
+ *
+ * Once its airtime is over, a frame that was not dropped is delivered to
+ * every socket of the same kind on another interface tuned to the same
+ * frequency, once that socket has called recv or polled for POLLIN.
+ * There is no radio thread: time is only looked at when the tools call
+ * in, so the backend is for one thread only.
+ *
+ * Generic netlink requests are answered right away from per-interface
+ * settings, the way genl handlers run in the sender's context.
+ *
+ * The spec after "fake:" is a comma separated list of:
+ *
+ *   lora=N fsk=N enocean=N   interfaces of each kind (2, 0, 1)
+ *   sf= bw= cr=              LoRa modulation (7, 125000, 1 for 4/5)
+ *   bitrate=                 FSK bit rate (50000); ERP2 is 125 kbit/s
+ *   airtime=us               the same airtime for every frame, 0 for none
+ *   drop=pct                 share of frames lost on the air (0)
+ *   queue=N                  frames an interface queues (16)
+ *   rxqueue=N                frames a socket holds for recv (256)
+ *   seed=N                   for the drops
+ */
+
+#define FAKE_FRAME_MAX		256
+#define FAKE_IFINDEX_BASE	1000
+/* of each kind, so "enocean63" still fits IFNAMSIZ */
+#define FAKE_MAX_IFS		64
+/* preamble, sync word, length and CRC */
+#define FAKE_FSK_OVERHEAD	10
+#define FAKE_ERP2_BITRATE	125000
+#define FAKE_GENL_LORA		0x40
+#define FAKE_GENL_FSK		0x41
+#define FAKE_REPLY_MIN		4096
+
+enum {
+	FAKE_FREQ,
+	FAKE_TX_POWER,
+	FAKE_FREQ_DEV,
+	FAKE_NUM_CFG,
+};
+
+enum {
+	FAKE_HAS_LORA	= 1 << 0,
+	FAKE_HAS_FSK	= 1 << 1,
+};
+
+struct fake_cfg_range {
+	int64_t min;
+	int64_t max;
+};
+
+static const struct fake_cfg_range fake_cfg_ranges[FAKE_NUM_CFG] = {
+	[FAKE_FREQ]	= { 137000000, 1020000000 },
+	[FAKE_TX_POWER]	= { -9, 22 },
+	[FAKE_FREQ_DEV]	= { 600, 200000 },
+};
+
+struct fake_family {
+	const char *genl_name;
+	uint16_t id;
+	int ifindex_attr;
+};
+
+static const struct fake_family fake_families[] = {
+	{ NLLORA_GENL_NAME, FAKE_GENL_LORA, NLLORA_ATTR_IFINDEX },
+	{ NLFSK_GENL_NAME, FAKE_GENL_FSK, NLFSK_ATTR_IFINDEX },
+};
+
+/* indexed like fake_families[] */
+static const int fake_family_bits[] = { FAKE_HAS_LORA, FAKE_HAS_FSK };
+
+struct fake_cmd {
+	int family;
+	uint8_t cmd;
+	int attr;
+	int cfg;
+	int set;
+};
+
+static const struct fake_cmd fake_cmds[] = {
+	{ 0, NLLORA_CMD_GET_FREQ, NLLORA_ATTR_FREQ, FAKE_FREQ, 0 },
+	{ 0, NLLORA_CMD_SET_FREQ, NLLORA_ATTR_FREQ, FAKE_FREQ, 1 },
+	{ 0, NLLORA_CMD_GET_TX_POWER, NLLORA_ATTR_TX_POWER, FAKE_TX_POWER, 0 },
+	{ 0, NLLORA_CMD_SET_TX_POWER, NLLORA_ATTR_TX_POWER, FAKE_TX_POWER, 1 },
+	{ 1, NLFSK_CMD_GET_FREQ, NLFSK_ATTR_FREQ, FAKE_FREQ, 0 },
+	{ 1, NLFSK_CMD_SET_FREQ, NLFSK_ATTR_FREQ, FAKE_FREQ, 1 },
+	/* the frequency deviation travels in the FREQ attribute */
+	{ 1, NLFSK_CMD_GET_FREQ_DEV, NLFSK_ATTR_FREQ, FAKE_FREQ_DEV, 0 },
+	{ 1, NLFSK_CMD_SET_FREQ_DEV, NLFSK_ATTR_FREQ, FAKE_FREQ_DEV, 1 },
+	{ 1, NLFSK_CMD_GET_TX_POWER, NLFSK_ATTR_TX_POWER, FAKE_TX_POWER, 0 },
+	{ 1, NLFSK_CMD_SET_TX_POWER, NLFSK_ATTR_TX_POWER, FAKE_TX_POWER, 1 },
+};
+
+#define NUM_FAKE_CMDS	(sizeof(fake_cmds) / sizeof(fake_cmds[0]))
+
+struct fake_frame {
+	uint64_t done;
+	int kind;
+	uint16_t eth_p;
+	uint16_t len;
+	int lost;
+	unsigned char data[FAKE_FRAME_MAX];
+};
+
+struct fake_if {
+	char name[IFNAMSIZ];
+	int ifindex;
+	unsigned short type;
+	int families;
+	int64_t cfg[FAKE_NUM_CFG];
+	/* the frame on the air first, then the ones waiting */
+	struct fake_frame *queue;
+	unsigned int head;
+	unsigned int len;
+	uint64_t busy_until;
+	unsigned long sent;
+	unsigned long lost;
+	unsigned long heard;
+	unsigned long full;
+	uint64_t air_ns;
+};
+
+struct fake_sock {
+	struct fake_if *fi;
+	int kind;
+	uint16_t eth_p;
+	/* set by the first recv or poll for input; send-only sockets get no copies */
+	int rx_enabled;
+	struct fake_frame *rx;
+	unsigned int rx_head;
+	unsigned int rx_len;
+	unsigned long rx_overruns;
+	unsigned int ring_head;
+	int armed;
+	struct fake_sock *next;
+};
+
+struct fake {
+	struct lora_params lora;
+	unsigned long bitrate;
+	int64_t airtime_ns;
+	uint32_t drop_ppm;
+	unsigned long queue;
+	unsigned long rx_queue;
+	uint64_t rng;
+	struct fake_if *ifs;
+	unsigned int num_ifs;
+	struct fake_sock *socks;
+	unsigned char *replies;
+	size_t reply_len;
+	size_t reply_size;
+	uint64_t start;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static uint32_t fake_rng(struct fake *f)
+{
+	f->rng ^= f->rng << 13;
+	f->rng ^= f->rng >> 7;
+	f->rng ^= f->rng << 17;
+	return f->rng >> 16;
+}
+
+static int fake_add_ifs(struct fake *f, const char *prefix, unsigned long num,
+	unsigned short type, int families, int64_t freq)
+{
+	unsigned long i;
+
+	if (num > FAKE_MAX_IFS)
+		return -EINVAL;
+	for (i = 0; i < num; i++) {
+		struct fake_if *fi = &f->ifs[f->num_ifs];
+
+		snprintf(fi->name, sizeof(fi->name), "%s%lu", prefix, i);
+		fi->ifindex = FAKE_IFINDEX_BASE + f->num_ifs;
+		fi->type = type;
+		fi->families = families;
+		fi->cfg[FAKE_FREQ] = freq;
+		fi->cfg[FAKE_TX_POWER] = 14;
+		fi->cfg[FAKE_FREQ_DEV] = 25000;
+		fi->queue = calloc(f->queue, sizeof(*fi->queue));
+		if (fi->queue == NULL)
+			return -ENOMEM;
+		f->num_ifs++;
+	}
+	return 0;
+}
+
+static int fake_parse(struct fake *f, char *args, unsigned long *num)
+{
+	struct {
+		const char *name;
+		unsigned long *val;
+		unsigned long min;
+		unsigned long max;
+	} opts[] = {
+		{ "lora", &num[0], 0, FAKE_MAX_IFS },
+		{ "fsk", &num[1], 0, FAKE_MAX_IFS },
+		{ "enocean", &num[2], 0, FAKE_MAX_IFS },
+		{ "sf", &num[3], LORA_SF_MIN, LORA_SF_MAX },
+		{ "bw", &num[4], 0, 500000 },
+		{ "cr", &num[5], 1, 4 },
+		{ "bitrate", &f->bitrate, 1, 10000000 },
+		{ "airtime", &num[6], 0, 60000000 },
+		{ "queue", &f->queue, 1, 65536 },
+		{ "rxqueue", &f->rx_queue, 1, 65536 },
+		{ "seed", &num[7], 1, ~0ul },
+	};
+	char *save, *tok, *val, *endptr;
+	unsigned int i;
+
+	for (tok = strtok_r(args, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		val = strchr(tok, '=');
+		if (val == NULL)
+			goto bad;
+		*val++ = '\0';
+
+		if (strcmp(tok, "drop") == 0) {
+			double pct = strtod(val, &endptr);
+
+			if (*endptr != '\0' || pct < 0 || pct > 100)
+				goto bad;
+			f->drop_ppm = pct * 10000;
+			continue;
+		}
+
+		for (i = 0; i < sizeof(opts) / sizeof(opts[0]); i++) {
+			if (strcmp(tok, opts[i].name) == 0)
+				break;
+		}
+		if (i == sizeof(opts) / sizeof(opts[0]))
+			goto bad;
+		*opts[i].val = strtoul(val, &endptr, 0);
+		if (*endptr != '\0' || *opts[i].val < opts[i].min || *opts[i].val > opts[i].max)
+			goto bad;
+		if (opts[i].val == &num[6])
+			f->airtime_ns = *opts[i].val * 1000ll;
+	}
+	return 0;
+
+bad:
+	fprintf(stderr, "fake transport: bad option %s\n", tok);
+	return -EINVAL;
+}
+
+static int fake_init(struct xport *xp, const char *args)
+{
+	/* lora, fsk, enocean, sf, bw, cr, airtime, seed */
+	unsigned long num[8] = { 2, 0, 1, 7, 125000, 1, 0, 0x9e3779b97f4a7c15ull };
+	struct fake *f;
+	char *copy = NULL;
+	int bw, ret = -ENOMEM;
+
+	f = calloc(1, sizeof(*f));
+	if (f == NULL)
+		return -ENOMEM;
+	f->bitrate = 50000;
+	f->airtime_ns = -1;
+	f->queue = 16;
+	f->rx_queue = 256;
+
+	if (args != NULL) {
+		copy = strdup(args);
+		if (copy == NULL)
+			goto fail;
+		ret = fake_parse(f, copy, num);
+		free(copy);
+		if (ret < 0)
+			goto fail;
+	}
+
+	bw = lora_bw_index(num[4]);
+	if (bw < 0) {
+		fprintf(stderr, "fake transport: no LoRa bandwidth of %lu Hz\n", num[4]);
+		ret = -EINVAL;
+		goto fail;
+	}
+	f->lora.sf = num[3];
+	f->lora.bw = bw;
+	f->lora.cr = num[5];
+	f->lora.preamble = 8;
+	f->lora.crc = 1;
+	f->lora.ldro = -1;
+	f->rng = num[7];
+
+	ret = -ENOMEM;
+	f->ifs = calloc(num[0] + num[1] + num[2] + 1, sizeof(*f->ifs));
+	if (f->ifs == NULL)
+		goto fail;
+	if (fake_add_ifs(f, "lora", num[0], ARPHRD_LORA, FAKE_HAS_LORA | FAKE_HAS_FSK, 868100000) < 0 ||
+	    fake_add_ifs(f, "fsk", num[1], ARPHRD_LORA, FAKE_HAS_FSK, 868100000) < 0 ||
+	    fake_add_ifs(f, "enocean", num[2], ARPHRD_ENOCEAN, 0, 868300000) < 0)
+		goto fail;
+
+	f->start = now_ns();
+	xp->priv = f;
+	return 0;
+
+fail:
+	if (f->ifs != NULL) {
+		unsigned int i;
+
+		for (i = 0; i < f->num_ifs; i++)
+			free(f->ifs[i].queue);
+		free(f->ifs);
+	}
+	free(f);
+	return ret;
+}
+
+static void fake_fini(struct xport *xp)
+{
+	struct fake *f = xp->priv;
+	unsigned int i;
+
+	for (i = 0; i < f->num_ifs; i++)
+		free(f->ifs[i].queue);
+	free(f->ifs);
+	free(f->replies);
+	free(f);
+}
+
+static int fake_load_ifs(struct xport *xp, struct ifcache *cache)
+{
+	struct fake *f = xp->priv;
+	unsigned int i;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->entries = calloc(f->num_ifs + 1, sizeof(*cache->entries));
+	if (cache->entries == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < f->num_ifs; i++) {
+		struct ifcache_entry *e = &cache->entries[i];
+
+		strcpy(e->name, f->ifs[i].name);
+		e->ifindex = f->ifs[i].ifindex;
+		e->type = f->ifs[i].type;
+		e->flags = IFF_UP | IFF_RUNNING;
+	}
+	cache->num = f->num_ifs;
+	return 0;
+}
+
+static struct fake_if *fake_find_if(struct fake *f, int ifindex)
+{
+	unsigned int i = ifindex - FAKE_IFINDEX_BASE;
+
+	return i < f->num_ifs ? &f->ifs[i] : NULL;
+}
+
+/*
+ * Frames
+ */
+
+static uint64_t fake_airtime(const struct fake *f, const struct fake_if *fi, int kind,
+	unsigned int len)
+{
+	uint64_t bitrate = fi->type == ARPHRD_ENOCEAN ? FAKE_ERP2_BITRATE : f->bitrate;
+
+	if (f->airtime_ns >= 0)
+		return f->airtime_ns;
+	if (kind == XPORT_LORA)
+		return lora_airtime_ns(&f->lora, len);
+	return (len + FAKE_FSK_OVERHEAD) * 8000000000ull / bitrate;
+}
+
+static void fake_deliver(struct fake *f, struct fake_if *fi, const struct fake_frame *fr)
+{
+	struct fake_sock *fs;
+	int heard = 0;
+
+	for (fs = f->socks; fs != NULL; fs = fs->next) {
+		struct fake_frame *slot;
+
+		/* a radio does not hear itself */
+		if (fs->fi == fi || fs->fi->cfg[FAKE_FREQ] != fi->cfg[FAKE_FREQ] ||
+		    fs->kind != fr->kind || fs->eth_p != fr->eth_p)
+			continue;
+		heard = 1;
+		if (!fs->rx_enabled)
+			continue;
+		if (fs->rx_len == f->rx_queue) {
+			fs->rx_overruns++;
+			continue;
+		}
+		slot = &fs->rx[(fs->rx_head + fs->rx_len) % f->rx_queue];
+		slot->done = fr->done;
+		slot->len = fr->len;
+		memcpy(slot->data, fr->data, fr->len);
+		fs->rx_len++;
+	}
+	fi->heard += heard;
+}
+
+/* everything whose airtime is over by now leaves the air */
+static void fake_advance(struct fake *f, uint64_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < f->num_ifs; i++) {
+		struct fake_if *fi = &f->ifs[i];
+
+		while (fi->len > 0 && fi->queue[fi->head].done <= now) {
+			if (!fi->queue[fi->head].lost && f->socks != NULL)
+				fake_deliver(f, fi, &fi->queue[fi->head]);
+			fi->head = (fi->head + 1) % f->queue;
+			fi->len--;
+		}
+	}
+}
+
+static uint64_t fake_next_done(const struct fake *f)
+{
+	uint64_t next = 0;
+	unsigned int i;
+
+	for (i = 0; i < f->num_ifs; i++) {
+		const struct fake_if *fi = &f->ifs[i];
+
+		if (fi->len > 0 && (next == 0 || fi->queue[fi->head].done < next))
+			next = fi->queue[fi->head].done;
+	}
+	return next;
+}
+
+/* makes the timerfd readable at t, or never for 0 */
+static void fake_arm(struct xport_sock *s, uint64_t t)
+{
+	struct fake_sock *fs = s->priv;
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = t / 1000000000ull;
+	its.it_value.tv_nsec = t % 1000000000ull;
+	timerfd_settime(s->fd, TFD_TIMER_ABSTIME, &its, NULL);
+	fs->armed = t != 0;
+}
+
+static void fake_disarm(struct xport_sock *s)
+{
+	struct fake_sock *fs = s->priv;
+	uint64_t ticks;
+
+	if (!fs->armed)
+		return;
+	fake_arm(s, 0);
+	/* a disarmed timerfd stays readable until read */
+	if (read(s->fd, &ticks, sizeof(ticks)) < 0)
+		ticks = 0;
+}
+
+static int fake_tx(struct xport_sock *s, const struct iovec *iov, unsigned int iovlen)
+{
+	struct fake *f = s->xp->priv;
+	struct fake_sock *fs = s->priv;
+	struct fake_if *fi = fs->fi;
+	struct fake_frame *fr;
+	uint64_t now = now_ns(), start, air;
+	size_t len = 0;
+	unsigned int i;
+
+	for (i = 0; i < iovlen; i++)
+		len += iov[i].iov_len;
+	if (len > FAKE_FRAME_MAX)
+		return -EMSGSIZE;
+
+	fake_disarm(s);
+	fake_advance(f, now);
+	if (fi->len == f->queue)
+		fi->full++;
+	while (fi->len == f->queue) {
+		uint64_t t = fi->queue[fi->head].done;
+
+		if (s->flags & XPORT_NONBLOCK) {
+			fake_arm(s, t);
+			return -EAGAIN;
+		}
+		sleep_until(t);
+		now = now_ns();
+		fake_advance(f, now);
+	}
+
+	fr = &fi->queue[(fi->head + fi->len) % f->queue];
+	fr->kind = s->kind;
+	fr->eth_p = s->eth_p;
+	fr->len = 0;
+	for (i = 0; i < iovlen; i++) {
+		memcpy(fr->data + fr->len, iov[i].iov_base, iov[i].iov_len);
+		fr->len += iov[i].iov_len;
+	}
+
+	air = fake_airtime(f, fi, s->kind, len);
+	start = fi->busy_until > now ? fi->busy_until : now;
+	fr->done = start + air;
+	fr->lost = f->drop_ppm && fake_rng(f) % 1000000 < f->drop_ppm;
+	fi->busy_until = fr->done;
+	fi->air_ns += air;
+	fi->len++;
+	fi->sent++;
+	fi->lost += fr->lost;
+	return len;
+}
+
+static int fake_socket(struct xport_sock *s)
+{
+	struct fake *f = s->xp->priv;
+	struct fake_sock *fs;
+
+	fs = calloc(1, sizeof(*fs));
+	if (fs == NULL)
+		return -ENOMEM;
+	fs->fi = fake_find_if(f, s->ifindex);
+	if (fs->fi == NULL) {
+		free(fs);
+		return -ENODEV;
+	}
+	if (s->kind == XPORT_LORA && fs->fi->type != ARPHRD_LORA) {
+		free(fs);
+		return -EINVAL;
+	}
+
+	fs->rx = calloc(f->rx_queue, sizeof(*fs->rx));
+	s->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fs->rx == NULL || s->fd == -1) {
+		int err = fs->rx == NULL ? ENOMEM : errno;
+
+		if (s->fd != -1)
+			close(s->fd);
+		free(fs->rx);
+		free(fs);
+		return -err;
+	}
+	fs->kind = s->kind;
+	fs->eth_p = s->eth_p;
+
+	s->priv = fs;
+	fs->next = f->socks;
+	f->socks = fs;
+	return 0;
+}
+
+static void fake_close(struct xport_sock *s)
+{
+	struct fake *f = s->xp->priv;
+	struct fake_sock *fs = s->priv, **p;
+
+	for (p = &f->socks; *p != NULL; p = &(*p)->next) {
+		if (*p == fs) {
+			*p = fs->next;
+			break;
+		}
+	}
+	if (fs->rx_overruns)
+		fprintf(stderr, "%s: %lu frames lost, receive queue full\n", s->ifname,
+			fs->rx_overruns);
+	close(s->fd);
+	free(s->ring);
+	free(fs->rx);
+	free(fs);
+}
+
+static int fake_send(struct xport_sock *s, const void *buf, size_t len)
+{
+	struct iovec iov = { (void *)buf, len };
+
+	return fake_tx(s, &iov, 1);
+}
+
+static int fake_sendmmsg(struct xport_sock *s, struct mmsghdr *msgs, unsigned int num)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num; i++) {
+		ret = fake_tx(s, msgs[i].msg_hdr.msg_iov, msgs[i].msg_hdr.msg_iovlen);
+		if (ret < 0)
+			return i ? (int)i : ret;
+		msgs[i].msg_len = ret;
+	}
+	return num;
+}
+
+static int fake_recv(struct xport_sock *s, void *buf, size_t size)
+{
+	struct fake *f = s->xp->priv;
+	struct fake_sock *fs = s->priv;
+	struct fake_frame *fr;
+	size_t len;
+
+	fs->rx_enabled = 1;
+	fake_disarm(s);
+	fake_advance(f, now_ns());
+	while (fs->rx_len == 0) {
+		uint64_t t = fake_next_done(f);
+
+		/* nothing on the air, and nothing else can put it there */
+		if (t == 0)
+			return -EAGAIN;
+		if (s->flags & XPORT_NONBLOCK) {
+			fake_arm(s, t);
+			return -EAGAIN;
+		}
+		sleep_until(t);
+		fake_advance(f, now_ns());
+	}
+
+	fr = &fs->rx[fs->rx_head];
+	len = fr->len < size ? fr->len : size;
+	memcpy(buf, fr->data, len);
+	fs->rx_head = (fs->rx_head + 1) % f->rx_queue;
+	fs->rx_len--;
+	return len;
+}
+
+static int fake_poll_events(struct xport_sock *s, int events)
+{
+	struct fake_sock *fs = s->priv;
+
+	if (events & POLLIN)
+		fs->rx_enabled = 1;
+	return POLLIN;
+}
+
+static int fake_tx_ring(struct xport_sock *s)
+{
+	const struct tpacket_req *req = &s->ring_req;
+
+	if (req->tp_block_size == 0 || req->tp_frame_size < TPACKET2_HDRLEN ||
+	    req->tp_frame_size % TPACKET_ALIGNMENT != 0 ||
+	    req->tp_block_size % req->tp_frame_size != 0 ||
+	    req->tp_frame_nr != req->tp_block_size / req->tp_frame_size * req->tp_block_nr)
+		return -EINVAL;
+
+	s->ring = calloc(1, s->ring_size);
+	return s->ring == NULL ? -ENOMEM : 0;
+}
+
+/* sends what is marked, in ring order, as the kernel's tpacket_snd() does */
+static int fake_flush(struct xport_sock *s)
+{
+	const struct tpacket_req *req = &s->ring_req;
+	unsigned int per_block = req->tp_block_size / req->tp_frame_size;
+	size_t offset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+	struct fake_sock *fs = s->priv;
+	unsigned int sent = 0;
+	int ret;
+
+	if (s->ring == NULL)
+		return -EINVAL;
+
+	for (;;) {
+		unsigned int i = fs->ring_head;
+		struct tpacket2_hdr *hdr = (void *)((char *)s->ring +
+			(size_t)(i / per_block) * req->tp_block_size +
+			(i % per_block) * req->tp_frame_size);
+		struct iovec iov;
+
+		if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_SEND_REQUEST)
+			break;
+		if (hdr->tp_len > req->tp_frame_size - offset) {
+			__atomic_store_n(&hdr->tp_status, TP_STATUS_WRONG_FORMAT, __ATOMIC_RELEASE);
+			return -EINVAL;
+		}
+
+		iov.iov_base = (char *)hdr + offset;
+		iov.iov_len = hdr->tp_len;
+		ret = fake_tx(s, &iov, 1);
+		if (ret == -EAGAIN)
+			return sent ? 0 : ret;
+		if (ret < 0) {
+			__atomic_store_n(&hdr->tp_status, TP_STATUS_WRONG_FORMAT, __ATOMIC_RELEASE);
+			return ret;
+		}
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_AVAILABLE, __ATOMIC_RELEASE);
+		fs->ring_head = (i + 1) % req->tp_frame_nr;
+		sent++;
+	}
+	return 0;
+}
+
+/*
+ * Generic netlink
+ */
+
+static int fake_reply(struct fake *f, const void *msg, size_t len)
+{
+	if (f->reply_len + NLMSG_ALIGN(len) > f->reply_size) {
+		size_t size = f->reply_size ? f->reply_size * 2 : FAKE_REPLY_MIN;
+		unsigned char *replies;
+
+		while (size < f->reply_len + NLMSG_ALIGN(len))
+			size *= 2;
+		replies = realloc(f->replies, size);
+		if (replies == NULL)
+			return -ENOMEM;
+		f->replies = replies;
+		f->reply_size = size;
+	}
+	memcpy(f->replies + f->reply_len, msg, len);
+	memset(f->replies + f->reply_len + len, 0, NLMSG_ALIGN(len) - len);
+	f->reply_len += NLMSG_ALIGN(len);
+	return 0;
+}
+
+static int fake_reply_ack(struct fake *f, const struct nlmsghdr *req, int err)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct nlmsgerr e;
+	} ack;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.nlh.nlmsg_len = sizeof(ack);
+	ack.nlh.nlmsg_type = NLMSG_ERROR;
+#ifdef NLM_F_CAPPED
+	/* only the request header is echoed back, never its payload */
+	ack.nlh.nlmsg_flags = NLM_F_CAPPED;
+#endif
+	ack.nlh.nlmsg_seq = req->nlmsg_seq;
+	ack.e.error = err;
+	ack.e.msg = *req;
+	return fake_reply(f, &ack, sizeof(ack));
+}
+
+static int fake_reply_value(struct fake *f, const struct nlmsghdr *req, int family,
+	const struct fake_if *fi, const struct fake_cmd *c)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct genlmsghdr genl;
+		struct nlattr ifindex_hdr;
+		uint32_t ifindex;
+		struct nlattr val_hdr;
+		uint32_t val;
+	} msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.nlh.nlmsg_len = sizeof(msg);
+	msg.nlh.nlmsg_type = req->nlmsg_type;
+	msg.nlh.nlmsg_seq = req->nlmsg_seq;
+	msg.genl.cmd = c->cmd;
+	msg.ifindex_hdr.nla_len = NLA_HDRLEN + sizeof(msg.ifindex);
+	msg.ifindex_hdr.nla_type = fake_families[family].ifindex_attr;
+	msg.ifindex = fi->ifindex;
+	msg.val_hdr.nla_len = NLA_HDRLEN + sizeof(msg.val);
+	msg.val_hdr.nla_type = c->attr;
+	/* s32 values go out in two's complement, the same four bytes */
+	msg.val = (uint32_t)fi->cfg[c->cfg];
+	return fake_reply(f, &msg, sizeof(msg));
+}
+
+static const struct nlattr *fake_attr(const struct nlmsghdr *nlh, int type)
+{
+	const struct nlattr *nla = (void *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+	int len = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+
+	while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN && nla->nla_len <= len) {
+		if ((nla->nla_type & NLA_TYPE_MASK) == type)
+			return nla->nla_len >= NLA_HDRLEN + sizeof(uint32_t) ? nla : NULL;
+		len -= NLA_ALIGN(nla->nla_len);
+		nla = (void *)((char *)nla + NLA_ALIGN(nla->nla_len));
+	}
+	return NULL;
+}
+
+static int fake_genl_handle(struct fake *f, const struct nlmsghdr *nlh)
+{
+	const struct genlmsghdr *genl = NLMSG_DATA(nlh);
+	const struct fake_cmd *c = NULL;
+	const struct nlattr *nla;
+	struct fake_if *fi;
+	unsigned int i;
+	int family;
+	int64_t val;
+
+	for (family = 0; family < (int)(sizeof(fake_families) / sizeof(fake_families[0])); family++) {
+		if (fake_families[family].id == nlh->nlmsg_type)
+			break;
+	}
+	if (family == sizeof(fake_families) / sizeof(fake_families[0]))
+		return -EOPNOTSUPP;
+	if (nlh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return -EINVAL;
+
+	for (i = 0; i < NUM_FAKE_CMDS; i++) {
+		if (fake_cmds[i].family == family && fake_cmds[i].cmd == genl->cmd) {
+			c = &fake_cmds[i];
+			break;
+		}
+	}
+	if (c == NULL)
+		return -EOPNOTSUPP;
+
+	nla = fake_attr(nlh, fake_families[family].ifindex_attr);
+	if (nla == NULL)
+		return -EINVAL;
+	fi = fake_find_if(f, *(const uint32_t *)((const char *)nla + NLA_HDRLEN));
+	if (fi == NULL)
+		return -ENODEV;
+	if (!(fi->families & fake_family_bits[family]))
+		return -EOPNOTSUPP;
+
+	if (!c->set)
+		return fake_reply_value(f, nlh, family, fi, c);
+
+	nla = fake_attr(nlh, c->attr);
+	if (nla == NULL)
+		return -EINVAL;
+	if (c->cfg == FAKE_TX_POWER)
+		val = *(const int32_t *)((const char *)nla + NLA_HDRLEN);
+	else
+		val = *(const uint32_t *)((const char *)nla + NLA_HDRLEN);
+	if (val < fake_cfg_ranges[c->cfg].min || val > fake_cfg_ranges[c->cfg].max)
+		return -EINVAL;
+	fi->cfg[c->cfg] = val;
+	return 0;
+}
+
+static int fake_genl_open(struct xport *xp, int rcvbuf)
+{
+	(void)xp;
+	(void)rcvbuf;
+	return 0;
+}
+
+static void fake_genl_close(struct xport *xp)
+{
+	struct fake *f = xp->priv;
+
+	f->reply_len = 0;
+}
+
+static int fake_genl_family(struct xport *xp, const char *name)
+{
+	unsigned int i;
+
+	(void)xp;
+	for (i = 0; i < sizeof(fake_families) / sizeof(fake_families[0]); i++) {
+		if (strcmp(fake_families[i].genl_name, name) == 0)
+			return fake_families[i].id;
+	}
+	return -ENOENT;
+}
+
+static int fake_genl_send(struct xport *xp, const void *buf, size_t len)
+{
+	const struct nlmsghdr *nlh = buf;
+	struct fake *f = xp->priv;
+	int left = len, ret;
+
+	for (; NLMSG_OK(nlh, left); nlh = NLMSG_NEXT(nlh, left)) {
+		ret = fake_genl_handle(f, nlh);
+		if (ret == -ENOMEM)
+			return ret;
+		if (ret < 0 || (nlh->nlmsg_flags & NLM_F_ACK)) {
+			if (fake_reply_ack(f, nlh, ret) < 0)
+				return -ENOMEM;
+		}
+	}
+	return left == 0 ? 0 : -EINVAL;
+}
+
+/* hands out as many whole replies as fit */
+static int fake_genl_recv(struct xport *xp, void *buf, size_t size)
+{
+	struct fake *f = xp->priv;
+	size_t len = 0;
+
+	if (f->reply_len == 0)
+		return -EAGAIN;
+
+	while (len < f->reply_len) {
+		const struct nlmsghdr *nlh = (void *)(f->replies + len);
+
+		if (len + NLMSG_ALIGN(nlh->nlmsg_len) > size)
+			break;
+		len += NLMSG_ALIGN(nlh->nlmsg_len);
+	}
+	if (len == 0)
+		return -EMSGSIZE;
+
+	memcpy(buf, f->replies, len);
+	memmove(f->replies, f->replies + len, f->reply_len - len);
+	f->reply_len -= len;
+	return len;
+}
+
+static int fake_genl_wait(struct xport *xp, int timeout_ms)
+{
+	struct fake *f = xp->priv;
+
+	(void)timeout_ms;
+	return f->reply_len > 0;
+}
+
+static void fake_print_stats(struct xport *xp)
+{
+	struct fake *f = xp->priv;
+	uint64_t now = now_ns(), secs = now - f->start;
+	unsigned int i;
+
+	fake_advance(f, now);
+	for (i = 0; i < f->num_ifs; i++) {
+		const struct fake_if *fi = &f->ifs[i];
+		/* airtime still to come does not count yet */
+		uint64_t air = fi->air_ns;
+
+		if (fi->sent == 0)
+			continue;
+		if (fi->busy_until > now)
+			air -= fi->busy_until - now;
+		printf("%s (fake): %lu frames, %lu lost on the air, %lu heard, %u still queued, "
+			"%lu times queue full, %.3f s on the air, %.1f%% busy\n",
+			fi->name, fi->sent, fi->lost, fi->heard, fi->len, fi->full, air / 1e9,
+			secs ? 100.0 * air / secs : 0.0);
+	}
+}
+
+const struct xport_ops xport_fake_ops = {
+	.name		= "fake",
+	.init		= fake_init,
+	.fini		= fake_fini,
+	.load_ifs	= fake_load_ifs,
+	.socket		= fake_socket,
+	.close		= fake_close,
+	.send		= fake_send,
+	.sendmmsg	= fake_sendmmsg,
+	.recv		= fake_recv,
+	.poll_events	= fake_poll_events,
+	.tx_ring	= fake_tx_ring,
+	.flush		= fake_flush,
+	.genl_open	= fake_genl_open,
+	.genl_close	= fake_genl_close,
+	.genl_family	= fake_genl_family,
+	.genl_send	= fake_genl_send,
+	.genl_recv	= fake_genl_recv,
+	.genl_wait	= fake_genl_wait,
+	.print_stats	= fake_print_stats,
+};
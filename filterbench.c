@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+#include "rxfilter.h"
+#include "include/linux/lora.h"
+#include "include/linux/enocean.h"
+
+/*
+ * Sends the same mix of wanted and unwanted frames twice: once to a
+ * socket without a filter that drops the unwanted ones in userspace, and
+ * once to a socket with the compiled classic BPF filter attached. The
+ * receiving thread's CPU time and the bytes it had copied show what the
+ * in-kernel filter saves.
+ */
+
+#define BATCH		64
+#define MAX_FRAME	255
+
+struct rx_stats {
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long matched;
+	unsigned long syscalls;
+	unsigned long drops;
+	uint64_t cpu_ns;
+};
+
+struct rx_thread {
+	int skt;
+	uint16_t eth_p;
+	const struct rxfilter *f;
+	volatile int done;
+	struct rx_stats st;
+};
+
+static void *rx_main(void *arg)
+{
+	struct rx_thread *t = arg;
+	unsigned char bufs[BATCH][MAX_FRAME + 1];
+	struct mmsghdr msgs[BATCH];
+	struct iovec iovs[BATCH];
+	struct pollfd pfd = { .fd = t->skt, .events = POLLIN };
+	uint64_t start = hist_cpu_ns(RUSAGE_THREAD);
+	unsigned int i;
+
+	for (;;) {
+		int got;
+
+		/* the sender is done once the socket stays quiet */
+		if (poll(&pfd, 1, 100) == 0 && __atomic_load_n(&t->done, __ATOMIC_ACQUIRE))
+			break;
+
+		for (i = 0; i < BATCH; i++) {
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = sizeof(bufs[i]);
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		got = recvmmsg(t->skt, msgs, BATCH, MSG_DONTWAIT, NULL);
+		t->st.syscalls++;
+		if (got <= 0)
+			continue;
+
+		for (i = 0; i < got; i++) {
+			t->st.bytes += msgs[i].msg_len;
+			if (rxfilter_match(t->f, t->eth_p, bufs[i], msgs[i].msg_len))
+				t->st.matched++;
+		}
+		t->st.frames += got;
+	}
+
+	t->st.cpu_ns = hist_cpu_ns(RUSAGE_THREAD) - start;
+	return NULL;
+}
+
+static int open_rx(const struct ifcache_entry *e, uint16_t eth_p)
+{
+	struct sockaddr_ll addr;
+	int skt, size = 16 << 20;
+
+	skt = socket(PF_PACKET, SOCK_DGRAM, htons(eth_p));
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	/* both runs should see every frame, so make room for a burst */
+	if (setsockopt(skt, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+		setsockopt(skt, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(eth_p);
+	addr.sll_ifindex = e->ifindex;
+	if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "bind failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	return skt;
+}
+
+/*
+ * Fill frames[] with LoRaWAN unconfirmed uplinks or ERP2 telegrams with a
+ * 32 bit originator ID. pct percent of them use match_val as DevAddr or
+ * ID, the others use other_val.
+ */
+static void build_frames(unsigned char (*frames)[MAX_FRAME], unsigned int num,
+	unsigned int size, uint16_t eth_p, unsigned int pct, uint32_t match_val,
+	uint32_t other_val)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		uint32_t v = (i * 100 / num) < pct ? match_val : other_val;
+
+		memset(frames[i], 0xa5, size);
+		if (eth_p == ETH_P_LORAWAN) {
+			frames[i][0] = 0x40;
+			frames[i][1] = v;
+			frames[i][2] = v >> 8;
+			frames[i][3] = v >> 16;
+			frames[i][4] = v >> 24;
+		} else {
+			/* 32 bit originator, telegram type 2 */
+			frames[i][0] = 0x22;
+			frames[i][1] = v >> 24;
+			frames[i][2] = v >> 16;
+			frames[i][3] = v >> 8;
+			frames[i][4] = v;
+		}
+	}
+}
+
+static int run(const struct ifcache_entry *e, uint16_t eth_p,
+	const struct rxfilter *f, int use_bpf, unsigned long count,
+	unsigned char (*frames)[MAX_FRAME], unsigned int size,
+	struct rx_stats *st)
+{
+	struct tpacket_stats pst;
+	socklen_t len = sizeof(pst);
+	struct sockaddr_ll addr;
+	struct mmsghdr msgs[BATCH];
+	struct iovec iovs[BATCH];
+	struct rx_thread t;
+	pthread_t thread;
+	unsigned long sent = 0;
+	unsigned int i;
+	int tx, ret;
+
+	memset(&t, 0, sizeof(t));
+	t.eth_p = eth_p;
+	t.f = f;
+	t.skt = open_rx(e, eth_p);
+	if (t.skt < 0)
+		return 1;
+	if (use_bpf && rxfilter_attach(t.skt, f, eth_p) < 0) {
+		close(t.skt);
+		return 1;
+	}
+
+	tx = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (tx == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		close(t.skt);
+		return 1;
+	}
+
+	proto_sockaddr_ll(&addr, eth_p, e->ifindex);
+	for (i = 0; i < BATCH; i++) {
+		iovs[i].iov_base = frames[i];
+		iovs[i].iov_len = size;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &addr;
+		msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = pthread_create(&thread, NULL, rx_main, &t);
+	if (ret != 0) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+		close(tx);
+		close(t.skt);
+		return 1;
+	}
+
+	while (sent < count) {
+		unsigned long left = count - sent;
+
+		ret = sendmmsg(tx, msgs, left < BATCH ? left : BATCH, 0);
+
+		if (ret == -1) {
+			int err = errno;
+
+			if (err == ENOBUFS || err == EINTR) {
+				sched_yield();
+				continue;
+			}
+			fprintf(stderr, "sendmmsg failed: %s\n", strerror(err));
+			break;
+		}
+		sent += ret;
+	}
+	__atomic_store_n(&t.done, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+
+	*st = t.st;
+	if (getsockopt(t.skt, SOL_PACKET, PACKET_STATISTICS, &pst, &len) == 0)
+		st->drops = pst.tp_drops;
+
+	close(tx);
+	close(t.skt);
+	return sent == count ? 0 : 1;
+}
+
+static void report(const char *name, const struct rx_stats *st, unsigned long count)
+{
+	printf("%-9s %lu frames received, %lu matched, %lu bytes copied, %lu recvmmsg calls, "
+		"%lu dropped, %.3f ms CPU, %.1f ns CPU/frame sent\n",
+		name, st->frames, st->matched, st->bytes, st->syscalls, st->drops,
+		st->cpu_ns / 1e6, (double)st->cpu_ns / count);
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-r match-percent] [-s size] [-p lorawan|erp2] [-f filter] ifname\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char (*frames)[MAX_FRAME];
+	const struct ifcache_entry *e;
+	const struct proto *p = proto_find("lorawan");
+	const char *expr = NULL;
+	struct rx_stats user, kern;
+	struct rxfilter f;
+	struct ifcache ifc;
+	unsigned long count = 1000000;
+	unsigned int pct = 10, size = 24;
+	uint32_t match_val, other_val;
+	char *endptr;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:r:s:p:f:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || count == 0)
+				return usage(argv[0]);
+			break;
+		case 'r':
+			pct = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || pct > 100)
+				return usage(argv[0]);
+			break;
+		case 's':
+			size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || size < 8 || size > MAX_FRAME)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			p = proto_find(optarg);
+			if (p == NULL || (p->eth_p != ETH_P_LORAWAN && p->eth_p != ETH_P_ERP2))
+				return usage(argv[0]);
+			break;
+		case 'f':
+			expr = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		return usage(argv[0]);
+
+	if (p->eth_p == ETH_P_LORAWAN) {
+		if (expr == NULL)
+			expr = "devaddr=26011a00/24";
+		match_val = 0x26011a42;
+		other_val = 0x26022b42;
+	} else {
+		if (expr == NULL)
+			expr = "id=0x01800000-0x0180ffff";
+		match_val = 0x01801234;
+		other_val = 0x05811234;
+	}
+	if (rxfilter_parse(&f, expr) < 0)
+		return 2;
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+	e = ifcache_find_name(&ifc, argv[optind]);
+	if (e == NULL) {
+		fprintf(stderr, "%s: no such device\n", argv[optind]);
+		ifcache_free(&ifc);
+		return 1;
+	}
+
+	frames = calloc(BATCH, sizeof(*frames));
+	if (frames == NULL) {
+		ifcache_free(&ifc);
+		return 1;
+	}
+	build_frames(frames, BATCH, size, p->eth_p, pct, match_val, other_val);
+
+	printf("%s on %s: %lu frames of %u bytes, %u%% matching %s\n",
+		p->name, e->name, count, size, pct, expr);
+
+	ret |= run(e, p->eth_p, &f, 0, count, frames, size, &user);
+	report("userspace", &user, count);
+	ret |= run(e, p->eth_p, &f, 1, count, frames, size, &kern);
+	report("kernel", &kern, count);
+
+	if (user.cpu_ns && user.bytes)
+		printf("kernel filter: %.1f%% less receiver CPU, %.1f%% fewer bytes copied\n",
+			100.0 * (1.0 - (double)kern.cpu_ns / user.cpu_ns),
+			100.0 * (1.0 - (double)kern.bytes / user.bytes));
+	/* with frames lost to a full socket buffer the counts cannot agree */
+	if (user.drops == 0 && kern.drops == 0 &&
+	    (kern.matched != user.matched || kern.frames != kern.matched)) {
+		fprintf(stderr, "filter mismatch: userspace matched %lu, kernel passed %lu\n",
+			user.matched, kern.frames);
+		ret = 1;
+	}
+
+	free(frames);
+	ifcache_free(&ifc);
+	return ret;
+}
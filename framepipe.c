@@ -0,0 +1,188 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framepipe.h"
+
+/*
+ * The producer and the consumer each own one cache line: their index, a
+ * cached copy of the other side's index that is only refreshed when the
+ * ring looks full or empty, and their counters. Neither side writes to the
+ * other's line, so a steady stream costs one cache miss per refresh rather
+ * than one per frame.
+ */
+struct fp_ring {
+	_Alignas(FP_CACHELINE) atomic_uint head;
+	unsigned int tail_cache;
+	uint64_t pushed;
+	uint64_t full;
+
+	_Alignas(FP_CACHELINE) atomic_uint tail;
+	unsigned int head_cache;
+	uint64_t popped;
+	uint64_t empty;
+	uint64_t occ_max;
+	uint64_t occ_sum;
+	uint64_t occ_samples;
+	struct hist lat;
+
+	_Alignas(FP_CACHELINE) unsigned int mask;
+	int track_latency;
+	struct frame **slots;
+};
+
+struct fp_ring *fp_ring_create(unsigned int size, int track_latency)
+{
+	struct fp_ring *r;
+	unsigned int n = 1;
+
+	while (n < size)
+		n <<= 1;
+
+	if (posix_memalign((void **)&r, FP_CACHELINE, sizeof(*r)))
+		return NULL;
+	memset(r, 0, sizeof(*r));
+	if (posix_memalign((void **)&r->slots, FP_CACHELINE, n * sizeof(*r->slots))) {
+		free(r);
+		return NULL;
+	}
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	r->mask = n - 1;
+	r->track_latency = track_latency;
+	hist_init(&r->lat);
+	return r;
+}
+
+void fp_ring_destroy(struct fp_ring *r)
+{
+	if (r == NULL)
+		return;
+	free(r->slots);
+	free(r);
+}
+
+unsigned int fp_ring_push(struct fp_ring *r, struct frame **f, unsigned int n)
+{
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	unsigned int room = r->mask + 1 - (head - r->tail_cache);
+	unsigned int i;
+
+	if (room < n) {
+		r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+		room = r->mask + 1 - (head - r->tail_cache);
+		if (n > room)
+			n = room;
+		if (n == 0) {
+			r->full++;
+			return 0;
+		}
+	}
+
+	if (r->track_latency) {
+		uint64_t now = hist_now_ns();
+
+		for (i = 0; i < n; i++)
+			f[i]->enq_ts = now;
+	}
+	for (i = 0; i < n; i++)
+		r->slots[(head + i) & r->mask] = f[i];
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+	r->pushed += n;
+	return n;
+}
+
+unsigned int fp_ring_pop(struct fp_ring *r, struct frame **f, unsigned int n)
+{
+	unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	unsigned int avail = r->head_cache - tail;
+	unsigned int i;
+
+	if (avail < n) {
+		r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+		avail = r->head_cache - tail;
+		/* sample the occupancy whenever we had to look anyway */
+		r->occ_sum += avail;
+		r->occ_samples++;
+		if (avail > r->occ_max)
+			r->occ_max = avail;
+		if (n > avail)
+			n = avail;
+		if (n == 0) {
+			r->empty++;
+			return 0;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		f[i] = r->slots[(tail + i) & r->mask];
+	atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+	r->popped += n;
+
+	if (r->track_latency) {
+		uint64_t now = hist_now_ns();
+
+		for (i = 0; i < n; i++)
+			hist_add(&r->lat, now - f[i]->enq_ts);
+	}
+	return n;
+}
+
+void fp_ring_get_stats(const struct fp_ring *r, struct fp_ring_stats *st)
+{
+	st->pushed = r->pushed;
+	st->full = r->full;
+	st->popped = r->popped;
+	st->empty = r->empty;
+	st->occ_max = r->occ_max;
+	st->occ_sum = r->occ_sum;
+	st->occ_samples = r->occ_samples;
+}
+
+const struct hist *fp_ring_latency(const struct fp_ring *r)
+{
+	return &r->lat;
+}
+
+void fp_ring_print(const char *name, const struct fp_ring *r)
+{
+	printf("%-10s pushed %llu  full %llu  popped %llu  empty %llu  occupancy avg %.1f max %llu of %u\n",
+		name, (unsigned long long)r->pushed, (unsigned long long)r->full,
+		(unsigned long long)r->popped, (unsigned long long)r->empty,
+		r->occ_samples ? (double)r->occ_sum / r->occ_samples : 0,
+		(unsigned long long)r->occ_max, r->mask + 1);
+	if (r->track_latency)
+		hist_print(name, &r->lat);
+}
+
+int frame_pool_init(struct frame_pool *p, unsigned int num)
+{
+	unsigned int i;
+
+	memset(p, 0, sizeof(*p));
+	if (posix_memalign((void **)&p->frames, FP_CACHELINE, (size_t)num * sizeof(*p->frames)))
+		return -1;
+	p->free = fp_ring_create(num, 0);
+	if (p->free == NULL) {
+		free(p->frames);
+		return -1;
+	}
+	p->num = num;
+
+	/* touch every frame now rather than on the first receive */
+	memset(p->frames, 0, (size_t)num * sizeof(*p->frames));
+	for (i = 0; i < num; i++) {
+		struct frame *f = &p->frames[i];
+
+		fp_ring_push(p->free, &f, 1);
+	}
+	return 0;
+}
+
+void frame_pool_free(struct frame_pool *p)
+{
+	fp_ring_destroy(p->free);
+	free(p->frames);
+	memset(p, 0, sizeof(*p));
+}
@@ -0,0 +1,81 @@
+#ifndef FRAMEPIPE_H
+#define FRAMEPIPE_H
+
+#include <stdint.h>
+
+#include "hist.h"
+
+/*
+ * Frame pipeline building blocks for daemons that split receive, MAC
+ * processing and transmit into threads. Frames live in a pool that is
+ * allocated once; stages hand pointers to them over single-producer,
+ * single-consumer rings, so the hot path takes neither malloc nor a lock.
+ *
+ * Each ring has one producer and one consumer thread. The pool is a ring
+ * too: one thread takes frames out of it, typically the receiver, and one
+ * thread puts them back, typically the last stage.
+ */
+
+#define FP_CACHELINE	64
+/* the largest LoRa and FSK payload the drivers accept */
+#define FRAME_DATA_MAX	256
+
+struct frame {
+	/* set by the application, e.g. when the frame was received */
+	uint64_t ts;
+	/* set by the ring it was last pushed to */
+	uint64_t enq_ts;
+	uint32_t seq;
+	int ifindex;
+	uint16_t eth_p;
+	uint16_t len;
+	unsigned char data[FRAME_DATA_MAX];
+} __attribute__((aligned(FP_CACHELINE)));
+
+struct fp_ring_stats {
+	uint64_t pushed;
+	uint64_t full;
+	uint64_t popped;
+	uint64_t empty;
+	uint64_t occ_max;
+	uint64_t occ_sum;
+	uint64_t occ_samples;
+};
+
+struct fp_ring;
+
+/* size is rounded up to a power of two; latency needs a clock read per push */
+struct fp_ring *fp_ring_create(unsigned int size, int track_latency);
+void fp_ring_destroy(struct fp_ring *r);
+
+/* both return how many of the n frames were moved, possibly 0 */
+unsigned int fp_ring_push(struct fp_ring *r, struct frame **f, unsigned int n);
+unsigned int fp_ring_pop(struct fp_ring *r, struct frame **f, unsigned int n);
+
+/* only meaningful once both sides have stopped */
+void fp_ring_get_stats(const struct fp_ring *r, struct fp_ring_stats *st);
+const struct hist *fp_ring_latency(const struct fp_ring *r);
+void fp_ring_print(const char *name, const struct fp_ring *r);
+
+struct frame_pool {
+	struct frame *frames;
+	unsigned int num;
+	struct fp_ring *free;
+};
+
+int frame_pool_init(struct frame_pool *p, unsigned int num);
+void frame_pool_free(struct frame_pool *p);
+
+static inline unsigned int frame_pool_get(struct frame_pool *p, struct frame **f,
+	unsigned int n)
+{
+	return fp_ring_pop(p->free, f, n);
+}
+
+static inline unsigned int frame_pool_put(struct frame_pool *p, struct frame **f,
+	unsigned int n)
+{
+	return fp_ring_push(p->free, f, n);
+}
+
+#endif
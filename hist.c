@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hist.h"
+
+static unsigned int hist_index(uint64_t val)
+{
+	unsigned int shift;
+
+	if (val < HIST_SUB_COUNT)
+		return val;
+
+	shift = 63 - __builtin_clzll(val) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_COUNT + ((val >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/* highest value that maps to the same bucket */
+static uint64_t hist_value(unsigned int idx)
+{
+	unsigned int shift;
+
+	if (idx < HIST_SUB_COUNT)
+		return idx;
+
+	shift = idx / HIST_SUB_COUNT - 1;
+	return ((uint64_t)(HIST_SUB_COUNT + idx % HIST_SUB_COUNT) << shift) +
+		((1ull << shift) - 1);
+}
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void hist_add(struct hist *h, uint64_t val)
+{
+	h->counts[hist_index(val)]++;
+	h->count++;
+	h->sum += val;
+	if (val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+}
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct hist *h, double pct)
+{
+	uint64_t rank, seen = 0;
+	unsigned int i;
+
+	if (h->count == 0)
+		return 0;
+
+	rank = (uint64_t)(pct / 100.0 * h->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > h->count)
+		rank = h->count;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i >= HIST_BUCKETS)
+		return h->max;
+	return hist_value(i) < h->max ? hist_value(i) : h->max;
+}
+
+/* values are taken to be nanoseconds and printed in microseconds */
+void hist_print(const char *name, const struct hist *h)
+{
+	if (h->count == 0) {
+		printf("%-10s no samples\n", name);
+		return;
+	}
+
+	printf("%-10s n %llu  min %.3f  avg %.3f  p50 %.3f  p99 %.3f  p999 %.3f  max %.3f us\n",
+		name, (unsigned long long)h->count,
+		h->min / 1e3, (double)h->sum / h->count / 1e3,
+		hist_percentile(h, 50.0) / 1e3,
+		hist_percentile(h, 99.0) / 1e3,
+		hist_percentile(h, 99.9) / 1e3,
+		h->max / 1e3);
+}
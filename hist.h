@@ -0,0 +1,61 @@
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/*
+ * Log-bucketed latency histogram in the style of HdrHistogram: values below
+ * 2^HIST_SUB_BITS are counted exactly, larger ones land in one of
+ * 2^HIST_SUB_BITS linear sub-buckets per power of two, which bounds the
+ * relative error to about 3%.
+ */
+
+#define HIST_SUB_BITS	5
+#define HIST_SUB_COUNT	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+struct hist {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+};
+
+void hist_init(struct hist *h);
+void hist_add(struct hist *h, uint64_t val);
+void hist_merge(struct hist *dst, const struct hist *src);
+uint64_t hist_percentile(const struct hist *h, double pct);
+void hist_print(const char *name, const struct hist *h);
+
+static inline uint64_t hist_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* user plus system time of RUSAGE_SELF or, with _GNU_SOURCE, RUSAGE_THREAD */
+static inline uint64_t hist_cpu_ns(int who)
+{
+	struct rusage ru;
+
+	getrusage(who, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+/* for spin-waits, so a sibling hyperthread is not starved */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ volatile("yield");
+#endif
+}
+
+#endif
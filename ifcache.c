@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+
+#include "ifcache.h"
+
+#define IFCACHE_BUF_SIZE	32768
+
+static int ifcache_add(struct ifcache *cache, unsigned int *alloc,
+	struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+	struct ifcache_entry *e;
+	struct rtattr *rta;
+	int len;
+
+	if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)))
+		return -EINVAL;
+
+	if (cache->num == *alloc) {
+		struct ifcache_entry *entries;
+
+		*alloc = *alloc ? *alloc * 2 : 16;
+		entries = realloc(cache->entries, *alloc * sizeof(*entries));
+		if (entries == NULL)
+			return -ENOMEM;
+		cache->entries = entries;
+	}
+
+	e = &cache->entries[cache->num];
+	memset(e, 0, sizeof(*e));
+	e->ifindex = ifi->ifi_index;
+	e->type = ifi->ifi_type;
+	e->flags = ifi->ifi_flags;
+
+	len = IFLA_PAYLOAD(nlh);
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type != IFLA_IFNAME)
+			continue;
+		strncpy(e->name, RTA_DATA(rta), IFNAMSIZ - 1);
+		break;
+	}
+
+	if (e->name[0] != '\0')
+		cache->num++;
+	return 0;
+}
+
+int ifcache_load(struct ifcache *cache)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	struct sockaddr_nl sa;
+	unsigned int alloc = 0;
+	char *buf;
+	int skt, done = 0, ret = 0;
+
+	memset(cache, 0, sizeof(*cache));
+
+	skt = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s (%d)\n", strerror(err), err);
+		return -err;
+	}
+
+	buf = malloc(IFCACHE_BUF_SIZE);
+	if (buf == NULL) {
+		close(skt);
+		return -ENOMEM;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof(req.ifi));
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = 1;
+	req.ifi.ifi_family = AF_UNSPEC;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+
+	if (sendto(skt, &req, req.nlh.nlmsg_len, 0, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		int err = errno;
+		fprintf(stderr, "sendto failed: %s (%d)\n", strerror(err), err);
+		ret = -err;
+		goto out;
+	}
+
+	while (!done && ret == 0) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv(skt, buf, IFCACHE_BUF_SIZE, 0);
+		if (len == -1) {
+			int err = errno;
+			if (err == EINTR)
+				continue;
+			fprintf(stderr, "recv failed: %s (%d)\n", strerror(err), err);
+			ret = -err;
+			break;
+		}
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != req.nlh.nlmsg_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *e = NLMSG_DATA(nlh);
+				ret = e->error ? e->error : -EIO;
+				fprintf(stderr, "RTM_GETLINK failed: %s\n", strerror(-ret));
+				break;
+			}
+			if (nlh->nlmsg_type != RTM_NEWLINK)
+				continue;
+			ret = ifcache_add(cache, &alloc, nlh);
+			if (ret < 0)
+				break;
+		}
+	}
+
+out:
+	free(buf);
+	close(skt);
+	if (ret < 0)
+		ifcache_free(cache);
+	return ret;
+}
+
+void ifcache_free(struct ifcache *cache)
+{
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->num = 0;
+}
+
+int ifcache_is_pattern(const char *name)
+{
+	return strpbrk(name, "*?[") != NULL;
+}
+
+const struct ifcache_entry *ifcache_find_name(const struct ifcache *cache,
+	const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->num; i++) {
+		if (strcmp(cache->entries[i].name, name) == 0)
+			return &cache->entries[i];
+	}
+	return NULL;
+}
+
+const struct ifcache_entry *ifcache_find_index(const struct ifcache *cache,
+	int ifindex)
+{
+	unsigned int i;
+
+	for (i = 0; i < cache->num; i++) {
+		if (cache->entries[i].ifindex == ifindex)
+			return &cache->entries[i];
+	}
+	return NULL;
+}
+
+const struct ifcache_entry *ifcache_next(const struct ifcache *cache,
+	const struct ifcache_entry *prev, const char *pattern, int type)
+{
+	unsigned int i = prev ? prev - cache->entries + 1 : 0;
+
+	for (; i < cache->num; i++) {
+		const struct ifcache_entry *e = &cache->entries[i];
+
+		if (type >= 0 && e->type != type)
+			continue;
+		if (fnmatch(pattern, e->name, 0) != 0)
+			continue;
+		return e;
+	}
+	return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef IFCACHE_H
+#define IFCACHE_H
+
+#include <net/if.h>
+
+/*
+ * Snapshot of the network interfaces taken with a single RTM_GETLINK dump,
+ * so tools can resolve names and glob patterns without a socket and ioctl
+ * per interface.
+ */
+
+struct ifcache_entry {
+	char name[IFNAMSIZ];
+	int ifindex;
+	unsigned short type;
+	unsigned int flags;
+};
+
+struct ifcache {
+	struct ifcache_entry *entries;
+	unsigned int num;
+};
+
+int ifcache_load(struct ifcache *cache);
+void ifcache_free(struct ifcache *cache);
+
+int ifcache_is_pattern(const char *name);
+const struct ifcache_entry *ifcache_find_name(const struct ifcache *cache,
+	const char *name);
+const struct ifcache_entry *ifcache_find_index(const struct ifcache *cache,
+	int ifindex);
+
+/*
+ * Iterate over the entries whose name matches the fnmatch(3) pattern and,
+ * unless type is negative, whose ARPHRD type equals type. Pass NULL as prev
+ * to get the first match.
+ */
+const struct ifcache_entry *ifcache_next(const struct ifcache *cache,
+	const struct ifcache_entry *prev, const char *pattern, int type);
+
+#endif
@@ -0,0 +1,3 @@
+#define ARPHRD_ENOCEAN	832
+
+#define ETH_P_ERP2	0x0100
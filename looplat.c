@@ -0,0 +1,594 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/socket.h>
+#include <linux/sockios.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+#include "include/linux/lora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+/*
+ * Sends sequence numbered probe frames on one interface and receives them
+ * on another, a second radio in range or the other end of a veth pair,
+ * and measures where the time goes. Four points in time are taken for
+ * every frame:
+ *
+ *   send   just before send() hands it to the kernel
+ *   tx     the TX timestamp, taken when the driver passes it to the device
+ *   rx     the RX timestamp, taken when the receiving driver delivers it
+ *   recv   when recvmmsg() returns it
+ *
+ * send to tx is the TX path (qdisc, lora-dev queue and SPI), tx to rx is
+ * time on air plus both drivers, rx to recv is the wakeup on the receiving
+ * side. send to recv is the whole trip.
+ *
+ * Software timestamps and the user space times are all CLOCK_REALTIME. With
+ * -H the devices are asked for hardware timestamps too. Those come from
+ * the devices' own clocks, so only hardware tx to hardware rx is reported,
+ * and it only makes sense when both share a clock.
+ *
+ * Frames are matched by a run id and a sequence number in the payload.
+ * The report includes lost, duplicated and reordered frames. A frame is
+ * reordered when it arrives after one with a higher sequence number.
+ */
+
+#define MAX_PAYLOAD	255
+#define PROBE_MAGIC	0x4c4c4154
+#define RX_BATCH	32
+#define RX_FRAME_SIZE	512
+#define CONTROL_SIZE	256
+
+struct probe {
+	uint32_t magic;
+	uint32_t run;
+	uint32_t seq;
+};
+
+struct frame_times {
+	uint64_t send;
+	uint64_t tx;
+	uint64_t rx;
+	uint64_t recv;
+	uint64_t hw_tx;
+	uint64_t hw_rx;
+	uint32_t copies;
+};
+
+struct lat_opts {
+	unsigned long count;
+	uint64_t interval;
+	uint64_t wait;
+	unsigned int size;
+	int hw;
+	const struct proto *proto;
+};
+
+struct lat_state {
+	int tx_skt;
+	int rx_skt;
+	struct sockaddr_ll sll;
+	int use_sll;
+	uint32_t run;
+	struct frame_times *t;
+	/* sequence number of the frame each TX timestamp id belongs to */
+	uint32_t *key_seq;
+	uint32_t next_key;
+	unsigned long sent;
+	unsigned long send_errors;
+	unsigned long received;
+	unsigned long foreign;
+	unsigned long reordered;
+	uint32_t max_seq;
+	uint32_t max_displacement;
+	int any_rx;
+	struct mmsghdr msgs[RX_BATCH];
+	struct iovec iovs[RX_BATCH];
+	/* ahead of the byte buffers, cmsghdrs need their alignment */
+	char controls[RX_BATCH][CONTROL_SIZE];
+	unsigned char bufs[RX_BATCH][RX_FRAME_SIZE];
+	unsigned char payload[MAX_PAYLOAD];
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t ts_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ull + ts->tv_nsec;
+}
+
+/* asks the driver to timestamp in hardware; most radios cannot */
+static void enable_hw(const char *ifname)
+{
+	struct hwtstamp_config cfg = {
+		.tx_type = HWTSTAMP_TX_ON,
+		.rx_filter = HWTSTAMP_FILTER_ALL,
+	};
+	struct ifreq ifr;
+	int skt = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (skt == -1)
+		return;
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	ifr.ifr_data = (void *)&cfg;
+	if (ioctl(skt, SIOCSHWTSTAMP, &ifr) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: no hardware timestamps: %s\n", ifname, strerror(err));
+	}
+	close(skt);
+}
+
+static int open_one(const struct ifcache_entry *e, const struct lat_opts *o,
+	struct lat_state *st, int rx)
+{
+	int flags = SOF_TIMESTAMPING_SOFTWARE;
+	int skt, on = 1;
+
+	if (rx)
+		flags |= SOF_TIMESTAMPING_RX_SOFTWARE;
+	else
+		flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+			SOF_TIMESTAMPING_OPT_TSONLY;
+	if (o->hw)
+		flags |= SOF_TIMESTAMPING_RAW_HARDWARE |
+			(rx ? SOF_TIMESTAMPING_RX_HARDWARE : SOF_TIMESTAMPING_TX_HARDWARE);
+
+	if (o->proto != NULL) {
+		struct sockaddr_ll addr;
+
+		/* a sender that does not want the frames it sends gets protocol 0 */
+		skt = socket(PF_PACKET, SOCK_DGRAM, rx ? htons(o->proto->eth_p) : 0);
+		if (skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			return -1;
+		}
+		setsockopt(skt, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on));
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = rx ? htons(o->proto->eth_p) : 0;
+		addr.sll_ifindex = e->ifindex;
+		if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: bind failed: %s\n", e->name, strerror(err));
+			close(skt);
+			return -1;
+		}
+		if (!rx) {
+			proto_sockaddr_ll(&st->sll, o->proto->eth_p, e->ifindex);
+			st->use_sll = 1;
+		}
+	} else {
+		struct sockaddr_lora addr;
+
+		skt = socket(PF_LORA, SOCK_DGRAM, 1);
+		if (skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			return -1;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.lora_family = AF_LORA;
+		addr.lora_ifindex = e->ifindex;
+		if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: bind failed: %s\n", e->name, strerror(err));
+			close(skt);
+			return -1;
+		}
+	}
+
+	if (setsockopt(skt, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+		int err = errno;
+		fprintf(stderr, "SO_TIMESTAMPING failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+	if (o->hw)
+		enable_hw(e->name);
+	return skt;
+}
+
+static void send_probe(struct lat_state *st, const struct lat_opts *o, uint32_t seq)
+{
+	struct probe p = { PROBE_MAGIC, st->run, seq };
+	struct iovec iov = { st->payload, o->size };
+	struct msghdr msg;
+	uint64_t now;
+
+	memcpy(st->payload, &p, sizeof(p));
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (st->use_sll) {
+		msg.msg_name = &st->sll;
+		msg.msg_namelen = sizeof(st->sll);
+	}
+
+	now = realtime_ns();
+	if (sendmsg(st->tx_skt, &msg, 0) == -1) {
+		int err = errno;
+
+		if (st->send_errors++ == 0)
+			fprintf(stderr, "sendmsg failed: %s\n", strerror(err));
+		/* a frame the qdisc dropped still used up a timestamp id */
+		if (err == ENOBUFS)
+			st->key_seq[st->next_key++] = UINT32_MAX;
+		return;
+	}
+	st->t[seq].send = now;
+	st->key_seq[st->next_key++] = seq;
+	st->sent++;
+}
+
+static void drain_errqueue(struct lat_state *st)
+{
+	for (;;) {
+		char control[CONTROL_SIZE];
+		struct sock_extended_err *ee = NULL;
+		struct scm_timestamping tss;
+		struct cmsghdr *cmsg;
+		struct msghdr msg;
+		int have_ts = 0;
+		uint32_t seq;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(st->tx_skt, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SO_TIMESTAMPING) {
+				memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+				have_ts = 1;
+			} else if (cmsg->cmsg_len >= CMSG_LEN(sizeof(*ee))) {
+				/* SOL_PACKET/PACKET_TX_TIMESTAMP or the family's own level */
+				ee = (void *)CMSG_DATA(cmsg);
+			}
+		}
+		if (ee == NULL || !have_ts || ee->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+		    ee->ee_data >= st->next_key)
+			continue;
+		seq = st->key_seq[ee->ee_data];
+		if (seq == UINT32_MAX)
+			continue;
+		if (tss.ts[0].tv_sec || tss.ts[0].tv_nsec)
+			st->t[seq].tx = ts_ns(&tss.ts[0]);
+		if (tss.ts[2].tv_sec || tss.ts[2].tv_nsec)
+			st->t[seq].hw_tx = ts_ns(&tss.ts[2]);
+	}
+}
+
+static void receive(struct lat_state *st, const struct lat_opts *o)
+{
+	int got, i;
+
+	for (i = 0; i < RX_BATCH; i++) {
+		st->iovs[i].iov_base = st->bufs[i];
+		st->iovs[i].iov_len = RX_FRAME_SIZE;
+		memset(&st->msgs[i].msg_hdr, 0, sizeof(st->msgs[i].msg_hdr));
+		st->msgs[i].msg_hdr.msg_iov = &st->iovs[i];
+		st->msgs[i].msg_hdr.msg_iovlen = 1;
+		st->msgs[i].msg_hdr.msg_control = st->controls[i];
+		st->msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+	}
+
+	got = recvmmsg(st->rx_skt, st->msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+	if (got <= 0)
+		return;
+
+	for (i = 0; i < got; i++) {
+		struct msghdr *msg = &st->msgs[i].msg_hdr;
+		struct frame_times *t;
+		struct cmsghdr *cmsg;
+		struct probe p;
+		uint64_t now = realtime_ns();
+
+		if (st->msgs[i].msg_len < sizeof(p)) {
+			st->foreign++;
+			continue;
+		}
+		memcpy(&p, st->bufs[i], sizeof(p));
+		if (p.magic != PROBE_MAGIC || p.run != st->run || p.seq >= o->count) {
+			st->foreign++;
+			continue;
+		}
+
+		t = &st->t[p.seq];
+		if (t->copies++ > 0)
+			continue;
+		t->recv = now;
+		for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+			struct scm_timestamping tss;
+
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPING)
+				continue;
+			memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+			if (tss.ts[0].tv_sec || tss.ts[0].tv_nsec)
+				t->rx = ts_ns(&tss.ts[0]);
+			if (tss.ts[2].tv_sec || tss.ts[2].tv_nsec)
+				t->hw_rx = ts_ns(&tss.ts[2]);
+		}
+
+		st->received++;
+		if (st->any_rx && p.seq < st->max_seq) {
+			st->reordered++;
+			if (st->max_seq - p.seq > st->max_displacement)
+				st->max_displacement = st->max_seq - p.seq;
+		} else {
+			st->max_seq = p.seq;
+		}
+		st->any_rx = 1;
+	}
+}
+
+/* waits for either socket until the deadline, CLOCK_MONOTONIC */
+static void wait_until(struct lat_state *st, uint64_t deadline)
+{
+	struct pollfd pfd[2] = {
+		{ .fd = st->rx_skt, .events = POLLIN },
+		{ .fd = st->tx_skt, .events = 0 },
+	};
+	uint64_t now;
+
+	while (!stop && (now = hist_now_ns()) < deadline) {
+		struct timespec ts = {
+			.tv_sec = (deadline - now) / 1000000000ull,
+			.tv_nsec = (deadline - now) % 1000000000ull,
+		};
+
+		if (ppoll(pfd, 2, &ts, NULL) <= 0)
+			continue;
+		return;
+	}
+}
+
+struct lat_hist {
+	const char *name;
+	struct hist h;
+	unsigned long negative;
+};
+
+static void lat_add(struct lat_hist *l, uint64_t from, uint64_t to)
+{
+	if (from == 0 || to == 0)
+		return;
+	if (to < from)
+		l->negative++;
+	else
+		hist_add(&l->h, to - from);
+}
+
+static void report(struct lat_state *st, const struct lat_opts *o)
+{
+	struct lat_hist l[] = {
+		{ .name = "send-tx" },
+		{ .name = "tx-rx" },
+		{ .name = "rx-recv" },
+		{ .name = "send-recv" },
+		{ .name = "hwtx-hwrx" },
+	};
+	unsigned long i, dups = 0, no_tx = 0, no_rx = 0;
+	unsigned int k;
+
+	for (k = 0; k < sizeof(l) / sizeof(l[0]); k++)
+		hist_init(&l[k].h);
+
+	for (i = 0; i < o->count; i++) {
+		const struct frame_times *t = &st->t[i];
+
+		if (t->send == 0)
+			continue;
+		if (t->tx == 0)
+			no_tx++;
+		if (t->copies == 0)
+			continue;
+		if (t->rx == 0)
+			no_rx++;
+		dups += t->copies - 1;
+		lat_add(&l[0], t->send, t->tx);
+		lat_add(&l[1], t->tx, t->rx);
+		lat_add(&l[2], t->rx, t->recv);
+		lat_add(&l[3], t->send, t->recv);
+		lat_add(&l[4], t->hw_tx, t->hw_rx);
+	}
+
+	printf("%lu sent, %lu send errors, %lu received, %lu lost (%.2f%%), %lu duplicated, "
+		"%lu reordered by up to %u, %lu foreign\n",
+		st->sent, st->send_errors, st->received, st->sent - st->received,
+		st->sent ? 100.0 * (st->sent - st->received) / st->sent : 0.0, dups,
+		st->reordered, st->max_displacement, st->foreign);
+	if (no_tx == st->sent && st->sent)
+		printf("no TX timestamps: the driver does not call skb_tx_timestamp()\n");
+	else if (no_tx)
+		printf("%lu frames without a TX timestamp\n", no_tx);
+	if (no_rx)
+		printf("%lu received frames without an RX timestamp\n", no_rx);
+
+	for (k = 0; k < sizeof(l) / sizeof(l[0]); k++) {
+		if (l[k].h.count == 0)
+			continue;
+		hist_print(l[k].name, &l[k].h);
+		if (l[k].negative)
+			printf("%-10s %lu negative, are the clocks apart?\n", "", l[k].negative);
+	}
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-i interval-us] [-s size] [-w wait-ms] [-p proto] [-H]\n"
+		"       tx-ifname rx-ifname\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct lat_opts o = {
+		.count = 1000,
+		.interval = 10000000,
+		.wait = 1000000000,
+		.size = 16,
+	};
+	const struct ifcache_entry *tx_e, *rx_e;
+	struct lat_state *st;
+	struct ifcache ifc;
+	struct sigaction sa;
+	uint64_t next;
+	unsigned long i;
+	char *endptr;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "n:i:s:w:p:H")) != -1) {
+		switch (opt) {
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.count == 0 || o.count >= UINT32_MAX)
+				return usage(argv[0]);
+			break;
+		case 'i':
+			o.interval = strtoull(optarg, &endptr, 0) * 1000;
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 's':
+			o.size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.size < sizeof(struct probe) || o.size > MAX_PAYLOAD)
+				return usage(argv[0]);
+			break;
+		case 'w':
+			o.wait = strtoull(optarg, &endptr, 0) * 1000000;
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.proto = proto_find(optarg);
+			if (o.proto == NULL)
+				return usage(argv[0]);
+			break;
+		case 'H':
+			o.hw = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc - 2)
+		return usage(argv[0]);
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+	tx_e = ifcache_find_name(&ifc, argv[optind]);
+	rx_e = ifcache_find_name(&ifc, argv[optind + 1]);
+	if (tx_e == NULL || rx_e == NULL) {
+		fprintf(stderr, "%s: no such device\n", argv[tx_e == NULL ? optind : optind + 1]);
+		ifcache_free(&ifc);
+		return 1;
+	}
+
+	st = calloc(1, sizeof(*st));
+	if (st == NULL || (st->t = calloc(o.count, sizeof(*st->t))) == NULL ||
+	    (st->key_seq = calloc(o.count, sizeof(*st->key_seq))) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+	st->tx_skt = st->rx_skt = -1;
+	st->run = realtime_ns() ^ getpid();
+	for (i = sizeof(struct probe); i < MAX_PAYLOAD; i++)
+		st->payload[i] = 0x42 + i;
+
+	/* the receiver first, so that it does not miss the first frames */
+	st->rx_skt = open_one(rx_e, &o, st, 1);
+	if (st->rx_skt < 0)
+		goto out;
+	st->tx_skt = open_one(tx_e, &o, st, 0);
+	if (st->tx_skt < 0)
+		goto out;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	next = hist_now_ns();
+	for (i = 0; i < o.count && !stop; i++) {
+		/* receive and collect TX timestamps while waiting for the next slot */
+		while (!stop && hist_now_ns() < next) {
+			wait_until(st, next);
+			receive(st, &o);
+			drain_errqueue(st);
+		}
+		send_probe(st, &o, i);
+		next += o.interval;
+	}
+
+	next = hist_now_ns() + o.wait;
+	while (!stop && hist_now_ns() < next && st->received < st->sent) {
+		wait_until(st, next);
+		receive(st, &o);
+		drain_errqueue(st);
+	}
+	drain_errqueue(st);
+
+	printf("%s -> %s, %s, %u byte frames every %.3f ms\n", tx_e->name, rx_e->name,
+		o.proto != NULL ? o.proto->name : "PF_LORA", o.size, o.interval / 1e6);
+	report(st, &o);
+	ret = st->received ? 0 : 1;
+
+out:
+	if (st != NULL) {
+		if (st->tx_skt >= 0)
+			close(st->tx_skt);
+		if (st->rx_skt >= 0)
+			close(st->rx_skt);
+		free(st->key_seq);
+		free(st->t);
+		free(st);
+	}
+	ifcache_free(&ifc);
+	return ret;
+}
@@ -0,0 +1,300 @@
+#include <errno.h>
+#include <string.h>
+
+#include "lorawan.h"
+
+static const struct aes_impl *aes;
+
+static inline const struct aes_impl *impl(void)
+{
+	if (aes == NULL)
+		aes = aes_impl_best();
+	return aes;
+}
+
+int lorawan_set_impl(const char *name)
+{
+	const struct aes_impl *a = aes_impl_find(name);
+
+	if (a == NULL)
+		return -ENOENT;
+	aes = a;
+	return 0;
+}
+
+const char *lorawan_impl_name(void)
+{
+	return impl()->name;
+}
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+int lorawan_parse(struct lorawan_frame *f, const uint8_t *buf, unsigned int len)
+{
+	unsigned int off;
+
+	if (len < 1 + LORAWAN_MIC_LEN)
+		return -EINVAL;
+
+	memset(f, 0, sizeof(*f));
+	f->buf = buf;
+	f->len = len;
+	f->mhdr = buf[0];
+	f->mtype = buf[0] >> 5;
+	f->fport = -1;
+	f->mic = get_le32(buf + len - LORAWAN_MIC_LEN);
+
+	if (!lorawan_is_data(f->mtype)) {
+		f->payload = buf + 1;
+		f->payload_len = len - 1 - LORAWAN_MIC_LEN;
+		return 0;
+	}
+
+	if (len < LORAWAN_DATA_MIN)
+		return -EINVAL;
+	f->devaddr = get_le32(buf + 1);
+	f->fctrl = buf[5];
+	f->fcnt = get_le16(buf + 6);
+	f->fopts_len = f->fctrl & LORAWAN_FCTRL_FOPTSLEN;
+	f->fopts = buf + 8;
+
+	off = 1 + LORAWAN_FHDR_LEN + f->fopts_len;
+	if (off + LORAWAN_MIC_LEN > len)
+		return -EINVAL;
+	if (off + LORAWAN_MIC_LEN == len)
+		return 0;
+
+	f->fport = buf[off];
+	/* MAC commands go either in FOpts or in an FPort 0 payload, not both */
+	if (f->fport == 0 && f->fopts_len != 0)
+		return -EINVAL;
+	f->payload = buf + off + 1;
+	f->payload_len = len - off - 1 - LORAWAN_MIC_LEN;
+	return 0;
+}
+
+int lorawan_build(uint8_t *buf, unsigned int size, const struct lorawan_frame *f,
+	uint32_t fcnt, const struct lorawan_key *nwk, const struct lorawan_key *app)
+{
+	unsigned int len, off;
+
+	if (!lorawan_is_data(f->mtype) || f->fopts_len > LORAWAN_FOPTS_MAX ||
+	    (f->fport < 0 && f->payload_len != 0) || f->fport > 255 ||
+	    (f->fport == 0 && f->fopts_len != 0))
+		return -EINVAL;
+
+	len = LORAWAN_DATA_MIN + f->fopts_len;
+	if (f->fport >= 0)
+		len += 1 + f->payload_len;
+	if (len > size || len > LORAWAN_PHY_MAX)
+		return -ENOSPC;
+
+	buf[0] = f->mtype << 5 | (f->mhdr & 0x1f);
+	put_le32(buf + 1, f->devaddr);
+	buf[5] = (f->fctrl & ~LORAWAN_FCTRL_FOPTSLEN) | f->fopts_len;
+	put_le16(buf + 6, fcnt);
+	if (f->fopts_len != 0)
+		memcpy(buf + 8, f->fopts, f->fopts_len);
+	off = 8 + f->fopts_len;
+
+	if (f->fport >= 0) {
+		buf[off++] = f->fport;
+		lorawan_crypt(f->fport == 0 ? nwk : app, lorawan_dir(f->mtype), f->devaddr,
+			fcnt, f->payload, buf + off, f->payload_len);
+	}
+	put_le32(buf + len - LORAWAN_MIC_LEN, lorawan_mic(nwk, buf, len, fcnt));
+	return len;
+}
+
+static void dbl(uint8_t *out, const uint8_t *in)
+{
+	uint8_t carry = in[0] >> 7;
+	unsigned int i;
+
+	for (i = 0; i < AES_BLOCK - 1; i++)
+		out[i] = in[i] << 1 | in[i + 1] >> 7;
+	out[AES_BLOCK - 1] = in[AES_BLOCK - 1] << 1 ^ (carry ? 0x87 : 0);
+}
+
+void lorawan_key_init(struct lorawan_key *k, const uint8_t *raw)
+{
+	uint8_t l[AES_BLOCK] = { 0 };
+
+	aes128_expand(&k->aes, raw);
+	impl()->encrypt(&k->aes, l, l);
+	dbl(k->k1, l);
+	dbl(k->k2, k->k1);
+}
+
+/*
+ * Split a CMAC computation over an optional 16-byte prefix block, B0 for
+ * data frames, and msg into a CBC-MAC lane, padding the last block into
+ * last and xoring it with the subkey.
+ */
+static void cmac_prepare(struct aes_cbc_lane *l, uint8_t *last, const struct lorawan_key *k,
+	const uint8_t *prefix, const uint8_t *msg, unsigned int len)
+{
+	unsigned int n, i;
+
+	if (len == 0 && prefix != NULL) {
+		msg = prefix;
+		len = AES_BLOCK;
+		prefix = NULL;
+	}
+	l->key = &k->aes;
+	l->first = prefix;
+	l->body = msg;
+	l->body_blocks = len != 0 ? (len - 1) / AES_BLOCK : 0;
+	l->last = last;
+
+	n = len - l->body_blocks * AES_BLOCK;
+	if (n == AES_BLOCK) {
+		for (i = 0; i < AES_BLOCK; i++)
+			last[i] = msg[l->body_blocks * AES_BLOCK + i] ^ k->k1[i];
+		return;
+	}
+	memset(last, 0, AES_BLOCK);
+	if (n != 0)
+		memcpy(last, msg + l->body_blocks * AES_BLOCK, n);
+	last[n] = 0x80;
+	for (i = 0; i < AES_BLOCK; i++)
+		last[i] ^= k->k2[i];
+}
+
+void lorawan_cmac(const struct lorawan_key *k, const uint8_t *msg, unsigned int len,
+	uint8_t *mac)
+{
+	struct aes_cbc_lane l;
+	uint8_t last[AES_BLOCK];
+
+	cmac_prepare(&l, last, k, NULL, msg, len);
+	impl()->cbc_mac_lanes(&l, 1);
+	memcpy(mac, l.mac, AES_BLOCK);
+}
+
+static void block_b0(uint8_t *b0, const uint8_t *buf, unsigned int len, uint32_t fcnt)
+{
+	memset(b0, 0, AES_BLOCK);
+	b0[0] = 0x49;
+	b0[5] = lorawan_dir(buf[0] >> 5);
+	memcpy(b0 + 6, buf + 1, 4);
+	put_le32(b0 + 10, fcnt);
+	b0[15] = len - LORAWAN_MIC_LEN;
+}
+
+uint32_t lorawan_mic(const struct lorawan_key *nwk, const uint8_t *buf, unsigned int len,
+	uint32_t fcnt)
+{
+	uint8_t b0[AES_BLOCK], last[AES_BLOCK];
+	struct aes_cbc_lane l;
+
+	block_b0(b0, buf, len, fcnt);
+	cmac_prepare(&l, last, nwk, b0, buf, len - LORAWAN_MIC_LEN);
+	impl()->cbc_mac_lanes(&l, 1);
+	return get_le32(l.mac);
+}
+
+void lorawan_crypt(const struct lorawan_key *k, int dir, uint32_t devaddr, uint32_t fcnt,
+	const uint8_t *in, uint8_t *out, unsigned int len)
+{
+	const struct aes_impl *a = impl();
+	const struct aes128_key *keys[AES_LANES];
+	uint8_t blk[AES_LANES][AES_BLOCK];
+	unsigned int i, n, off, blocks = (len + AES_BLOCK - 1) / AES_BLOCK, ctr = 1;
+
+	for (i = 0; i < AES_LANES; i++)
+		keys[i] = &k->aes;
+
+	/* the A blocks are independent, so up to AES_LANES go at once */
+	for (off = 0; blocks != 0; blocks -= n) {
+		n = blocks < AES_LANES ? blocks : AES_LANES;
+		for (i = 0; i < n; i++) {
+			memset(blk[i], 0, AES_BLOCK);
+			blk[i][0] = 0x01;
+			blk[i][5] = dir;
+			put_le32(blk[i] + 6, devaddr);
+			put_le32(blk[i] + 10, fcnt);
+			blk[i][15] = ctr++;
+		}
+		a->encrypt_lanes(keys, blk, n);
+		for (i = 0; i < n * AES_BLOCK && off < len; i++, off++)
+			out[off] = in[off] ^ blk[i / AES_BLOCK][i % AES_BLOCK];
+	}
+}
+
+void lorawan_decrypt(const struct lorawan_frame *f, uint32_t fcnt,
+	const struct lorawan_key *nwk, const struct lorawan_key *app, uint8_t *out)
+{
+	lorawan_crypt(f->fport == 0 ? nwk : app, lorawan_dir(f->mtype), f->devaddr, fcnt,
+		f->payload, out, f->payload_len);
+}
+
+/* sessions are looked up per frame, so their keys are rarely in cache */
+static inline void prefetch_key(const struct lorawan_key *k)
+{
+	const char *p = (const char *)k;
+	unsigned int off;
+
+	for (off = 0; off < sizeof(*k); off += 64)
+		__builtin_prefetch(p + off);
+}
+
+unsigned int lorawan_verify_batch(struct lorawan_mic_job *jobs, unsigned int n)
+{
+	const struct aes_impl *a = impl();
+	struct aes_cbc_lane l[AES_LANES];
+	uint8_t b0[AES_LANES][AES_BLOCK], last[AES_LANES][AES_BLOCK];
+	unsigned int idx[AES_LANES];
+	unsigned int i = 0, j, lanes, ok = 0;
+
+	while (i < n) {
+		for (lanes = 0; i < n && lanes < AES_LANES; i++) {
+			struct lorawan_mic_job *job = &jobs[i];
+
+			job->ok = 0;
+			if (i + 2 * AES_LANES < n) {
+				prefetch_key(jobs[i + 2 * AES_LANES].key);
+				__builtin_prefetch(jobs[i + 2 * AES_LANES].buf);
+			}
+			if (job->len < LORAWAN_DATA_MIN)
+				continue;
+			block_b0(b0[lanes], job->buf, job->len, job->fcnt);
+			cmac_prepare(&l[lanes], last[lanes], job->key, b0[lanes], job->buf,
+				job->len - LORAWAN_MIC_LEN);
+			idx[lanes++] = i;
+		}
+		if (lanes != 0)
+			a->cbc_mac_lanes(l, lanes);
+
+		for (j = 0; j < lanes; j++) {
+			struct lorawan_mic_job *job = &jobs[idx[j]];
+
+			job->ok = memcmp(l[j].mac, job->buf + job->len - LORAWAN_MIC_LEN,
+				LORAWAN_MIC_LEN) == 0;
+			ok += job->ok;
+		}
+	}
+	return ok;
+}
@@ -0,0 +1,131 @@
+#ifndef LORAWAN_H
+#define LORAWAN_H
+
+#include <stdint.h>
+
+#include "aes.h"
+
+/*
+ * LoRaWAN 1.0.x PHYPayload codec: parsing without copying, building, the
+ * AES-CMAC message integrity code and FRMPayload encryption, the latter two
+ * on whatever AES implementation the CPU supports best.
+ *
+ * Keys are expanded once into struct lorawan_key, which also holds the
+ * CMAC subkeys, so a network server keeps one per session and the per
+ * frame cost is only the block encryptions themselves.
+ */
+
+#define LORAWAN_MIC_LEN		4
+#define LORAWAN_FHDR_LEN	7
+/* MHDR, FHDR and MIC */
+#define LORAWAN_DATA_MIN	(1 + LORAWAN_FHDR_LEN + LORAWAN_MIC_LEN)
+#define LORAWAN_FOPTS_MAX	15
+#define LORAWAN_PHY_MAX		255
+
+enum lorawan_mtype {
+	LORAWAN_JOIN_REQUEST,
+	LORAWAN_JOIN_ACCEPT,
+	LORAWAN_UNCONFIRMED_UP,
+	LORAWAN_UNCONFIRMED_DOWN,
+	LORAWAN_CONFIRMED_UP,
+	LORAWAN_CONFIRMED_DOWN,
+	LORAWAN_REJOIN_REQUEST,
+	LORAWAN_PROPRIETARY,
+};
+
+/* FCtrl bits, uplink and downlink */
+#define LORAWAN_FCTRL_ADR	0x80
+#define LORAWAN_FCTRL_ACK	0x20
+#define LORAWAN_FCTRL_FOPTSLEN	0x0f
+
+struct lorawan_key {
+	struct aes128_key aes;
+	uint8_t k1[AES_BLOCK];
+	uint8_t k2[AES_BLOCK];
+};
+
+/*
+ * A parsed PHYPayload. The pointers point into the buffer that was parsed;
+ * for frames other than data frames only mhdr, mtype, payload and mic are
+ * set, with payload covering everything between MHDR and MIC.
+ */
+struct lorawan_frame {
+	const uint8_t *buf;
+	unsigned int len;
+	uint8_t mhdr;
+	uint8_t mtype;
+	uint32_t devaddr;
+	uint8_t fctrl;
+	uint16_t fcnt;
+	const uint8_t *fopts;
+	unsigned int fopts_len;
+	/* -1 when the frame has no FPort */
+	int fport;
+	const uint8_t *payload;
+	unsigned int payload_len;
+	uint32_t mic;
+};
+
+/* what the MIC of one frame is checked against, for lorawan_verify_batch() */
+struct lorawan_mic_job {
+	const uint8_t *buf;
+	unsigned int len;
+	/* the full 32-bit frame counter the server reconstructed */
+	uint32_t fcnt;
+	const struct lorawan_key *key;
+	int ok;
+};
+
+static inline int lorawan_is_data(uint8_t mtype)
+{
+	return mtype >= LORAWAN_UNCONFIRMED_UP && mtype <= LORAWAN_CONFIRMED_DOWN;
+}
+
+/* 0 for uplinks, 1 for downlinks, as in the B0 and A blocks */
+static inline int lorawan_dir(uint8_t mtype)
+{
+	return mtype == LORAWAN_UNCONFIRMED_DOWN || mtype == LORAWAN_CONFIRMED_DOWN;
+}
+
+/* returns 0 or -EINVAL when the frame is truncated or malformed */
+int lorawan_parse(struct lorawan_frame *f, const uint8_t *buf, unsigned int len);
+
+/*
+ * Build a data frame from f's mtype, devaddr, fctrl (FOptsLen is taken from
+ * fopts_len), fopts, fport and plaintext payload. The low 16 bits of fcnt
+ * are sent. The payload is encrypted with app, or nwk for FPort 0, and the
+ * MIC is computed with nwk. Returns the frame length, -EINVAL or -ENOSPC.
+ */
+int lorawan_build(uint8_t *buf, unsigned int size, const struct lorawan_frame *f,
+	uint32_t fcnt, const struct lorawan_key *nwk, const struct lorawan_key *app);
+
+void lorawan_key_init(struct lorawan_key *k, const uint8_t *raw);
+
+/* AES-CMAC as in RFC 4493, e.g. for join request MICs */
+void lorawan_cmac(const struct lorawan_key *k, const uint8_t *msg, unsigned int len,
+	uint8_t *mac);
+
+/* the MIC of a data frame, computed over everything but its last 4 bytes */
+uint32_t lorawan_mic(const struct lorawan_key *nwk, const uint8_t *buf, unsigned int len,
+	uint32_t fcnt);
+
+/* encrypt or decrypt FRMPayload in place or from in to out */
+void lorawan_crypt(const struct lorawan_key *k, int dir, uint32_t devaddr, uint32_t fcnt,
+	const uint8_t *in, uint8_t *out, unsigned int len);
+
+/* decrypt f's payload into out with the key its FPort calls for */
+void lorawan_decrypt(const struct lorawan_frame *f, uint32_t fcnt,
+	const struct lorawan_key *nwk, const struct lorawan_key *app, uint8_t *out);
+
+/*
+ * Check the MICs of n data frames, setting ok in each job. Frames are
+ * processed AES_LANES at a time with their block encryptions interleaved.
+ * Returns the number of valid MICs.
+ */
+unsigned int lorawan_verify_batch(struct lorawan_mic_job *jobs, unsigned int n);
+
+/* pick the AES implementation by name; -ENOENT if this CPU lacks it */
+int lorawan_set_impl(const char *name);
+const char *lorawan_impl_name(void);
+
+#endif
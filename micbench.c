@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hist.h"
+#include "lorawan.h"
+
+/*
+ * Measures LoRaWAN MIC verification on every AES implementation the CPU
+ * supports, one frame per call and in batches, over frames from many
+ * devices with their own session keys as a network server sees them.
+ * Each implementation is first checked against the RFC 4493 examples and
+ * against building, parsing and decrypting a frame; the frames are built
+ * with the first one, so the MIC counts also show they all agree.
+ */
+
+#define IMPL_MAX	4
+
+struct bench_opts {
+	unsigned int frames;
+	unsigned int len;
+	unsigned int keys;
+	unsigned int batch;
+	unsigned int bad_pct;
+	const char *impl;
+};
+
+struct uplink {
+	uint8_t buf[LORAWAN_PHY_MAX];
+	unsigned int len;
+	uint32_t fcnt;
+	unsigned int key;
+	int bad;
+};
+
+static const uint8_t rfc4493_key[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+static const uint8_t rfc4493_msg[64] = {
+	0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96,
+	0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+	0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c,
+	0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+	0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11,
+	0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+	0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17,
+	0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+};
+
+static const struct {
+	unsigned int len;
+	uint8_t mac[16];
+} rfc4493_macs[] = {
+	{ 0, { 0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28,
+	       0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46 } },
+	{ 16, { 0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44,
+		0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c } },
+	{ 40, { 0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30,
+		0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27 } },
+	{ 64, { 0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92,
+		0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe } },
+};
+
+static uint64_t rng_state = 0x853c49e6748fea9bull;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state >> 16;
+}
+
+static int self_check(void)
+{
+	struct lorawan_key k, nwk, app;
+	struct lorawan_frame f = {
+		.mtype = LORAWAN_CONFIRMED_UP,
+		.devaddr = 0x26011bda,
+		.fctrl = LORAWAN_FCTRL_ADR,
+		.fopts = (const uint8_t *)"\x02",
+		.fopts_len = 1,
+		.fport = 1,
+		.payload = rfc4493_msg,
+		.payload_len = 37,
+	};
+	struct lorawan_frame p;
+	struct lorawan_mic_job job;
+	uint8_t mac[16], buf[LORAWAN_PHY_MAX], plain[LORAWAN_PHY_MAX];
+	unsigned int i;
+	int len;
+
+	lorawan_key_init(&k, rfc4493_key);
+	for (i = 0; i < sizeof(rfc4493_macs) / sizeof(rfc4493_macs[0]); i++) {
+		lorawan_cmac(&k, rfc4493_msg, rfc4493_macs[i].len, mac);
+		if (memcmp(mac, rfc4493_macs[i].mac, 16) != 0) {
+			fprintf(stderr, "%s: RFC 4493 example %u failed\n", lorawan_impl_name(), i + 1);
+			return -1;
+		}
+	}
+
+	lorawan_key_init(&nwk, rfc4493_key);
+	lorawan_key_init(&app, rfc4493_msg);
+	len = lorawan_build(buf, sizeof(buf), &f, 0x12345, &nwk, &app);
+	if (len < 0 || lorawan_parse(&p, buf, len) != 0 || p.fcnt != 0x2345 ||
+	    p.devaddr != f.devaddr || p.fport != 1 || p.payload_len != f.payload_len ||
+	    p.mic != lorawan_mic(&nwk, buf, len, 0x12345)) {
+		fprintf(stderr, "%s: build and parse disagree\n", lorawan_impl_name());
+		return -1;
+	}
+	lorawan_decrypt(&p, 0x12345, &nwk, &app, plain);
+	job = (struct lorawan_mic_job){ .buf = buf, .len = len, .fcnt = 0x12345, .key = &nwk };
+	if (memcmp(plain, f.payload, f.payload_len) != 0 || lorawan_verify_batch(&job, 1) != 1) {
+		fprintf(stderr, "%s: decrypt or verify failed\n", lorawan_impl_name());
+		return -1;
+	}
+	return 0;
+}
+
+static void make_uplinks(const struct bench_opts *o, struct lorawan_key *keys,
+	struct uplink *up)
+{
+	uint8_t payload[LORAWAN_PHY_MAX], raw[16];
+	unsigned int i, j;
+
+	for (i = 0; i < o->keys; i++) {
+		for (j = 0; j < 16; j++)
+			raw[j] = rng();
+		lorawan_key_init(&keys[i], raw);
+	}
+
+	for (i = 0; i < o->frames; i++) {
+		struct lorawan_frame f = {
+			.mtype = LORAWAN_UNCONFIRMED_UP,
+			.fport = 1 + rng() % 223,
+			.payload = payload,
+			.payload_len = o->len,
+		};
+		struct uplink *u = &up[i];
+
+		u->key = rng() % o->keys;
+		u->fcnt = rng();
+		f.devaddr = 0x26000000 | u->key;
+		for (j = 0; j < o->len; j++)
+			payload[j] = rng();
+		/* the payload is encrypted with the same key; only the MIC matters here */
+		u->len = lorawan_build(u->buf, sizeof(u->buf), &f, u->fcnt, &keys[u->key],
+			&keys[u->key]);
+		u->bad = rng() % 100 < o->bad_pct;
+		if (u->bad)
+			u->buf[u->len - 1] ^= 0x5a;
+	}
+}
+
+static int bench(const struct bench_opts *o, const struct lorawan_key *keys,
+	const struct uplink *up, struct lorawan_mic_job *jobs)
+{
+	unsigned long good = 0, expect = 0;
+	uint64_t t0, t1, t2;
+	unsigned int i, n;
+
+	for (i = 0; i < o->frames; i++)
+		expect += !up[i].bad;
+
+	t0 = hist_now_ns();
+	for (i = 0; i < o->frames; i++) {
+		const struct uplink *u = &up[i];
+		uint32_t mic = lorawan_mic(&keys[u->key], u->buf, u->len, u->fcnt);
+
+		good += memcmp(&mic, u->buf + u->len - LORAWAN_MIC_LEN, LORAWAN_MIC_LEN) == 0;
+	}
+	t1 = hist_now_ns();
+	if (good != expect) {
+		fprintf(stderr, "%s: %lu valid MICs, expected %lu\n", lorawan_impl_name(), good, expect);
+		return -1;
+	}
+
+	/* the jobs would come with the frames, so filling them in is not timed */
+	for (i = 0; i < o->frames; i++) {
+		jobs[i].buf = up[i].buf;
+		jobs[i].len = up[i].len;
+		jobs[i].fcnt = up[i].fcnt;
+		jobs[i].key = &keys[up[i].key];
+	}
+	good = 0;
+	t2 = hist_now_ns();
+	for (i = 0; i < o->frames; i += n) {
+		n = o->frames - i < o->batch ? o->frames - i : o->batch;
+		good += lorawan_verify_batch(jobs + i, n);
+	}
+	t2 = hist_now_ns() - t2;
+	if (good != expect) {
+		fprintf(stderr, "%s: %lu valid MICs in batches, expected %lu\n",
+			lorawan_impl_name(), good, expect);
+		return -1;
+	}
+
+	printf("%-9s single %10.0f MICs/s %7.1f ns   batch %10.0f MICs/s %7.1f ns   x%.2f\n",
+		lorawan_impl_name(), o->frames * 1e9 / (t1 - t0), (double)(t1 - t0) / o->frames,
+		o->frames * 1e9 / t2, (double)t2 / o->frames, (double)(t1 - t0) / t2);
+	return 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n frames] [-l payload-len] [-k devices] [-b batch] [-e bad-pct]\n"
+		"       [-i aesni|armv8|portable]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.frames = 200000,
+		.len = 20,
+		.keys = 1000,
+		.batch = 64,
+		.bad_pct = 1,
+	};
+	const struct aes_impl *impls[IMPL_MAX];
+	struct lorawan_mic_job *jobs;
+	struct lorawan_key *keys;
+	struct uplink *up;
+	unsigned int i, n;
+	char *endptr;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:l:k:b:e:i:")) != -1) {
+		switch (opt) {
+		case 'n':
+			o.frames = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.frames == 0)
+				return usage(argv[0]);
+			break;
+		case 'l':
+			o.len = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.len > LORAWAN_PHY_MAX - LORAWAN_DATA_MIN - 1)
+				return usage(argv[0]);
+			break;
+		case 'k':
+			o.keys = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.keys == 0 || o.keys > 0xffffff)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0)
+				return usage(argv[0]);
+			break;
+		case 'e':
+			o.bad_pct = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.bad_pct > 100)
+				return usage(argv[0]);
+			break;
+		case 'i':
+			o.impl = optarg;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		return usage(argv[0]);
+
+	if (o.impl != NULL) {
+		impls[0] = aes_impl_find(o.impl);
+		if (impls[0] == NULL) {
+			fprintf(stderr, "%s: unknown or not supported by this CPU\n", o.impl);
+			return 1;
+		}
+		n = 1;
+	} else {
+		n = aes_impl_list(impls, IMPL_MAX);
+	}
+
+	keys = calloc(o.keys, sizeof(*keys));
+	up = calloc(o.frames, sizeof(*up));
+	jobs = calloc(o.frames, sizeof(*jobs));
+	if (keys == NULL || up == NULL || jobs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	printf("%u frames of %u bytes from %u devices, %u%% with a bad MIC, batches of %u\n",
+		o.frames, LORAWAN_DATA_MIN + 1 + o.len, o.keys, o.bad_pct, o.batch);
+	/* built with the first, so the others are checked against it */
+	lorawan_set_impl(impls[0]->name);
+	make_uplinks(&o, keys, up);
+	for (i = 0; i < n; i++) {
+		lorawan_set_impl(impls[i]->name);
+		if (self_check() || bench(&o, keys, up, jobs))
+			return 1;
+	}
+
+	free(jobs);
+	free(up);
+	free(keys);
+	return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <stdint.h>
+
+/* the MurmurHash3 64-bit finalizer, also good for picking items at random */
+static inline uint64_t mix64(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdull;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+#endif
@@ -1,20 +1,37 @@
 #include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <linux/socket.h>
-#include <sys/ioctl.h>
 #include <net/if.h>
 
 #include <netlink/netlink.h>
 #include <netlink/genl/genl.h>
 #include <netlink/genl/ctrl.h>
 
+#include "hist.h"
+#include "ifcache.h"
+#include "xport.h"
 #include "include/linux/lora.h"
 #include "include/linux/nllora.h"
 #include "include/linux/nlfsk.h"
 
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+#ifndef NLLORA_MCGRP_CONFIG
+#define NLLORA_MCGRP_CONFIG "config"
+#endif
+
+#ifndef NLFSK_MCGRP_CONFIG
+#define NLFSK_MCGRP_CONFIG "config"
+#endif
+
 static struct nla_policy my_lora_policy[NLLORA_ATTR_MAX + 1] = {
 	[NLLORA_ATTR_IFINDEX]	= { .type = NLA_U32 },
 	[NLLORA_ATTR_FREQ]	= { .type = NLA_U32 },
@@ -27,810 +44,1539 @@ static struct nla_policy my_fsk_policy[NLFSK_ATTR_MAX + 1] = {
 	[NLFSK_ATTR_TX_POWER]	= { .type = NLA_S32 },
 };
 
-static int seq_check(struct nl_msg *msg, void *arg)
-{
-	return NL_OK;
-}
+enum {
+	FAMILY_LORA,
+	FAMILY_FSK,
+	FAMILY_NUM,
+};
 
-static int nllora_get_freq_val(struct nl_msg *msg, void *arg)
-{
-	struct nlattr *attrs[NLLORA_ATTR_MAX + 1];
-	uint32_t *freq = arg;
+struct nlradio_family {
+	const char *mode;
+	const char *genl_name;
+	const char *mcgrp_name;
+	int ifindex_attr;
+	int maxattr;
+	struct nla_policy *policy;
+};
 
-	genlmsg_parse(nlmsg_hdr(msg), 0, attrs, NLLORA_ATTR_MAX, my_lora_policy);
+static const struct nlradio_family nlradio_families[FAMILY_NUM] = {
+	[FAMILY_LORA] = {
+		.mode		= "lora",
+		.genl_name	= NLLORA_GENL_NAME,
+		.mcgrp_name	= NLLORA_MCGRP_CONFIG,
+		.ifindex_attr	= NLLORA_ATTR_IFINDEX,
+		.maxattr	= NLLORA_ATTR_MAX,
+		.policy		= my_lora_policy,
+	},
+	[FAMILY_FSK] = {
+		.mode		= "fsk",
+		.genl_name	= NLFSK_GENL_NAME,
+		.mcgrp_name	= NLFSK_MCGRP_CONFIG,
+		.ifindex_attr	= NLFSK_ATTR_IFINDEX,
+		.maxattr	= NLFSK_ATTR_MAX,
+		.policy		= my_fsk_policy,
+	},
+};
 
-	if (!attrs[NLLORA_ATTR_FREQ])
-		return NL_SKIP;
+#define NLRADIO_ATTR_MAX	31
 
-	*freq = nla_get_u32(attrs[NLLORA_ATTR_FREQ]);
+_Static_assert(NLLORA_ATTR_MAX <= NLRADIO_ATTR_MAX &&
+	       NLFSK_ATTR_MAX <= NLRADIO_ATTR_MAX, "NLRADIO_ATTR_MAX too small");
 
-	return NL_OK;
+/*
+ * One entry per radio parameter. Adding a parameter only needs a new
+ * entry here and in the family's policy.
+ */
+struct nlattr_desc {
+	const char *name;
+	const char *label;
+	int family;
+	uint8_t get_cmd;
+	uint8_t set_cmd;
+	int attr;
+	int nla_type;
+};
+
+static const struct nlattr_desc nlattr_descs[] = {
+	{ "freq", "frequency", FAMILY_LORA,
+	  NLLORA_CMD_GET_FREQ, NLLORA_CMD_SET_FREQ, NLLORA_ATTR_FREQ, NLA_U32 },
+	{ "tx_power", "tx power", FAMILY_LORA,
+	  NLLORA_CMD_GET_TX_POWER, NLLORA_CMD_SET_TX_POWER, NLLORA_ATTR_TX_POWER, NLA_S32 },
+	{ "freq", "frequency", FAMILY_FSK,
+	  NLFSK_CMD_GET_FREQ, NLFSK_CMD_SET_FREQ, NLFSK_ATTR_FREQ, NLA_U32 },
+	/* the frequency deviation travels in the FREQ attribute */
+	{ "freq_dev", "frequency deviation", FAMILY_FSK,
+	  NLFSK_CMD_GET_FREQ_DEV, NLFSK_CMD_SET_FREQ_DEV, NLFSK_ATTR_FREQ, NLA_U32 },
+	{ "tx_power", "tx power", FAMILY_FSK,
+	  NLFSK_CMD_GET_TX_POWER, NLFSK_CMD_SET_TX_POWER, NLFSK_ATTR_TX_POWER, NLA_S32 },
+};
+
+#define NUM_NLATTR_DESCS	(sizeof(nlattr_descs) / sizeof(nlattr_descs[0]))
+
+static bool nlattr_desc_is_signed(const struct nlattr_desc *desc)
+{
+	return desc->nla_type == NLA_S32;
 }
 
-static int nllora_get_freq(struct nl_sock *sk, int family_id,
-	int ifindex, uint32_t *val)
+static int family_from_mode(const char *mode)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
-	int ret;
+	int i;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
+	for (i = 0; i < FAMILY_NUM; i++) {
+		if (strcmp(nlradio_families[i].mode, mode) == 0)
+			return i;
 	}
+	return -EINVAL;
+}
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLLORA_CMD_GET_FREQ, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
-	}
+static const struct nlattr_desc *nlattr_desc_find(int family, const char *name)
+{
+	int i;
 
-	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, ifindex);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+	for (i = 0; i < NUM_NLATTR_DESCS; i++) {
+		if (nlattr_descs[i].family == family &&
+		    strcmp(nlattr_descs[i].name, name) == 0)
+			return &nlattr_descs[i];
 	}
+	return NULL;
+}
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
-	}
+/*
+ * Requests are queued back-to-back with consecutive sequence numbers into
+ * one buffer that goes out with a single sendmsg, and replies are matched
+ * by sequence number. At most NLRADIO_WINDOW requests are kept in flight
+ * so the replies cannot overrun the socket receive buffer.
+ *
+ * libnl only builds and parses the messages. They travel through the
+ * transport, so the fake radio can answer them instead of the kernel.
+ */
+
+#define NLRADIO_WINDOW		32
+#define NLRADIO_MSG_MAX		128
+#define NLRADIO_RCVBUF		(1024 * 1024)
+#define NLRADIO_RECV_SIZE	32768
+
+static struct xport *xp;
+
+enum {
+	NLRADIO_PENDING,
+	NLRADIO_SENT,
+	NLRADIO_DONE,
+};
 
-	nlmsg_free(msg);
+struct nlradio_req {
+	const struct nlattr_desc *desc;
+	unsigned int line;
+	char ifname[IFNAMSIZ];
+	int ifindex;
+	bool set;
+	bool have_val;
+	int64_t val;
+	int state;
+	int err;
+};
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
-	}
+struct nlradio {
+	struct nl_sock *sk;
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	int family_ids[FAMILY_NUM];
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nllora_get_freq_val, val);
+	char sendbuf[NLRADIO_WINDOW * NLRADIO_MSG_MAX];
+	size_t sendlen;
 
-	ret = nl_recvmsgs(sk, cb);
+	struct nlradio_req *reqs;
+	unsigned int num_reqs;
+	unsigned int inflight;
+	unsigned int done;
+	uint32_t base_seq;
+};
 
-	nl_cb_put(cb);
+static int seq_check(struct nl_msg *msg, void *arg)
+{
+	return NL_OK;
+}
 
-	return ret;
+static struct nlradio_req *nlradio_lookup_seq(struct nlradio *nr, uint32_t seq)
+{
+	uint32_t idx = seq - nr->base_seq;
+
+	if (idx >= nr->num_reqs || nr->reqs[idx].state != NLRADIO_SENT)
+		return NULL;
+	return &nr->reqs[idx];
 }
 
-static int nllora_set_freq(struct nl_sock *sk, int family_id,
-	int ifindex, uint32_t val)
+static void nlradio_complete(struct nlradio *nr, struct nlradio_req *req, int err)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
-	int ret;
+	req->state = NLRADIO_DONE;
+	req->err = err;
+	nr->inflight--;
+	nr->done++;
+}
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
-	}
+static int nlradio_valid(struct nl_msg *msg, void *arg)
+{
+	struct nlattr *attrs[NLRADIO_ATTR_MAX + 1];
+	struct nlmsghdr *hdr = nlmsg_hdr(msg);
+	const struct nlradio_family *fam;
+	const struct nlattr_desc *desc;
+	struct nlradio *nr = arg;
+	struct nlradio_req *req;
+	struct nlattr *a;
+	int ret;
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLLORA_CMD_SET_FREQ, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
-	}
+	req = nlradio_lookup_seq(nr, hdr->nlmsg_seq);
+	if (req == NULL)
+		return NL_SKIP;
 
-	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, ifindex);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
-	}
+	desc = req->desc;
+	fam = &nlradio_families[desc->family];
+	ret = genlmsg_parse(hdr, 0, attrs, fam->maxattr, fam->policy);
+	if (ret < 0 || !attrs[desc->attr])
+		return NL_SKIP;
 
-	ret = nla_put_u32(msg, NLLORA_ATTR_FREQ, val);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32 2\n");
-		nlmsg_free(msg);
-		return ret;
+	a = attrs[desc->attr];
+	switch (desc->nla_type) {
+	case NLA_U8:
+		req->val = nla_get_u8(a);
+		break;
+	case NLA_U16:
+		req->val = nla_get_u16(a);
+		break;
+	case NLA_S32:
+		req->val = nla_get_s32(a);
+		break;
+	default:
+		req->val = nla_get_u32(a);
+		break;
 	}
+	req->have_val = true;
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
-	}
+	return NL_OK;
+}
 
-	nlmsg_free(msg);
+static int nlradio_ack(struct nl_msg *msg, void *arg)
+{
+	struct nlradio *nr = arg;
+	struct nlradio_req *req;
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
-	}
+	req = nlradio_lookup_seq(nr, nlmsg_hdr(msg)->nlmsg_seq);
+	if (req != NULL)
+		nlradio_complete(nr, req, 0);
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	return NL_OK;
+}
 
-	ret = nl_recvmsgs(sk, cb);
+static int nlradio_error(struct sockaddr_nl *nla, struct nlmsgerr *e, void *arg)
+{
+	struct nlradio *nr = arg;
+	struct nlradio_req *req;
 
-	nl_cb_put(cb);
+	req = nlradio_lookup_seq(nr, e->msg.nlmsg_seq);
+	if (req != NULL)
+		nlradio_complete(nr, req, e->error);
 
-	return ret;
+	return NL_SKIP;
 }
 
-static int nllora_get_tx_power_val(struct nl_msg *msg, void *arg)
+/* stands in for nl_recv(); libnl frees the buffer */
+static int nlradio_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
+	unsigned char **buf, struct ucred **creds)
 {
-	struct nlattr *attrs[NLLORA_ATTR_MAX + 1];
-	uint32_t *freq = arg;
-
-	genlmsg_parse(nlmsg_hdr(msg), 0, attrs, NLLORA_ATTR_MAX, my_lora_policy);
+	int ret;
 
-	if (!attrs[NLLORA_ATTR_TX_POWER])
-		return NL_SKIP;
+	*buf = malloc(NLRADIO_RECV_SIZE);
+	if (*buf == NULL)
+		return -NLE_NOMEM;
 
-	*freq = nla_get_u32(attrs[NLLORA_ATTR_TX_POWER]);
+	ret = xport_genl_recv(xp, *buf, NLRADIO_RECV_SIZE);
+	if (ret < 0) {
+		free(*buf);
+		*buf = NULL;
+		return -nl_syserr2nlerr(ret);
+	}
 
-	return NL_OK;
+	memset(nla, 0, sizeof(*nla));
+	nla->nl_family = AF_NETLINK;
+	if (creds != NULL)
+		*creds = NULL;
+	return ret;
 }
 
-static int nllora_get_tx_power(struct nl_sock *sk, int family_id,
-	int ifindex, int32_t *val)
+static int nlradio_open(struct nlradio *nr)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
 	int ret;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
-	}
+	memset(nr, 0, sizeof(*nr));
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLLORA_CMD_GET_TX_POWER, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
+	/* never connected, it only hands out sequence numbers */
+	nr->sk = nl_socket_alloc();
+	if (nr->sk == NULL) {
+		fprintf(stderr, "nl_socket_alloc\n");
 		return -ENOMEM;
 	}
 
-	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, ifindex);
+	ret = xport_genl_open(xp, NLRADIO_RCVBUF);
 	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+		fprintf(stderr, "genl socket: %s\n", strerror(-ret));
+		nl_socket_free(nr->sk);
+		return -EIO;
 	}
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+	nr->msg = nlmsg_alloc();
+	if (nr->msg == NULL) {
+		fprintf(stderr, "nlmsg_alloc\n");
+		xport_genl_close(xp);
+		nl_socket_free(nr->sk);
+		return -ENOMEM;
 	}
 
-	nlmsg_free(msg);
-
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
+	nr->cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (nr->cb == NULL) {
 		fprintf(stderr, "nl_cb_alloc\n");
+		nlmsg_free(nr->msg);
+		xport_genl_close(xp);
+		nl_socket_free(nr->sk);
 		return -ENOMEM;
 	}
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nllora_get_tx_power_val, val);
+	nl_cb_set(nr->cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	nl_cb_set(nr->cb, NL_CB_VALID, NL_CB_CUSTOM, nlradio_valid, nr);
+	nl_cb_set(nr->cb, NL_CB_ACK, NL_CB_CUSTOM, nlradio_ack, nr);
+	nl_cb_err(nr->cb, NL_CB_CUSTOM, nlradio_error, nr);
+	nl_cb_overwrite_recv(nr->cb, nlradio_recv);
 
-	ret = nl_recvmsgs(sk, cb);
+	return 0;
+}
 
-	nl_cb_put(cb);
+static void nlradio_close(struct nlradio *nr)
+{
+	nl_cb_put(nr->cb);
+	nlmsg_free(nr->msg);
+	xport_genl_close(xp);
+	nl_socket_free(nr->sk);
+}
 
-	return ret;
+static int nlradio_family_id(struct nlradio *nr, int family)
+{
+	if (nr->family_ids[family] == 0) {
+		nr->family_ids[family] = xport_genl_family(xp,
+			nlradio_families[family].genl_name);
+		if (nr->family_ids[family] < 0)
+			fprintf(stderr, "genl family %s: %s\n",
+				nlradio_families[family].genl_name,
+				strerror(-nr->family_ids[family]));
+	}
+	return nr->family_ids[family];
 }
 
-static int nllora_set_tx_power(struct nl_sock *sk, int family_id,
-	int ifindex, int32_t val)
+/*
+ * libnl has no way to reset a message, but rewinding its length to the bare
+ * netlink header is enough: genlmsg_put() and nla_put_*() rewrite every byte
+ * that follows.
+ */
+static void nlradio_msg_rewind(struct nl_msg *msg)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
+	nlmsg_hdr(msg)->nlmsg_len = NLMSG_HDRLEN;
+}
+
+static int nlradio_queue(struct nlradio *nr, struct nlradio_req *req)
+{
+	const struct nlattr_desc *desc = req->desc;
+	const struct nlradio_family *fam = &nlradio_families[desc->family];
+	struct nl_msg *msg = nr->msg;
+	struct nlmsghdr *hdr;
 	void *ptr;
 	int ret;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
-	}
+	nlradio_msg_rewind(msg);
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLLORA_CMD_SET_TX_POWER, 0);
+	ptr = genlmsg_put(msg, NL_AUTO_PORT, nr->base_seq + (req - nr->reqs),
+		nr->family_ids[desc->family], 0, NLM_F_REQUEST | NLM_F_ACK,
+		req->set ? desc->set_cmd : desc->get_cmd, 0);
 	if (ptr == NULL) {
 		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
 		return -ENOMEM;
 	}
 
-	ret = nla_put_u32(msg, NLLORA_ATTR_IFINDEX, ifindex);
+	ret = nla_put_u32(msg, fam->ifindex_attr, req->ifindex);
 	if (ret < 0) {
 		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+		return -ENOMEM;
 	}
 
-	ret = nla_put_s32(msg, NLLORA_ATTR_TX_POWER, val);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_s32\n");
-		nlmsg_free(msg);
-		return ret;
+	if (req->set) {
+		switch (desc->nla_type) {
+		case NLA_U8:
+			ret = nla_put_u8(msg, desc->attr, req->val);
+			break;
+		case NLA_U16:
+			ret = nla_put_u16(msg, desc->attr, req->val);
+			break;
+		case NLA_S32:
+			ret = nla_put_s32(msg, desc->attr, req->val);
+			break;
+		default:
+			ret = nla_put_u32(msg, desc->attr, req->val);
+			break;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "nla_put %s\n", desc->name);
+			return -ENOMEM;
+		}
 	}
 
-	ret = nl_send_auto(sk, msg);
+	nl_complete_msg(nr->sk, msg);
+
+	hdr = nlmsg_hdr(msg);
+	if (NLMSG_ALIGN(hdr->nlmsg_len) > NLRADIO_MSG_MAX) {
+		fprintf(stderr, "message too long\n");
+		return -EMSGSIZE;
+	}
+	memcpy(nr->sendbuf + nr->sendlen, hdr, hdr->nlmsg_len);
+	nr->sendlen += NLMSG_ALIGN(hdr->nlmsg_len);
+
+	return 0;
+}
+
+static int nlradio_flush(struct nlradio *nr)
+{
+	int ret;
+
+	if (nr->sendlen == 0)
+		return 0;
+
+	ret = xport_genl_send(xp, nr->sendbuf, nr->sendlen);
+	nr->sendlen = 0;
 	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+		fprintf(stderr, "genl send: %s\n", strerror(-ret));
+		return -EIO;
 	}
 
-	nlmsg_free(msg);
+	return 0;
+}
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
+static int nlradio_run(struct nlradio *nr, struct nlradio_req *reqs, unsigned int num)
+{
+	unsigned int i, next = 0;
+	int ret = 0;
+
+	nr->reqs = reqs;
+	nr->num_reqs = num;
+	nr->inflight = 0;
+	nr->done = 0;
+
+	/* resolving talks on the same socket, so do it up front */
+	for (i = 0; i < num; i++) {
+		if (reqs[i].state != NLRADIO_PENDING)
+			nr->done++;
+		else if (nlradio_family_id(nr, reqs[i].desc->family) < 0) {
+			reqs[i].state = NLRADIO_DONE;
+			reqs[i].err = -EAFNOSUPPORT;
+			nr->done++;
+		}
 	}
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	nr->base_seq = nl_socket_use_seq(nr->sk);
 
-	ret = nl_recvmsgs(sk, cb);
+	while (nr->done < num) {
+		unsigned int first = next;
 
-	nl_cb_put(cb);
+		while (next < num && nr->inflight < NLRADIO_WINDOW) {
+			struct nlradio_req *req = &reqs[next++];
 
-	return ret;
+			if (req->state != NLRADIO_PENDING)
+				continue;
+
+			ret = nlradio_queue(nr, req);
+			if (ret < 0) {
+				req->state = NLRADIO_DONE;
+				req->err = ret;
+				nr->done++;
+				continue;
+			}
+			req->state = NLRADIO_SENT;
+			nr->inflight++;
+		}
+
+		ret = nlradio_flush(nr);
+		if (ret < 0) {
+			for (i = first; i < next; i++) {
+				if (reqs[i].state == NLRADIO_SENT)
+					nlradio_complete(nr, &reqs[i], ret);
+			}
+		}
+
+		if (nr->inflight == 0)
+			continue;
+
+		ret = nl_recvmsgs(nr->sk, nr->cb);
+		if (ret < 0) {
+			fprintf(stderr, "nl_recvmsgs: %s\n", nl_geterror(ret));
+			break;
+		}
+	}
+
+	/* keep later sequence numbers clear of the ones used here */
+	for (i = 1; i < num; i++)
+		nl_socket_use_seq(nr->sk);
+
+	nr->reqs = NULL;
+	nr->num_reqs = 0;
+
+	return ret < 0 ? -EIO : 0;
 }
 
-static int nlfsk_get_freq_val(struct nl_msg *msg, void *arg)
+static struct ifcache ifc;
+
+static int lookup_ifindex(const char *ifname, int *ifindex)
 {
-	struct nlattr *attrs[NLFSK_ATTR_MAX + 1];
-	uint32_t *freq = arg;
+	const struct ifcache_entry *e;
+
+	e = ifcache_find_name(&ifc, ifname);
+	if (e == NULL) {
+		fprintf(stderr, "%s: no such device\n", ifname);
+		return -ENODEV;
+	}
 
-	genlmsg_parse(nlmsg_hdr(msg), 0, attrs, NLFSK_ATTR_MAX, my_fsk_policy);
+	*ifindex = e->ifindex;
+	return 0;
+}
 
-	if (!attrs[NLFSK_ATTR_FREQ])
-		return NL_SKIP;
+/*
+ * Iterate over the interfaces named by a plain name or a glob pattern.
+ * Patterns only match LoRa interfaces.
+ */
+static const struct ifcache_entry *next_if(const struct ifcache_entry *prev,
+	const char *name)
+{
+	return ifcache_next(&ifc, prev, name,
+		ifcache_is_pattern(name) ? ARPHRD_LORA : -1);
+}
+
+static int parse_value(const struct nlattr_desc *desc, const char *arg, int64_t *val)
+{
+	char *endptr;
 
-	*freq = nla_get_u32(attrs[NLFSK_ATTR_FREQ]);
+	if (nlattr_desc_is_signed(desc))
+		*val = strtol(arg, &endptr, 0);
+	else
+		*val = strtoul(arg, &endptr, 0);
+	if (endptr == arg)
+		return -EINVAL;
+	return 0;
+}
 
-	return NL_OK;
+static void print_value(const struct nlattr_desc *desc, int64_t val)
+{
+	if (nlattr_desc_is_signed(desc))
+		printf("%d", (int32_t)val);
+	else
+		printf("%u", (uint32_t)val);
 }
 
-static int nlfsk_get_freq(struct nl_sock *sk, int family_id,
-	int ifindex, uint32_t *val)
+static int handle_op(struct nlradio *nr, const char *name, const char *mode,
+	const char *cmd, int argc, char **args)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
+	const struct ifcache_entry *e;
+	struct nlradio_req tmpl, *reqs;
+	unsigned int i, num = 0, failed = 0;
 	int ret;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.state = NLRADIO_PENDING;
+	tmpl.desc = nlattr_desc_find(family_from_mode(mode), cmd);
+	if (tmpl.desc == NULL)
+		return -EINVAL;
+
+	if (argc == 1) {
+		ret = parse_value(tmpl.desc, args[0], &tmpl.val);
+		if (ret) {
+			fprintf(stderr, "invalid argument\n");
+			return 1;
+		}
+		tmpl.set = true;
+	} else if (argc != 0)
+		return -EINVAL;
+
+	for (e = next_if(NULL, name); e != NULL; e = next_if(e, name))
+		num++;
+	if (num == 0) {
+		fprintf(stderr, "%s: no such device\n", name);
+		return 1;
 	}
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLFSK_CMD_GET_FREQ, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
-	}
+	reqs = calloc(num, sizeof(*reqs));
+	if (reqs == NULL)
+		return 1;
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_IFINDEX, ifindex);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+	for (e = next_if(NULL, name), i = 0; e != NULL; e = next_if(e, name), i++) {
+		reqs[i] = tmpl;
+		strcpy(reqs[i].ifname, e->name);
+		reqs[i].ifindex = e->ifindex;
 	}
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+	ret = nlradio_run(nr, reqs, num);
+
+	for (i = 0; i < num; i++) {
+		struct nlradio_req *req = &reqs[i];
+
+		if (ret || req->state != NLRADIO_DONE || req->err ||
+		    (!req->set && !req->have_val)) {
+			if (num > 1)
+				fprintf(stderr, "%s: ", req->ifname);
+			fprintf(stderr, "nl%s_%s_%s\n", mode, req->set ? "set" : "get", cmd);
+			failed++;
+			continue;
+		}
+
+		if (!req->set) {
+			if (num > 1 || ifcache_is_pattern(name))
+				printf("%s: ", req->ifname);
+			printf("%s: ", req->desc->label);
+			print_value(req->desc, req->val);
+			printf("\n");
+		}
 	}
 
-	nlmsg_free(msg);
+	free(reqs);
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
-	}
+	return failed ? 1 : 0;
+}
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nlfsk_get_freq_val, val);
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
 
-	ret = nl_recvmsgs(sk, cb);
+/*
+ * Stats mode: repeat one command, or all get commands of a family, one at a
+ * time and time each phase. The generic netlink handlers run in the context
+ * of the sending task, so "send" covers the kernel and driver work of a
+ * command; "wait" only grows if a reply is deferred.
+ */
+
+enum {
+	PHASE_BUILD,
+	PHASE_SEND,
+	PHASE_WAIT,
+	PHASE_RECV,
+	PHASE_TOTAL,
+	PHASE_NUM,
+};
 
-	nl_cb_put(cb);
+static const char *phase_names[PHASE_NUM] = {
+	[PHASE_BUILD]	= "build",
+	[PHASE_SEND]	= "send",
+	[PHASE_WAIT]	= "wait",
+	[PHASE_RECV]	= "recv",
+	[PHASE_TOTAL]	= "total",
+};
 
-	return ret;
-}
+struct op_stats {
+	const struct nlattr_desc *desc;
+	unsigned int errors;
+	struct hist phases[PHASE_NUM];
+};
 
-static int nlfsk_set_freq(struct nl_sock *sk, int family_id,
-	int ifindex, uint32_t val)
+static int nlradio_run_timed(struct nlradio *nr, struct nlradio_req *req,
+	uint64_t *t)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
 	int ret;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
+	nr->reqs = req;
+	nr->num_reqs = 1;
+	nr->inflight = 0;
+	nr->done = 0;
+	nr->base_seq = nl_socket_use_seq(nr->sk);
+
+	t[0] = hist_now_ns();
+	ret = nlradio_queue(nr, req);
+	t[1] = hist_now_ns();
+	if (ret == 0) {
+		req->state = NLRADIO_SENT;
+		nr->inflight++;
+		ret = nlradio_flush(nr);
+		if (ret < 0)
+			nlradio_complete(nr, req, ret);
+	}
+	t[2] = hist_now_ns();
+
+	if (ret == 0)
+		xport_genl_wait(xp, -1);
+	t[3] = hist_now_ns();
+
+	while (ret == 0 && nr->done < 1) {
+		ret = nl_recvmsgs(nr->sk, nr->cb);
+		if (ret < 0) {
+			fprintf(stderr, "nl_recvmsgs: %s\n", nl_geterror(ret));
+			ret = -EIO;
+		}
 	}
+	t[4] = hist_now_ns();
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLFSK_CMD_SET_FREQ, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
+	nr->reqs = NULL;
+	nr->num_reqs = 0;
+
+	if (ret == 0 && req->err)
+		ret = req->err;
+	return ret;
+}
+
+static int do_stats(const char *ifname, const char *mode, const char *cmd,
+	unsigned int repeat, int argc, char **args)
+{
+	struct op_stats *stats;
+	struct nlradio_req req;
+	struct nlradio nr;
+	unsigned int i, num_stats = 0, ops = 0;
+	uint64_t t[PHASE_NUM], start, end;
+	int family, ifindex, d, p, ret;
+	int64_t val = 0;
+
+	family = family_from_mode(mode);
+	if (family < 0 || argc > 1)
+		return -EINVAL;
+
+	stats = calloc(NUM_NLATTR_DESCS, sizeof(*stats));
+	if (stats == NULL)
+		return 1;
+
+	for (d = 0; d < NUM_NLATTR_DESCS; d++) {
+		if (nlattr_descs[d].family != family)
+			continue;
+		if (strcmp(cmd, "all") != 0 && strcmp(cmd, nlattr_descs[d].name) != 0)
+			continue;
+		stats[num_stats].desc = &nlattr_descs[d];
+		for (p = 0; p < PHASE_NUM; p++)
+			hist_init(&stats[num_stats].phases[p]);
+		num_stats++;
+	}
+	if (num_stats == 0 || (argc == 1 && num_stats != 1)) {
+		free(stats);
+		return -EINVAL;
+	}
+	if (argc == 1 && parse_value(stats[0].desc, args[0], &val)) {
+		fprintf(stderr, "invalid argument\n");
+		free(stats);
+		return 1;
 	}
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_IFINDEX, ifindex);
+	ret = lookup_ifindex(ifname, &ifindex);
 	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+		free(stats);
+		return 1;
 	}
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_FREQ, val);
+	ret = nlradio_open(&nr);
 	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32 2\n");
-		nlmsg_free(msg);
-		return ret;
+		free(stats);
+		return 1;
 	}
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+	if (nlradio_family_id(&nr, family) < 0) {
+		nlradio_close(&nr);
+		free(stats);
+		return 1;
 	}
 
-	nlmsg_free(msg);
+	start = hist_now_ns();
+	for (i = 0; i < repeat; i++) {
+		for (d = 0; d < num_stats; d++) {
+			struct op_stats *st = &stats[d];
+
+			memset(&req, 0, sizeof(req));
+			req.desc = st->desc;
+			req.ifindex = ifindex;
+			req.state = NLRADIO_PENDING;
+			req.set = argc == 1;
+			req.val = val;
+
+			ret = nlradio_run_timed(&nr, &req, t);
+			ops++;
+			if (ret < 0) {
+				st->errors++;
+				continue;
+			}
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
+			for (p = PHASE_BUILD; p < PHASE_TOTAL; p++)
+				hist_add(&st->phases[p], t[p + 1] - t[p]);
+			hist_add(&st->phases[PHASE_TOTAL], t[PHASE_TOTAL] - t[0]);
+		}
 	}
+	end = hist_now_ns();
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	nlradio_close(&nr);
 
-	ret = nl_recvmsgs(sk, cb);
+	for (d = 0; d < num_stats; d++) {
+		printf("%s %s %s%s: %u errors\n", ifname, mode, stats[d].desc->name,
+			argc == 1 ? " (set)" : "", stats[d].errors);
+		for (p = 0; p < PHASE_NUM; p++)
+			hist_print(phase_names[p], &stats[d].phases[p]);
+	}
+	printf("%u ops in %.3f ms, %.0f ops/s\n", ops, (end - start) / 1e6,
+		end > start ? ops * 1e9 / (end - start) : 0.0);
 
-	nl_cb_put(cb);
+	free(stats);
 
-	return ret;
+	return 0;
 }
 
-static int nlfsk_get_freq_dev(struct nl_sock *sk, int family_id,
-	int ifindex, uint32_t *val)
+/*
+ * Batch mode: one command per line in the same form as on the command line.
+ */
+
+struct batch {
+	struct nlradio_req *reqs;
+	unsigned int num;
+	unsigned int alloc;
+};
+
+static struct nlradio_req *batch_add(struct batch *b)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
-	int ret;
+	struct nlradio_req *req;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
+	if (b->num == b->alloc) {
+		struct nlradio_req *reqs;
+
+		b->alloc = b->alloc ? b->alloc * 2 : 64;
+		reqs = realloc(b->reqs, b->alloc * sizeof(*reqs));
+		if (reqs == NULL)
+			return NULL;
+		b->reqs = reqs;
 	}
+	req = &b->reqs[b->num++];
+	memset(req, 0, sizeof(*req));
+	return req;
+}
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLFSK_CMD_GET_FREQ_DEV, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
+/*
+ * A pattern in the interface column expands into one request per match.
+ * Lines that cannot be run still get a request so they show up in the
+ * report.
+ */
+static int batch_parse_line(struct batch *b, char *line, unsigned int lineno)
+{
+	const struct ifcache_entry *e;
+	struct nlradio_req tmpl, *req;
+	char *args[5], *tok;
+	int argc = 0, ret;
+
+	for (tok = strtok(line, " \t\r\n"); tok != NULL; tok = strtok(NULL, " \t\r\n")) {
+		if (tok[0] == '#')
+			break;
+		if (argc == 5) {
+			fprintf(stderr, "line %u: too many arguments\n", lineno);
+			return -EINVAL;
+		}
+		args[argc++] = tok;
+	}
+	if (argc == 0)
+		return 0;
+	if (argc < 3 || strlen(args[0]) >= IFNAMSIZ) {
+		fprintf(stderr, "line %u: expected ifname lora|fsk op [value]\n", lineno);
+		return -EINVAL;
 	}
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_IFINDEX, ifindex);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+	memset(&tmpl, 0, sizeof(tmpl));
+	tmpl.line = lineno;
+	strcpy(tmpl.ifname, args[0]);
+	tmpl.state = NLRADIO_DONE;
+
+	tmpl.desc = nlattr_desc_find(family_from_mode(args[1]), args[2]);
+	if (tmpl.desc == NULL) {
+		fprintf(stderr, "line %u: unknown operation %s %s\n", lineno, args[1], args[2]);
+		tmpl.err = -EINVAL;
+		goto fail;
 	}
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+	if (argc == 4) {
+		ret = parse_value(tmpl.desc, args[3], &tmpl.val);
+		if (ret) {
+			fprintf(stderr, "line %u: invalid argument\n", lineno);
+			tmpl.err = ret;
+			goto fail;
+		}
+		tmpl.set = true;
+	} else if (argc > 4) {
+		fprintf(stderr, "line %u: too many arguments\n", lineno);
+		tmpl.err = -EINVAL;
+		goto fail;
 	}
 
-	nlmsg_free(msg);
+	tmpl.err = -ENODEV;
+	for (e = next_if(NULL, args[0]); e != NULL; e = next_if(e, args[0])) {
+		req = batch_add(b);
+		if (req == NULL)
+			return -ENOMEM;
+		*req = tmpl;
+		strcpy(req->ifname, e->name);
+		req->ifindex = e->ifindex;
+		req->state = NLRADIO_PENDING;
+		req->err = 0;
+		tmpl.err = 0;
+	}
+	if (tmpl.err == 0)
+		return 0;
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
+fail:
+	req = batch_add(b);
+	if (req == NULL)
 		return -ENOMEM;
+	*req = tmpl;
+	return 0;
+}
+
+static int batch_read(struct batch *b, const char *path)
+{
+	char line[256];
+	unsigned int lineno = 0;
+	FILE *f;
+	int ret = 0;
+
+	if (strcmp(path, "-") == 0)
+		f = stdin;
+	else
+		f = fopen(path, "r");
+	if (f == NULL) {
+		int err = errno;
+		fprintf(stderr, "fopen failed: %s\n", strerror(err));
+		return -err;
 	}
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nlfsk_get_freq_val, val);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		ret = batch_parse_line(b, line, ++lineno);
+		if (ret < 0)
+			break;
+	}
 
-	ret = nl_recvmsgs(sk, cb);
+	if (f != stdin)
+		fclose(f);
+	return ret;
+}
 
-	nl_cb_put(cb);
+static int batch_report(const struct batch *b)
+{
+	unsigned int i, failed = 0;
+
+	for (i = 0; i < b->num; i++) {
+		const struct nlradio_req *req = &b->reqs[i];
+		const char *name = req->desc ? req->desc->name : "?";
+
+		if (req->state != NLRADIO_DONE) {
+			printf("%u: %s %s: no reply\n", req->line, req->ifname, name);
+			failed++;
+		} else if (req->err) {
+			printf("%u: %s %s: %s\n", req->line, req->ifname, name, strerror(-req->err));
+			failed++;
+		} else if (req->set)
+			printf("%u: %s %s: ok\n", req->line, req->ifname, name);
+		else if (!req->have_val) {
+			printf("%u: %s %s: no value\n", req->line, req->ifname, name);
+			failed++;
+		} else {
+			printf("%u: %s %s: ", req->line, req->ifname, name);
+			print_value(req->desc, req->val);
+			printf("\n");
+		}
+	}
 
-	return ret;
+	return failed;
 }
 
-static int nlfsk_set_freq_dev(struct nl_sock *sk, int family_id,
-	int ifindex, uint32_t val)
+static int do_batch(const char *path)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
+	struct timespec start, end;
+	struct nlradio nr;
+	struct batch b;
+	unsigned int failed;
 	int ret;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
-	}
+	memset(&b, 0, sizeof(b));
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLFSK_CMD_SET_FREQ_DEV, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
-	}
-
-	ret = nla_put_u32(msg, NLFSK_ATTR_IFINDEX, ifindex);
+	ret = batch_read(&b, path);
 	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
+		free(b.reqs);
+		return 1;
 	}
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_FREQ, val);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32 2\n");
-		nlmsg_free(msg);
-		return ret;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	ret = nl_send_auto(sk, msg);
+	ret = nlradio_open(&nr);
 	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+		free(b.reqs);
+		return 1;
 	}
 
-	nlmsg_free(msg);
+	ret = nlradio_run(&nr, b.reqs, b.num);
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	nlradio_close(&nr);
 
-	ret = nl_recvmsgs(sk, cb);
+	failed = batch_report(&b);
+	printf("%u commands, %u failed, %.3f ms\n", b.num, failed,
+		elapsed_ms(&start, &end));
 
-	nl_cb_put(cb);
+	free(b.reqs);
 
-	return ret;
+	return (ret < 0 || failed) ? 1 : 0;
 }
 
-static int nlfsk_get_tx_power_val(struct nl_msg *msg, void *arg)
+/*
+ * Dump mode: every parameter of every LoRa interface for both families.
+ * The uapi has no dumpit or aggregate get command, so this queues all the
+ * individual get requests into as few sendmsg calls as the window allows
+ * and collects the replies in one pass. Parameters a device does not
+ * support are left out.
+ */
+
+static int list_radio_ifs(const char *pattern, struct ifcache_entry **out,
+	unsigned int *num)
 {
-	struct nlattr *attrs[NLFSK_ATTR_MAX + 1];
-	uint32_t *tx_power = arg;
+	const struct ifcache_entry *e;
+	struct ifcache_entry *ifs;
+	unsigned int count = 0;
 
-	genlmsg_parse(nlmsg_hdr(msg), 0, attrs, NLFSK_ATTR_MAX, my_fsk_policy);
+	ifs = calloc(ifc.num + 1, sizeof(*ifs));
+	if (ifs == NULL)
+		return -ENOMEM;
 
-	if (!attrs[NLFSK_ATTR_TX_POWER])
-		return NL_SKIP;
+	for (e = ifcache_next(&ifc, NULL, pattern, ARPHRD_LORA); e != NULL;
+	     e = ifcache_next(&ifc, e, pattern, ARPHRD_LORA))
+		ifs[count++] = *e;
 
-	*tx_power = nla_get_u32(attrs[NLFSK_ATTR_TX_POWER]);
+	*out = ifs;
+	*num = count;
+	return 0;
+}
 
-	return NL_OK;
+static bool dump_family_present(const struct nlradio_req *reqs, int family)
+{
+	int d;
+
+	for (d = 0; d < NUM_NLATTR_DESCS; d++) {
+		if (nlattr_descs[d].family == family &&
+		    reqs[d].err == 0 && reqs[d].have_val)
+			return true;
+	}
+	return false;
 }
 
-static int nlfsk_get_tx_power(struct nl_sock *sk, int family_id,
-	int ifindex, int32_t *val)
+static void dump_print_table(const struct ifcache_entry *ifs, unsigned int num_ifs,
+	const struct nlradio_req *reqs)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
-	int ret;
+	const char *cols[NUM_NLATTR_DESCS];
+	unsigned int i, num_cols = 0;
+	int d, f, c;
+
+	/* one column per parameter name, shared between families */
+	for (d = 0; d < NUM_NLATTR_DESCS; d++) {
+		for (c = 0; c < num_cols; c++) {
+			if (strcmp(cols[c], nlattr_descs[d].name) == 0)
+				break;
+		}
+		if (c == num_cols)
+			cols[num_cols++] = nlattr_descs[d].name;
+	}
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
+	printf("%-*s %-6s", IFNAMSIZ, "ifname", "family");
+	for (c = 0; c < num_cols; c++)
+		printf(" %12s", cols[c]);
+	printf("\n");
+
+	for (i = 0; i < num_ifs; i++) {
+		const struct nlradio_req *row = &reqs[i * NUM_NLATTR_DESCS];
+
+		for (f = 0; f < FAMILY_NUM; f++) {
+			if (!dump_family_present(row, f))
+				continue;
+
+			printf("%-*s %-6s", IFNAMSIZ, ifs[i].name, nlradio_families[f].mode);
+			for (c = 0; c < num_cols; c++) {
+				const struct nlattr_desc *desc = nlattr_desc_find(f, cols[c]);
+				const struct nlradio_req *req;
+
+				if (desc == NULL) {
+					printf(" %12s", "-");
+					continue;
+				}
+				req = &row[desc - nlattr_descs];
+				if (req->err || !req->have_val)
+					printf(" %12s", "-");
+				else if (nlattr_desc_is_signed(desc))
+					printf(" %12d", (int32_t)req->val);
+				else
+					printf(" %12u", (uint32_t)req->val);
+			}
+			printf("\n");
+		}
 	}
+}
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLFSK_CMD_GET_TX_POWER, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
+static void dump_print_json(const struct ifcache_entry *ifs, unsigned int num_ifs,
+	const struct nlradio_req *reqs)
+{
+	unsigned int i;
+	int d, f;
+
+	printf("[");
+	for (i = 0; i < num_ifs; i++) {
+		const struct nlradio_req *row = &reqs[i * NUM_NLATTR_DESCS];
+
+		printf("%s\n  {\"ifname\": \"%s\", \"ifindex\": %d",
+			i ? "," : "", ifs[i].name, ifs[i].ifindex);
+		for (f = 0; f < FAMILY_NUM; f++) {
+			bool first = true;
+
+			if (!dump_family_present(row, f))
+				continue;
+
+			printf(", \"%s\": {", nlradio_families[f].mode);
+			for (d = 0; d < NUM_NLATTR_DESCS; d++) {
+				if (nlattr_descs[d].family != f ||
+				    row[d].err || !row[d].have_val)
+					continue;
+				printf("%s\"%s\": ", first ? "" : ", ", nlattr_descs[d].name);
+				print_value(&nlattr_descs[d], row[d].val);
+				first = false;
+			}
+			printf("}");
+		}
+		printf("}");
 	}
+	printf("%s]\n", num_ifs ? "\n" : "");
+}
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_IFINDEX, ifindex);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
+static struct nlradio_req *dump_alloc_reqs(const struct ifcache_entry *ifs,
+	unsigned int num_ifs)
+{
+	struct nlradio_req *reqs;
+	unsigned int i;
+	int d;
+
+	reqs = calloc(num_ifs * NUM_NLATTR_DESCS + 1, sizeof(*reqs));
+	if (reqs == NULL)
+		return NULL;
+
+	for (i = 0; i < num_ifs; i++) {
+		for (d = 0; d < NUM_NLATTR_DESCS; d++) {
+			struct nlradio_req *req = &reqs[i * NUM_NLATTR_DESCS + d];
+
+			req->desc = &nlattr_descs[d];
+			strcpy(req->ifname, ifs[i].name);
+			req->ifindex = ifs[i].ifindex;
+			req->state = NLRADIO_PENDING;
+		}
+	}
+
+	return reqs;
+}
+
+static int dump_collect(const char *pattern, struct ifcache_entry **ifs,
+	unsigned int *num_ifs, struct nlradio_req **reqs)
+{
+	struct nlradio nr;
+	int ret;
+
+	ret = list_radio_ifs(pattern, ifs, num_ifs);
+	if (ret < 0)
 		return ret;
+
+	*reqs = dump_alloc_reqs(*ifs, *num_ifs);
+	if (*reqs == NULL) {
+		free(*ifs);
+		return -ENOMEM;
 	}
 
-	ret = nl_send_auto(sk, msg);
+	ret = nlradio_open(&nr);
+	if (ret == 0) {
+		ret = nlradio_run(&nr, *reqs, *num_ifs * NUM_NLATTR_DESCS);
+		nlradio_close(&nr);
+	}
 	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+		free(*reqs);
+		free(*ifs);
 	}
 
-	nlmsg_free(msg);
+	return ret;
+}
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
-	}
+static int do_dump(bool json, const char *pattern)
+{
+	struct nlradio_req *reqs;
+	struct ifcache_entry *ifs;
+	unsigned int num_ifs;
+	int ret;
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
-	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, nlfsk_get_tx_power_val, val);
+	ret = dump_collect(pattern, &ifs, &num_ifs, &reqs);
+	if (ret < 0)
+		return 1;
 
-	ret = nl_recvmsgs(sk, cb);
+	if (json)
+		dump_print_json(ifs, num_ifs, reqs);
+	else
+		dump_print_table(ifs, num_ifs, reqs);
 
-	nl_cb_put(cb);
+	free(reqs);
+	free(ifs);
 
-	return ret;
+	return 0;
 }
 
-static int nlfsk_set_tx_power(struct nl_sock *sk, int family_id,
-	int ifindex, int32_t val)
+/*
+ * Snapshot file: a header followed by one fixed-size record per parameter,
+ * in native byte order. A parameter is identified by family and get command,
+ * which are fixed by the uapi.
+ */
+
+#define SNAPSHOT_MAGIC		"LRSN"
+#define SNAPSHOT_VERSION	1
+
+struct snapshot_hdr {
+	char magic[4];
+	uint16_t version;
+	uint16_t count;
+};
+
+struct snapshot_rec {
+	char ifname[IFNAMSIZ];
+	uint8_t family;
+	uint8_t get_cmd;
+	uint8_t pad[2];
+	uint32_t val;
+};
+
+static const struct nlattr_desc *snapshot_rec_desc(const struct snapshot_rec *rec)
 {
-	struct nl_msg *msg;
-	struct nl_cb *cb;
-	void *ptr;
-	int ret;
+	int d;
 
-	msg = nlmsg_alloc();
-	if (msg == NULL) {
-		fprintf(stderr, "nlmsg_alloc\n");
-		return -ENOMEM;
+	for (d = 0; d < NUM_NLATTR_DESCS; d++) {
+		if (nlattr_descs[d].family == rec->family &&
+		    nlattr_descs[d].get_cmd == rec->get_cmd)
+			return &nlattr_descs[d];
 	}
+	return NULL;
+}
 
-	ptr = genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, family_id, 0, NLM_F_REQUEST, NLFSK_CMD_SET_TX_POWER, 0);
-	if (ptr == NULL) {
-		fprintf(stderr, "genlmsg_put\n");
-		nlmsg_free(msg);
-		return -ENOMEM;
-	}
+static int do_snapshot(const char *path)
+{
+	struct snapshot_hdr hdr;
+	struct snapshot_rec rec;
+	struct nlradio_req *reqs;
+	struct ifcache_entry *ifs;
+	unsigned int i, num_ifs, count = 0;
+	FILE *f;
+	int ret;
 
-	ret = nla_put_u32(msg, NLFSK_ATTR_IFINDEX, ifindex);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_u32\n");
-		nlmsg_free(msg);
-		return ret;
-	}
+	ret = dump_collect("*", &ifs, &num_ifs, &reqs);
+	if (ret < 0)
+		return 1;
 
-	ret = nla_put_s32(msg, NLFSK_ATTR_TX_POWER, val);
-	if (ret < 0) {
-		fprintf(stderr, "nla_put_s32\n");
-		nlmsg_free(msg);
-		return ret;
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		int err = errno;
+		fprintf(stderr, "fopen failed: %s\n", strerror(err));
+		free(reqs);
+		free(ifs);
+		return 1;
 	}
 
-	ret = nl_send_auto(sk, msg);
-	if (ret < 0) {
-		fprintf(stderr, "nl_send_auto\n");
-		nlmsg_free(msg);
-		return ret;
+	memset(&hdr, 0, sizeof(hdr));
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	for (i = 0; i < num_ifs * NUM_NLATTR_DESCS; i++) {
+		if (reqs[i].err || !reqs[i].have_val)
+			continue;
+		memset(&rec, 0, sizeof(rec));
+		strcpy(rec.ifname, reqs[i].ifname);
+		rec.family = reqs[i].desc->family;
+		rec.get_cmd = reqs[i].desc->get_cmd;
+		rec.val = reqs[i].val;
+		fwrite(&rec, sizeof(rec), 1, f);
+		count++;
 	}
 
-	nlmsg_free(msg);
+	memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.version = SNAPSHOT_VERSION;
+	hdr.count = count;
+	rewind(f);
+	fwrite(&hdr, sizeof(hdr), 1, f);
 
-	cb = nl_cb_alloc(NL_CB_DEFAULT);
-	if (cb == NULL) {
-		fprintf(stderr, "nl_cb_alloc\n");
-		return -ENOMEM;
+	ret = ferror(f);
+	if (fclose(f) != 0 || ret) {
+		fprintf(stderr, "writing %s failed\n", path);
+		ret = 1;
 	}
 
-	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	if (ret == 0)
+		printf("%u parameters of %u interfaces saved\n", count, num_ifs);
 
-	ret = nl_recvmsgs(sk, cb);
-
-	nl_cb_put(cb);
+	free(reqs);
+	free(ifs);
 
-	return ret;
+	return ret ? 1 : 0;
 }
 
-static int get_ifindex(const char *ifname, const char *mode, int *ifindex)
+static int snapshot_read(const char *path, struct snapshot_rec **out, unsigned int *num)
 {
-	struct ifreq ifr;
-	int skt, ret;
+	struct snapshot_hdr hdr;
+	struct snapshot_rec *recs;
+	FILE *f;
 
-	if (strcmp(mode, "lora") == 0) {
-		//skt = socket(PF_LORA, SOCK_DGRAM, 1);
-		skt = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_LORA));
-	} else if (strcmp(mode, "fsk") == 0) {
-		skt = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_FSK));
-	} else return -EINVAL;
-	if (skt == -1) {
+	f = fopen(path, "rb");
+	if (f == NULL) {
 		int err = errno;
-		fprintf(stderr, "socket failed: %s (%d)\n", strerror(err), err);
+		fprintf(stderr, "fopen failed: %s\n", strerror(err));
 		return -err;
 	}
 
-	strcpy(ifr.ifr_name, ifname);
-	ret = ioctl(skt, SIOCGIFINDEX, &ifr);
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "ioctl failed: %s (%d)\n", strerror(err), err);
-		close(skt);
-		return -err;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != SNAPSHOT_VERSION) {
+		fprintf(stderr, "%s: not a snapshot file\n", path);
+		fclose(f);
+		return -EINVAL;
 	}
-	close(skt);
 
-	*ifindex = ifr.ifr_ifindex;
-	return 0;
-}
+	recs = calloc(hdr.count + 1, sizeof(*recs));
+	if (recs == NULL) {
+		fclose(f);
+		return -ENOMEM;
+	}
 
-static int handle_lora(struct nl_sock *sk, int family_id, int ifindex, const char *cmd,
-	int argc, char **args)
-{
-	uint32_t freq;
-	int32_t tx_power;
-	char *endptr;
-	int ret;
+	if (fread(recs, sizeof(*recs), hdr.count, f) != hdr.count) {
+		fprintf(stderr, "%s: truncated\n", path);
+		free(recs);
+		fclose(f);
+		return -EINVAL;
+	}
+	fclose(f);
 
-	if (strcmp(cmd, "freq") == 0) {
-		if (argc == 0) {
-			ret = nllora_get_freq(sk, family_id, ifindex, &freq);
-			if (ret) {
-				fprintf(stderr, "nllora_get_freq\n");
-				return 1;
-			}
-			printf("frequency: %u\n", freq);
-		} else if (argc == 1) {
-			freq = strtoul(args[0], &endptr, 0);
-			if (endptr == args[0]) {
-				fprintf(stderr, "invalid argument\n");
-				return 1;
-			}
-			ret = nllora_set_freq(sk, family_id, ifindex, freq);
-			if (ret) {
-				fprintf(stderr, "nllora_set_freq\n");
-				return 1;
-			}
-		} else return -EINVAL;
-	} else if (strcmp(cmd, "tx_power") == 0) {
-		if (argc == 0) {
-			ret = nllora_get_tx_power(sk, family_id, ifindex, &tx_power);
-			if (ret) {
-				fprintf(stderr, "nllora_get_tx_power\n");
-				return 1;
-			}
-			printf("tx power: %d\n", tx_power);
-		} else if (argc == 1) {
-			tx_power = strtol(args[0], &endptr, 0);
-			if (endptr == args[0]) {
-				fprintf(stderr, "invalid argument\n");
-				return 1;
-			}
-			ret = nllora_set_tx_power(sk, family_id, ifindex, tx_power);
-			if (ret) {
-				fprintf(stderr, "nllora_set_tx_power\n");
-				return 1;
-			}
-		} else return -EINVAL;
-	} else return -EINVAL;
+	*out = recs;
+	*num = hdr.count;
 	return 0;
 }
 
-static int handle_fsk(struct nl_sock *sk, int family_id, int ifindex, const char *cmd,
-	int argc, char **args)
+/*
+ * Apply a snapshot: read the current value of every parameter it names and
+ * only send set commands for the ones that differ, so that radios are not
+ * retuned needlessly.
+ */
+static int do_apply(const char *path)
 {
-	uint32_t freq;
-	int32_t tx_power;
-	char *endptr;
+	struct timespec start, mid, end;
+	struct nlradio_req *gets, *sets;
+	struct snapshot_rec *recs = NULL;
+	const struct ifcache_entry *e;
+	struct nlradio nr;
+	unsigned int i, num_recs = 0, num_sets = 0;
+	unsigned int skipped = 0, missing = 0, failed = 0;
 	int ret;
 
-	if (strcmp(cmd, "freq") == 0) {
-		if (argc == 0) {
-			ret = nlfsk_get_freq(sk, family_id, ifindex, &freq);
-			if (ret) {
-				fprintf(stderr, "nlfsk_get_freq\n");
-				return 1;
-			}
-			printf("frequency: %u\n", freq);
-		} else if (argc == 1) {
-			freq = strtoul(args[0], &endptr, 0);
-			if (endptr == args[0]) {
-				fprintf(stderr, "invalid argument\n");
-				return 1;
-			}
-			ret = nlfsk_set_freq(sk, family_id, ifindex, freq);
-			if (ret) {
-				fprintf(stderr, "nlfsk_set_freq\n");
-				return 1;
-			}
-		} else return -EINVAL;
-	} else if (strcmp(cmd, "freq_dev") == 0) {
-		if (argc == 0) {
-			ret = nlfsk_get_freq_dev(sk, family_id, ifindex, &freq);
-			if (ret) {
-				fprintf(stderr, "nlfsk_get_freq_dev\n");
-				return 1;
-			}
-			printf("frequency deviation: %u\n", freq);
-		} else if (argc == 1) {
-			freq = strtoul(args[0], &endptr, 0);
-			if (endptr == args[0]) {
-				fprintf(stderr, "invalid argument\n");
-				return 1;
-			}
-			ret = nlfsk_set_freq_dev(sk, family_id, ifindex, freq);
-			if (ret) {
-				fprintf(stderr, "nlfsk_set_freq_dev\n");
-				return 1;
-			}
-		} else return -EINVAL;
-	} else if (strcmp(cmd, "tx_power") == 0) {
-		if (argc == 0) {
-			ret = nlfsk_get_tx_power(sk, family_id, ifindex, &tx_power);
-			if (ret) {
-				fprintf(stderr, "nlfsk_get_tx_power\n");
-				return 1;
-			}
-			printf("tx power: %d\n", tx_power);
-		} else if (argc == 1) {
-			tx_power = strtol(args[0], &endptr, 0);
-			if (endptr == args[0]) {
-				fprintf(stderr, "invalid argument\n");
-				return 1;
-			}
-			ret = nlfsk_set_tx_power(sk, family_id, ifindex, tx_power);
-			if (ret) {
-				fprintf(stderr, "nlfsk_set_tx_power\n");
-				return 1;
-			}
-		} else return -EINVAL;
-	} else return -EINVAL;
-	return 0;
+	ret = snapshot_read(path, &recs, &num_recs);
+	if (ret < 0)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	gets = calloc(num_recs + 1, sizeof(*gets));
+	sets = calloc(num_recs + 1, sizeof(*sets));
+	if (gets == NULL || sets == NULL) {
+		free(gets);
+		free(sets);
+		free(recs);
+		return 1;
+	}
+
+	for (i = 0; i < num_recs; i++) {
+		struct nlradio_req *req = &gets[i];
+
+		recs[i].ifname[IFNAMSIZ - 1] = '\0';
+		strcpy(req->ifname, recs[i].ifname);
+		req->state = NLRADIO_DONE;
+		req->err = -ENODEV;
+
+		req->desc = snapshot_rec_desc(&recs[i]);
+		if (req->desc == NULL) {
+			req->err = -EINVAL;
+			continue;
+		}
+		e = ifcache_find_name(&ifc, req->ifname);
+		if (e != NULL) {
+			req->ifindex = e->ifindex;
+			req->state = NLRADIO_PENDING;
+			req->err = 0;
+		}
+	}
+
+	ret = nlradio_open(&nr);
+	if (ret < 0)
+		goto out;
+
+	ret = nlradio_run(&nr, gets, num_recs);
+	if (ret < 0)
+		goto out_close;
+
+	for (i = 0; i < num_recs; i++) {
+		const struct nlradio_req *get = &gets[i];
+		int64_t val;
+
+		if (get->desc == NULL || get->ifindex == 0) {
+			fprintf(stderr, "%s: skipping unknown parameter or interface\n",
+				get->ifname);
+			missing++;
+			continue;
+		}
+
+		if (nlattr_desc_is_signed(get->desc))
+			val = (int32_t)recs[i].val;
+		else
+			val = recs[i].val;
+
+		if (get->err == 0 && get->have_val && get->val == val) {
+			skipped++;
+			continue;
+		}
+
+		sets[num_sets] = *get;
+		sets[num_sets].set = true;
+		sets[num_sets].have_val = false;
+		sets[num_sets].val = val;
+		sets[num_sets].state = NLRADIO_PENDING;
+		sets[num_sets].err = 0;
+		num_sets++;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &mid);
+
+	ret = nlradio_run(&nr, sets, num_sets);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (i = 0; i < num_sets; i++) {
+		if (sets[i].state == NLRADIO_DONE && sets[i].err == 0)
+			continue;
+		fprintf(stderr, "%s %s %s: %s\n", sets[i].ifname,
+			nlradio_families[sets[i].desc->family].mode, sets[i].desc->name,
+			sets[i].err ? strerror(-sets[i].err) : "no reply");
+		failed++;
+	}
+
+	printf("%u sets, %u skipped, %u failed, %u unknown\n",
+		num_sets, skipped, failed, missing);
+	printf("compare %.3f ms, apply %.3f ms, total %.3f ms\n",
+		elapsed_ms(&start, &mid), elapsed_ms(&mid, &end), elapsed_ms(&start, &end));
+
+out_close:
+	nlradio_close(&nr);
+out:
+	free(sets);
+	free(gets);
+	free(recs);
+
+	return (ret < 0 || failed) ? 1 : 0;
 }
 
-static int usage(const char *argv0)
+/*
+ * Monitor mode: subscribe to the configuration multicast group of each
+ * family and print every change as it is announced.
+ */
+
+#define MONITOR_RCVBUF	(4 * 1024 * 1024)
+
+struct monitor {
+	int family_ids[FAMILY_NUM];
+};
+
+static const struct nlattr_desc *nlattr_desc_find_cmd(int family, uint8_t cmd)
 {
-	fprintf(stderr, "Usage: %s lora0 lora|fsk op\n", argv0);
-	return 2;
+	int i;
+
+	for (i = 0; i < NUM_NLATTR_DESCS; i++) {
+		if (nlattr_descs[i].family == family &&
+		    (nlattr_descs[i].set_cmd == cmd || nlattr_descs[i].get_cmd == cmd))
+			return &nlattr_descs[i];
+	}
+	return NULL;
 }
 
-int main(int argc, char **argv)
+static int monitor_event(struct nl_msg *msg, void *arg)
 {
-	struct nl_sock *sk;
-	const char *name;
-	int ifindex, family_id, ret;
+	struct nlattr *attrs[NLRADIO_ATTR_MAX + 1];
+	struct nlmsghdr *hdr = nlmsg_hdr(msg);
+	const struct nlradio_family *fam;
+	const struct nlattr_desc *desc;
+	struct monitor *mon = arg;
+	struct genlmsghdr *ghdr;
+	char ifname[IF_NAMESIZE] = "?";
+	char stamp[32];
+	struct timespec ts;
+	struct tm tm;
+	int f, ret;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	localtime_r(&ts.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%F %T", &tm);
+
+	for (f = 0; f < FAMILY_NUM; f++) {
+		if (mon->family_ids[f] == hdr->nlmsg_type)
+			break;
+	}
+	if (f == FAMILY_NUM)
+		return NL_SKIP;
+	fam = &nlradio_families[f];
 
-	if (argc < 1 + 3) {
-		return usage(argv[0]);
+	ret = genlmsg_parse(hdr, 0, attrs, fam->maxattr, fam->policy);
+	if (ret < 0)
+		return NL_SKIP;
+
+	ghdr = nlmsg_data(hdr);
+	if (attrs[fam->ifindex_attr]) {
+		int ifindex = nla_get_u32(attrs[fam->ifindex_attr]);
+		const struct ifcache_entry *e = ifcache_find_index(&ifc, ifindex);
+
+		if (e != NULL)
+			strcpy(ifname, e->name);
+		else
+			if_indextoname(ifindex, ifname);
 	}
 
-	if (strcmp(argv[2], "lora") != 0 &&
-	    strcmp(argv[2], "fsk") != 0)
-		return usage(argv[0]);
+	printf("[%s.%06ld] %s %s ", stamp, ts.tv_nsec / 1000, ifname, fam->mode);
+
+	desc = nlattr_desc_find_cmd(f, ghdr->cmd);
+	if (desc == NULL)
+		printf("cmd %u\n", ghdr->cmd);
+	else if (!attrs[desc->attr])
+		printf("%s\n", desc->name);
+	else {
+		int64_t val;
+
+		if (nlattr_desc_is_signed(desc))
+			val = nla_get_s32(attrs[desc->attr]);
+		else
+			val = nla_get_u32(attrs[desc->attr]);
+		printf("%s ", desc->name);
+		print_value(desc, val);
+		printf("\n");
+	}
+	fflush(stdout);
 
-	ret = get_ifindex(argv[1], argv[2], &ifindex);
-	if (ret < 0)
+	return NL_OK;
+}
+
+static int do_monitor(void)
+{
+	struct monitor mon;
+	struct nl_sock *sk;
+	struct nl_cb *cb;
+	int f, grp, fd, one = 1, groups = 0, ret;
+
+	/* announcements come from the kernel to every listener */
+	if (xp->ops != &xport_kernel_ops) {
+		fprintf(stderr, "-monitor needs the kernel transport\n");
 		return 1;
-	//printf("ifindex %d\n", ifindex);
+	}
 
 	sk = nl_socket_alloc();
 	if (sk == NULL) {
@@ -838,6 +1584,8 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
+	nl_socket_disable_seq_check(sk);
+
 	ret = genl_connect(sk);
 	if (ret < 0) {
 		fprintf(stderr, "genl_connect\n");
@@ -845,30 +1593,165 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	if (strcmp(argv[2], "lora") == 0) {
-		name = NLLORA_GENL_NAME;
-	} else if (strcmp(argv[2], "fsk") == 0) {
-		name = NLFSK_GENL_NAME;
-	} else return 1;
-
-	family_id = genl_ctrl_resolve(sk, name);
-	if (family_id < 0) {
-		fprintf(stderr, "genl_ctrl_resolve\n");
+	for (f = 0; f < FAMILY_NUM; f++) {
+		const struct nlradio_family *fam = &nlradio_families[f];
+
+		mon.family_ids[f] = genl_ctrl_resolve(sk, fam->genl_name);
+		if (mon.family_ids[f] < 0)
+			continue;
+
+		grp = genl_ctrl_resolve_grp(sk, fam->genl_name, fam->mcgrp_name);
+		if (grp < 0) {
+			fprintf(stderr, "%s has no %s multicast group\n",
+				fam->genl_name, fam->mcgrp_name);
+			continue;
+		}
+
+		ret = nl_socket_add_membership(sk, grp);
+		if (ret < 0) {
+			fprintf(stderr, "nl_socket_add_membership: %s\n", nl_geterror(ret));
+			continue;
+		}
+		groups++;
+	}
+	if (groups == 0) {
 		nl_socket_free(sk);
 		return 1;
 	}
 
-	if (strcmp(argv[2], "lora") == 0) {
-		ret = handle_lora(sk, family_id, ifindex, argv[3], argc - 4, &argv[4]);
-	} else if (strcmp(argv[2], "fsk") == 0) {
-		ret = handle_fsk(sk, family_id, ifindex, argv[3], argc - 4, &argv[4]);
-	} else return 1;
-	if (ret) {
+	fd = nl_socket_get_fd(sk);
+	if (setsockopt(fd, SOL_NETLINK, NETLINK_NO_ENOBUFS, &one, sizeof(one)) == -1) {
+		int err = errno;
+		fprintf(stderr, "NETLINK_NO_ENOBUFS failed: %s\n", strerror(err));
+	}
+	nl_socket_set_buffer_size(sk, MONITOR_RCVBUF, 0);
+
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (cb == NULL) {
+		fprintf(stderr, "nl_cb_alloc\n");
 		nl_socket_free(sk);
 		return 1;
 	}
 
+	nl_cb_set(cb, NL_CB_SEQ_CHECK, NL_CB_CUSTOM, seq_check, NULL);
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, monitor_event, &mon);
+
+	for (;;) {
+		ret = nl_recvmsgs(sk, cb);
+		if (ret == -NLE_NOMEM) {
+			/* only without NETLINK_NO_ENOBUFS */
+			fprintf(stderr, "receive buffer overrun, events lost\n");
+			continue;
+		}
+		if (ret < 0) {
+			fprintf(stderr, "nl_recvmsgs: %s\n", nl_geterror(ret));
+			break;
+		}
+	}
+
+	nl_cb_put(cb);
 	nl_socket_free(sk);
 
+	return 1;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s lora0|pattern lora|fsk op [value]\n", argv0);
+	fprintf(stderr, "       %s -batch file|-\n", argv0);
+	fprintf(stderr, "       %s -dump [-json] [pattern]\n", argv0);
+	fprintf(stderr, "       %s -snapshot|-apply file\n", argv0);
+	fprintf(stderr, "       %s -stats [-repeat N] lora0 lora|fsk op|all [value]\n", argv0);
+	fprintf(stderr, "       %s -monitor\n", argv0);
+	return 2;
+}
+
+static int run(int argc, char **argv)
+{
+	struct nlradio nr;
+	char *endptr;
+	int ret;
+
+	if (argc == 3 && strcmp(argv[1], "-batch") == 0)
+		return do_batch(argv[2]);
+
+	if (argc >= 2 && strcmp(argv[1], "-dump") == 0) {
+		bool json = argc >= 3 && strcmp(argv[2], "-json") == 0;
+		int i = json ? 3 : 2;
+
+		if (argc > i + 1)
+			return usage(argv[0]);
+		return do_dump(json, argc == i + 1 ? argv[i] : "*");
+	}
+
+	if (argc == 2 && strcmp(argv[1], "-monitor") == 0)
+		return do_monitor();
+
+	if (argc == 3 && strcmp(argv[1], "-snapshot") == 0)
+		return do_snapshot(argv[2]);
+
+	if (argc == 3 && strcmp(argv[1], "-apply") == 0)
+		return do_apply(argv[2]);
+
+	if (argc >= 2 && strcmp(argv[1], "-stats") == 0) {
+		unsigned long repeat = 1000;
+		int i = 2;
+
+		if (argc >= 4 && strcmp(argv[2], "-repeat") == 0) {
+			repeat = strtoul(argv[3], &endptr, 0);
+			if (endptr == argv[3] || repeat == 0)
+				return usage(argv[0]);
+			i = 4;
+		}
+		if (argc < i + 3)
+			return usage(argv[0]);
+		ret = do_stats(argv[i], argv[i + 1], argv[i + 2], repeat,
+			argc - i - 3, &argv[i + 3]);
+		if (ret == -EINVAL)
+			return usage(argv[0]);
+		return ret ? 1 : 0;
+	}
+
+	if (argc < 1 + 3) {
+		return usage(argv[0]);
+	}
+
+	if (family_from_mode(argv[2]) < 0)
+		return usage(argv[0]);
+
+	ret = nlradio_open(&nr);
+	if (ret < 0)
+		return 1;
+
+	ret = handle_op(&nr, argv[1], argv[2], argv[3], argc - 4, &argv[4]);
+	if (ret) {
+		nlradio_close(&nr);
+		return 1;
+	}
+
+	nlradio_close(&nr);
+
 	return 0;
 }
+
+int main(int argc, char **argv)
+{
+	int ret;
+
+	xp = xport_open(NULL);
+	if (xp == NULL)
+		return 1;
+
+	ret = xport_load_ifs(xp, &ifc);
+	if (ret < 0) {
+		xport_close(xp);
+		return 1;
+	}
+
+	ret = run(argc, argv);
+
+	ifcache_free(&ifc);
+	xport_close(xp);
+
+	return ret;
+}
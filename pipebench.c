@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "framepipe.h"
+#include "hist.h"
+
+/*
+ * Moves frames through a receive, MAC and transmit stage, one thread each,
+ * and reports throughput, CPU time per frame and the latency from the
+ * receive stage to the transmit stage.
+ *
+ * -m ring hands frames over framepipe rings and recycles them through a
+ * frame pool. -m mutex is the usual first attempt: a malloc per frame and
+ * queues protected by a mutex and condition variable, drained in bursts
+ * of the same size.
+ */
+
+#define NUM_STAGES	3
+#define BURST_MAX	256
+#define SPINS		64
+
+enum {
+	MODE_RING = 1,
+	MODE_MUTEX = 2,
+};
+
+struct bench_opts {
+	int modes;
+	unsigned long count;
+	unsigned int burst;
+	unsigned int ring_size;
+	unsigned int pool_size;
+	unsigned int len;
+	int pin;
+	int track_latency;
+};
+
+struct mq_node {
+	struct mq_node *next;
+	struct frame f;
+};
+
+struct mq {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct mq_node *head;
+	struct mq_node *tail;
+	unsigned long len;
+	unsigned long max_len;
+};
+
+struct bench {
+	const struct bench_opts *o;
+	struct frame_pool pool;
+	struct fp_ring *rings[NUM_STAGES - 1];
+	struct mq queues[NUM_STAGES - 1];
+	unsigned long out_of_order;
+	uint64_t checksum;
+	struct hist e2e;
+};
+
+/* spin briefly, then let the other stages have the CPU */
+static void backoff(unsigned int *spins)
+{
+	if (++*spins < SPINS) {
+		cpu_relax();
+	} else {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+static void fill_frame(struct frame *f, uint32_t seq, unsigned int len)
+{
+	f->seq = seq;
+	f->len = len;
+	f->eth_p = 0x80fb;
+	f->data[0] = 0x40;
+	memset(f->data + 1, seq, len - 1);
+	f->ts = hist_now_ns();
+}
+
+/* stands in for MAC work: touch the whole payload */
+static uint64_t process_frame(struct frame *f)
+{
+	uint64_t sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < f->len; i++)
+		sum += f->data[i];
+	f->data[0] ^= 0x20;
+	return sum;
+}
+
+static void push_all(struct fp_ring *r, struct frame **f, unsigned int n)
+{
+	unsigned int done = 0, spins = 0;
+
+	while (done < n) {
+		unsigned int k = fp_ring_push(r, f + done, n - done);
+
+		if (k == 0)
+			backoff(&spins);
+		done += k;
+	}
+}
+
+static void *ring_rx(void *arg)
+{
+	struct bench *b = arg;
+	const struct bench_opts *o = b->o;
+	struct frame *f[BURST_MAX];
+	unsigned long seq = 0;
+	unsigned int spins = 0, i, n;
+
+	while (seq < o->count) {
+		n = o->count - seq < o->burst ? o->count - seq : o->burst;
+		n = frame_pool_get(&b->pool, f, n);
+		if (n == 0) {
+			backoff(&spins);
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			fill_frame(f[i], seq++, o->len);
+		push_all(b->rings[0], f, n);
+	}
+	return NULL;
+}
+
+static void *ring_mac(void *arg)
+{
+	struct bench *b = arg;
+	const struct bench_opts *o = b->o;
+	struct frame *f[BURST_MAX];
+	unsigned long done = 0;
+	unsigned int spins = 0, i, n;
+	uint64_t sum = 0;
+
+	while (done < o->count) {
+		n = fp_ring_pop(b->rings[0], f, o->burst);
+		if (n == 0) {
+			backoff(&spins);
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			sum += process_frame(f[i]);
+		push_all(b->rings[1], f, n);
+		done += n;
+	}
+	b->checksum = sum;
+	return NULL;
+}
+
+static void *ring_tx(void *arg)
+{
+	struct bench *b = arg;
+	const struct bench_opts *o = b->o;
+	struct frame *f[BURST_MAX];
+	unsigned long done = 0;
+	unsigned int spins = 0, i, n;
+	uint32_t next = 0;
+	uint64_t now;
+
+	while (done < o->count) {
+		n = fp_ring_pop(b->rings[1], f, o->burst);
+		if (n == 0) {
+			backoff(&spins);
+			continue;
+		}
+		now = hist_now_ns();
+		for (i = 0; i < n; i++) {
+			hist_add(&b->e2e, now - f[i]->ts);
+			if (f[i]->seq != next)
+				b->out_of_order++;
+			next = f[i]->seq + 1;
+		}
+		/* the pool has room for every frame, so this never falls short */
+		frame_pool_put(&b->pool, f, n);
+		done += n;
+	}
+	return NULL;
+}
+
+static void mq_init(struct mq *q)
+{
+	memset(q, 0, sizeof(*q));
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->cond, NULL);
+}
+
+static void mq_destroy(struct mq *q)
+{
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->cond);
+}
+
+static void mq_push(struct mq *q, struct mq_node **nodes, unsigned int n)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&q->lock);
+	for (i = 0; i < n; i++) {
+		nodes[i]->next = NULL;
+		if (q->tail != NULL)
+			q->tail->next = nodes[i];
+		else
+			q->head = nodes[i];
+		q->tail = nodes[i];
+	}
+	q->len += n;
+	if (q->len > q->max_len)
+		q->max_len = q->len;
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static unsigned int mq_pop(struct mq *q, struct mq_node **nodes, unsigned int n)
+{
+	unsigned int i = 0;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->head == NULL)
+		pthread_cond_wait(&q->cond, &q->lock);
+	while (i < n && q->head != NULL) {
+		nodes[i++] = q->head;
+		q->head = q->head->next;
+	}
+	if (q->head == NULL)
+		q->tail = NULL;
+	q->len -= i;
+	pthread_mutex_unlock(&q->lock);
+	return i;
+}
+
+static void *mutex_rx(void *arg)
+{
+	struct bench *b = arg;
+	const struct bench_opts *o = b->o;
+	struct mq_node *nodes[BURST_MAX];
+	unsigned long seq = 0;
+	unsigned int i, n;
+
+	while (seq < o->count) {
+		n = o->count - seq < o->burst ? o->count - seq : o->burst;
+		for (i = 0; i < n; i++) {
+			nodes[i] = malloc(sizeof(*nodes[i]));
+			if (nodes[i] == NULL) {
+				fprintf(stderr, "out of memory\n");
+				exit(1);
+			}
+			fill_frame(&nodes[i]->f, seq++, o->len);
+		}
+		mq_push(&b->queues[0], nodes, n);
+	}
+	return NULL;
+}
+
+static void *mutex_mac(void *arg)
+{
+	struct bench *b = arg;
+	const struct bench_opts *o = b->o;
+	struct mq_node *nodes[BURST_MAX];
+	unsigned long done = 0;
+	unsigned int i, n;
+	uint64_t sum = 0;
+
+	while (done < o->count) {
+		n = mq_pop(&b->queues[0], nodes, o->burst);
+		for (i = 0; i < n; i++)
+			sum += process_frame(&nodes[i]->f);
+		mq_push(&b->queues[1], nodes, n);
+		done += n;
+	}
+	b->checksum = sum;
+	return NULL;
+}
+
+static void *mutex_tx(void *arg)
+{
+	struct bench *b = arg;
+	const struct bench_opts *o = b->o;
+	struct mq_node *nodes[BURST_MAX];
+	unsigned long done = 0;
+	unsigned int i, n;
+	uint32_t next = 0;
+	uint64_t now;
+
+	while (done < o->count) {
+		n = mq_pop(&b->queues[1], nodes, o->burst);
+		now = hist_now_ns();
+		for (i = 0; i < n; i++) {
+			hist_add(&b->e2e, now - nodes[i]->f.ts);
+			if (nodes[i]->f.seq != next)
+				b->out_of_order++;
+			next = nodes[i]->f.seq + 1;
+			free(nodes[i]);
+		}
+		done += n;
+	}
+	return NULL;
+}
+
+static int run(struct bench *b, int mode)
+{
+	static void *(*const fns[][NUM_STAGES])(void *) = {
+		[MODE_RING] = { ring_rx, ring_mac, ring_tx },
+		[MODE_MUTEX] = { mutex_rx, mutex_mac, mutex_tx },
+	};
+	const struct bench_opts *o = b->o;
+	pthread_t threads[NUM_STAGES];
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t start, end, cpu;
+	unsigned int i;
+	int ret;
+
+	cpu = hist_cpu_ns(RUSAGE_SELF);
+	start = hist_now_ns();
+	for (i = 0; i < NUM_STAGES; i++) {
+		pthread_attr_t attr;
+
+		pthread_attr_init(&attr);
+		if (o->pin) {
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			CPU_SET(i % ncpu, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+		ret = pthread_create(&threads[i], &attr, fns[mode][i], b);
+		pthread_attr_destroy(&attr);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+			exit(1);
+		}
+	}
+	for (i = 0; i < NUM_STAGES; i++)
+		pthread_join(threads[i], NULL);
+	end = hist_now_ns();
+	cpu = hist_cpu_ns(RUSAGE_SELF) - cpu;
+
+	printf("%-6s %lu frames in %.3f s, %.0f frames/s, %.0f ns CPU per frame, %lu out of order\n",
+		mode == MODE_RING ? "ring:" : "mutex:", o->count, (end - start) / 1e9,
+		o->count * 1e9 / (end - start), (double)cpu / o->count, b->out_of_order);
+	hist_print("rx>tx", &b->e2e);
+	return 0;
+}
+
+static int run_ring(const struct bench_opts *o)
+{
+	struct bench b;
+	unsigned int i;
+
+	memset(&b, 0, sizeof(b));
+	b.o = o;
+	hist_init(&b.e2e);
+	if (frame_pool_init(&b.pool, o->pool_size) < 0) {
+		fprintf(stderr, "frame_pool_init failed\n");
+		return -1;
+	}
+	for (i = 0; i < NUM_STAGES - 1; i++) {
+		b.rings[i] = fp_ring_create(o->ring_size, o->track_latency);
+		if (b.rings[i] == NULL) {
+			fprintf(stderr, "fp_ring_create failed\n");
+			return -1;
+		}
+	}
+
+	run(&b, MODE_RING);
+	fp_ring_print("rx>mac", b.rings[0]);
+	fp_ring_print("mac>tx", b.rings[1]);
+	fp_ring_print("pool", b.pool.free);
+
+	for (i = 0; i < NUM_STAGES - 1; i++)
+		fp_ring_destroy(b.rings[i]);
+	frame_pool_free(&b.pool);
+	return 0;
+}
+
+static int run_mutex(const struct bench_opts *o)
+{
+	struct bench b;
+	unsigned int i;
+
+	memset(&b, 0, sizeof(b));
+	b.o = o;
+	hist_init(&b.e2e);
+	for (i = 0; i < NUM_STAGES - 1; i++)
+		mq_init(&b.queues[i]);
+
+	run(&b, MODE_MUTEX);
+	printf("%-10s longest queue %lu\n", "rx>mac", b.queues[0].max_len);
+	printf("%-10s longest queue %lu\n", "mac>tx", b.queues[1].max_len);
+
+	for (i = 0; i < NUM_STAGES - 1; i++)
+		mq_destroy(&b.queues[i]);
+	return 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-m ring|mutex|both] [-n count] [-b burst] [-r ring-size] [-P pool-size]\n"
+		"       [-l len] [-c] [-L]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.modes = MODE_RING | MODE_MUTEX,
+		.count = 1000000,
+		.burst = 16,
+		.ring_size = 1024,
+		.pool_size = 4096,
+		.len = 32,
+	};
+	char *endptr;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:n:b:r:P:l:cL")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (strcmp(optarg, "ring") == 0)
+				o.modes = MODE_RING;
+			else if (strcmp(optarg, "mutex") == 0)
+				o.modes = MODE_MUTEX;
+			else if (strcmp(optarg, "both") == 0)
+				o.modes = MODE_RING | MODE_MUTEX;
+			else
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.count == 0)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.burst = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.burst == 0 || o.burst > BURST_MAX)
+				return usage(argv[0]);
+			break;
+		case 'r':
+			o.ring_size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.ring_size == 0)
+				return usage(argv[0]);
+			break;
+		case 'P':
+			o.pool_size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.pool_size == 0)
+				return usage(argv[0]);
+			break;
+		case 'l':
+			o.len = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.len == 0 || o.len > FRAME_DATA_MAX)
+				return usage(argv[0]);
+			break;
+		case 'c':
+			o.pin = 1;
+			break;
+		case 'L':
+			o.track_latency = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		return usage(argv[0]);
+
+	if ((o.modes & MODE_RING) && run_ring(&o) < 0)
+		return 1;
+	if ((o.modes & MODE_MUTEX) && run_mutex(&o) < 0)
+		return 1;
+	return 0;
+}
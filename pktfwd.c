@@ -0,0 +1,1291 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+#include "include/linux/lora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING	23
+#endif
+
+/*
+ * Bridges radio sockets to a network server speaking the Semtech UDP
+ * protocol (GWMP v2). Frames received on the radios are drained with
+ * recvmmsg, packed as rxpk objects into PUSH_DATA datagrams and sent with
+ * one sendmmsg per poll round. PULL_RESP downlinks from the server are
+ * sent on the radio picked by their rfch field, again batched per radio,
+ * and answered with TX_ACK. JSON is written straight into buffers that
+ * are allocated once at startup.
+ *
+ * Radios carry no RF metadata through the socket, so frequency and data
+ * rate come from the command line and RSSI and SNR are reported as 0.
+ * Downlinks are sent as soon as they arrive; tmst scheduling is left to
+ * the radio.
+ *
+ * With -S the tool is instead a minimal stand-in network server that
+ * acknowledges everything and, with -e, answers every LoRaWAN uplink
+ * with a downlink on the same radio.
+ */
+
+#define MAX_RADIOS	8
+#define BATCH_MAX	64
+#define MAX_FRAME	256
+/* an rxpk object with a 255 byte payload and a DATR_MAX datr fits easily */
+#define RXPK_MAX	640
+#define DATR_MAX	32
+#define DGRAM_MIN	1024
+#define DGRAM_MAX	65000
+#define DOWN_BUF_SIZE	4096
+#define ACK_BUF_SIZE	64
+#define SERVER_REPLIES	256
+
+#define GWMP_VERSION	2
+#define GWMP_HDR_LEN	4
+#define GWMP_EUI_LEN	8
+
+enum {
+	GWMP_PUSH_DATA,
+	GWMP_PUSH_ACK,
+	GWMP_PULL_DATA,
+	GWMP_PULL_RESP,
+	GWMP_PULL_ACK,
+	GWMP_TX_ACK,
+};
+
+struct pktfwd_opts {
+	const char *server;
+	unsigned char eui[GWMP_EUI_LEN];
+	unsigned int batch;
+	unsigned int max_dgram;
+	unsigned int keepalive;
+	unsigned long count;
+	const struct proto *proto;
+	const char *datr;
+	const char *serve_port;
+	int echo;
+};
+
+struct radio {
+	const struct ifcache_entry *e;
+	unsigned int index;
+	uint32_t freq;
+	int skt;
+	struct sockaddr_ll sll;
+	int use_sll;
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovs[BATCH_MAX];
+	unsigned char bufs[BATCH_MAX][MAX_FRAME];
+	char cmsgs[BATCH_MAX][CMSG_SPACE(sizeof(struct timespec))];
+	/* downlinks waiting for this round's sendmmsg */
+	struct mmsghdr tx_msgs[BATCH_MAX];
+	struct iovec tx_iovs[BATCH_MAX];
+	unsigned char tx_bufs[BATCH_MAX][MAX_FRAME];
+	uint16_t tx_tokens[BATCH_MAX];
+	uint64_t tx_ts[BATCH_MAX];
+	unsigned int tx_num;
+	unsigned long up;
+	unsigned long down;
+};
+
+struct bridge {
+	const struct pktfwd_opts *o;
+	struct radio *radios;
+	unsigned int num_radios;
+	int udp;
+	uint16_t token;
+	const char *modu;
+	const char *datr;
+	int datr_quoted;
+
+	/* PUSH_DATA datagrams filled during a poll round */
+	unsigned char *up_bufs;
+	struct mmsghdr *up_msgs;
+	struct iovec *up_iovs;
+	unsigned int up_max;
+	unsigned int up_num;
+	unsigned int up_entries;
+	char *up_pos;
+	uint64_t *up_ts;
+	unsigned int up_pending;
+
+	/* datagrams from the server */
+	unsigned char (*down_bufs)[DOWN_BUF_SIZE];
+	struct mmsghdr down_msgs[BATCH_MAX];
+	struct iovec down_iovs[BATCH_MAX];
+	char down_cmsgs[BATCH_MAX][CMSG_SPACE(sizeof(struct timespec))];
+
+	/* TX_ACKs for the downlinks of this round */
+	unsigned char ack_bufs[BATCH_MAX][ACK_BUF_SIZE];
+	struct mmsghdr ack_msgs[BATCH_MAX];
+	struct iovec ack_iovs[BATCH_MAX];
+	unsigned int ack_num;
+
+	/* when each PUSH_DATA token went out, 0 once acknowledged */
+	uint64_t push_time[65536];
+
+	unsigned long up_frames;
+	unsigned long up_dgrams;
+	unsigned long up_errors;
+	unsigned long push_acks;
+	unsigned long pull_acks;
+	unsigned long down_frames;
+	unsigned long down_errors;
+	unsigned long bad_dgrams;
+	uint64_t up_first;
+	uint64_t up_last;
+	uint64_t down_first;
+	uint64_t down_last;
+	struct hist up_hist;
+	struct hist ack_hist;
+	struct hist down_hist;
+};
+
+struct server_reply {
+	struct sockaddr_storage addr;
+	unsigned char buf[DOWN_BUF_SIZE];
+};
+
+struct server {
+	const struct pktfwd_opts *o;
+	int udp;
+	uint16_t token;
+	unsigned char (*bufs)[DGRAM_MAX + 1];
+	struct sockaddr_storage addrs[BATCH_MAX];
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovs[BATCH_MAX];
+	struct server_reply *replies;
+	struct mmsghdr reply_msgs[SERVER_REPLIES];
+	struct iovec reply_iovs[SERVER_REPLIES];
+	unsigned int reply_num;
+	struct sockaddr_storage pull_addr;
+	socklen_t pull_addrlen;
+	unsigned long push_data;
+	unsigned long rxpk;
+	unsigned long pull_data;
+	unsigned long pull_resp;
+	unsigned long tx_acks;
+	unsigned long bad_dgrams;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static const char b64_enc[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static signed char b64_dec[256];
+
+static void b64_init(void)
+{
+	unsigned int i;
+
+	memset(b64_dec, -1, sizeof(b64_dec));
+	for (i = 0; i < 64; i++)
+		b64_dec[(unsigned char)b64_enc[i]] = i;
+}
+
+static char *put_base64(char *p, const unsigned char *d, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i + 2 < len; i += 3) {
+		uint32_t v = d[i] << 16 | d[i + 1] << 8 | d[i + 2];
+
+		*p++ = b64_enc[v >> 18];
+		*p++ = b64_enc[(v >> 12) & 0x3f];
+		*p++ = b64_enc[(v >> 6) & 0x3f];
+		*p++ = b64_enc[v & 0x3f];
+	}
+	if (i < len) {
+		uint32_t v = d[i] << 16 | (i + 1 < len ? d[i + 1] << 8 : 0);
+
+		*p++ = b64_enc[v >> 18];
+		*p++ = b64_enc[(v >> 12) & 0x3f];
+		*p++ = i + 1 < len ? b64_enc[(v >> 6) & 0x3f] : '=';
+		*p++ = '=';
+	}
+	return p;
+}
+
+/* returns the decoded length, or -1 if it is not base64 or exceeds max */
+static int get_base64(const char *s, unsigned int len, unsigned char *d,
+	unsigned int max)
+{
+	unsigned int i, n = 0, bits = 0;
+	uint32_t v = 0;
+
+	for (i = 0; i < len && s[i] != '='; i++) {
+		int c = b64_dec[(unsigned char)s[i]];
+
+		if (c < 0)
+			return -1;
+		v = v << 6 | c;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (n == max)
+				return -1;
+			d[n++] = v >> bits;
+		}
+	}
+	return n;
+}
+
+static char *put_str(char *p, const char *s)
+{
+	while (*s != '\0')
+		*p++ = *s++;
+	return p;
+}
+
+static char *put_uint(char *p, uint64_t v)
+{
+	char tmp[20];
+	unsigned int n = 0;
+
+	do {
+		tmp[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	while (n > 0)
+		*p++ = tmp[--n];
+	return p;
+}
+
+/* Hz as MHz with six decimals, the way GWMP writes frequencies */
+static char *put_mhz(char *p, uint32_t hz)
+{
+	uint32_t frac = hz % 1000000;
+	int i;
+
+	p = put_uint(p, hz / 1000000);
+	*p++ = '.';
+	for (i = 5; i >= 0; i--) {
+		p[i] = '0' + frac % 10;
+		frac /= 10;
+	}
+	return p + 6;
+}
+
+static char *put_header(char *p, uint16_t token, int type)
+{
+	*p++ = GWMP_VERSION;
+	*p++ = token >> 8;
+	*p++ = token;
+	*p++ = type;
+	return p;
+}
+
+static uint16_t get_token(const unsigned char *buf)
+{
+	return buf[1] << 8 | buf[2];
+}
+
+/* value after "key": in a NUL-terminated JSON text, or NULL */
+static const char *json_find(const char *text, const char *key)
+{
+	size_t len = strlen(key);
+	const char *p = text;
+
+	while ((p = strchr(p, '"')) != NULL) {
+		p++;
+		if (strncmp(p, key, len) == 0 && p[len] == '"') {
+			p += len + 1;
+			while (*p == ' ')
+				p++;
+			if (*p == ':') {
+				p++;
+				while (*p == ' ')
+					p++;
+				return p;
+			}
+		}
+	}
+	return NULL;
+}
+
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* kernel receive timestamp of a message, or now if there is none */
+static uint64_t rx_time(struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec ts;
+
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+		}
+	}
+	return realtime_ns();
+}
+
+/* room for a burst while the other side of the bridge is being served */
+static void grow_rcvbuf(int skt)
+{
+	int size = 4 << 20;
+
+	if (setsockopt(skt, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+		setsockopt(skt, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static int open_radio(struct radio *r, const struct pktfwd_opts *o)
+{
+	int on = 1;
+
+	if (o->proto != NULL) {
+		struct sockaddr_ll addr;
+
+		r->skt = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, htons(o->proto->eth_p));
+		if (r->skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			return -1;
+		}
+		setsockopt(r->skt, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on));
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(o->proto->eth_p);
+		addr.sll_ifindex = r->e->ifindex;
+		if (bind(r->skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: bind failed: %s\n", r->e->name, strerror(err));
+			return -1;
+		}
+
+		proto_sockaddr_ll(&r->sll, o->proto->eth_p, r->e->ifindex);
+		r->use_sll = 1;
+	} else {
+		struct sockaddr_lora addr;
+
+		r->skt = socket(PF_LORA, SOCK_DGRAM | SOCK_NONBLOCK, 1);
+		if (r->skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			return -1;
+		}
+
+		memset(&addr, 0, sizeof(addr));
+		addr.lora_family = AF_LORA;
+		addr.lora_ifindex = r->e->ifindex;
+		if (bind(r->skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+			int err = errno;
+			fprintf(stderr, "%s: bind failed: %s\n", r->e->name, strerror(err));
+			return -1;
+		}
+	}
+
+	setsockopt(r->skt, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	grow_rcvbuf(r->skt);
+	return 0;
+}
+
+static int open_udp(const char *hostport, int passive)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256], *port;
+	int skt = -1, on = 1, ret;
+
+	snprintf(host, sizeof(host), "%s", hostport);
+	port = strrchr(host, ':');
+	if (port == NULL) {
+		fprintf(stderr, "%s: expected host:port\n", hostport);
+		return -1;
+	}
+	*port++ = '\0';
+	/* [v6 address]:port */
+	if (host[0] == '[' && port - host > 2 && port[-2] == ']') {
+		port[-2] = '\0';
+		memmove(host, host + 1, strlen(host));
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	ret = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &res);
+	if (ret != 0) {
+		fprintf(stderr, "%s: %s\n", hostport, gai_strerror(ret));
+		return -1;
+	}
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		skt = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+		if (skt == -1)
+			continue;
+		if (passive)
+			ret = bind(skt, ai->ai_addr, ai->ai_addrlen);
+		else
+			ret = connect(skt, ai->ai_addr, ai->ai_addrlen);
+		if (ret == 0)
+			break;
+		close(skt);
+		skt = -1;
+	}
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: %s failed: %s\n", hostport, passive ? "bind" : "connect",
+			strerror(err));
+	} else {
+		setsockopt(skt, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+		grow_rcvbuf(skt);
+	}
+	freeaddrinfo(res);
+	return skt;
+}
+
+static void up_close(struct bridge *b)
+{
+	struct iovec *iov = &b->up_iovs[b->up_num - 1];
+
+	b->up_pos = put_str(b->up_pos, "]}");
+	iov->iov_len = b->up_pos - (char *)iov->iov_base;
+}
+
+static void up_begin(struct bridge *b)
+{
+	unsigned char *buf = b->up_bufs + (size_t)b->up_num * b->o->max_dgram;
+	char *p = (char *)buf;
+
+	p = put_header(p, b->token, GWMP_PUSH_DATA);
+	b->token++;
+	memcpy(p, b->o->eui, GWMP_EUI_LEN);
+	p += GWMP_EUI_LEN;
+	b->up_pos = put_str(p, "{\"rxpk\":[");
+
+	b->up_iovs[b->up_num].iov_base = buf;
+	b->up_num++;
+	b->up_entries = 0;
+}
+
+static void up_add(struct bridge *b, struct radio *r, const unsigned char *data,
+	unsigned int len, uint64_t ts)
+{
+	char *p, *end;
+
+	if (b->up_num != 0) {
+		end = (char *)b->up_iovs[b->up_num - 1].iov_base + b->o->max_dgram;
+		/* room for this object and the closing brackets */
+		if (end - b->up_pos < RXPK_MAX + 2) {
+			up_close(b);
+			up_begin(b);
+		}
+	} else {
+		up_begin(b);
+	}
+
+	p = b->up_pos;
+	if (b->up_entries++ != 0)
+		*p++ = ',';
+	p = put_str(p, "{\"tmst\":");
+	p = put_uint(p, (uint32_t)(ts / 1000));
+	p = put_str(p, ",\"chan\":0,\"rfch\":");
+	p = put_uint(p, r->index);
+	p = put_str(p, ",\"freq\":");
+	p = put_mhz(p, r->freq);
+	p = put_str(p, ",\"stat\":1,\"modu\":\"");
+	p = put_str(p, b->modu);
+	p = put_str(p, b->datr_quoted ? "\",\"datr\":\"" : "\",\"datr\":");
+	p = put_str(p, b->datr);
+	p = put_str(p, b->datr_quoted ? "\",\"codr\":\"4/5\"" : "");
+	p = put_str(p, ",\"rssi\":0,\"lsnr\":0,\"size\":");
+	p = put_uint(p, len);
+	p = put_str(p, ",\"data\":\"");
+	p = put_base64(p, data, len);
+	p = put_str(p, "\"}");
+	b->up_pos = p;
+
+	b->up_ts[b->up_pending++] = ts;
+}
+
+static void up_flush(struct bridge *b)
+{
+	unsigned int i, done = 0;
+	uint64_t now, sent;
+	int ret;
+
+	if (b->up_num == 0)
+		return;
+	up_close(b);
+
+	while (done < b->up_num) {
+		ret = sendmmsg(b->udp, b->up_msgs + done, b->up_num - done, 0);
+		if (ret == -1) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			if (err == EAGAIN || err == ENOBUFS) {
+				struct pollfd pfd = { .fd = b->udp, .events = POLLOUT };
+
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			fprintf(stderr, "sendmmsg failed: %s\n", strerror(err));
+			b->up_errors += b->up_num - done;
+			break;
+		}
+		sent = hist_now_ns();
+		for (i = done; i < done + ret; i++)
+			b->push_time[get_token(b->up_iovs[i].iov_base)] = sent;
+		done += ret;
+	}
+	b->up_dgrams += done;
+
+	now = realtime_ns();
+	for (i = 0; i < b->up_pending; i++)
+		hist_add(&b->up_hist, now > b->up_ts[i] ? now - b->up_ts[i] : 0);
+	b->up_pending = 0;
+	b->up_num = 0;
+}
+
+static void rx_radio(struct bridge *b, struct radio *r)
+{
+	unsigned int i;
+	int got;
+
+	for (i = 0; i < b->o->batch; i++) {
+		r->msgs[i].msg_hdr.msg_control = r->cmsgs[i];
+		r->msgs[i].msg_hdr.msg_controllen = sizeof(r->cmsgs[i]);
+	}
+
+	got = recvmmsg(r->skt, r->msgs, b->o->batch, MSG_DONTWAIT, NULL);
+	if (got == -1) {
+		int err = errno;
+
+		if (err != EAGAIN && err != EINTR)
+			fprintf(stderr, "%s: recvmmsg failed: %s\n", r->e->name, strerror(err));
+		return;
+	}
+
+	if (b->up_first == 0)
+		b->up_first = hist_now_ns();
+	b->up_last = hist_now_ns();
+	for (i = 0; i < got; i++)
+		up_add(b, r, r->bufs[i], r->msgs[i].msg_len, rx_time(&r->msgs[i].msg_hdr));
+	r->up += got;
+	b->up_frames += got;
+}
+
+static void send_pull_data(struct bridge *b)
+{
+	unsigned char buf[GWMP_HDR_LEN + GWMP_EUI_LEN];
+
+	put_header((char *)buf, b->token++, GWMP_PULL_DATA);
+	memcpy(buf + GWMP_HDR_LEN, b->o->eui, GWMP_EUI_LEN);
+	if (send(b->udp, buf, sizeof(buf), 0) == -1) {
+		int err = errno;
+		fprintf(stderr, "PULL_DATA failed: %s\n", strerror(err));
+	}
+}
+
+static void queue_tx_ack(struct bridge *b, uint16_t token, const char *error)
+{
+	char *p = (char *)b->ack_bufs[b->ack_num];
+
+	p = put_header(p, token, GWMP_TX_ACK);
+	memcpy(p, b->o->eui, GWMP_EUI_LEN);
+	p += GWMP_EUI_LEN;
+	p = put_str(p, "{\"txpk_ack\":{\"error\":\"");
+	p = put_str(p, error);
+	p = put_str(p, "\"}}");
+	b->ack_iovs[b->ack_num].iov_len = p - (char *)b->ack_bufs[b->ack_num];
+	b->ack_num++;
+}
+
+static void queue_downlink(struct bridge *b, char *text, uint16_t token, uint64_t ts)
+{
+	const char *data, *rfch, *end;
+	struct radio *r;
+	unsigned long idx = 0;
+	int len;
+
+	data = json_find(text, "data");
+	if (json_find(text, "txpk") == NULL || data == NULL || *data != '"') {
+		b->bad_dgrams++;
+		return;
+	}
+	data++;
+	end = strchr(data, '"');
+	rfch = json_find(text, "rfch");
+	if (rfch != NULL)
+		idx = strtoul(rfch, NULL, 10);
+	if (end == NULL || idx >= b->num_radios) {
+		queue_tx_ack(b, token, "TX_FREQ");
+		b->down_errors++;
+		return;
+	}
+
+	r = &b->radios[idx];
+	len = get_base64(data, end - data, r->tx_bufs[r->tx_num], MAX_FRAME);
+	if (len <= 0) {
+		/* the protocol has no code for this, so the server sees ours */
+		queue_tx_ack(b, token, "PAYLOAD");
+		b->down_errors++;
+		return;
+	}
+	r->tx_iovs[r->tx_num].iov_len = len;
+	r->tx_tokens[r->tx_num] = token;
+	r->tx_ts[r->tx_num] = ts;
+	r->tx_num++;
+}
+
+static void tx_radio(struct bridge *b, struct radio *r)
+{
+	unsigned int i, done = 0;
+	uint64_t now;
+	int ret;
+
+	while (done < r->tx_num) {
+		ret = sendmmsg(r->skt, r->tx_msgs + done, r->tx_num - done, 0);
+		if (ret == -1) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			if (err == EAGAIN || err == ENOBUFS) {
+				struct pollfd pfd = { .fd = r->skt, .events = POLLOUT };
+
+				poll(&pfd, 1, 100);
+				continue;
+			}
+			fprintf(stderr, "%s: sendmmsg failed: %s\n", r->e->name, strerror(err));
+			/* GWMP has no better code for a radio that refused the frame */
+			for (i = done; i < r->tx_num; i++)
+				queue_tx_ack(b, r->tx_tokens[i], "COLLISION_PACKET");
+			b->down_errors += r->tx_num - done;
+			break;
+		}
+
+		now = realtime_ns();
+		for (i = done; i < done + ret; i++) {
+			hist_add(&b->down_hist, now > r->tx_ts[i] ? now - r->tx_ts[i] : 0);
+			queue_tx_ack(b, r->tx_tokens[i], "NONE");
+		}
+		done += ret;
+	}
+	r->down += done;
+	b->down_frames += done;
+	r->tx_num = 0;
+}
+
+static void rx_server(struct bridge *b)
+{
+	unsigned int i;
+	uint64_t now;
+	int got, ret;
+
+	for (i = 0; i < b->o->batch; i++) {
+		b->down_msgs[i].msg_hdr.msg_control = b->down_cmsgs[i];
+		b->down_msgs[i].msg_hdr.msg_controllen = sizeof(b->down_cmsgs[i]);
+	}
+
+	got = recvmmsg(b->udp, b->down_msgs, b->o->batch, MSG_DONTWAIT, NULL);
+	if (got == -1) {
+		int err = errno;
+
+		if (err != EAGAIN && err != EINTR)
+			fprintf(stderr, "recvmmsg failed: %s\n", strerror(err));
+		return;
+	}
+
+	now = hist_now_ns();
+	for (i = 0; i < got; i++) {
+		unsigned char *buf = b->down_bufs[i];
+		unsigned int len = b->down_msgs[i].msg_len;
+		uint16_t token = get_token(buf);
+
+		if (len < GWMP_HDR_LEN || buf[0] != GWMP_VERSION) {
+			b->bad_dgrams++;
+			continue;
+		}
+
+		switch (buf[3]) {
+		case GWMP_PUSH_ACK:
+			if (b->push_time[token] != 0) {
+				hist_add(&b->ack_hist, now - b->push_time[token]);
+				b->push_time[token] = 0;
+				b->push_acks++;
+			}
+			break;
+		case GWMP_PULL_ACK:
+			b->pull_acks++;
+			break;
+		case GWMP_PULL_RESP:
+			buf[len] = '\0';
+			if (b->down_first == 0)
+				b->down_first = now;
+			b->down_last = now;
+			queue_downlink(b, (char *)buf + GWMP_HDR_LEN, token,
+				rx_time(&b->down_msgs[i].msg_hdr));
+			break;
+		default:
+			b->bad_dgrams++;
+			break;
+		}
+	}
+
+	for (i = 0; i < b->num_radios; i++) {
+		if (b->radios[i].tx_num != 0)
+			tx_radio(b, &b->radios[i]);
+	}
+
+	if (b->ack_num != 0) {
+		ret = sendmmsg(b->udp, b->ack_msgs, b->ack_num, 0);
+		if (ret == -1) {
+			int err = errno;
+			fprintf(stderr, "TX_ACK failed: %s\n", strerror(err));
+		}
+		b->ack_num = 0;
+	}
+}
+
+static int bridge_init(struct bridge *b, const struct pktfwd_opts *o)
+{
+	unsigned int i, j;
+
+	b->o = o;
+	b->up_max = b->num_radios * o->batch;
+	b->up_bufs = malloc((size_t)b->up_max * o->max_dgram);
+	b->up_msgs = calloc(b->up_max, sizeof(*b->up_msgs));
+	b->up_iovs = calloc(b->up_max, sizeof(*b->up_iovs));
+	b->up_ts = calloc(b->up_max, sizeof(*b->up_ts));
+	b->down_bufs = malloc(BATCH_MAX * sizeof(*b->down_bufs));
+	if (b->up_bufs == NULL || b->up_msgs == NULL || b->up_iovs == NULL ||
+	    b->up_ts == NULL || b->down_bufs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < b->up_max; i++) {
+		b->up_msgs[i].msg_hdr.msg_iov = &b->up_iovs[i];
+		b->up_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	for (i = 0; i < BATCH_MAX; i++) {
+		b->down_iovs[i].iov_base = b->down_bufs[i];
+		/* one byte left to NUL-terminate the JSON */
+		b->down_iovs[i].iov_len = DOWN_BUF_SIZE - 1;
+		b->down_msgs[i].msg_hdr.msg_iov = &b->down_iovs[i];
+		b->down_msgs[i].msg_hdr.msg_iovlen = 1;
+		b->ack_iovs[i].iov_base = b->ack_bufs[i];
+		b->ack_msgs[i].msg_hdr.msg_iov = &b->ack_iovs[i];
+		b->ack_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (j = 0; j < b->num_radios; j++) {
+		struct radio *r = &b->radios[j];
+
+		for (i = 0; i < BATCH_MAX; i++) {
+			r->iovs[i].iov_base = r->bufs[i];
+			r->iovs[i].iov_len = MAX_FRAME;
+			r->msgs[i].msg_hdr.msg_iov = &r->iovs[i];
+			r->msgs[i].msg_hdr.msg_iovlen = 1;
+			r->tx_iovs[i].iov_base = r->tx_bufs[i];
+			r->tx_msgs[i].msg_hdr.msg_iov = &r->tx_iovs[i];
+			r->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+			if (r->use_sll) {
+				r->tx_msgs[i].msg_hdr.msg_name = &r->sll;
+				r->tx_msgs[i].msg_hdr.msg_namelen = sizeof(r->sll);
+			}
+		}
+	}
+
+	if (o->proto != NULL && o->proto->eth_p == ETH_P_FSK) {
+		b->modu = "FSK";
+		b->datr = o->datr != NULL ? o->datr : "50000";
+		b->datr_quoted = 0;
+	} else {
+		b->modu = "LORA";
+		b->datr = o->datr != NULL ? o->datr : "SF7BW125";
+		b->datr_quoted = 1;
+	}
+
+	hist_init(&b->up_hist);
+	hist_init(&b->ack_hist);
+	hist_init(&b->down_hist);
+	return 0;
+}
+
+static double rate(unsigned long n, uint64_t first, uint64_t last)
+{
+	return last > first ? n * 1e9 / (last - first) : 0;
+}
+
+static void bridge_report(const struct bridge *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->num_radios; i++) {
+		const struct radio *r = &b->radios[i];
+		struct tpacket_stats st = { 0 };
+		socklen_t len = sizeof(st);
+
+		if (r->use_sll)
+			getsockopt(r->skt, SOL_PACKET, PACKET_STATISTICS, &st, &len);
+		printf("%s: %lu up, %u dropped, %lu down\n", r->e->name, r->up,
+			st.tp_drops, r->down);
+	}
+	printf("uplink: %lu frames in %lu PUSH_DATA, %.0f frames/s, %lu acked, %lu send errors\n",
+		b->up_frames, b->up_dgrams, rate(b->up_frames, b->up_first, b->up_last),
+		b->push_acks, b->up_errors);
+	printf("downlink: %lu frames, %.0f frames/s, %lu errors, %lu PULL_ACK, %lu bad datagrams\n",
+		b->down_frames, rate(b->down_frames, b->down_first, b->down_last),
+		b->down_errors, b->pull_acks, b->bad_dgrams);
+	hist_print("radio>udp", &b->up_hist);
+	hist_print("push_ack", &b->ack_hist);
+	hist_print("udp>radio", &b->down_hist);
+}
+
+static int run_bridge(struct bridge *b)
+{
+	struct pollfd pfds[MAX_RADIOS + 1];
+	uint64_t now, next_pull = 0, done_at = 0;
+	unsigned int i, n = b->num_radios;
+	int timeout;
+
+	for (i = 0; i < n; i++) {
+		pfds[i].fd = b->radios[i].skt;
+		pfds[i].events = POLLIN;
+	}
+	pfds[n].fd = b->udp;
+	pfds[n].events = POLLIN;
+
+	while (!stop) {
+		now = hist_now_ns();
+		if (now >= next_pull) {
+			send_pull_data(b);
+			next_pull = now + b->o->keepalive * 1000000000ull;
+		}
+		/* give the acks and downlinks of the last frames a second */
+		if (b->o->count != 0 && b->up_frames >= b->o->count && done_at == 0)
+			done_at = now + 1000000000ull;
+		if (done_at != 0 && now >= done_at)
+			break;
+
+		timeout = (next_pull - now) / 1000000 + 1;
+		if (done_at != 0 && (int)((done_at - now) / 1000000 + 1) < timeout)
+			timeout = (done_at - now) / 1000000 + 1;
+
+		if (poll(pfds, n + 1, timeout) == -1) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(err));
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (pfds[i].revents & POLLIN)
+				rx_radio(b, &b->radios[i]);
+		}
+		up_flush(b);
+		if (pfds[n].revents & POLLIN)
+			rx_server(b);
+	}
+
+	bridge_report(b);
+	return 0;
+}
+
+static void server_flush(struct server *s)
+{
+	int ret;
+
+	if (s->reply_num == 0)
+		return;
+	ret = sendmmsg(s->udp, s->reply_msgs, s->reply_num, 0);
+	if (ret == -1) {
+		int err = errno;
+		fprintf(stderr, "sendmmsg failed: %s\n", strerror(err));
+	}
+	s->reply_num = 0;
+}
+
+static struct server_reply *server_reply(struct server *s, const struct sockaddr_storage *addr,
+	socklen_t addrlen)
+{
+	struct server_reply *r;
+
+	if (s->reply_num == SERVER_REPLIES)
+		server_flush(s);
+	r = &s->replies[s->reply_num];
+	memcpy(&r->addr, addr, addrlen);
+	s->reply_msgs[s->reply_num].msg_hdr.msg_namelen = addrlen;
+	s->reply_num++;
+	return r;
+}
+
+static void server_ack(struct server *s, const struct sockaddr_storage *addr,
+	socklen_t addrlen, uint16_t token, int type)
+{
+	struct server_reply *r = server_reply(s, addr, addrlen);
+
+	put_header((char *)r->buf, token, type);
+	s->reply_iovs[s->reply_num - 1].iov_len = GWMP_HDR_LEN;
+}
+
+/* answer a LoRaWAN uplink with an unconfirmed downlink on the same radio */
+static void server_echo(struct server *s, unsigned long rfch, unsigned char *frame,
+	unsigned int len)
+{
+	struct server_reply *r;
+	unsigned int mtype = frame[0] >> 5;
+	char *p;
+
+	if ((mtype != 2 && mtype != 4) || s->pull_addrlen == 0)
+		return;
+	frame[0] = (frame[0] & 0x1f) | 3 << 5;
+
+	r = server_reply(s, &s->pull_addr, s->pull_addrlen);
+	p = put_header((char *)r->buf, s->token++, GWMP_PULL_RESP);
+	p = put_str(p, "{\"txpk\":{\"imme\":true,\"rfch\":");
+	p = put_uint(p, rfch);
+	p = put_str(p, ",\"freq\":869.525000,\"powe\":14,\"modu\":\"LORA\","
+		"\"datr\":\"SF9BW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":");
+	p = put_uint(p, len);
+	p = put_str(p, ",\"data\":\"");
+	p = put_base64(p, frame, len);
+	p = put_str(p, "\"}}");
+	s->reply_iovs[s->reply_num - 1].iov_len = p - (char *)r->buf;
+	s->pull_resp++;
+}
+
+static void server_push_data(struct server *s, char *text)
+{
+	unsigned char frame[MAX_FRAME];
+	const char *p = text, *data, *end;
+	unsigned long rfch;
+	char *next;
+	int len;
+
+	/* the rxpk objects as the bridge writes them, rfch ahead of data */
+	while ((p = json_find(p, "rfch")) != NULL) {
+		rfch = strtoul(p, &next, 10);
+		data = json_find(next, "data");
+		if (data == NULL || *data != '"')
+			break;
+		data++;
+		end = strchr(data, '"');
+		if (end == NULL)
+			break;
+		s->rxpk++;
+		if (s->o->echo) {
+			len = get_base64(data, end - data, frame, sizeof(frame));
+			if (len > 0)
+				server_echo(s, rfch, frame, len);
+		}
+		p = end;
+	}
+}
+
+static int run_server(struct server *s)
+{
+	struct pollfd pfd = { .fd = s->udp, .events = POLLIN };
+	unsigned int i;
+	int got;
+
+	while (!stop) {
+		if (poll(&pfd, 1, -1) == -1) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(err));
+			return -1;
+		}
+
+		for (i = 0; i < s->o->batch; i++)
+			s->msgs[i].msg_hdr.msg_namelen = sizeof(s->addrs[i]);
+		got = recvmmsg(s->udp, s->msgs, s->o->batch, MSG_DONTWAIT, NULL);
+		if (got == -1)
+			continue;
+
+		for (i = 0; i < got; i++) {
+			unsigned char *buf = s->bufs[i];
+			unsigned int len = s->msgs[i].msg_len;
+			socklen_t addrlen = s->msgs[i].msg_hdr.msg_namelen;
+
+			if (len < GWMP_HDR_LEN || buf[0] != GWMP_VERSION) {
+				s->bad_dgrams++;
+				continue;
+			}
+			buf[len] = '\0';
+
+			switch (buf[3]) {
+			case GWMP_PUSH_DATA:
+				s->push_data++;
+				server_ack(s, &s->addrs[i], addrlen, get_token(buf), GWMP_PUSH_ACK);
+				if (len > GWMP_HDR_LEN + GWMP_EUI_LEN)
+					server_push_data(s, (char *)buf + GWMP_HDR_LEN + GWMP_EUI_LEN);
+				break;
+			case GWMP_PULL_DATA:
+				s->pull_data++;
+				memcpy(&s->pull_addr, &s->addrs[i], addrlen);
+				s->pull_addrlen = addrlen;
+				server_ack(s, &s->addrs[i], addrlen, get_token(buf), GWMP_PULL_ACK);
+				break;
+			case GWMP_TX_ACK:
+				s->tx_acks++;
+				break;
+			default:
+				s->bad_dgrams++;
+				break;
+			}
+		}
+		server_flush(s);
+	}
+
+	printf("%lu PUSH_DATA with %lu rxpk, %lu PULL_DATA, %lu PULL_RESP, %lu TX_ACK, %lu bad datagrams\n",
+		s->push_data, s->rxpk, s->pull_data, s->pull_resp, s->tx_acks, s->bad_dgrams);
+	return 0;
+}
+
+static int server_init(struct server *s, const struct pktfwd_opts *o)
+{
+	unsigned int i;
+
+	s->o = o;
+	s->bufs = malloc(BATCH_MAX * sizeof(*s->bufs));
+	s->replies = calloc(SERVER_REPLIES, sizeof(*s->replies));
+	if (s->bufs == NULL || s->replies == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	for (i = 0; i < BATCH_MAX; i++) {
+		s->iovs[i].iov_base = s->bufs[i];
+		s->iovs[i].iov_len = DGRAM_MAX;
+		s->msgs[i].msg_hdr.msg_iov = &s->iovs[i];
+		s->msgs[i].msg_hdr.msg_iovlen = 1;
+		s->msgs[i].msg_hdr.msg_name = &s->addrs[i];
+	}
+	for (i = 0; i < SERVER_REPLIES; i++) {
+		s->reply_iovs[i].iov_base = s->replies[i].buf;
+		s->reply_msgs[i].msg_hdr.msg_iov = &s->reply_iovs[i];
+		s->reply_msgs[i].msg_hdr.msg_iovlen = 1;
+		s->reply_msgs[i].msg_hdr.msg_name = &s->replies[i].addr;
+	}
+	return 0;
+}
+
+static int parse_eui(const char *s, unsigned char *eui)
+{
+	unsigned int i;
+
+	if (strlen(s) != 2 * GWMP_EUI_LEN)
+		return -1;
+	for (i = 0; i < GWMP_EUI_LEN; i++) {
+		if (sscanf(s + 2 * i, "%2hhx", &eui[i]) != 1)
+			return -1;
+	}
+	return 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s host:port] [-g eui] [-b batch] [-M max-datagram] [-k keepalive]\n"
+		"       [-n count] [-D datr] [-p proto] ifname[@freq]...\n"
+		"       %s -S [host]:port [-e] [-b batch]\n",
+		argv0, argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct pktfwd_opts o = {
+		.server = "127.0.0.1:1700",
+		.eui = { 0xaa, 0x55, 0x5a, 0x00, 0x00, 0x00, 0x00, 0x01 },
+		.batch = 32,
+		.max_dgram = 4096,
+		.keepalive = 10,
+	};
+	struct sigaction sa;
+	struct ifcache ifc;
+	struct bridge *b;
+	unsigned int i;
+	char *endptr;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:g:b:M:k:n:D:p:S:e")) != -1) {
+		switch (opt) {
+		case 's':
+			o.server = optarg;
+			break;
+		case 'g':
+			if (parse_eui(optarg, o.eui) < 0)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0 || o.batch > BATCH_MAX)
+				return usage(argv[0]);
+			break;
+		case 'M':
+			o.max_dgram = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.max_dgram < DGRAM_MIN || o.max_dgram > DGRAM_MAX)
+				return usage(argv[0]);
+			break;
+		case 'k':
+			o.keepalive = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.keepalive == 0)
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'D':
+			o.datr = optarg;
+			if (strlen(o.datr) > DATR_MAX)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.proto = proto_find(optarg);
+			if (o.proto == NULL)
+				return usage(argv[0]);
+			break;
+		case 'S':
+			o.serve_port = optarg;
+			break;
+		case 'e':
+			o.echo = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	b64_init();
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (o.serve_port != NULL) {
+		struct server s;
+
+		if (optind != argc)
+			return usage(argv[0]);
+		memset(&s, 0, sizeof(s));
+		if (server_init(&s, &o) == 0) {
+			s.udp = open_udp(o.serve_port, 1);
+			if (s.udp != -1) {
+				ret = run_server(&s) < 0;
+				close(s.udp);
+			}
+		}
+		free(s.bufs);
+		free(s.replies);
+		return ret;
+	}
+
+	if (optind == argc || argc - optind > MAX_RADIOS)
+		return usage(argv[0]);
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+
+	b = calloc(1, sizeof(*b));
+	if (b != NULL) {
+		b->udp = -1;
+		b->radios = calloc(argc - optind, sizeof(*b->radios));
+	}
+	if (b == NULL || b->radios == NULL) {
+		fprintf(stderr, "out of memory\n");
+		goto out;
+	}
+
+	for (; optind < argc; optind++) {
+		struct radio *r = &b->radios[b->num_radios];
+		char *name = argv[optind];
+		char *at = strchr(name, '@');
+
+		r->skt = -1;
+		r->index = b->num_radios++;
+		r->freq = 868100000;
+		if (at != NULL) {
+			*at = '\0';
+			r->freq = strtoul(at + 1, &endptr, 0);
+			if (*endptr != '\0' || r->freq == 0) {
+				ret = usage(argv[0]);
+				goto out;
+			}
+		}
+		r->e = ifcache_find_name(&ifc, name);
+		if (r->e == NULL) {
+			fprintf(stderr, "%s: no such device\n", name);
+			goto out;
+		}
+		if (open_radio(r, &o) < 0)
+			goto out;
+	}
+
+	if (bridge_init(b, &o) < 0)
+		goto out;
+	b->udp = open_udp(o.server, 0);
+	if (b->udp == -1)
+		goto out;
+
+	ret = run_bridge(b) < 0;
+
+out:
+	if (b != NULL) {
+		for (i = 0; b->radios != NULL && i < b->num_radios; i++) {
+			if (b->radios[i].skt != -1)
+				close(b->radios[i].skt);
+		}
+		if (b->udp != -1)
+			close(b->udp);
+		free(b->up_bufs);
+		free(b->up_msgs);
+		free(b->up_iovs);
+		free(b->up_ts);
+		free(b->down_bufs);
+		free(b->radios);
+		free(b);
+	}
+	ifcache_free(&ifc);
+	return ret;
+}
@@ -0,0 +1,724 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/socket.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "erp2.h"
+#include "hist.h"
+#include "ifcache.h"
+#include "lorawan.h"
+#include "proto.h"
+#include "simdev.h"
+#include "include/linux/lora.h"
+#include "include/linux/enocean.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+/*
+ * Generates the uplinks of a population of virtual end devices, to find
+ * out how many devices a gateway can take. Every device has its own mean
+ * period, spread by -v around -i. Its uplinks either arrive as a Poisson
+ * process, with exponential gaps, or periodically with -j jitter. The
+ * first uplink comes at a random point within the first period, so the
+ * devices do not all fire at once.
+ *
+ * Devices wait in a hierarchical timer wheel of 256 slots per level. A
+ * slot at level n spans 256^n ticks. Adding a device and taking it out
+ * when it is due cost O(1), and a device moves down a level at most
+ * three times while it waits. So a million devices cost about as much
+ * per uplink as a thousand do.
+ *
+ * Due uplinks join a queue per interface and leave in sendmmsg batches
+ * while the socket takes them. Once a queue is full, new uplinks are
+ * dropped, as a gateway with a full TX path would drop them.
+ *
+ * -p lorawan frames use sessbench's DevAddrs and keys, so a session table
+ * filled by sessbench -n accepts them. ERP2 telegrams are 4BS from
+ * 0x01800000 plus the device number. -x runs the scheduler against a
+ * simulated clock and no sockets, which measures its cost per uplink.
+ */
+
+#define MAX_DEVICES	(1u << 24)
+#define MAX_BATCH	64
+#define MAX_QUEUE	65536
+#define MAX_FRAME	LORAWAN_PHY_MAX
+#define ERP2_ID_BASE	0x01800000
+
+#define WHEEL_BITS	8
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_NIL	UINT32_MAX
+/* short of a full turn of the top level, so a slot is never the current one */
+#define WHEEL_REACH	((1ull << (WHEEL_BITS * WHEEL_LEVELS)) - \
+			 (1ull << (WHEEL_BITS * (WHEEL_LEVELS - 1))))
+
+enum {
+	ARRIVAL_POISSON,
+	ARRIVAL_PERIODIC,
+};
+
+enum {
+	PAYLOAD_RAW,
+	PAYLOAD_LORAWAN,
+	PAYLOAD_ERP2,
+};
+
+/* what the wheel links through sits next to the rest, one cache miss per uplink */
+struct device {
+	uint64_t due;
+	uint32_t next;
+	/* mean gap between uplinks in ticks */
+	uint32_t period;
+	uint32_t seq;
+};
+
+struct wheel {
+	uint32_t head[WHEEL_LEVELS][WHEEL_SIZE];
+	struct device *devs;
+	uint64_t now;
+};
+
+struct pending {
+	uint32_t dev;
+	uint32_t seq;
+	uint64_t tick;
+};
+
+struct gen_if {
+	const struct ifcache_entry *e;
+	int skt;
+	struct pending *queue;
+	unsigned int head, len;
+	unsigned int max_len;
+	unsigned long offered;
+	unsigned long dropped;
+	unsigned long sent;
+	unsigned long bytes;
+	unsigned long eagain;
+	unsigned long enobufs;
+	unsigned long errors;
+	/* time spent sending from enqueue(), kept out of the scheduler's */
+	uint64_t forced_ns;
+	struct hist delay;
+	unsigned char frames[MAX_BATCH][MAX_FRAME];
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iovs[MAX_BATCH];
+};
+
+struct gen_opts {
+	unsigned int devices;
+	double period;
+	unsigned int spread;
+	int arrival;
+	unsigned int jitter;
+	const struct proto *proto;
+	int payload;
+	unsigned int size;
+	unsigned int queue;
+	unsigned int batch;
+	unsigned int duration;
+	uint64_t tick;
+	int simulate;
+};
+
+static volatile sig_atomic_t stop;
+static uint64_t rng_state = 0x2545f4914f6cdd1dull;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint64_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 7;
+	rng_state ^= rng_state << 17;
+	return rng_state;
+}
+
+/* uniform in (0, 1] */
+static double rng_unit(void)
+{
+	return ((rng() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static void wheel_init(struct wheel *w, struct device *devs)
+{
+	memset(w->head, 0xff, sizeof(w->head));
+	w->devs = devs;
+	w->now = 0;
+}
+
+/* due must not be in the past */
+static void wheel_add(struct wheel *w, uint32_t dev, uint64_t due)
+{
+	uint64_t delta = due - w->now;
+	unsigned int level = 0;
+	uint32_t *slot;
+
+	/* further out than the wheel reaches waits as far out as it can */
+	w->devs[dev].due = due;
+	if (delta >= WHEEL_REACH) {
+		delta = WHEEL_REACH - 1;
+		due = w->now + delta;
+	}
+	while (delta >> (WHEEL_BITS * (level + 1)))
+		level++;
+	slot = &w->head[level][(due >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	w->devs[dev].next = *slot;
+	*slot = dev;
+}
+
+/* moves the devices of a slot to the levels below now that it is current */
+static void wheel_cascade(struct wheel *w, unsigned int level)
+{
+	uint32_t *slot = &w->head[level][(w->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	uint32_t dev = *slot;
+
+	*slot = WHEEL_NIL;
+	while (dev != WHEEL_NIL) {
+		uint32_t next = w->devs[dev].next;
+
+		wheel_add(w, dev, w->devs[dev].due);
+		dev = next;
+	}
+}
+
+/* takes the devices due at the current tick off the wheel */
+static uint32_t wheel_expire(struct wheel *w)
+{
+	unsigned int level;
+	uint32_t *slot, list;
+
+	for (level = 1; level < WHEEL_LEVELS; level++) {
+		if ((w->now >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+			break;
+		wheel_cascade(w, level);
+	}
+	slot = &w->head[0][w->now & WHEEL_MASK];
+	list = *slot;
+	*slot = WHEEL_NIL;
+	return list;
+}
+
+static uint64_t next_gap(const struct device *d, const struct gen_opts *o)
+{
+	double gap;
+
+	if (o->arrival == ARRIVAL_POISSON)
+		gap = -log(rng_unit()) * d->period;
+	else
+		gap = d->period * (1.0 + o->jitter / 100.0 * (2 * rng_unit() - 1));
+	return gap < 1 ? 1 : (uint64_t)gap;
+}
+
+static int open_one(struct gen_if *g, const struct gen_opts *o)
+{
+	int ret;
+
+	if (o->proto->eth_p == ETH_P_LORA || o->proto->eth_p == ETH_P_LORAWAN) {
+		struct sockaddr_lora addr;
+
+		g->skt = socket(PF_LORA, SOCK_DGRAM | SOCK_NONBLOCK, 1);
+		if (g->skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			return -1;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.lora_family = AF_LORA;
+		addr.lora_ifindex = g->e->ifindex;
+		ret = bind(g->skt, (struct sockaddr *)&addr, sizeof(addr));
+	} else {
+		struct sockaddr_ll addr;
+
+		g->skt = socket(PF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, htons(o->proto->eth_p));
+		if (g->skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			return -1;
+		}
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(o->proto->eth_p);
+		addr.sll_ifindex = g->e->ifindex;
+		ret = bind(g->skt, (struct sockaddr *)&addr, sizeof(addr));
+	}
+	if (ret == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: bind failed: %s\n", g->e->name, strerror(err));
+		close(g->skt);
+		g->skt = -1;
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned int build_frame(unsigned char *buf, const struct pending *p,
+	const struct gen_opts *o)
+{
+	uint8_t payload[MAX_FRAME];
+	unsigned int i;
+
+	for (i = 0; i < o->size; i++)
+		payload[i] = 0x42 + i;
+	/* which device and which of its uplinks, for whoever receives it */
+	for (i = 0; i < 4 && i < o->size; i++)
+		payload[i] = p->dev >> (24 - 8 * i);
+	for (i = 4; i < 8 && i < o->size; i++)
+		payload[i] = p->seq >> (56 - 8 * i);
+
+	if (o->payload == PAYLOAD_LORAWAN) {
+		struct lorawan_frame f = {
+			.mtype = LORAWAN_UNCONFIRMED_UP,
+			.devaddr = simdev_addr(p->dev),
+			.fport = 1,
+			.payload = payload,
+			.payload_len = o->size,
+		};
+		struct lorawan_key nwk, app;
+		uint8_t raw[16];
+
+		simdev_key(p->dev, 0, raw);
+		lorawan_key_init(&nwk, raw);
+		simdev_key(p->dev, 1, raw);
+		lorawan_key_init(&app, raw);
+		return lorawan_build(buf, MAX_FRAME, &f, p->seq, &nwk, &app);
+	}
+	if (o->payload == PAYLOAD_ERP2) {
+		const uint8_t data[4] = { p->seq >> 16, p->seq >> 8, p->seq, 0x08 };
+		struct erp2_telegram t = {
+			.addr = ERP2_ADDR_ID32,
+			.type = ERP2_TYPE_4BS,
+			.id = ERP2_ID_BASE + p->dev,
+			.data = data,
+			.data_len = sizeof(data),
+		};
+
+		return erp2_build(buf, MAX_FRAME, &t);
+	}
+	memcpy(buf, payload, o->size);
+	return o->size;
+}
+
+/* sends what the socket takes; returns -1 once it stops taking frames */
+static int flush(struct gen_if *g, const struct gen_opts *o, uint64_t start)
+{
+	while (g->len > 0) {
+		unsigned int i, n = g->len < o->batch ? g->len : o->batch;
+		uint64_t now;
+		int ret;
+
+		for (i = 0; i < n; i++) {
+			const struct pending *p = &g->queue[(g->head + i) % o->queue];
+
+			g->iovs[i].iov_base = g->frames[i];
+			g->iovs[i].iov_len = build_frame(g->frames[i], p, o);
+			memset(&g->msgs[i].msg_hdr, 0, sizeof(g->msgs[i].msg_hdr));
+			g->msgs[i].msg_hdr.msg_iov = &g->iovs[i];
+			g->msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		if (o->simulate) {
+			ret = n;
+			for (i = 0; i < n; i++)
+				g->msgs[i].msg_len = g->iovs[i].iov_len;
+			now = start + g->queue[g->head].tick * o->tick;
+		} else {
+			ret = sendmmsg(g->skt, g->msgs, n, 0);
+			now = hist_now_ns();
+		}
+		if (ret == -1) {
+			int err = errno;
+
+			if (err == EAGAIN)
+				g->eagain++;
+			else if (err == ENOBUFS)
+				g->enobufs++;
+			else if (err != EINTR && g->errors++ == 0)
+				fprintf(stderr, "%s: sendmmsg failed: %s\n", g->e->name, strerror(err));
+			return -1;
+		}
+
+		for (i = 0; i < (unsigned int)ret; i++) {
+			const struct pending *p = &g->queue[(g->head + i) % o->queue];
+			uint64_t due = start + p->tick * o->tick;
+
+			g->bytes += g->msgs[i].msg_len;
+			hist_add(&g->delay, now > due ? now - due : 0);
+		}
+		g->sent += ret;
+		g->head = (g->head + ret) % o->queue;
+		g->len -= ret;
+	}
+	return 0;
+}
+
+/* a full queue only drops once the socket has refused to take more */
+static void enqueue(struct gen_if *g, const struct gen_opts *o, uint32_t dev,
+	uint32_t seq, uint64_t tick, uint64_t start)
+{
+	struct pending *p;
+
+	g->offered++;
+	if (g->len == o->queue) {
+		uint64_t t0 = hist_now_ns();
+
+		flush(g, o, start);
+		g->forced_ns += hist_now_ns() - t0;
+	}
+	if (g->len == o->queue) {
+		g->dropped++;
+		return;
+	}
+	p = &g->queue[(g->head + g->len) % o->queue];
+	p->dev = dev;
+	p->seq = seq;
+	p->tick = tick;
+	if (++g->len > g->max_len)
+		g->max_len = g->len;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop)
+		;
+}
+
+static void report(const char *name, const struct gen_if *g, uint64_t ns)
+{
+	double secs = ns / 1e9;
+
+	printf("%s: %lu offered, %lu sent, %lu dropped (%.2f%%), %lu bytes, %.1f frames/s, "
+		"queue up to %u, %lu EAGAIN, %lu ENOBUFS, %lu errors\n",
+		name, g->offered, g->sent, g->dropped,
+		g->offered ? 100.0 * g->dropped / g->offered : 0.0, g->bytes,
+		secs > 0 ? g->sent / secs : 0.0, g->max_len, g->eagain, g->enobufs, g->errors);
+}
+
+static int run(struct gen_if *gs, unsigned int num_gs, struct device *devs,
+	const struct gen_opts *o)
+{
+	uint64_t end_tick = o->duration * 1000000000ull / o->tick;
+	uint64_t start = hist_now_ns(), sched_ns = 0, events = 0, max_lag = 0, next_print;
+	unsigned long last_sent = 0, last_dropped = 0;
+	struct wheel w;
+	struct gen_if total;
+	double rate = 0;
+	unsigned int i;
+
+	wheel_init(&w, devs);
+	/* Poisson devices are already mid-stream, periodic ones start within a period */
+	for (i = 0; i < o->devices; i++) {
+		wheel_add(&w, i, o->arrival == ARRIVAL_POISSON ? next_gap(&devs[i], o) - 1 :
+			rng() % devs[i].period);
+		rate += 1e9 / ((double)devs[i].period * o->tick);
+	}
+	printf("%u devices, %.1f uplinks/s offered on average\n", o->devices, rate);
+
+	next_print = 1000000000ull / o->tick;
+	for (; w.now < end_tick && !stop; w.now++) {
+		uint64_t t0, target = w.now;
+		uint32_t dev;
+
+		if (!o->simulate) {
+			target = (hist_now_ns() - start) / o->tick;
+			if (target < w.now)
+				sleep_until(start + w.now * o->tick);
+		}
+
+		t0 = hist_now_ns();
+		dev = wheel_expire(&w);
+		/* idle ticks only count when they move devices between levels */
+		if (dev == WHEEL_NIL && (w.now & WHEEL_MASK) != 0)
+			t0 = 0;
+		for (; dev != WHEEL_NIL; ) {
+			uint32_t next = devs[dev].next;
+			struct device *d = &devs[dev];
+
+			enqueue(&gs[dev % num_gs], o, dev, d->seq++, w.now, start);
+			wheel_add(&w, dev, w.now + next_gap(d, o));
+			events++;
+			dev = next;
+		}
+		if (t0 != 0)
+			sched_ns += hist_now_ns() - t0;
+
+		/* how far behind the clock this generator itself is */
+		if (target > w.now && target - w.now > max_lag)
+			max_lag = target - w.now;
+		for (i = 0; i < num_gs; i++)
+			flush(&gs[i], o, start);
+
+		if (!o->simulate && w.now >= next_print) {
+			unsigned long sent = 0, dropped = 0, queued = 0;
+
+			for (i = 0; i < num_gs; i++) {
+				sent += gs[i].sent;
+				dropped += gs[i].dropped;
+				queued += gs[i].len;
+			}
+			printf("%llu s: %lu sent, %lu dropped, %lu queued\n",
+				(unsigned long long)(w.now * o->tick / 1000000000ull),
+				sent - last_sent, dropped - last_dropped, queued);
+			last_sent = sent;
+			last_dropped = dropped;
+			next_print += 1000000000ull / o->tick;
+		}
+	}
+	for (i = 0; i < num_gs; i++)
+		sched_ns -= gs[i].forced_ns;
+	start = hist_now_ns() - start;
+	if (o->simulate)
+		start = w.now * o->tick;
+
+	memset(&total, 0, sizeof(total));
+	hist_init(&total.delay);
+	for (i = 0; i < num_gs; i++) {
+		struct gen_if *g = &gs[i];
+
+		report(o->simulate ? "simulated" : g->e->name, g, start);
+		hist_merge(&total.delay, &g->delay);
+		total.offered += g->offered;
+		total.dropped += g->dropped;
+		total.sent += g->sent;
+		total.bytes += g->bytes;
+		total.eagain += g->eagain;
+		total.enobufs += g->enobufs;
+		total.errors += g->errors;
+		if (g->max_len > total.max_len)
+			total.max_len = g->max_len;
+	}
+	if (num_gs > 1)
+		report("total", &total, start);
+	hist_print("queued", &total.delay);
+	printf("scheduler: %llu uplinks in %.3f s, %.1f ns each, up to %.3f ms behind\n",
+		(unsigned long long)events, sched_ns / 1e9, events ? (double)sched_ns / events : 0.0,
+		max_lag * o->tick / 1e6);
+
+	return total.errors ? 1 : 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-N devices] [-i period-s] [-v spread-%%] [-a poisson|periodic] [-j jitter-%%]\n"
+		"       [-p proto] [-s size] [-q queue] [-b batch] [-t seconds] [-T tick-us] [-x]\n"
+		"       [ifname|pattern ...]\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct gen_opts o = {
+		.devices = 1000,
+		.period = 60,
+		.spread = 20,
+		.arrival = ARRIVAL_POISSON,
+		.jitter = 10,
+		.size = 16,
+		.queue = 256,
+		.batch = 16,
+		.duration = 60,
+		.tick = 1000000,
+	};
+	const struct ifcache_entry *e;
+	struct ifcache ifc;
+	struct device *devs;
+	struct gen_if *gs;
+	struct sigaction sa;
+	unsigned int i, num_gs = 0;
+	char *endptr;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "N:i:v:a:j:p:s:q:b:t:T:x")) != -1) {
+		switch (opt) {
+		case 'N':
+			o.devices = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.devices == 0 || o.devices > MAX_DEVICES)
+				return usage(argv[0]);
+			break;
+		case 'i':
+			o.period = strtod(optarg, &endptr);
+			if (*endptr != '\0' || o.period <= 0)
+				return usage(argv[0]);
+			break;
+		case 'v':
+			o.spread = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.spread >= 100)
+				return usage(argv[0]);
+			break;
+		case 'a':
+			if (strcmp(optarg, "poisson") == 0)
+				o.arrival = ARRIVAL_POISSON;
+			else if (strcmp(optarg, "periodic") == 0)
+				o.arrival = ARRIVAL_PERIODIC;
+			else
+				return usage(argv[0]);
+			break;
+		case 'j':
+			o.jitter = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.jitter >= 100)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.proto = proto_find(optarg);
+			if (o.proto == NULL)
+				return usage(argv[0]);
+			break;
+		case 's':
+			o.size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.size == 0 || o.size > MAX_FRAME - LORAWAN_DATA_MIN - 1)
+				return usage(argv[0]);
+			break;
+		case 'q':
+			o.queue = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.queue == 0 || o.queue > MAX_QUEUE)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0 || o.batch > MAX_BATCH)
+				return usage(argv[0]);
+			break;
+		case 't':
+			o.duration = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.duration == 0)
+				return usage(argv[0]);
+			break;
+		case 'T':
+			o.tick = strtoull(optarg, &endptr, 0) * 1000;
+			if (*endptr != '\0' || o.tick == 0)
+				return usage(argv[0]);
+			break;
+		case 'x':
+			o.simulate = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (o.proto == NULL)
+		o.proto = proto_find("lora");
+	if (o.proto->eth_p == ETH_P_LORAWAN)
+		o.payload = PAYLOAD_LORAWAN;
+	else if (o.proto->eth_p == ETH_P_ERP2)
+		o.payload = PAYLOAD_ERP2;
+
+	devs = calloc(o.devices, sizeof(*devs));
+	if (devs == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < o.devices; i++) {
+		double p = o.period * 1e9 / o.tick;
+
+		p *= 1.0 + o.spread / 100.0 * (2 * rng_unit() - 1);
+		devs[i].period = p < 1 ? 1 : p > UINT32_MAX ? UINT32_MAX : p;
+	}
+
+	memset(&ifc, 0, sizeof(ifc));
+	if (o.simulate) {
+		gs = calloc(1, sizeof(*gs));
+		if (gs == NULL)
+			goto out;
+		num_gs = 1;
+	} else {
+		if (ifcache_load(&ifc) < 0)
+			goto out;
+		gs = calloc(ifc.num + 1, sizeof(*gs));
+		if (gs == NULL)
+			goto out;
+		if (optind == argc) {
+			static char *def_lora[] = { "lora0" }, *def_erp2[] = { "enocean0" };
+
+			argv = o.payload == PAYLOAD_ERP2 ? def_erp2 : def_lora;
+			argc = 1;
+			optind = 0;
+		}
+		for (; optind < argc; optind++) {
+			/* patterns only pick interfaces of the radio the protocol needs */
+			int type = !ifcache_is_pattern(argv[optind]) ? -1 :
+				o.payload == PAYLOAD_ERP2 ? ARPHRD_ENOCEAN : ARPHRD_LORA;
+			int found = 0;
+
+			for (e = ifcache_next(&ifc, NULL, argv[optind], type); e != NULL;
+			     e = ifcache_next(&ifc, e, argv[optind], type)) {
+				found = 1;
+				/* the same interface named twice gets one socket */
+				for (i = 0; i < num_gs; i++) {
+					if (gs[i].e == e)
+						break;
+				}
+				if (i < num_gs)
+					continue;
+				if (num_gs == ifc.num) {
+					fprintf(stderr, "too many interfaces\n");
+					goto out_close;
+				}
+				gs[num_gs].e = e;
+				if (open_one(&gs[num_gs], &o) < 0)
+					goto out_close;
+				num_gs++;
+			}
+			if (!found) {
+				fprintf(stderr, "%s: no such device\n", argv[optind]);
+				goto out_close;
+			}
+		}
+	}
+	for (i = 0; i < num_gs; i++) {
+		hist_init(&gs[i].delay);
+		gs[i].queue = calloc(o.queue, sizeof(*gs[i].queue));
+		if (gs[i].queue == NULL) {
+			fprintf(stderr, "out of memory\n");
+			goto out_close;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	ret = run(gs, num_gs, devs, &o);
+
+out_close:
+	for (i = 0; i < num_gs; i++) {
+		if (!o.simulate)
+			close(gs[i].skt);
+		free(gs[i].queue);
+	}
+	free(gs);
+out:
+	free(devs);
+	ifcache_free(&ifc);
+	return ret;
+}
@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+
+#include "proto.h"
+#include "include/linux/lora.h"
+#include "include/linux/enocean.h"
+
+const struct proto protos[] = {
+	{ "lora",	ETH_P_LORA },
+	{ "lorawan",	ETH_P_LORAWAN },
+	{ "fsk",	ETH_P_FSK },
+	{ "flrc",	ETH_P_FLRC },
+	{ "ook",	ETH_P_OOK },
+	{ "erp2",	ETH_P_ERP2 },
+};
+
+const unsigned int num_protos = sizeof(protos) / sizeof(protos[0]);
+
+_Static_assert(sizeof(protos) / sizeof(protos[0]) <= PROTO_MAX, "PROTO_MAX too small");
+
+const struct proto *proto_find(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_protos; i++) {
+		if (strcmp(protos[i].name, name) == 0)
+			return &protos[i];
+	}
+	return NULL;
+}
+
+int proto_parse_list(char *list, const struct proto **sel)
+{
+	char *tok, *save;
+	int num = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok != NULL;
+	     tok = strtok_r(NULL, ",", &save)) {
+		const struct proto *p = proto_find(tok);
+
+		if (p == NULL || num == (int)num_protos)
+			return -1;
+		sel[num++] = p;
+	}
+	return num;
+}
+
+int proto_all(const struct proto **sel)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_protos; i++)
+		sel[i] = &protos[i];
+	return num_protos;
+}
+
+void proto_print_names(FILE *f)
+{
+	unsigned int i;
+
+	fprintf(f, "Protocols:");
+	for (i = 0; i < num_protos; i++)
+		fprintf(f, " %s", protos[i].name);
+	fprintf(f, "\n");
+}
+
+void proto_sockaddr_ll(struct sockaddr_ll *sll, uint16_t eth_p, int ifindex)
+{
+	memset(sll, 0, sizeof(*sll));
+	sll->sll_family = AF_PACKET;
+	sll->sll_protocol = htons(eth_p);
+	sll->sll_ifindex = ifindex;
+	sll->sll_halen = 6;
+}
@@ -0,0 +1,45 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * The ETH_P_* protocols the radio drivers deliver frames with, by the
+ * short names the tools accept on their command lines.
+ */
+
+#define PROTO_MAX	8
+
+struct proto {
+	const char *name;
+	uint16_t eth_p;
+};
+
+extern const struct proto protos[];
+extern const unsigned int num_protos;
+
+const struct proto *proto_find(const char *name);
+
+/*
+ * Parse a comma separated list of protocol names into sel, which must
+ * have room for PROTO_MAX entries. Returns the number of entries or -1
+ * on unknown names.
+ */
+int proto_parse_list(char *list, const struct proto **sel);
+
+/* Fill sel with every protocol and return how many there are. */
+int proto_all(const struct proto **sel);
+
+void proto_print_names(FILE *f);
+
+struct sockaddr_ll;
+
+/*
+ * Where to send eth_p frames out of ifindex on a SOCK_DGRAM packet
+ * socket. The address has a zero link-layer address, without which
+ * Ethernet-typed test devices such as veth and lo refuse to send.
+ */
+void proto_sockaddr_ll(struct sockaddr_ll *sll, uint16_t eth_p, int ifindex);
+
+#endif
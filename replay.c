@@ -0,0 +1,789 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+
+/*
+ * Replays a pcap or pcapng trace, such as one written by capture, onto the
+ * radio interfaces. Frames need the Linux cooked (SLL) link type so that
+ * their ETH_P_* protocol is known; each goes out on a PF_PACKET socket
+ * with that protocol.
+ *
+ * The file is mapped and indexed up front. capture drains one ring per
+ * protocol at a time, so the index is sorted by timestamp before anything
+ * is sent. Payloads go to sendmmsg() straight from the mapping, which is
+ * populated at mmap() time so that page faults do not show up as timing
+ * error.
+ *
+ * A timer thread sleeps until shortly before a frame is due and spins the
+ * rest of the way, as txtime -m fifo does. It then sends that frame along
+ * with every later one that is already due, up to -b frames per
+ * sendmmsg(). So a burst, or a backlog after a late wakeup, costs one
+ * syscall. -s scales the gaps between frames and -s 0 sends flat out.
+ *
+ * Frames go to the interface named in the trace, which -r can rename.
+ * Frames without one (classic pcap) go to -d, or by default to enocean0
+ * for ERP2 and lora0 for everything else.
+ */
+
+#define LINKTYPE_LINUX_SLL	113
+#define SLL_HDR_LEN		16
+#define SLL_PROTO_OFF		14
+
+#define PCAP_MAGIC_US		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define PCAP_HDR_LEN		24
+#define PCAP_REC_LEN		16
+
+#define PCAPNG_SHB		0x0A0D0D0A
+#define PCAPNG_IDB		0x00000001
+#define PCAPNG_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER	0x1A2B3C4D
+
+#define OPT_ENDOFOPT		0
+#define OPT_IF_NAME		2
+#define OPT_IF_TSRESOL		9
+
+#define MAX_IFS			64
+#define MAX_OUTS		32
+#define MAX_RENAMES		16
+#define BATCH_MAX		256
+#define SLEEP_MAX_NS		100000000ull
+
+struct frame {
+	const unsigned char *data;
+	uint64_t ts;
+	uint32_t len;
+	/* position in the file, so frames with equal timestamps keep their order */
+	uint32_t seq;
+	uint16_t eth_p;
+	uint16_t out;
+};
+
+struct out {
+	char name[IFNAMSIZ];
+	int ifindex;
+	unsigned long frames;
+};
+
+struct trace {
+	const char *path;
+	unsigned char *map;
+	size_t size;
+	struct frame *frames;
+	unsigned long num;
+	unsigned long cap;
+	unsigned long other_link;
+	unsigned long truncated;
+	unsigned long filtered;
+	struct out outs[MAX_OUTS];
+	unsigned int num_outs;
+};
+
+/* an interface of the pcapng section being read */
+struct trace_if {
+	uint16_t linktype;
+	uint8_t tsresol;
+	char name[IFNAMSIZ];
+};
+
+struct rename {
+	const char *from;
+	const char *to;
+};
+
+struct replay_opts {
+	double scale;
+	unsigned int batch;
+	unsigned long loops;
+	uint64_t spin;
+	uint64_t lead;
+	int prio;
+	int cpu;
+	int dry_run;
+	int quiet;
+	const struct proto *sel[PROTO_MAX];
+	int num_sel;
+	const char *def_if;
+	struct rename renames[MAX_RENAMES];
+	unsigned int num_renames;
+};
+
+struct replay_state {
+	const struct trace *t;
+	const struct replay_opts *o;
+	int skt;
+	uint64_t start;
+	uint64_t end;
+	uint64_t last_due;
+	unsigned long sent;
+	unsigned long bytes;
+	unsigned long batches;
+	unsigned long syscalls;
+	unsigned long retries;
+	unsigned long send_errors;
+	int done;
+	struct hist late;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static uint16_t rd16(const unsigned char *p, int swap)
+{
+	uint16_t v;
+
+	memcpy(&v, p, 2);
+	return swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const unsigned char *p, int swap)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+/* if_tsresol: a negative power of 10, or of 2 with the top bit set */
+static uint64_t ts_to_ns(uint64_t ts, uint8_t resol)
+{
+	unsigned int n = resol & 0x7f;
+	uint64_t p = 1;
+
+	if (resol & 0x80)
+		return ((unsigned __int128)ts * 1000000000u) >> n;
+	if (n <= 9) {
+		while (n++ < 9)
+			p *= 10;
+		return ts * p;
+	}
+	while (n-- > 9)
+		p *= 10;
+	return ts / p;
+}
+
+static int out_get(struct trace *t, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < t->num_outs; i++) {
+		if (strcmp(t->outs[i].name, name) == 0)
+			return i;
+	}
+	if (t->num_outs == MAX_OUTS) {
+		fprintf(stderr, "%s: more than %d interfaces\n", t->path, MAX_OUTS);
+		return -1;
+	}
+	snprintf(t->outs[i].name, sizeof(t->outs[i].name), "%s", name);
+	return t->num_outs++;
+}
+
+static int add_frame(struct trace *t, const struct replay_opts *o, const unsigned char *data,
+	uint32_t caplen, uint32_t len, uint64_t ts, uint16_t linktype, const char *ifname)
+{
+	const struct proto *p = NULL;
+	struct frame *f;
+	uint16_t eth_p;
+	unsigned int i;
+	int out;
+
+	if (linktype != LINKTYPE_LINUX_SLL) {
+		t->other_link++;
+		return 0;
+	}
+	/* a cut off frame would go out shorter than it was received */
+	if (caplen < len || caplen < SLL_HDR_LEN) {
+		t->truncated++;
+		return 0;
+	}
+
+	eth_p = data[SLL_PROTO_OFF] << 8 | data[SLL_PROTO_OFF + 1];
+	for (i = 0; i < (unsigned int)o->num_sel; i++) {
+		if (o->sel[i]->eth_p == eth_p)
+			p = o->sel[i];
+	}
+	if (p == NULL) {
+		t->filtered++;
+		return 0;
+	}
+
+	if (ifname == NULL || ifname[0] == '\0')
+		ifname = o->def_if != NULL ? o->def_if :
+			strcmp(p->name, "erp2") == 0 ? "enocean0" : "lora0";
+	for (i = 0; i < o->num_renames; i++) {
+		if (strcmp(o->renames[i].from, ifname) == 0) {
+			ifname = o->renames[i].to;
+			break;
+		}
+	}
+	out = out_get(t, ifname);
+	if (out < 0)
+		return -1;
+
+	if (t->num == t->cap) {
+		size_t cap = t->cap ? t->cap * 2 : 4096;
+		struct frame *n = realloc(t->frames, cap * sizeof(*n));
+
+		if (n == NULL) {
+			fprintf(stderr, "out of memory\n");
+			return -1;
+		}
+		t->frames = n;
+		t->cap = cap;
+	}
+	f = &t->frames[t->num];
+	f->data = data + SLL_HDR_LEN;
+	f->len = caplen - SLL_HDR_LEN;
+	f->ts = ts;
+	f->seq = t->num++;
+	f->eth_p = eth_p;
+	f->out = out;
+	t->outs[out].frames++;
+	return 0;
+}
+
+static int load_pcap(struct trace *t, const struct replay_opts *o)
+{
+	uint32_t magic = rd32(t->map, 0);
+	int swap = magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+		magic == __builtin_bswap32(PCAP_MAGIC_NS);
+	uint32_t frac = rd32(t->map, swap) == PCAP_MAGIC_NS ? 1 : 1000;
+	uint16_t linktype = rd32(t->map + 20, swap);
+	size_t off = PCAP_HDR_LEN;
+
+	while (off + PCAP_REC_LEN <= t->size) {
+		const unsigned char *rec = t->map + off;
+		uint32_t caplen = rd32(rec + 8, swap);
+
+		if (caplen > t->size - off - PCAP_REC_LEN) {
+			fprintf(stderr, "%s: record at %zu runs past the end\n", t->path, off);
+			break;
+		}
+		if (add_frame(t, o, rec + PCAP_REC_LEN, caplen, rd32(rec + 12, swap),
+			      rd32(rec, swap) * 1000000000ull + (uint64_t)rd32(rec + 4, swap) * frac,
+			      linktype, NULL) < 0)
+			return -1;
+		off += PCAP_REC_LEN + caplen;
+	}
+	return 0;
+}
+
+static void parse_idb_opts(struct trace_if *ifp, const unsigned char *p,
+	const unsigned char *end, int swap)
+{
+	while (p + 4 <= end) {
+		uint16_t code = rd16(p, swap), len = rd16(p + 2, swap);
+
+		if (code == OPT_ENDOFOPT || len > end - p - 4)
+			break;
+		if (code == OPT_IF_NAME)
+			snprintf(ifp->name, sizeof(ifp->name), "%.*s", (int)len, p + 4);
+		else if (code == OPT_IF_TSRESOL && len >= 1)
+			ifp->tsresol = p[4];
+		p += 4 + ((len + 3) & ~3);
+	}
+}
+
+static int load_pcapng(struct trace *t, const struct replay_opts *o)
+{
+	struct trace_if ifs[MAX_IFS];
+	unsigned int num_ifs = 0;
+	size_t off = 0;
+	int swap = 0;
+
+	while (off + 12 <= t->size) {
+		const unsigned char *b = t->map + off;
+		uint32_t type, total;
+
+		/* the SHB type reads the same either way round */
+		if (rd32(b, 0) == PCAPNG_SHB) {
+			swap = rd32(b + 8, 0) != PCAPNG_BYTE_ORDER;
+			if (swap && rd32(b + 8, 1) != PCAPNG_BYTE_ORDER) {
+				fprintf(stderr, "%s: bad byte order magic at %zu\n", t->path, off);
+				return -1;
+			}
+			num_ifs = 0;
+		}
+		type = rd32(b, swap);
+		total = rd32(b + 4, swap);
+		if (total < 12 || total % 4 != 0 || total > t->size - off) {
+			fprintf(stderr, "%s: bad block length at %zu\n", t->path, off);
+			break;
+		}
+
+		if (type == PCAPNG_IDB && total >= 20) {
+			struct trace_if *ifp = &ifs[num_ifs];
+
+			if (num_ifs == MAX_IFS) {
+				fprintf(stderr, "%s: more than %d interfaces in a section\n",
+					t->path, MAX_IFS);
+				return -1;
+			}
+			memset(ifp, 0, sizeof(*ifp));
+			ifp->linktype = rd16(b + 8, swap);
+			ifp->tsresol = 6;
+			parse_idb_opts(ifp, b + 16, b + total - 4, swap);
+			num_ifs++;
+		} else if (type == PCAPNG_EPB && total >= 32) {
+			uint32_t id = rd32(b + 8, swap), caplen = rd32(b + 20, swap);
+			uint64_t ts = (uint64_t)rd32(b + 12, swap) << 32 | rd32(b + 16, swap);
+
+			if (id >= num_ifs || caplen > total - 32) {
+				fprintf(stderr, "%s: bad packet block at %zu\n", t->path, off);
+				return -1;
+			}
+			if (add_frame(t, o, b + 28, caplen, rd32(b + 24, swap),
+				      ts_to_ns(ts, ifs[id].tsresol), ifs[id].linktype,
+				      ifs[id].name) < 0)
+				return -1;
+		}
+		off += total;
+	}
+	return 0;
+}
+
+static int frame_cmp(const void *a, const void *b)
+{
+	const struct frame *x = a, *y = b;
+
+	if (x->ts != y->ts)
+		return x->ts < y->ts ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int trace_load(struct trace *t, const struct replay_opts *o)
+{
+	struct stat st;
+	uint32_t magic;
+	int fd, ret;
+
+	fd = open(t->path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: %s\n", t->path, strerror(err));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+	if (st.st_size < PCAP_HDR_LEN) {
+		fprintf(stderr, "%s: too short for a trace\n", t->path);
+		close(fd);
+		return -1;
+	}
+	t->size = st.st_size;
+	t->map = mmap(NULL, t->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (t->map == MAP_FAILED) {
+		int err = errno;
+		fprintf(stderr, "%s: mmap failed: %s\n", t->path, strerror(err));
+		return -1;
+	}
+
+	magic = rd32(t->map, 0);
+	if (magic == PCAPNG_SHB) {
+		ret = load_pcapng(t, o);
+	} else if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS ||
+		   magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+		   magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+		ret = load_pcap(t, o);
+	} else {
+		fprintf(stderr, "%s: neither pcap nor pcapng\n", t->path);
+		ret = -1;
+	}
+	if (ret < 0)
+		return -1;
+
+	qsort(t->frames, t->num, sizeof(*t->frames), frame_cmp);
+	return 0;
+}
+
+static void trace_free(struct trace *t)
+{
+	free(t->frames);
+	if (t->map != NULL && t->map != MAP_FAILED)
+		munmap(t->map, t->size);
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop)
+		;
+}
+
+/* when frame i of the given loop is due, relative to the first one */
+static uint64_t due_offset(const struct replay_state *st, unsigned long i, unsigned long loop)
+{
+	const struct frame *f = st->t->frames;
+	unsigned long n = st->t->num;
+	uint64_t span = f[n - 1].ts - f[0].ts;
+
+	/* the next loop starts an average gap after the last frame */
+	if (n > 1)
+		span += span / (n - 1);
+	return (f[i].ts - f[0].ts + loop * span) / st->o->scale;
+}
+
+static int send_batch(struct replay_state *st, struct mmsghdr *msgs, unsigned int n)
+{
+	unsigned int done = 0;
+
+	st->batches++;
+	if (st->o->dry_run)
+		return 0;
+
+	while (done < n) {
+		int ret = sendmmsg(st->skt, msgs + done, n - done, 0);
+
+		st->syscalls++;
+		if (ret >= 0) {
+			done += ret;
+			continue;
+		}
+		/* ^C: drop the rest of the batch rather than wait for the device */
+		if (stop)
+			break;
+		if (errno == EINTR)
+			continue;
+		if (errno == ENOBUFS || errno == EAGAIN) {
+			/* the device queue is full, give it a moment to drain */
+			struct timespec ts = { 0, 50000 };
+
+			st->retries++;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		if (st->send_errors++ == 0) {
+			int err = errno;
+			fprintf(stderr, "sendmmsg failed: %s\n", strerror(err));
+		}
+		/* skip the frame that failed */
+		done++;
+	}
+	return 0;
+}
+
+static void run(struct replay_state *st)
+{
+	const struct replay_opts *o = st->o;
+	const struct trace *t = st->t;
+	struct sockaddr_ll addrs[BATCH_MAX];
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iovs[BATCH_MAX];
+	uint64_t due[BATCH_MAX];
+	unsigned long loop, i;
+	unsigned int j, n;
+	uint64_t base;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (j = 0; j < BATCH_MAX; j++) {
+		msgs[j].msg_hdr.msg_name = &addrs[j];
+		msgs[j].msg_hdr.msg_namelen = sizeof(addrs[j]);
+		msgs[j].msg_hdr.msg_iov = &iovs[j];
+		msgs[j].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* a moment to settle before the first frame is due; flat out just goes */
+	base = hist_now_ns() + (o->scale > 0 ? o->lead : 0);
+	st->start = base;
+	for (loop = 0; loop < o->loops && !stop; loop++) {
+		for (i = 0; i < t->num && !stop; i += n) {
+			uint64_t next = o->scale > 0 ? base + due_offset(st, i, loop) : 0;
+			uint64_t now;
+
+			/* long gaps are slept in pieces so that ^C is noticed */
+			while (next > o->spin && next - o->spin > hist_now_ns() && !stop) {
+				uint64_t until = next - o->spin;
+
+				if (until - hist_now_ns() > SLEEP_MAX_NS)
+					until = hist_now_ns() + SLEEP_MAX_NS;
+				sleep_until(until);
+			}
+			while ((now = hist_now_ns()) < next && !stop)
+				;
+			if (stop)
+				break;
+
+			for (n = 0; n < o->batch && i + n < t->num; n++) {
+				const struct frame *f = &t->frames[i + n];
+
+				due[n] = o->scale > 0 ? base + due_offset(st, i + n, loop) : now;
+				if (due[n] > now)
+					break;
+				proto_sockaddr_ll(&addrs[n], f->eth_p, t->outs[f->out].ifindex);
+				iovs[n].iov_base = (void *)f->data;
+				iovs[n].iov_len = f->len;
+				st->bytes += f->len;
+			}
+
+			send_batch(st, msgs, n);
+			if (o->scale > 0) {
+				for (j = 0; j < n; j++)
+					hist_add(&st->late, now - due[j]);
+				st->last_due = due[n - 1];
+			}
+			__atomic_store_n(&st->sent, st->sent + n, __ATOMIC_RELAXED);
+		}
+	}
+	st->end = hist_now_ns();
+	__atomic_store_n(&st->done, 1, __ATOMIC_RELEASE);
+}
+
+static void *replay_main(void *arg)
+{
+	run(arg);
+	return NULL;
+}
+
+/*
+ * Starts the timer thread, as SCHED_FIFO pinned to a CPU if asked to and
+ * allowed, and prints progress until it is done.
+ */
+static int run_thread(struct replay_state *st, const struct replay_opts *o)
+{
+	struct sched_param sp = { .sched_priority = o->prio };
+	unsigned long total = st->t->num * o->loops, last = 0;
+	pthread_attr_t attr;
+	pthread_t thread;
+	cpu_set_t set;
+	int ret;
+
+	pthread_attr_init(&attr);
+	if (o->prio > 0) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+			fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &sp);
+	}
+	if (o->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(o->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+
+	ret = pthread_create(&thread, &attr, replay_main, st);
+	if (ret == EPERM) {
+		fprintf(stderr, "no permission for SCHED_FIFO, using normal scheduling\n");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		ret = pthread_create(&thread, &attr, replay_main, st);
+	}
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+		return -1;
+	}
+
+	while (!__atomic_load_n(&st->done, __ATOMIC_ACQUIRE)) {
+		unsigned long sent;
+
+		poll(NULL, 0, 1000);
+		sent = __atomic_load_n(&st->sent, __ATOMIC_RELAXED);
+		if (!o->quiet && !__atomic_load_n(&st->done, __ATOMIC_ACQUIRE))
+			printf("%lu of %lu frames sent, %lu in the last second\n", sent, total,
+				sent - last);
+		last = sent;
+	}
+	pthread_join(thread, NULL);
+	return 0;
+}
+
+static void report(const struct replay_state *st, const struct replay_opts *o)
+{
+	const struct trace *t = st->t;
+	double secs = (st->end - st->start) / 1e9;
+	double span = (t->frames[t->num - 1].ts - t->frames[0].ts) / 1e9;
+	unsigned int i;
+
+	printf("sent %lu frames, %lu bytes in %.3f s: %.0f frames/s, %.0f bytes/s, %lu batches, %lu sendmmsg calls, %lu retries, %lu errors%s\n",
+		st->sent, st->bytes, secs, secs > 0 ? st->sent / secs : 0.0,
+		secs > 0 ? st->bytes / secs : 0.0, st->batches, st->syscalls, st->retries,
+		st->send_errors,
+		o->dry_run ? " (dry run)" : "");
+	if (o->scale > 0 && span > 0 && secs > 0)
+		printf("trace rate at %gx: %.0f frames/s, achieved %.3f of it\n", o->scale,
+			t->num * o->scale / span, (st->sent / secs) / (t->num * o->scale / span));
+	if (o->scale > 0 && st->late.count) {
+		printf("last frame due at %.3f s, done %.3f ms after it\n",
+			(st->last_due - st->start) / 1e9, ((int64_t)st->end - (int64_t)st->last_due) / 1e6);
+		hist_print("late", &st->late);
+	}
+	for (i = 0; i < t->num_outs; i++)
+		printf("  %s: %lu frames per loop\n", t->outs[i].name, t->outs[i].frames);
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s scale] [-b batch] [-l loops] [-p proto,...] [-d ifname] [-r from=to]\n"
+		"       [-w spin-us] [-P prio] [-c cpu] [-x] [-q] file\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_opts o = {
+		.scale = 1.0,
+		.batch = 32,
+		.loops = 1,
+		.spin = 200000,
+		.lead = 10000000,
+		.cpu = -1,
+	};
+	struct replay_state st;
+	struct trace t;
+	struct ifcache ifc;
+	struct sigaction sa;
+	char *endptr, *eq;
+	unsigned int i;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:b:l:p:d:r:w:P:c:xq")) != -1) {
+		switch (opt) {
+		case 's':
+			o.scale = strtod(optarg, &endptr);
+			if (*endptr != '\0' || o.scale < 0)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0 || o.batch > BATCH_MAX)
+				return usage(argv[0]);
+			break;
+		case 'l':
+			o.loops = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.loops == 0)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.num_sel = proto_parse_list(optarg, o.sel);
+			if (o.num_sel <= 0)
+				return usage(argv[0]);
+			break;
+		case 'd':
+			o.def_if = optarg;
+			break;
+		case 'r':
+			eq = strchr(optarg, '=');
+			if (eq == NULL || o.num_renames == MAX_RENAMES)
+				return usage(argv[0]);
+			*eq = '\0';
+			o.renames[o.num_renames].from = optarg;
+			o.renames[o.num_renames++].to = eq + 1;
+			break;
+		case 'w':
+			o.spin = strtoull(optarg, &endptr, 0) * 1000;
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'P':
+			o.prio = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.prio < 1 || o.prio > 99)
+				return usage(argv[0]);
+			break;
+		case 'c':
+			o.cpu = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.cpu < 0)
+				return usage(argv[0]);
+			break;
+		case 'x':
+			o.dry_run = 1;
+			break;
+		case 'q':
+			o.quiet = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		return usage(argv[0]);
+	if (o.num_sel == 0)
+		o.num_sel = proto_all(o.sel);
+
+	memset(&t, 0, sizeof(t));
+	memset(&ifc, 0, sizeof(ifc));
+	t.path = argv[optind];
+	if (trace_load(&t, &o) < 0)
+		goto out;
+	printf("%s: %lu frames over %.3f s, skipped %lu of other link types, %lu truncated, %lu of other protocols\n",
+		t.path, t.num, t.num ? (t.frames[t.num - 1].ts - t.frames[0].ts) / 1e9 : 0.0,
+		t.other_link, t.truncated, t.filtered);
+	if (t.num == 0)
+		goto out;
+
+	memset(&st, 0, sizeof(st));
+	st.t = &t;
+	st.o = &o;
+	st.skt = -1;
+	hist_init(&st.late);
+
+	if (!o.dry_run) {
+		if (ifcache_load(&ifc) < 0)
+			goto out;
+		for (i = 0; i < t.num_outs; i++) {
+			const struct ifcache_entry *e = ifcache_find_name(&ifc, t.outs[i].name);
+
+			if (e == NULL) {
+				fprintf(stderr, "%s: no such device\n", t.outs[i].name);
+				goto out;
+			}
+			t.outs[i].ifindex = e->ifindex;
+		}
+
+		/* protocol 0: send only, nothing is queued for receiving */
+		st.skt = socket(PF_PACKET, SOCK_DGRAM, 0);
+		if (st.skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			goto out;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (run_thread(&st, &o) == 0) {
+		report(&st, &o);
+		ret = st.send_errors ? 1 : 0;
+	}
+	if (st.skt != -1)
+		close(st.skt);
+out:
+	ifcache_free(&ifc);
+	trace_free(&t);
+	return ret;
+}
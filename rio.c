@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "rio.h"
+
+#define RIO_BGID	0
+
+/* user_data tags, both structs are at least 8 byte aligned */
+#define TAG_RX		1ul
+#define TAG_MASK	7ul
+
+enum {
+	TX_FREE,
+	TX_FILLING,
+	TX_QUEUED,
+	/* send completed, buffer still in use until the zero copy notifications */
+	TX_NOTIF,
+};
+
+struct rio_sock {
+	int fd;
+	rio_rx_cb cb;
+	void *user;
+	int armed;
+	int failed;
+};
+
+struct rio_tx {
+	unsigned char *buf;
+	int state;
+	int fd;
+	unsigned int len;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct msghdr msg;
+	struct iovec iov;
+	rio_tx_cb cb;
+	void *user;
+	unsigned int notifs;
+	/* went out as SEND_ZC */
+	int zc;
+	struct rio_tx *next_free;
+};
+
+struct rio {
+	struct io_uring ring;
+	struct rio_params p;
+	struct io_uring_buf_ring *br;
+	unsigned char *rx_area;
+	unsigned char *tx_area;
+	struct rio_tx *txs;
+	struct rio_tx *free_txs;
+	struct rio_sock *socks;
+	unsigned int num_socks;
+	int no_zc;
+	struct rio_stats stats;
+};
+
+static struct io_uring_sqe *get_sqe(struct rio *rio)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(&rio->ring);
+
+	/* the SQ ring is full, push it to the kernel and try again */
+	if (sqe == NULL) {
+		io_uring_submit(&rio->ring);
+		rio->stats.enters++;
+		sqe = io_uring_get_sqe(&rio->ring);
+	}
+	return sqe;
+}
+
+static int arm_rx(struct rio *rio, struct rio_sock *s)
+{
+	struct io_uring_sqe *sqe = get_sqe(rio);
+
+	if (sqe == NULL)
+		return -EBUSY;
+
+	io_uring_prep_recv_multishot(sqe, s->fd, NULL, 0, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = RIO_BGID;
+	io_uring_sqe_set_data64(sqe, (uintptr_t)s | TAG_RX);
+	s->armed = 1;
+	return 0;
+}
+
+static void recycle_rx(struct rio *rio, unsigned int bid)
+{
+	io_uring_buf_ring_add(rio->br, rio->rx_area + (size_t)bid * rio->p.rx_buf_size,
+		rio->p.rx_buf_size, bid, io_uring_buf_ring_mask(rio->p.rx_bufs), 0);
+	io_uring_buf_ring_advance(rio->br, 1);
+}
+
+struct rio *rio_create(const struct rio_params *p)
+{
+	struct iovec iov;
+	struct rio *rio;
+	unsigned int i;
+	int ret;
+
+	/* buffer rings are indexed with a mask */
+	if (p->rx_bufs == 0 || (p->rx_bufs & (p->rx_bufs - 1)) != 0)
+		return NULL;
+
+	rio = calloc(1, sizeof(*rio));
+	if (rio == NULL)
+		return NULL;
+	rio->p = *p;
+
+	ret = io_uring_queue_init(p->entries, &rio->ring, IORING_SETUP_SUBMIT_ALL |
+		IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring_queue_init failed: %s\n", strerror(-ret));
+		free(rio);
+		return NULL;
+	}
+
+	rio->socks = calloc(p->max_socks, sizeof(*rio->socks));
+	rio->txs = calloc(p->tx_bufs, sizeof(*rio->txs));
+	if (posix_memalign((void **)&rio->rx_area, 4096, (size_t)p->rx_bufs * p->rx_buf_size) ||
+	    posix_memalign((void **)&rio->tx_area, 4096, (size_t)p->tx_bufs * p->tx_buf_size))
+		goto err;
+	if (rio->socks == NULL || rio->txs == NULL)
+		goto err;
+
+	rio->br = io_uring_setup_buf_ring(&rio->ring, p->rx_bufs, RIO_BGID, 0, &ret);
+	if (rio->br == NULL) {
+		fprintf(stderr, "io_uring_setup_buf_ring failed: %s\n", strerror(-ret));
+		goto err;
+	}
+	for (i = 0; i < p->rx_bufs; i++)
+		io_uring_buf_ring_add(rio->br, rio->rx_area + (size_t)i * p->rx_buf_size,
+			p->rx_buf_size, i, io_uring_buf_ring_mask(p->rx_bufs), i);
+	io_uring_buf_ring_advance(rio->br, p->rx_bufs);
+
+	/* one registered region for all TX buffers, used as fixed buffer 0 */
+	iov.iov_base = rio->tx_area;
+	iov.iov_len = (size_t)p->tx_bufs * p->tx_buf_size;
+	ret = io_uring_register_buffers(&rio->ring, &iov, 1);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring_register_buffers failed: %s\n", strerror(-ret));
+		goto err;
+	}
+
+	for (i = 0; i < p->tx_bufs; i++) {
+		rio->txs[i].buf = rio->tx_area + (size_t)i * p->tx_buf_size;
+		rio->txs[i].next_free = i + 1 < p->tx_bufs ? &rio->txs[i + 1] : NULL;
+	}
+	rio->free_txs = &rio->txs[0];
+
+	return rio;
+
+err:
+	rio_destroy(rio);
+	return NULL;
+}
+
+void rio_destroy(struct rio *rio)
+{
+	if (rio == NULL)
+		return;
+	if (rio->br != NULL)
+		io_uring_free_buf_ring(&rio->ring, rio->br, rio->p.rx_bufs, RIO_BGID);
+	io_uring_queue_exit(&rio->ring);
+	free(rio->rx_area);
+	free(rio->tx_area);
+	free(rio->txs);
+	free(rio->socks);
+	free(rio);
+}
+
+int rio_add_socket(struct rio *rio, int fd, rio_rx_cb cb, void *user)
+{
+	struct rio_sock *s;
+
+	if (rio->num_socks == rio->p.max_socks)
+		return -ENOSPC;
+
+	s = &rio->socks[rio->num_socks++];
+	s->fd = fd;
+	s->cb = cb;
+	s->user = user;
+	return arm_rx(rio, s);
+}
+
+static struct rio_tx *tx_of(struct rio *rio, unsigned char *buf)
+{
+	size_t i = (buf - rio->tx_area) / rio->p.tx_buf_size;
+
+	return &rio->txs[i];
+}
+
+unsigned char *rio_get_tx_buf(struct rio *rio)
+{
+	struct rio_tx *tx = rio->free_txs;
+
+	if (tx == NULL)
+		return NULL;
+	rio->free_txs = tx->next_free;
+	tx->state = TX_FILLING;
+	return tx->buf;
+}
+
+void rio_put_tx_buf(struct rio *rio, unsigned char *buf)
+{
+	struct rio_tx *tx = tx_of(rio, buf);
+
+	tx->state = TX_FREE;
+	tx->next_free = rio->free_txs;
+	rio->free_txs = tx;
+}
+
+static int queue_tx(struct rio *rio, struct rio_tx *tx)
+{
+	struct io_uring_sqe *sqe = get_sqe(rio);
+
+	if (sqe == NULL)
+		return -EBUSY;
+
+	tx->zc = !rio->no_zc;
+	if (tx->zc) {
+		io_uring_prep_send_zc_fixed(sqe, tx->fd, tx->buf, tx->len, 0, 0, 0);
+		if (tx->addrlen)
+			io_uring_prep_send_set_addr(sqe, (struct sockaddr *)&tx->addr,
+				tx->addrlen);
+	} else {
+		/* plain sendmsg still reads straight from the registered buffer */
+		memset(&tx->msg, 0, sizeof(tx->msg));
+		tx->iov.iov_base = tx->buf;
+		tx->iov.iov_len = tx->len;
+		tx->msg.msg_iov = &tx->iov;
+		tx->msg.msg_iovlen = 1;
+		if (tx->addrlen) {
+			tx->msg.msg_name = &tx->addr;
+			tx->msg.msg_namelen = tx->addrlen;
+		}
+		io_uring_prep_sendmsg(sqe, tx->fd, &tx->msg, 0);
+	}
+	io_uring_sqe_set_data64(sqe, (uintptr_t)tx);
+	tx->state = TX_QUEUED;
+	return 0;
+}
+
+int rio_send(struct rio *rio, int fd, unsigned char *buf, unsigned int len,
+	const void *addr, unsigned int addrlen, rio_tx_cb cb, void *user)
+{
+	struct rio_tx *tx = tx_of(rio, buf);
+
+	if (len > rio->p.tx_buf_size || addrlen > sizeof(tx->addr))
+		return -EINVAL;
+
+	tx->fd = fd;
+	tx->len = len;
+	tx->cb = cb;
+	tx->user = user;
+	tx->addrlen = addrlen;
+	if (addrlen)
+		memcpy(&tx->addr, addr, addrlen);
+	return queue_tx(rio, tx);
+}
+
+static void handle_rx(struct rio *rio, struct rio_sock *s, struct io_uring_cqe *cqe)
+{
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		s->armed = 0;
+
+	if (cqe->res == -ENOBUFS) {
+		/* every buffer is taken; rearmed once this batch gave them back */
+		rio->stats.rx_nobufs++;
+		return;
+	}
+
+	if (cqe->flags & IORING_CQE_F_BUFFER) {
+		unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+		rio->stats.rx_frames++;
+		s->cb(rio, s->user, s->fd, rio->rx_area + (size_t)bid * rio->p.rx_buf_size,
+			cqe->res);
+		recycle_rx(rio, bid);
+	} else if (cqe->res < 0) {
+		/* report it once and leave the socket alone from now on */
+		s->failed = 1;
+		s->cb(rio, s->user, s->fd, NULL, cqe->res);
+	}
+}
+
+static void handle_tx(struct rio *rio, struct rio_tx *tx, struct io_uring_cqe *cqe)
+{
+	int res = cqe->res;
+
+	if (cqe->flags & IORING_CQE_F_NOTIF) {
+		if (--tx->notifs == 0 && tx->state == TX_NOTIF)
+			rio_put_tx_buf(rio, tx->buf);
+		return;
+	}
+	if (cqe->flags & IORING_CQE_F_MORE)
+		tx->notifs++;
+
+	/*
+	 * Packet and PF_LORA sockets do not do zero copy. Fall back for good,
+	 * and resend every zero copy send that was already in flight as well.
+	 */
+	if (res == -EOPNOTSUPP && tx->zc) {
+		rio->no_zc = 1;
+		res = queue_tx(rio, tx);
+		if (res == 0)
+			return;
+	}
+
+	if (res < 0)
+		rio->stats.tx_errors++;
+	else
+		rio->stats.tx_frames++;
+	if (tx->zc)
+		rio->stats.tx_zc++;
+
+	if (tx->cb != NULL)
+		tx->cb(rio, tx->user, tx->fd, res);
+
+	if (tx->notifs)
+		tx->state = TX_NOTIF;
+	else
+		rio_put_tx_buf(rio, tx->buf);
+}
+
+int rio_run(struct rio *rio, int timeout_ms)
+{
+	struct io_uring_cqe *cqe;
+	unsigned int head, n = 0, i;
+	int ret;
+
+	if (timeout_ms < 0) {
+		ret = io_uring_submit_and_wait(&rio->ring, 1);
+	} else if (timeout_ms == 0) {
+		ret = io_uring_submit(&rio->ring);
+	} else {
+		struct __kernel_timespec ts = {
+			.tv_sec = timeout_ms / 1000,
+			.tv_nsec = (timeout_ms % 1000) * 1000000ll,
+		};
+
+		ret = io_uring_submit_and_wait_timeout(&rio->ring, &cqe, 1, &ts, NULL);
+	}
+	rio->stats.enters++;
+	if (ret < 0 && ret != -ETIME && ret != -EINTR)
+		return ret;
+
+	io_uring_for_each_cqe(&rio->ring, head, cqe) {
+		uintptr_t data = io_uring_cqe_get_data64(cqe);
+
+		if (data & TAG_RX)
+			handle_rx(rio, (struct rio_sock *)(data & ~TAG_MASK), cqe);
+		else
+			handle_tx(rio, (struct rio_tx *)data, cqe);
+		n++;
+	}
+	io_uring_cq_advance(&rio->ring, n);
+
+	for (i = 0; i < rio->num_socks; i++) {
+		if (!rio->socks[i].armed && !rio->socks[i].failed) {
+			rio->stats.rx_rearms++;
+			arm_rx(rio, &rio->socks[i]);
+		}
+	}
+
+	return n;
+}
+
+const struct rio_stats *rio_get_stats(const struct rio *rio)
+{
+	return &rio->stats;
+}
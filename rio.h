@@ -0,0 +1,71 @@
+#ifndef RIO_H
+#define RIO_H
+
+#include <liburing.h>
+
+/*
+ * Radio I/O engine on top of io_uring. Every registered socket keeps a
+ * multishot receive in flight that picks its buffers from a provided
+ * buffer ring, so a stream of frames costs no syscall per frame. Sends
+ * are composed in place in a pool of registered buffers and submitted
+ * together with whatever else is pending on the next rio_run() call.
+ *
+ * Callbacks run from rio_run(). The data passed to an rx callback is
+ * only valid until the callback returns.
+ */
+
+struct rio;
+
+typedef void (*rio_rx_cb)(struct rio *rio, void *user, int fd,
+	const unsigned char *data, int len);
+typedef void (*rio_tx_cb)(struct rio *rio, void *user, int fd, int res);
+
+struct rio_stats {
+	unsigned long enters;
+	unsigned long rx_frames;
+	unsigned long rx_rearms;
+	unsigned long rx_nobufs;
+	unsigned long tx_frames;
+	unsigned long tx_errors;
+	unsigned long tx_zc;
+};
+
+struct rio_params {
+	unsigned int entries;
+	unsigned int rx_bufs;
+	unsigned int rx_buf_size;
+	unsigned int tx_bufs;
+	unsigned int tx_buf_size;
+	unsigned int max_socks;
+};
+
+struct rio *rio_create(const struct rio_params *p);
+void rio_destroy(struct rio *rio);
+
+/* Start receiving on fd; cb gets every frame, or a negative errno. */
+int rio_add_socket(struct rio *rio, int fd, rio_rx_cb cb, void *user);
+
+/*
+ * Get a registered TX buffer of tx_buf_size bytes to fill in, or NULL if
+ * all of them are in flight. Pass it to rio_send() or rio_put_tx_buf().
+ */
+unsigned char *rio_get_tx_buf(struct rio *rio);
+void rio_put_tx_buf(struct rio *rio, unsigned char *buf);
+
+/*
+ * Queue buf for sending on fd. With addr set it goes out through sendmsg
+ * to that address, for unbound packet sockets. cb may be NULL.
+ */
+int rio_send(struct rio *rio, int fd, unsigned char *buf, unsigned int len,
+	const void *addr, unsigned int addrlen, rio_tx_cb cb, void *user);
+
+/*
+ * Submit everything queued and handle completions, waiting up to
+ * timeout_ms for at least one (-1: forever, 0: don't wait). Returns the
+ * number of completions handled or a negative errno.
+ */
+int rio_run(struct rio *rio, int timeout_ms);
+
+const struct rio_stats *rio_get_stats(const struct rio *rio);
+
+#endif
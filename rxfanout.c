@@ -0,0 +1,564 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+#include "rxfilter.h"
+#include "include/linux/lora.h"
+#include "include/linux/enocean.h"
+
+/*
+ * Every worker thread opens its own PF_PACKET socket per interface and
+ * protocol and joins it to a PACKET_FANOUT group, so the kernel spreads
+ * the frames over the workers and nothing is shared between them. Fanout
+ * groups only take sockets with the same protocol and device, hence one
+ * group per (interface, protocol) pair.
+ *
+ * With -i the tool also runs injector threads that send frames on the
+ * given interface, which together with -s gives a scaling benchmark.
+ */
+
+#define MAX_WORKERS	64
+#define MAX_SOCKETS	64
+#define RX_BATCH	64
+#define RX_FRAME_SIZE	2048
+#define TX_BATCH	64
+#define TX_FRAME_SIZE	32
+
+struct rx_target {
+	const struct ifcache_entry *e;
+	const struct proto *proto;
+	uint16_t group;
+};
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	int cpu;
+	int skts[MAX_SOCKETS];
+	unsigned int num_skts;
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long polls;
+	uint32_t digest;
+	unsigned char bufs[RX_BATCH][RX_FRAME_SIZE];
+	struct mmsghdr msgs[RX_BATCH];
+	struct iovec iovs[RX_BATCH];
+} __attribute__((aligned(64)));
+
+struct injector {
+	pthread_t thread;
+	int cpu;
+	int skt;
+	int ifindex;
+	const struct proto **sel;
+	unsigned int num_sel;
+	unsigned long sent;
+	unsigned long errors;
+} __attribute__((aligned(64)));
+
+struct fanout_opts {
+	unsigned int workers;
+	int mode;
+	unsigned int duration;
+	unsigned int work;
+	unsigned int injectors;
+	int sweep;
+};
+
+static struct rxfilter filter;
+static volatile int stop;
+static volatile sig_atomic_t interrupted;
+static unsigned int work_rounds;
+static int num_cpus;
+
+static void on_signal(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+}
+
+static int pin_to_cpu(pthread_t thread, int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+static int open_rx(const struct rx_target *t, int mode)
+{
+	struct sockaddr_ll addr;
+	int skt, arg;
+
+	skt = socket(PF_PACKET, SOCK_DGRAM, htons(t->proto->eth_p));
+	if (skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	if (rxfilter_attach(skt, &filter, t->proto->eth_p) < 0) {
+		close(skt);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(t->proto->eth_p);
+	addr.sll_ifindex = t->e ? t->e->ifindex : 0;
+	if (bind(skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "bind failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	arg = t->group | (mode << 16);
+	if (setsockopt(skt, SOL_PACKET, PACKET_FANOUT, &arg, sizeof(arg)) == -1) {
+		int err = errno;
+		fprintf(stderr, "PACKET_FANOUT failed: %s\n", strerror(err));
+		close(skt);
+		return -1;
+	}
+
+	return skt;
+}
+
+/*
+ * Stand-in for the per-frame processing a real consumer does (decoding,
+ * dedup, forwarding). -W scales its cost so the benchmark is bound by the
+ * workers rather than by the injectors.
+ */
+static uint32_t process(const unsigned char *buf, unsigned int len, uint32_t h)
+{
+	unsigned int r, i;
+
+	for (r = 0; r < work_rounds; r++) {
+		for (i = 0; i < len; i++) {
+			h ^= buf[i];
+			h *= 16777619;
+		}
+	}
+	return h;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct pollfd pfds[MAX_SOCKETS];
+	unsigned int i, j;
+	uint32_t h = 2166136261u;
+
+	for (i = 0; i < RX_BATCH; i++) {
+		w->iovs[i].iov_base = w->bufs[i];
+		w->iovs[i].iov_len = RX_FRAME_SIZE;
+	}
+	for (i = 0; i < w->num_skts; i++) {
+		pfds[i].fd = w->skts[i];
+		pfds[i].events = POLLIN;
+	}
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		int n = poll(pfds, w->num_skts, 100);
+
+		w->polls++;
+		if (n <= 0)
+			continue;
+
+		for (i = 0; i < w->num_skts; i++) {
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+			for (;;) {
+				int got;
+
+				for (j = 0; j < RX_BATCH; j++) {
+					memset(&w->msgs[j].msg_hdr, 0, sizeof(w->msgs[j].msg_hdr));
+					w->msgs[j].msg_hdr.msg_iov = &w->iovs[j];
+					w->msgs[j].msg_hdr.msg_iovlen = 1;
+				}
+				got = recvmmsg(w->skts[i], w->msgs, RX_BATCH, MSG_DONTWAIT, NULL);
+				if (got <= 0)
+					break;
+				for (j = 0; j < got; j++) {
+					h = process(w->bufs[j], w->msgs[j].msg_len, h);
+					w->bytes += w->msgs[j].msg_len;
+				}
+				w->frames += got;
+				if (got < RX_BATCH)
+					break;
+			}
+		}
+	}
+
+	w->digest = h;
+	return NULL;
+}
+
+static void *injector_main(void *arg)
+{
+	struct injector *in = arg;
+	unsigned char frames[TX_BATCH][TX_FRAME_SIZE];
+	struct sockaddr_ll addrs[TX_BATCH];
+	struct mmsghdr msgs[TX_BATCH];
+	struct iovec iovs[TX_BATCH];
+	unsigned long seq = 0;
+	unsigned int i;
+
+	for (i = 0; i < TX_BATCH; i++) {
+		const struct proto *p = in->sel[i % in->num_sel];
+
+		proto_sockaddr_ll(&addrs[i], p->eth_p, in->ifindex);
+		memset(frames[i], 0x42, TX_FRAME_SIZE);
+		iovs[i].iov_base = frames[i];
+		iovs[i].iov_len = TX_FRAME_SIZE;
+		memset(&msgs[i], 0, sizeof(msgs[i]));
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		int ret;
+
+		/* vary the payload so hash fanout has something to hash */
+		for (i = 0; i < TX_BATCH; i++) {
+			memcpy(frames[i], &seq, sizeof(seq));
+			seq++;
+		}
+
+		ret = sendmmsg(in->skt, msgs, TX_BATCH, 0);
+		if (ret == -1) {
+			if (errno != ENOBUFS && errno != EINTR)
+				in->errors++;
+			continue;
+		}
+		in->sent += ret;
+	}
+
+	return NULL;
+}
+
+/* returns frames/s received, or a negative value on setup errors */
+static double run_once(const struct fanout_opts *o, unsigned int workers,
+	const struct rx_target *targets, unsigned int num_targets,
+	struct injector *injs, unsigned int num_injs)
+{
+	struct worker *ws;
+	unsigned long frames = 0, sent = 0, min = ~0ul, max = 0;
+	unsigned int i, j;
+	uint64_t start, end;
+	double secs, rate;
+
+	ws = aligned_alloc(64, workers * sizeof(*ws));
+	if (ws == NULL)
+		return -1;
+	memset(ws, 0, workers * sizeof(*ws));
+
+	for (i = 0; i < workers; i++) {
+		ws[i].id = i;
+		ws[i].cpu = i % num_cpus;
+		for (j = 0; j < num_targets; j++) {
+			int skt = open_rx(&targets[j], o->mode);
+
+			if (skt < 0)
+				goto err;
+			ws[i].skts[ws[i].num_skts++] = skt;
+		}
+	}
+
+	__atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < workers; i++) {
+		pthread_create(&ws[i].thread, NULL, worker_main, &ws[i]);
+		pin_to_cpu(ws[i].thread, ws[i].cpu);
+	}
+	for (i = 0; i < num_injs; i++) {
+		injs[i].sent = 0;
+		injs[i].errors = 0;
+		pthread_create(&injs[i].thread, NULL, injector_main, &injs[i]);
+		pin_to_cpu(injs[i].thread, injs[i].cpu);
+	}
+
+	start = hist_now_ns();
+	if (o->duration) {
+		struct timespec ts = { o->duration, 0 };
+
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR && !interrupted)
+			;
+	} else {
+		while (!interrupted)
+			pause();
+	}
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	end = hist_now_ns();
+
+	for (i = 0; i < num_injs; i++) {
+		pthread_join(injs[i].thread, NULL);
+		sent += injs[i].sent;
+	}
+	for (i = 0; i < workers; i++) {
+		pthread_join(ws[i].thread, NULL);
+		frames += ws[i].frames;
+		if (ws[i].frames < min)
+			min = ws[i].frames;
+		if (ws[i].frames > max)
+			max = ws[i].frames;
+	}
+
+	secs = (end - start) / 1e9;
+	rate = secs > 0 ? frames / secs : 0.0;
+
+	if (!o->sweep) {
+		for (i = 0; i < workers; i++)
+			printf("worker %u (cpu %d): %lu frames, %lu bytes, %.1f frames/s, %lu polls\n",
+				ws[i].id, ws[i].cpu, ws[i].frames, ws[i].bytes,
+				secs > 0 ? ws[i].frames / secs : 0.0, ws[i].polls);
+	}
+	printf("%u workers: %lu frames in %.3f s, %.1f frames/s, per worker %lu..%lu",
+		workers, frames, secs, rate, min, max);
+	if (num_injs)
+		printf(", %lu injected", sent);
+	printf("\n");
+
+	for (i = 0; i < workers; i++) {
+		for (j = 0; j < ws[i].num_skts; j++)
+			close(ws[i].skts[j]);
+	}
+	free(ws);
+	return rate;
+
+err:
+	for (i = 0; i < workers; i++) {
+		for (j = 0; j < ws[i].num_skts; j++)
+			close(ws[i].skts[j]);
+	}
+	free(ws);
+	return -1;
+}
+
+static int open_injectors(const char *ifname, const struct proto **sel,
+	unsigned int num_sel, struct injector *injs, unsigned int num_injs,
+	const struct ifcache *ifc)
+{
+	const struct ifcache_entry *e = ifcache_find_name(ifc, ifname);
+	unsigned int i;
+
+	if (e == NULL) {
+		fprintf(stderr, "%s: no such device\n", ifname);
+		return -1;
+	}
+
+	for (i = 0; i < num_injs; i++) {
+		injs[i].skt = socket(PF_PACKET, SOCK_DGRAM, 0);
+		if (injs[i].skt == -1) {
+			int err = errno;
+			fprintf(stderr, "socket failed: %s\n", strerror(err));
+			while (i-- > 0)
+				close(injs[i].skt);
+			return -1;
+		}
+		injs[i].ifindex = e->ifindex;
+		injs[i].sel = sel;
+		injs[i].num_sel = num_sel;
+		/* fill CPUs from the top, workers start at the bottom */
+		injs[i].cpu = num_cpus - 1 - (i % num_cpus);
+	}
+
+	return 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-w workers] [-m hash|cpu|lb] [-p proto[,proto...]] [-t seconds] [-W work]\n"
+		"       [-f filter] [-i inject-ifname [-I injectors]] [-s] [ifname|pattern ...]\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct fanout_opts o = {
+		.workers = 0,
+		.mode = PACKET_FANOUT_CPU,
+		.injectors = 1,
+	};
+	const struct proto *sel[PROTO_MAX];
+	struct rx_target targets[MAX_SOCKETS];
+	struct injector injs[MAX_WORKERS];
+	const struct ifcache_entry *e;
+	const char *inject = NULL;
+	struct ifcache ifc;
+	struct sigaction sa;
+	unsigned int i, num_targets = 0, num_injs = 0;
+	double base = 0.0;
+	char *endptr;
+	int j, opt, num_sel = 0, ret = 0;
+	uint16_t group;
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (num_cpus < 1)
+		num_cpus = 1;
+
+	while ((opt = getopt(argc, argv, "w:m:p:t:W:f:i:I:s")) != -1) {
+		switch (opt) {
+		case 'w':
+			o.workers = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.workers == 0 || o.workers > MAX_WORKERS)
+				return usage(argv[0]);
+			break;
+		case 'm':
+			if (strcmp(optarg, "hash") == 0)
+				o.mode = PACKET_FANOUT_HASH;
+			else if (strcmp(optarg, "cpu") == 0)
+				o.mode = PACKET_FANOUT_CPU;
+			else if (strcmp(optarg, "lb") == 0)
+				o.mode = PACKET_FANOUT_LB;
+			else
+				return usage(argv[0]);
+			break;
+		case 'p':
+			num_sel = proto_parse_list(optarg, sel);
+			if (num_sel <= 0)
+				return usage(argv[0]);
+			break;
+		case 't':
+			o.duration = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'W':
+			o.work = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'f':
+			if (rxfilter_parse(&filter, optarg) < 0)
+				return 2;
+			break;
+		case 'i':
+			inject = optarg;
+			break;
+		case 'I':
+			o.injectors = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.injectors == 0 || o.injectors > MAX_WORKERS)
+				return usage(argv[0]);
+			break;
+		case 's':
+			o.sweep = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (o.workers == 0)
+		o.workers = num_cpus < MAX_WORKERS ? num_cpus : MAX_WORKERS;
+	if (num_sel == 0)
+		num_sel = proto_all(sel);
+	if (o.sweep && o.duration == 0)
+		o.duration = 5;
+	work_rounds = o.work;
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+
+	/* fanout group ids are global, so keep clear of other instances */
+	group = getpid() & 0xffff;
+
+	if (optind == argc) {
+		for (j = 0; j < num_sel; j++) {
+			targets[num_targets].e = NULL;
+			targets[num_targets].proto = sel[j];
+			targets[num_targets].group = group++;
+			num_targets++;
+		}
+	}
+	for (; optind < argc; optind++) {
+		const char *name = argv[optind];
+		int found = 0;
+
+		for (e = ifcache_next(&ifc, NULL, name, -1); e != NULL;
+		     e = ifcache_next(&ifc, e, name, -1)) {
+			/* patterns only pick LoRa and EnOcean interfaces */
+			if (ifcache_is_pattern(name) && e->type != ARPHRD_LORA &&
+			    e->type != ARPHRD_ENOCEAN)
+				continue;
+			found = 1;
+			for (j = 0; j < num_sel; j++) {
+				if (num_targets == MAX_SOCKETS) {
+					fprintf(stderr, "too many interfaces\n");
+					ifcache_free(&ifc);
+					return 1;
+				}
+				targets[num_targets].e = e;
+				targets[num_targets].proto = sel[j];
+				targets[num_targets].group = group++;
+				num_targets++;
+			}
+		}
+		if (!found) {
+			fprintf(stderr, "%s: no such device\n", name);
+			ret = 1;
+		}
+	}
+	if (num_targets == 0) {
+		ifcache_free(&ifc);
+		return 1;
+	}
+
+	if (inject != NULL) {
+		num_injs = o.injectors;
+		if (open_injectors(inject, sel, num_sel, injs, num_injs, &ifc) < 0) {
+			ifcache_free(&ifc);
+			return 1;
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	if (!o.sweep) {
+		if (run_once(&o, o.workers, targets, num_targets, injs, num_injs) < 0)
+			ret = 1;
+	} else {
+		for (i = 1; i <= o.workers; i++) {
+			double rate = run_once(&o, i, targets, num_targets, injs, num_injs);
+
+			if (rate < 0) {
+				ret = 1;
+				break;
+			}
+			if (i == 1)
+				base = rate;
+			printf("%u workers: %.2fx the rate of 1 worker\n", i,
+				base > 0 ? rate / base : 0.0);
+			if (interrupted)
+				break;
+		}
+	}
+
+	for (i = 0; i < num_injs; i++)
+		close(injs[i].skt);
+	ifcache_free(&ifc);
+	return ret;
+}
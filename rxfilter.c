@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "erp2.h"
+#include "rxfilter.h"
+#include "include/linux/lora.h"
+#include "include/linux/enocean.h"
+
+/* LoRaWAN MHDR MType values that carry a DevAddr */
+#define LORAWAN_MTYPE_SHIFT	5
+#define LORAWAN_MTYPE_DATA_MIN	2
+#define LORAWAN_MTYPE_DATA_MAX	5
+
+#define RET_ACCEPT		0x40000
+#define RET_DROP		0
+
+/*
+ * Tiny assembler: classic BPF only has forward jumps with 8 bit offsets,
+ * so jump targets are recorded as labels and resolved once the program
+ * is complete.
+ */
+
+enum {
+	L_DROP,
+	L_ACCEPT,
+	L_NEXT,
+	L_NUM = 64,
+};
+
+struct bpf_prog {
+	struct sock_filter *insns;
+	unsigned int len;
+	int labels[L_NUM];
+	unsigned int next_label;
+	/* jump labels per instruction, -1 falls through; ja keeps its in jt */
+	short jt[RXFILTER_MAX_INSNS];
+	short jf[RXFILTER_MAX_INSNS];
+	int err;
+};
+
+static void emit(struct bpf_prog *p, uint16_t code, uint32_t k)
+{
+	if (p->len == RXFILTER_MAX_INSNS) {
+		p->err = 1;
+		return;
+	}
+	p->insns[p->len] = (struct sock_filter)BPF_STMT(code, k);
+	p->jt[p->len] = -1;
+	p->jf[p->len] = -1;
+	p->len++;
+}
+
+static void emit_jump(struct bpf_prog *p, uint16_t code, uint32_t k, int jt, int jf)
+{
+	if (p->len == RXFILTER_MAX_INSNS) {
+		p->err = 1;
+		return;
+	}
+	p->insns[p->len] = (struct sock_filter)BPF_JUMP(BPF_JMP | code | BPF_K, k, 0, 0);
+	p->jt[p->len] = jt;
+	p->jf[p->len] = jf;
+	p->len++;
+}
+
+static void emit_ja(struct bpf_prog *p, int label)
+{
+	emit(p, BPF_JMP | BPF_JA, 0);
+	if (!p->err)
+		p->jt[p->len - 1] = label;
+}
+
+static int new_label(struct bpf_prog *p)
+{
+	if (p->next_label == L_NUM) {
+		p->err = 1;
+		return L_DROP;
+	}
+	p->labels[p->next_label] = -1;
+	return p->next_label++;
+}
+
+static void set_label(struct bpf_prog *p, int label)
+{
+	p->labels[label] = p->len;
+}
+
+static int resolve(struct bpf_prog *p)
+{
+	unsigned int i;
+
+	if (p->err)
+		return -1;
+
+	for (i = 0; i < p->len; i++) {
+		int t;
+
+		if (p->insns[i].code == (BPF_JMP | BPF_JA)) {
+			t = p->labels[p->jt[i]] - (int)i - 1;
+			if (p->labels[p->jt[i]] < 0 || t < 0)
+				return -1;
+			p->insns[i].k = t;
+			continue;
+		}
+		if (p->jt[i] >= 0) {
+			t = p->labels[p->jt[i]] - (int)i - 1;
+			if (p->labels[p->jt[i]] < 0 || t < 0 || t > 255)
+				return -1;
+			p->insns[i].jt = t;
+		}
+		if (p->jf[i] >= 0) {
+			t = p->labels[p->jf[i]] - (int)i - 1;
+			if (p->labels[p->jf[i]] < 0 || t < 0 || t > 255)
+				return -1;
+			p->insns[i].jf = t;
+		}
+	}
+	return p->len;
+}
+
+static int parse_u32(const char *s, char **end, uint32_t *val)
+{
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(s, end, 0);
+	if (errno || *end == s || v > 0xffffffffUL)
+		return -1;
+	*val = v;
+	return 0;
+}
+
+static int parse_term(struct rxfilter *f, char *term)
+{
+	char *val = strchr(term, '=');
+	char *end;
+
+	if (val == NULL)
+		return -1;
+	*val++ = '\0';
+
+	if (strcmp(term, "id") == 0) {
+		uint32_t lo, hi;
+
+		if (f->num_ids == RXFILTER_MAX_TERMS || parse_u32(val, &end, &lo) < 0)
+			return -1;
+		hi = lo;
+		if (*end == '-' && parse_u32(end + 1, &end, &hi) < 0)
+			return -1;
+		if (*end != '\0' || hi < lo)
+			return -1;
+		f->ids[f->num_ids].lo = lo;
+		f->ids[f->num_ids].hi = hi;
+		f->num_ids++;
+	} else if (strcmp(term, "devaddr") == 0) {
+		unsigned long addr, bits = 32;
+
+		if (f->num_devaddrs == RXFILTER_MAX_TERMS)
+			return -1;
+		errno = 0;
+		/* DevAddrs are written in hex, with or without 0x */
+		addr = strtoul(val, &end, 16);
+		if (errno || end == val || addr > 0xffffffffUL)
+			return -1;
+		if (*end == '/') {
+			bits = strtoul(end + 1, &end, 10);
+			if (bits > 32)
+				return -1;
+		}
+		if (*end != '\0')
+			return -1;
+		f->devaddrs[f->num_devaddrs].mask = bits ? ~0u << (32 - bits) : 0;
+		f->devaddrs[f->num_devaddrs].addr = addr & f->devaddrs[f->num_devaddrs].mask;
+		f->num_devaddrs++;
+	} else if (strcmp(term, "minlen") == 0) {
+		if (parse_u32(val, &end, &f->min_len) < 0 || *end != '\0')
+			return -1;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+int rxfilter_parse(struct rxfilter *f, const char *expr)
+{
+	char *copy, *term, *save;
+	int ret = 0;
+
+	memset(f, 0, sizeof(*f));
+
+	copy = strdup(expr);
+	if (copy == NULL)
+		return -1;
+
+	for (term = strtok_r(copy, ", ", &save); term != NULL;
+	     term = strtok_r(NULL, ", ", &save)) {
+		char *orig = strdupa(term);
+
+		if (parse_term(f, term) < 0) {
+			fprintf(stderr, "invalid filter term: %s\n", orig);
+			ret = -1;
+			break;
+		}
+	}
+
+	free(copy);
+	return ret;
+}
+
+/*
+ * Leaves the originator ID in A, or jumps to L_DROP for ERP2 frames with
+ * 48 bit or reserved addressing.
+ */
+static void compile_erp2_id(struct bpf_prog *p)
+{
+	int no_ext_type = new_label(p);
+	int id24 = new_label(p);
+	int id32 = new_label(p);
+	int done = new_label(p);
+
+	/* M[0] = offset of the originator ID */
+	emit(p, BPF_LD | BPF_B | BPF_ABS, 0);
+	emit(p, BPF_ALU | BPF_AND | BPF_K, ERP2_EXT_HDR);
+	emit(p, BPF_ALU | BPF_RSH | BPF_K, 4);
+	emit(p, BPF_ALU | BPF_ADD | BPF_K, 1);
+	emit(p, BPF_ST, 0);
+	emit(p, BPF_LD | BPF_B | BPF_ABS, 0);
+	emit(p, BPF_ALU | BPF_AND | BPF_K, ERP2_TYPE_MASK);
+	emit_jump(p, BPF_JEQ, ERP2_TYPE_EXT, -1, no_ext_type);
+	emit(p, BPF_LD | BPF_MEM, 0);
+	emit(p, BPF_ALU | BPF_ADD | BPF_K, 1);
+	emit(p, BPF_ST, 0);
+	set_label(p, no_ext_type);
+	emit(p, BPF_LDX | BPF_MEM, 0);
+
+	emit(p, BPF_LD | BPF_B | BPF_ABS, 0);
+	emit(p, BPF_ALU | BPF_RSH | BPF_K, ERP2_ADDR_SHIFT);
+	emit_jump(p, BPF_JEQ, ERP2_ADDR_ID24, id24, -1);
+	emit_jump(p, BPF_JEQ, ERP2_ADDR_ID32, id32, -1);
+	emit_jump(p, BPF_JEQ, ERP2_ADDR_ID32_DST, id32, L_DROP);
+
+	/* no 24 bit loads, so combine a halfword and a byte */
+	set_label(p, id24);
+	emit(p, BPF_LD | BPF_B | BPF_IND, 2);
+	emit(p, BPF_ST, 1);
+	emit(p, BPF_LD | BPF_H | BPF_IND, 0);
+	emit(p, BPF_ALU | BPF_LSH | BPF_K, 8);
+	emit(p, BPF_LDX | BPF_MEM, 1);
+	emit(p, BPF_ALU | BPF_OR | BPF_X, 0);
+	emit_ja(p, done);
+
+	set_label(p, id32);
+	emit(p, BPF_LD | BPF_W | BPF_IND, 0);
+	set_label(p, done);
+}
+
+int rxfilter_compile(const struct rxfilter *f, uint16_t eth_p,
+	struct sock_filter *insns)
+{
+	struct bpf_prog p;
+	unsigned int i;
+	int use_ids = eth_p == ETH_P_ERP2 && f->num_ids > 0;
+	int use_devaddrs = eth_p == ETH_P_LORAWAN && f->num_devaddrs > 0;
+
+	if (!use_ids && !use_devaddrs && f->min_len == 0)
+		return 0;
+
+	memset(&p, 0, sizeof(p));
+	p.insns = insns;
+	p.next_label = L_NEXT;
+	p.labels[L_DROP] = -1;
+	p.labels[L_ACCEPT] = -1;
+
+	if (f->min_len) {
+		emit(&p, BPF_LD | BPF_W | BPF_LEN, 0);
+		emit_jump(&p, BPF_JGE, f->min_len, -1, L_DROP);
+	}
+
+	if (use_ids) {
+		compile_erp2_id(&p);
+		for (i = 0; i < f->num_ids; i++) {
+			int next = new_label(&p);
+
+			emit_jump(&p, BPF_JGE, f->ids[i].lo, -1, next);
+			emit_jump(&p, BPF_JGT, f->ids[i].hi, next, L_ACCEPT);
+			set_label(&p, next);
+		}
+		emit(&p, BPF_RET | BPF_K, RET_DROP);
+	}
+
+	if (use_devaddrs) {
+		emit(&p, BPF_LD | BPF_B | BPF_ABS, 0);
+		emit(&p, BPF_ALU | BPF_RSH | BPF_K, LORAWAN_MTYPE_SHIFT);
+		emit_jump(&p, BPF_JGE, LORAWAN_MTYPE_DATA_MIN, -1, L_DROP);
+		emit_jump(&p, BPF_JGT, LORAWAN_MTYPE_DATA_MAX, L_DROP, -1);
+		/*
+		 * Absolute word loads are big endian but the DevAddr is sent
+		 * little endian, so swap the mask and prefix instead of the
+		 * loaded value.
+		 */
+		emit(&p, BPF_LD | BPF_W | BPF_ABS, 1);
+		emit(&p, BPF_ST, 0);
+		for (i = 0; i < f->num_devaddrs; i++) {
+			uint32_t mask = __builtin_bswap32(f->devaddrs[i].mask);
+			uint32_t addr = __builtin_bswap32(f->devaddrs[i].addr);
+
+			if (i > 0)
+				emit(&p, BPF_LD | BPF_MEM, 0);
+			emit(&p, BPF_ALU | BPF_AND | BPF_K, mask);
+			emit_jump(&p, BPF_JEQ, addr, L_ACCEPT, -1);
+		}
+		emit(&p, BPF_RET | BPF_K, RET_DROP);
+	}
+
+	set_label(&p, L_ACCEPT);
+	emit(&p, BPF_RET | BPF_K, RET_ACCEPT);
+	set_label(&p, L_DROP);
+	emit(&p, BPF_RET | BPF_K, RET_DROP);
+
+	return resolve(&p);
+}
+
+int rxfilter_attach(int skt, const struct rxfilter *f, uint16_t eth_p)
+{
+	struct sock_filter insns[RXFILTER_MAX_INSNS];
+	struct sock_fprog prog;
+	int len;
+
+	len = rxfilter_compile(f, eth_p, insns);
+	if (len < 0) {
+		fprintf(stderr, "filter too large\n");
+		return -1;
+	}
+	if (len == 0)
+		return 0;
+
+	prog.len = len;
+	prog.filter = insns;
+	if (setsockopt(skt, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1) {
+		int err = errno;
+		fprintf(stderr, "SO_ATTACH_FILTER failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	return 0;
+}
+
+int rxfilter_match(const struct rxfilter *f, uint16_t eth_p,
+	const unsigned char *buf, unsigned int len)
+{
+	unsigned int i, off;
+	uint32_t v;
+
+	if (len < f->min_len)
+		return 0;
+
+	if (eth_p == ETH_P_ERP2 && f->num_ids > 0) {
+		if (len < 1)
+			return 0;
+		off = 1;
+		if (buf[0] & ERP2_EXT_HDR)
+			off++;
+		if ((buf[0] & ERP2_TYPE_MASK) == ERP2_TYPE_EXT)
+			off++;
+		switch (buf[0] >> ERP2_ADDR_SHIFT) {
+		case ERP2_ADDR_ID24:
+			if (len < off + 3)
+				return 0;
+			v = buf[off] << 16 | buf[off + 1] << 8 | buf[off + 2];
+			break;
+		case ERP2_ADDR_ID32:
+		case ERP2_ADDR_ID32_DST:
+			if (len < off + 4)
+				return 0;
+			v = (uint32_t)buf[off] << 24 | buf[off + 1] << 16 |
+				buf[off + 2] << 8 | buf[off + 3];
+			break;
+		default:
+			return 0;
+		}
+		for (i = 0; i < f->num_ids; i++) {
+			if (v >= f->ids[i].lo && v <= f->ids[i].hi)
+				return 1;
+		}
+		return 0;
+	}
+
+	if (eth_p == ETH_P_LORAWAN && f->num_devaddrs > 0) {
+		if (len < 5)
+			return 0;
+		v = buf[0] >> LORAWAN_MTYPE_SHIFT;
+		if (v < LORAWAN_MTYPE_DATA_MIN || v > LORAWAN_MTYPE_DATA_MAX)
+			return 0;
+		v = buf[1] | buf[2] << 8 | buf[3] << 16 | (uint32_t)buf[4] << 24;
+		for (i = 0; i < f->num_devaddrs; i++) {
+			if ((v & f->devaddrs[i].mask) == f->devaddrs[i].addr)
+				return 1;
+		}
+		return 0;
+	}
+
+	return 1;
+}
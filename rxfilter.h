@@ -0,0 +1,58 @@
+#ifndef RXFILTER_H
+#define RXFILTER_H
+
+#include <stdint.h>
+#include <linux/filter.h>
+
+/*
+ * Receive filters compiled to classic BPF, so frames nobody asked for are
+ * dropped in the kernel before they are copied to userspace.
+ *
+ * An expression is a comma separated list of terms:
+ *
+ *   id=0x0180abcd or id=0x01800000-0x0180ffff
+ *	ERP2 originator ID or ID range (24 and 32 bit IDs)
+ *   devaddr=26011a00/24
+ *	LoRaWAN DevAddr prefix (data frames only)
+ *   minlen=12
+ *	minimum frame length
+ *
+ * Terms of the same kind are or'ed, different kinds are and'ed. id terms
+ * only apply to ETH_P_ERP2 sockets and devaddr terms only to ETH_P_LORAWAN
+ * sockets; minlen applies to all of them.
+ */
+
+#define RXFILTER_MAX_TERMS	16
+#define RXFILTER_MAX_INSNS	256
+
+struct rxfilter {
+	uint32_t min_len;
+	unsigned int num_ids;
+	struct {
+		uint32_t lo, hi;
+	} ids[RXFILTER_MAX_TERMS];
+	unsigned int num_devaddrs;
+	struct {
+		uint32_t addr, mask;
+	} devaddrs[RXFILTER_MAX_TERMS];
+};
+
+/* Returns 0, or -1 after printing what is wrong with expr. */
+int rxfilter_parse(struct rxfilter *f, const char *expr);
+
+/*
+ * Compile the terms relevant to protocol eth_p into insns, which must have
+ * room for RXFILTER_MAX_INSNS instructions. Returns the number of
+ * instructions, 0 if nothing needs filtering for eth_p, or -1.
+ */
+int rxfilter_compile(const struct rxfilter *f, uint16_t eth_p,
+	struct sock_filter *insns);
+
+/* Compile for eth_p and attach with SO_ATTACH_FILTER. */
+int rxfilter_attach(int skt, const struct rxfilter *f, uint16_t eth_p);
+
+/* The same decision in plain C, for comparison and for testing. */
+int rxfilter_match(const struct rxfilter *f, uint16_t eth_p,
+	const unsigned char *buf, unsigned int len);
+
+#endif
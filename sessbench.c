@@ -0,0 +1,322 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hist.h"
+#include "lorawan.h"
+#include "sesstab.h"
+#include "simdev.h"
+
+/*
+ * Exercises a session table file the way a network server's receive path
+ * would. The table is opened, or created and filled with -n devices, then
+ * DevAddrs are looked up at random. After that, batches of uplinks go
+ * through lookup, MIC check and counter commit, and are replayed to
+ * check that every copy is rejected. A replayed FCnt is behind the
+ * session's counter, so it is taken for one that rolled over and fails
+ * the MIC rather than being reported as a replay.
+ *
+ * Run it again on the same file to measure a cold start from the mapped
+ * file. Use -x to exit without closing, so that the next run has to
+ * recover.
+ */
+
+#define CAND_MAX	4
+
+struct bench_opts {
+	const char *path;
+	unsigned int devices;
+	unsigned int capacity;
+	unsigned long lookups;
+	unsigned int uplinks;
+	unsigned int batch;
+	int crash;
+};
+
+static int populate(struct sesstab *t, unsigned int from, unsigned int to)
+{
+	uint8_t nwk[16], app[16], eui[8];
+	uint64_t t0 = hist_now_ns();
+	unsigned int i;
+
+	for (i = from; i < to; i++) {
+		simdev_key(i, 0, nwk);
+		simdev_key(i, 1, app);
+		simdev_eui(i, eui);
+		if (sesstab_add(t, simdev_addr(i), eui, nwk, app, 0, 0) == NULL) {
+			fprintf(stderr, "adding device %u failed: %s\n", i, strerror(errno));
+			return -1;
+		}
+	}
+	if (to > from)
+		printf("added %u devices in %.3f s, %.0f ns each\n", to - from,
+			(hist_now_ns() - t0) / 1e9, (double)(hist_now_ns() - t0) / (to - from));
+	return 0;
+}
+
+/* keeps the loads in bench_lookups() from being optimized out */
+static volatile uint64_t sink;
+
+static void bench_lookups(struct sesstab *t, const struct bench_opts *o, const char *name)
+{
+	struct hist h;
+	uint64_t t0, t1, sum = 0;
+	unsigned long i, missing = 0;
+
+	hist_init(&h);
+	t0 = hist_now_ns();
+	for (i = 0; i < o->lookups; i++) {
+		unsigned int dev = mix64(i ^ t0) % o->devices, iter = 0;
+		uint32_t devaddr = simdev_addr(dev);
+		struct sesstab_rec *r;
+		uint64_t s = hist_now_ns();
+
+		r = sesstab_find(t, devaddr, &iter);
+		/* touch what verifying a MIC would, the key and the counter */
+		if (r != NULL)
+			sum += r->nwk.aes.rk[10][0] + (uint32_t)atomic_load(&r->up);
+		else
+			missing++;
+		hist_add(&h, hist_now_ns() - s);
+	}
+	t1 = hist_now_ns();
+	sink = sum;
+	printf("%s: %lu lookups, %.1f ns each including clock reads, %lu missing\n",
+		name, o->lookups, (double)(t1 - t0) / o->lookups, missing);
+	hist_print(name, &h);
+}
+
+struct uplink {
+	uint8_t buf[LORAWAN_DATA_MIN + 1 + 16];
+	unsigned int len;
+	uint32_t devaddr;
+};
+
+static int make_uplinks(struct sesstab *t, const struct bench_opts *o, struct uplink *up)
+{
+	uint8_t payload[16] = { 0 }, raw[16], eui[8];
+	uint16_t *sent = calloc(o->devices, sizeof(*sent));
+	struct lorawan_key key;
+	unsigned int i;
+
+	if (sent == NULL)
+		return -1;
+
+	for (i = 0; i < o->uplinks; i++) {
+		unsigned int dev = mix64(i + 0x5eed) % o->devices, iter = 0;
+		struct lorawan_frame f = {
+			.mtype = LORAWAN_UNCONFIRMED_UP,
+			.devaddr = simdev_addr(dev),
+			.fport = 1,
+			.payload = payload,
+			.payload_len = sizeof(payload),
+		};
+		struct sesstab_rec *r;
+		uint32_t fcnt = 0;
+
+		/* carry on from the device's counter, so frames are accepted once */
+		simdev_eui(dev, eui);
+		while ((r = sesstab_find(t, f.devaddr, &iter)) != NULL) {
+			if (memcmp(r->dev_eui, eui, sizeof(eui)) == 0)
+				break;
+		}
+		if (r != NULL)
+			fcnt = (uint32_t)atomic_load(&r->up);
+		fcnt += sent[dev]++;
+
+		simdev_key(dev, 0, raw);
+		lorawan_key_init(&key, raw);
+		up[i].len = lorawan_build(up[i].buf, sizeof(up[i].buf), &f, fcnt, &key, &key);
+		up[i].devaddr = f.devaddr;
+	}
+	free(sent);
+	return 0;
+}
+
+/*
+ * What a receive thread does with a batch of uplinks: look up every
+ * session the DevAddr could belong to, check all their MICs in one batch
+ * and commit the counter of the one that matched.
+ */
+static void verify_uplinks(struct sesstab *t, const struct bench_opts *o,
+	const struct uplink *up, const char *name)
+{
+	struct lorawan_mic_job *jobs = calloc((size_t)o->batch * CAND_MAX, sizeof(*jobs));
+	struct sesstab_rec **recs = calloc((size_t)o->batch * CAND_MAX, sizeof(*recs));
+	uint64_t *snaps = calloc((size_t)o->batch * CAND_MAX, sizeof(*snaps));
+	unsigned long accepted = 0, replay = 0, bad_mic = 0, other = 0, cands = 0;
+	unsigned int i, j, n;
+	uint64_t t0;
+
+	if (jobs == NULL || recs == NULL || snaps == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	t0 = hist_now_ns();
+	for (i = 0; i < o->uplinks; i += o->batch) {
+		unsigned int end = i + o->batch < o->uplinks ? i + o->batch : o->uplinks;
+		unsigned int valid;
+
+		for (n = 0, j = i; j < end; j++) {
+			const struct uplink *u = &up[j];
+			uint16_t fcnt = u->buf[6] | u->buf[7] << 8;
+			unsigned int iter = 0, c = 0;
+			struct sesstab_rec *r;
+
+			while (c < CAND_MAX && (r = sesstab_find(t, u->devaddr, &iter)) != NULL) {
+				jobs[n].buf = u->buf;
+				jobs[n].len = u->len;
+				jobs[n].key = &r->nwk;
+				jobs[n].fcnt = sesstab_fcnt_up(r, fcnt, &snaps[n]);
+				recs[n++] = r;
+				c++;
+			}
+			cands += c;
+		}
+
+		valid = lorawan_verify_batch(jobs, n);
+		bad_mic += end - i - valid;
+		for (j = 0; j < n; j++) {
+			if (!jobs[j].ok)
+				continue;
+			switch (sesstab_fcnt_up_commit(recs[j], snaps[j], jobs[j].fcnt)) {
+			case 0:
+				accepted++;
+				break;
+			case -EALREADY:
+				replay++;
+				break;
+			default:
+				other++;
+				break;
+			}
+		}
+	}
+	t0 = hist_now_ns() - t0;
+
+	printf("%s: %u uplinks in %.3f s, %.0f ns each: %lu accepted, %lu replayed, %lu failed the MIC or had no session, %lu other; %.3f sessions per DevAddr\n",
+		name, o->uplinks, t0 / 1e9, (double)t0 / o->uplinks, accepted, replay, bad_mic,
+		other, (double)cands / o->uplinks);
+	free(snaps);
+	free(recs);
+	free(jobs);
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-f file] [-n devices] [-C capacity] [-l lookups] [-u uplinks] [-b batch] [-x]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_opts o = {
+		.path = "sessions.tab",
+		.devices = 200000,
+		.lookups = 1000000,
+		.uplinks = 200000,
+		.batch = 64,
+	};
+	struct sesstab_stats st;
+	struct sesstab *t;
+	struct uplink *up;
+	uint64_t t0;
+	char *endptr;
+	int opt, ret, status = 0;
+
+	while ((opt = getopt(argc, argv, "f:n:C:l:u:b:x")) != -1) {
+		switch (opt) {
+		case 'f':
+			o.path = optarg;
+			break;
+		case 'n':
+			o.devices = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.devices == 0)
+				return usage(argv[0]);
+			break;
+		case 'C':
+			o.capacity = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'l':
+			o.lookups = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'u':
+			o.uplinks = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0)
+				return usage(argv[0]);
+			break;
+		case 'x':
+			o.crash = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc)
+		return usage(argv[0]);
+	if (o.capacity == 0)
+		o.capacity = o.devices + o.devices / 4;
+
+	t0 = hist_now_ns();
+	t = sesstab_open(o.path, o.capacity);
+	if (t == NULL) {
+		fprintf(stderr, "%s: %s\n", o.path, strerror(errno));
+		return 1;
+	}
+	sesstab_get_stats(t, &st);
+	printf("opened %s in %.3f ms: %u of %u sessions, index of %u%s\n", o.path,
+		(hist_now_ns() - t0) / 1e6, st.count, st.capacity, st.index_size,
+		st.recovered ? ", recovered from an unclean shutdown" : "");
+
+	/* failures still close the table, or the next open would recover it */
+	if (st.count < o.devices && populate(t, st.count, o.devices)) {
+		status = 1;
+		goto close;
+	}
+
+	if (o.lookups != 0) {
+		bench_lookups(t, &o, "first");
+		bench_lookups(t, &o, "warm");
+	}
+
+	if (o.uplinks != 0) {
+		up = calloc(o.uplinks, sizeof(*up));
+		if (up == NULL || make_uplinks(t, &o, up)) {
+			fprintf(stderr, "out of memory\n");
+			free(up);
+			status = 1;
+			goto close;
+		}
+		verify_uplinks(t, &o, up, "uplinks");
+		verify_uplinks(t, &o, up, "replayed");
+		free(up);
+	}
+
+	if (o.crash) {
+		printf("exiting without closing\n");
+		return 0;
+	}
+close:
+	t0 = hist_now_ns();
+	ret = sesstab_close(t);
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", o.path, strerror(-ret));
+		return 1;
+	}
+	printf("closed in %.3f ms\n", (hist_now_ns() - t0) / 1e6);
+	return status;
+}
@@ -0,0 +1,395 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sesstab.h"
+
+#define SESSTAB_MAGIC	"LWSESS\0"
+#define SESSTAB_VERSION	1
+#define HDR_SIZE	4096
+
+/* index entries are DevAddr << 32 | record + 1 */
+#define SLOT_EMPTY	0
+#define SLOT_TOMB	UINT32_MAX
+
+struct sesstab_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+	uint32_t capacity;
+	uint32_t index_size;
+	uint32_t count;
+	/* records below this have been handed out at least once */
+	uint32_t used;
+	/* first free record + 1, 0 when only records from used on are free */
+	uint32_t free_head;
+	uint32_t tombstones;
+	uint32_t clean;
+};
+
+struct sesstab {
+	int fd;
+	void *map;
+	size_t map_len;
+	struct sesstab_hdr *hdr;
+	_Atomic uint64_t *index;
+	struct sesstab_rec *recs;
+	unsigned int mask;
+	int recovered;
+};
+
+static uint32_t crc_table[256];
+
+__attribute__((constructor)) static void crc_init(void)
+{
+	uint32_t c;
+	unsigned int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+static uint32_t crc32(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	crc = ~crc;
+	while (len--)
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+static uint32_t rec_crc(const struct sesstab_rec *r)
+{
+	uint32_t crc = crc32(0, &r->devaddr, sizeof(r->devaddr));
+
+	crc = crc32(crc, r->dev_eui, sizeof(r->dev_eui));
+	crc = crc32(crc, r->app_skey, sizeof(r->app_skey));
+	return crc32(crc, &r->nwk, sizeof(r->nwk));
+}
+
+static inline unsigned int hash(const struct sesstab *t, uint32_t devaddr)
+{
+	return ((uint64_t)devaddr * 0x9e3779b97f4a7c15ull) >> 32 & t->mask;
+}
+
+static inline uint64_t entry(uint32_t devaddr, uint32_t slot)
+{
+	return (uint64_t)devaddr << 32 | slot;
+}
+
+static size_t index_bytes(uint32_t index_size)
+{
+	size_t len = (size_t)index_size * sizeof(uint64_t);
+
+	return (len + HDR_SIZE - 1) & ~(size_t)(HDR_SIZE - 1);
+}
+
+static size_t file_size(uint32_t capacity, uint32_t index_size)
+{
+	return HDR_SIZE + index_bytes(index_size) + (size_t)capacity * SESSTAB_REC_SIZE;
+}
+
+static void index_insert(struct sesstab *t, uint32_t devaddr, uint32_t rec)
+{
+	unsigned int idx = hash(t, devaddr);
+
+	for (;; idx = (idx + 1) & t->mask) {
+		uint32_t slot = atomic_load_explicit(&t->index[idx], memory_order_relaxed);
+
+		if (slot == SLOT_EMPTY || slot == SLOT_TOMB) {
+			if (slot == SLOT_TOMB)
+				t->hdr->tombstones--;
+			/* the record is complete; publish it */
+			atomic_store_explicit(&t->index[idx], entry(devaddr, rec + 1),
+				memory_order_release);
+			return;
+		}
+	}
+}
+
+void sesstab_rehash(struct sesstab *t)
+{
+	uint32_t i;
+
+	memset((void *)t->index, 0, (size_t)t->hdr->index_size * sizeof(uint64_t));
+	t->hdr->tombstones = 0;
+	for (i = 0; i < t->hdr->used; i++) {
+		if (t->recs[i].link == SESSTAB_LIVE)
+			index_insert(t, t->recs[i].devaddr, i);
+	}
+}
+
+/*
+ * Trust only records that are marked live and whose contents check out,
+ * and rebuild everything else from them. Untouched records are holes in
+ * the file and read as zeroes, i.e. free.
+ */
+static void recover(struct sesstab *t)
+{
+	struct sesstab_hdr *hdr = t->hdr;
+	uint32_t i, live = 0;
+
+	hdr->used = 0;
+	for (i = 0; i < hdr->capacity; i++) {
+		struct sesstab_rec *r = &t->recs[i];
+
+		if (r->link != SESSTAB_LIVE)
+			continue;
+		if (r->crc != rec_crc(r)) {
+			r->link = 0;
+			continue;
+		}
+		atomic_fetch_add_explicit(&r->fcnt_down, SESSTAB_DOWN_SKIP, memory_order_relaxed);
+		hdr->used = i + 1;
+		live++;
+	}
+
+	hdr->free_head = 0;
+	for (i = hdr->used; i-- > 0;) {
+		if (t->recs[i].link != SESSTAB_LIVE) {
+			t->recs[i].link = hdr->free_head;
+			hdr->free_head = i + 1;
+		}
+	}
+	hdr->count = live;
+	sesstab_rehash(t);
+}
+
+static int check_hdr(const struct sesstab_hdr *hdr, size_t len)
+{
+	if (memcmp(hdr->magic, SESSTAB_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    hdr->version != SESSTAB_VERSION || hdr->rec_size != SESSTAB_REC_SIZE ||
+	    hdr->index_size == 0 || (hdr->index_size & (hdr->index_size - 1)) != 0 ||
+	    hdr->index_size < hdr->capacity || file_size(hdr->capacity, hdr->index_size) != len)
+		return -EINVAL;
+	return 0;
+}
+
+struct sesstab *sesstab_open(const char *path, unsigned int capacity)
+{
+	struct sesstab *t;
+	struct stat st;
+	uint32_t index_size = 64;
+	int err, created = 0;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	t->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (t->fd < 0 || fstat(t->fd, &st) < 0)
+		goto fail;
+
+	if (st.st_size == 0) {
+		if (capacity == 0) {
+			errno = EINVAL;
+			goto fail;
+		}
+		/* at most half full, so probes stay short */
+		while (index_size < 2 * capacity)
+			index_size <<= 1;
+		/* the file stays sparse until records are written */
+		if (ftruncate(t->fd, file_size(capacity, index_size)) < 0)
+			goto fail;
+		st.st_size = file_size(capacity, index_size);
+		created = 1;
+	}
+
+	t->map_len = st.st_size;
+	if (t->map_len < HDR_SIZE) {
+		errno = EINVAL;
+		goto fail;
+	}
+	t->map = mmap(NULL, t->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, t->fd, 0);
+	if (t->map == MAP_FAILED) {
+		t->map = NULL;
+		goto fail;
+	}
+	t->hdr = t->map;
+
+	if (created) {
+		memcpy(t->hdr->magic, SESSTAB_MAGIC, sizeof(t->hdr->magic));
+		t->hdr->version = SESSTAB_VERSION;
+		t->hdr->rec_size = SESSTAB_REC_SIZE;
+		t->hdr->capacity = capacity;
+		t->hdr->index_size = index_size;
+		t->hdr->clean = 1;
+	}
+	if (check_hdr(t->hdr, t->map_len)) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	t->index = (_Atomic uint64_t *)((char *)t->map + HDR_SIZE);
+	t->recs = (struct sesstab_rec *)((char *)t->map + HDR_SIZE +
+		index_bytes(t->hdr->index_size));
+	t->mask = t->hdr->index_size - 1;
+	/* every lookup starts in the index, so start reading it in now */
+	madvise((void *)t->index, index_bytes(t->hdr->index_size), MADV_WILLNEED);
+
+	if (!t->hdr->clean) {
+		recover(t);
+		t->recovered = 1;
+	}
+	/* from here on a crash has to be noticed by the next open */
+	t->hdr->clean = 0;
+	if (msync(t->map, HDR_SIZE, MS_SYNC) < 0)
+		goto fail;
+	return t;
+
+fail:
+	err = errno;
+	if (t->map != NULL)
+		munmap(t->map, t->map_len);
+	if (t->fd >= 0)
+		close(t->fd);
+	free(t);
+	errno = err;
+	return NULL;
+}
+
+int sesstab_sync(struct sesstab *t)
+{
+	if (msync(t->map, t->map_len, MS_SYNC) < 0)
+		return -errno;
+	return 0;
+}
+
+int sesstab_close(struct sesstab *t)
+{
+	int ret;
+
+	ret = sesstab_sync(t);
+	if (ret == 0) {
+		t->hdr->clean = 1;
+		if (msync(t->map, HDR_SIZE, MS_SYNC) < 0)
+			ret = -errno;
+	}
+	munmap(t->map, t->map_len);
+	close(t->fd);
+	free(t);
+	return ret;
+}
+
+struct sesstab_rec *sesstab_find(struct sesstab *t, uint32_t devaddr, unsigned int *iter)
+{
+	unsigned int pos, idx;
+
+	for (pos = *iter; pos <= t->mask; pos++) {
+		uint64_t e;
+
+		idx = (hash(t, devaddr) + pos) & t->mask;
+		e = atomic_load_explicit(&t->index[idx], memory_order_acquire);
+		if ((uint32_t)e == SLOT_EMPTY)
+			break;
+		if ((uint32_t)e == SLOT_TOMB || e >> 32 != devaddr)
+			continue;
+		*iter = pos + 1;
+		return &t->recs[(uint32_t)e - 1];
+	}
+	*iter = t->mask + 1;
+	return NULL;
+}
+
+struct sesstab_rec *sesstab_add(struct sesstab *t, uint32_t devaddr, const uint8_t *dev_eui,
+	const uint8_t *nwk_skey, const uint8_t *app_skey, uint32_t fcnt_up, uint32_t fcnt_down)
+{
+	struct sesstab_hdr *hdr = t->hdr;
+	struct sesstab_rec *r;
+	uint32_t rec;
+	uint64_t up;
+
+	/* tombstones count against the index too; sesstab_rehash() clears them */
+	if (hdr->count + hdr->tombstones >= hdr->index_size / 4 * 3) {
+		errno = EAGAIN;
+		return NULL;
+	}
+	if (hdr->free_head != 0) {
+		rec = hdr->free_head - 1;
+	} else if (hdr->used < hdr->capacity) {
+		rec = hdr->used;
+	} else {
+		errno = ENOSPC;
+		return NULL;
+	}
+	r = &t->recs[rec];
+
+	r->devaddr = devaddr;
+	memcpy(r->dev_eui, dev_eui, sizeof(r->dev_eui));
+	memcpy(r->app_skey, app_skey, sizeof(r->app_skey));
+	lorawan_key_init(&r->nwk, nwk_skey);
+	r->crc = rec_crc(r);
+	atomic_store_explicit(&r->fcnt_down, fcnt_down, memory_order_relaxed);
+	/* a new generation, so commits against an earlier occupant fail */
+	up = atomic_load_explicit(&r->up, memory_order_relaxed);
+	atomic_store_explicit(&r->up, ((up >> 32) + 1) << 32 | fcnt_up, memory_order_relaxed);
+
+	if (hdr->free_head != 0)
+		hdr->free_head = r->link;
+	else
+		hdr->used++;
+	r->link = SESSTAB_LIVE;
+	hdr->count++;
+	index_insert(t, devaddr, rec);
+	return r;
+}
+
+void sesstab_del(struct sesstab *t, struct sesstab_rec *r)
+{
+	uint32_t rec = r - t->recs;
+	unsigned int idx = hash(t, r->devaddr), pos;
+
+	for (pos = 0; pos <= t->mask; pos++, idx = (idx + 1) & t->mask) {
+		uint64_t e = atomic_load_explicit(&t->index[idx], memory_order_relaxed);
+
+		if ((uint32_t)e == SLOT_EMPTY)
+			break;
+		if ((uint32_t)e == rec + 1) {
+			atomic_store_explicit(&t->index[idx], entry(0, SLOT_TOMB),
+				memory_order_release);
+			t->hdr->tombstones++;
+			break;
+		}
+	}
+
+	atomic_fetch_add_explicit(&r->up, 1ull << 32, memory_order_release);
+	r->link = t->hdr->free_head;
+	t->hdr->free_head = rec + 1;
+	t->hdr->count--;
+}
+
+int sesstab_fcnt_up_commit(struct sesstab_rec *r, uint64_t snap, uint32_t fcnt)
+{
+	uint64_t up = snap;
+
+	do {
+		uint32_t next = (uint32_t)up;
+
+		if (up >> 32 != snap >> 32)
+			return -ESTALE;
+		if (fcnt < next)
+			return -EALREADY;
+		if (fcnt - next > SESSTAB_MAX_FCNT_GAP)
+			return -ERANGE;
+	} while (!atomic_compare_exchange_weak_explicit(&r->up, &up,
+			(up & ~0xffffffffull) | (fcnt + 1),
+			memory_order_acq_rel, memory_order_acquire));
+	return 0;
+}
+
+void sesstab_get_stats(const struct sesstab *t, struct sesstab_stats *st)
+{
+	st->capacity = t->hdr->capacity;
+	st->count = t->hdr->count;
+	st->tombstones = t->hdr->tombstones;
+	st->index_size = t->hdr->index_size;
+	st->recovered = t->recovered;
+}
@@ -0,0 +1,131 @@
+#ifndef SESSTAB_H
+#define SESSTAB_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "lorawan.h"
+
+/*
+ * LoRaWAN sessions by DevAddr in a file that is mapped rather than loaded.
+ * The file holds a header page, an open-addressing index of 8-byte
+ * (DevAddr, record) entries and an array of 256-byte, cache-line-aligned
+ * records. A record holds the expanded network session key ready for
+ * lorawan_verify_batch() and the frame counters, which are updated with
+ * atomics in place.
+ *
+ * One thread adds and deletes sessions; any number of threads look them up
+ * and advance their counters concurrently. A record is written completely
+ * before the index entry pointing to it is published, so a crash never
+ * leaves a reachable half-written session. The header records whether the
+ * table was closed cleanly; if not, sesstab_open() checks every record,
+ * rebuilds the index and moves every downlink counter forward by
+ * SESSTAB_DOWN_SKIP, as increments since the last sync may not have made
+ * it to disk. Uplink counters cannot be moved forward like that without
+ * rejecting the devices' next frames, see sesstab_sync().
+ */
+
+#define SESSTAB_REC_SIZE	256
+#define SESSTAB_DOWN_SKIP	1000
+/* how far ahead of the expected FCnt an uplink may be, as in LoRaWAN 1.0 */
+#define SESSTAB_MAX_FCNT_GAP	16384
+
+struct sesstab_rec {
+	/* record generation << 32 | next expected uplink FCnt */
+	_Atomic uint64_t up;
+	atomic_uint fcnt_down;
+	uint32_t devaddr;
+	/* SESSTAB_LIVE, or the next free record + 1 */
+	uint32_t link;
+	/* over devaddr, dev_eui, app_skey and nwk */
+	uint32_t crc;
+	uint8_t dev_eui[8];
+	uint8_t app_skey[16];
+	struct lorawan_key nwk;
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct sesstab_rec) == SESSTAB_REC_SIZE, "sesstab record size");
+
+#define SESSTAB_LIVE	UINT32_MAX
+
+struct sesstab_stats {
+	unsigned int capacity;
+	unsigned int count;
+	unsigned int tombstones;
+	unsigned int index_size;
+	/* set when sesstab_open() had to recover from an unclean shutdown */
+	int recovered;
+};
+
+struct sesstab;
+
+/*
+ * Map the table at path, creating it for capacity sessions when it does not
+ * exist; capacity is ignored otherwise. Returns NULL with errno set.
+ */
+struct sesstab *sesstab_open(const char *path, unsigned int capacity);
+
+/* write everything back and mark the file clean */
+int sesstab_close(struct sesstab *t);
+
+/*
+ * Write back the counters and any other changes, e.g. periodically. A
+ * process that dies keeps its counters in the page cache, but after a
+ * power loss or kernel crash the uplink counters are back at their value
+ * at the last sync. Frames accepted since then are accepted once more
+ * if replayed, so the interval between syncs is also the replay window.
+ */
+int sesstab_sync(struct sesstab *t);
+
+/*
+ * Sessions with the given DevAddr one by one, as several devices may share
+ * one: start with *iter = 0 and call again until it returns NULL.
+ */
+struct sesstab_rec *sesstab_find(struct sesstab *t, uint32_t devaddr, unsigned int *iter);
+
+/*
+ * Writer only. NULL with errno ENOSPC when every record is taken, or
+ * EAGAIN when the index is too full of deleted entries. For the latter,
+ * pause the lookups, call sesstab_rehash() and try again.
+ */
+struct sesstab_rec *sesstab_add(struct sesstab *t, uint32_t devaddr, const uint8_t *dev_eui,
+	const uint8_t *nwk_skey, const uint8_t *app_skey, uint32_t fcnt_up, uint32_t fcnt_down);
+void sesstab_del(struct sesstab *t, struct sesstab_rec *r);
+
+/*
+ * Rebuild the index without tombstones. Lookups must not run concurrently,
+ * so call it while the receive path is paused.
+ */
+void sesstab_rehash(struct sesstab *t);
+
+void sesstab_get_stats(const struct sesstab *t, struct sesstab_stats *st);
+
+/*
+ * The full 32-bit counter for a received 16-bit FCnt, to check the MIC
+ * with. snap remembers the state it was derived from for the commit.
+ */
+static inline uint32_t sesstab_fcnt_up(struct sesstab_rec *r, uint16_t fcnt, uint64_t *snap)
+{
+	uint64_t up = atomic_load_explicit(&r->up, memory_order_acquire);
+	uint32_t next = (uint32_t)up;
+	uint32_t full = (next & ~0xffffu) | fcnt;
+
+	if (full < next)
+		full += 0x10000;
+	*snap = up;
+	return full;
+}
+
+/*
+ * Accept fcnt once its MIC checked out. Returns 0, -EALREADY for a replay
+ * or a frame overtaken by a later one, -ERANGE when too far ahead and
+ * -ESTALE when the session was deleted or replaced meanwhile.
+ */
+int sesstab_fcnt_up_commit(struct sesstab_rec *r, uint64_t snap, uint32_t fcnt);
+
+static inline uint32_t sesstab_fcnt_down_next(struct sesstab_rec *r)
+{
+	return atomic_fetch_add_explicit(&r->fcnt_down, 1, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef SIMDEV_H
+#define SIMDEV_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "mix.h"
+
+/*
+ * The simulated LoRaWAN devices of the benchmarks. Device i always gets
+ * the same DevAddr, DevEUI and keys, so frames popgen sends for device i
+ * pass the MIC check against a session table that sessbench -n filled.
+ */
+
+/* NetID 0x13 style addresses, so some devices end up sharing one */
+static inline uint32_t simdev_addr(unsigned int i)
+{
+	return 0x26000000 | (mix64(i) & 0x1ffffff);
+}
+
+static inline void simdev_eui(unsigned int i, uint8_t *eui)
+{
+	uint64_t e = 0x70b3d50000000000ull | i;
+	unsigned int j;
+
+	for (j = 0; j < 8; j++)
+		eui[j] = e >> (56 - 8 * j);
+}
+
+/* which is 0 for the NwkSKey and 1 for the AppSKey */
+static inline void simdev_key(unsigned int i, unsigned int which, uint8_t *key)
+{
+	uint64_t a = mix64((uint64_t)i << 8 | which), b = mix64(a);
+
+	memcpy(key, &a, 8);
+	memcpy(key + 8, &b, 8);
+}
+
+#endif
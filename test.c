@@ -1,64 +1,376 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <linux/socket.h>
 #include <net/if.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
+#include "hist.h"
+#include "ifcache.h"
+#include "xport.h"
 #include "include/linux/lora.h"
 
-#ifndef AF_LORA
-#define AF_LORA 28
-#endif
+#define MAX_PAYLOAD	255
+#define MAX_BATCH	64
 
-#ifndef PF_LORA
-#define PF_LORA AF_LORA
-#endif
+/*
+ * Without options this sends a single 0x42 0x43 frame, as it always did.
+ * With -n/-t it turns into a load generator: every interface gets a
+ * non-blocking socket, frames go out in sendmmsg batches, and sockets that
+ * report EAGAIN or ENOBUFS wait for epoll before sending again.
+ *
+ * The sockets come from the transport in RADIO_TRANSPORT, see xport.h, so
+ * "RADIO_TRANSPORT=fake ./test -n 100000 'lora*'" runs against the fake
+ * radio.
+ */
 
-int main(void)
+enum {
+	TX_READY,
+	TX_WAIT_EPOLL,
+	TX_WAIT_TIMER,
+	TX_FAILED,
+};
+
+struct tx_if {
+	const struct ifcache_entry *e;
+	struct xport_sock *s;
+	int state;
+	uint64_t retry_at;
+	unsigned long sent;
+	unsigned long bytes;
+	unsigned long eagain;
+	unsigned long enobufs;
+	unsigned long errors;
+	struct hist lat;
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iovs[MAX_BATCH];
+};
+
+struct tx_opts {
+	unsigned int min_size;
+	unsigned int max_size;
+	unsigned long count;
+	unsigned int duration;
+	unsigned int batch;
+};
+
+static unsigned char payload[MAX_PAYLOAD];
+
+static int open_one(struct xport *xp, struct tx_if *t)
 {
-	int skt = socket(PF_LORA, SOCK_DGRAM, 1);
-	if (skt == -1) {
-		int err = errno;
-		fprintf(stderr, "socket failed: %s\n", strerror(err));
+	int ret;
+
+	ret = xport_socket(xp, t->e, XPORT_LORA, 0, XPORT_NONBLOCK, &t->s);
+	if (ret < 0) {
+		fprintf(stderr, "%s: socket failed: %s\n", t->e->name, strerror(-ret));
 		return 1;
 	}
-	printf("socket %d\n", skt);
 
-	struct ifreq ifr;
-	strcpy(ifr.ifr_name, "lora0");
-	int ret = ioctl(skt, SIOCGIFINDEX, &ifr);
-	if (ret == -1) {
+	return 0;
+}
+
+static unsigned int frame_size(const struct tx_opts *o)
+{
+	if (o->max_size == o->min_size)
+		return o->min_size;
+	return o->min_size + rand() % (o->max_size - o->min_size + 1);
+}
+
+/* returns the number of frames sent or a negative errno */
+static int send_batch(struct tx_if *t, const struct tx_opts *o, unsigned int num)
+{
+	uint64_t start, end;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < num; i++) {
+		t->iovs[i].iov_base = payload;
+		t->iovs[i].iov_len = frame_size(o);
+		memset(&t->msgs[i].msg_hdr, 0, sizeof(t->msgs[i].msg_hdr));
+		t->msgs[i].msg_hdr.msg_iov = &t->iovs[i];
+		t->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	start = hist_now_ns();
+	ret = xport_sendmmsg(t->s, t->msgs, num);
+	end = hist_now_ns();
+	if (ret < 0) {
+		int err = -ret;
+
+		if (err == EAGAIN)
+			t->eagain++;
+		else if (err == ENOBUFS)
+			t->enobufs++;
+		else if (err == EINTR)
+			return 0;
+		else {
+			t->errors++;
+			fprintf(stderr, "%s: sendmmsg failed: %s\n", t->e->name, strerror(err));
+		}
+		return -err;
+	}
+
+	for (i = 0; i < (unsigned int)ret; i++) {
+		t->bytes += t->msgs[i].msg_len;
+		hist_add(&t->lat, (end - start) / ret);
+	}
+	t->sent += ret;
+
+	return ret;
+}
+
+static void report(const char *name, unsigned long sent, unsigned long bytes,
+	unsigned long eagain, unsigned long enobufs, unsigned long errors,
+	uint64_t ns)
+{
+	double secs = ns / 1e9;
+
+	printf("%s: %lu frames, %lu bytes in %.3f s, %.1f frames/s, %.1f bytes/s, "
+		"%lu EAGAIN, %lu ENOBUFS, %lu errors\n",
+		name, sent, bytes, secs,
+		secs > 0 ? sent / secs : 0.0, secs > 0 ? bytes / secs : 0.0,
+		eagain, enobufs, errors);
+}
+
+static int run(struct tx_if *ifs, unsigned int num_ifs, const struct tx_opts *o)
+{
+	struct epoll_event ev, events[16];
+	uint64_t start, end, now, deadline = 0;
+	struct hist total_lat;
+	unsigned long sent = 0, bytes = 0, eagain = 0, enobufs = 0, errors = 0;
+	unsigned int i, active = num_ifs;
+	int ep, n, ret;
+
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep == -1) {
 		int err = errno;
-		fprintf(stderr, "ioctl failed: %s\n", strerror(err));
+		fprintf(stderr, "epoll_create1 failed: %s\n", strerror(err));
 		return 1;
 	}
-	printf("ifindex %d\n", ifr.ifr_ifindex);
 
-	struct sockaddr_lora addr;
-	addr.lora_family = AF_LORA;
-	addr.lora_ifindex = ifr.ifr_ifindex;
-	ret = bind(skt, (struct sockaddr *)&addr, sizeof(addr));
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "bind failed: %s\n", strerror(err));
+	for (i = 0; i < num_ifs; i++) {
+		ev.events = xport_poll_events(ifs[i].s, EPOLLOUT) | EPOLLET;
+		ev.data.u32 = i;
+		if (epoll_ctl(ep, EPOLL_CTL_ADD, ifs[i].s->fd, &ev) == -1) {
+			int err = errno;
+			fprintf(stderr, "epoll_ctl failed: %s\n", strerror(err));
+			close(ep);
+			return 1;
+		}
+	}
+
+	start = hist_now_ns();
+	if (o->duration)
+		deadline = start + o->duration * 1000000000ull;
+
+	while (active > 0) {
+		int timeout = -1;
+
+		/* one batch per interface and pass, so a fast one cannot starve the rest */
+		active = 0;
+		for (i = 0; i < num_ifs; i++) {
+			struct tx_if *t = &ifs[i];
+
+			if (t->state == TX_READY && (o->count == 0 || t->sent < o->count)) {
+				unsigned long left = o->count ? o->count - t->sent : o->batch;
+
+				ret = send_batch(t, o, left < o->batch ? left : o->batch);
+				if (ret == -EAGAIN)
+					t->state = TX_WAIT_EPOLL;
+				else if (ret == -ENOBUFS) {
+					t->state = TX_WAIT_TIMER;
+					t->retry_at = hist_now_ns() + 1000000;
+				} else if (ret < 0)
+					t->state = TX_FAILED;
+			}
+			if (t->state == TX_FAILED || (o->count && t->sent >= o->count))
+				continue;
+			active++;
+			/* only look for wakeups while others can still send */
+			if (t->state == TX_READY)
+				timeout = 0;
+			/* a full qdisc is not signalled through epoll, so retry soon */
+			else if (t->state == TX_WAIT_TIMER && timeout != 0)
+				timeout = 1;
+		}
+
+		if (deadline && hist_now_ns() >= deadline)
+			break;
+		if (active == 0)
+			break;
+
+		n = epoll_wait(ep, events, 16, timeout);
+		if (n == -1) {
+			int err = errno;
+
+			if (err == EINTR)
+				continue;
+			fprintf(stderr, "epoll_wait failed: %s\n", strerror(err));
+			break;
+		}
+		now = hist_now_ns();
+		for (i = 0; i < num_ifs; i++) {
+			if (ifs[i].state == TX_WAIT_TIMER && now >= ifs[i].retry_at)
+				ifs[i].state = TX_READY;
+		}
+		for (i = 0; i < (unsigned int)n; i++) {
+			if (ifs[events[i].data.u32].state == TX_WAIT_EPOLL)
+				ifs[events[i].data.u32].state = TX_READY;
+		}
+	}
+	end = hist_now_ns();
+
+	close(ep);
+
+	hist_init(&total_lat);
+	for (i = 0; i < num_ifs; i++) {
+		struct tx_if *t = &ifs[i];
+
+		report(t->e->name, t->sent, t->bytes, t->eagain, t->enobufs, t->errors,
+			end - start);
+		hist_merge(&total_lat, &t->lat);
+		sent += t->sent;
+		bytes += t->bytes;
+		eagain += t->eagain;
+		enobufs += t->enobufs;
+		errors += t->errors;
+	}
+	if (num_ifs > 1)
+		report("total", sent, bytes, eagain, enobufs, errors, end - start);
+	hist_print("per frame", &total_lat);
+
+	return errors ? 1 : 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-s size[-max]] [-n count] [-t seconds] [-b batch] [ifname|pattern ...]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct tx_opts o = {
+		.min_size = 2,
+		.max_size = 2,
+		.count = 1,
+		.batch = 16,
+	};
+	const struct ifcache_entry *e;
+	struct ifcache ifc;
+	struct xport *xp;
+	struct tx_if *ifs;
+	unsigned int i, num_ifs = 0;
+	char *endptr;
+	int opt, have_count = 0, ret = 0;
+
+	while ((opt = getopt(argc, argv, "s:n:t:b:")) != -1) {
+		switch (opt) {
+		case 's':
+			o.min_size = strtoul(optarg, &endptr, 0);
+			o.max_size = o.min_size;
+			if (*endptr == '-')
+				o.max_size = strtoul(endptr + 1, &endptr, 0);
+			if (*endptr != '\0' || o.min_size == 0 ||
+			    o.max_size < o.min_size || o.max_size > MAX_PAYLOAD)
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			have_count = 1;
+			break;
+		case 't':
+			o.duration = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0 || o.batch > MAX_BATCH)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (o.duration && !have_count)
+		o.count = 0;
+	if (o.count == 0 && o.duration == 0)
+		return usage(argv[0]);
+
+	for (i = 0; i < MAX_PAYLOAD; i++)
+		payload[i] = 0x42 + i;
+
+	xp = xport_open(NULL);
+	if (xp == NULL)
+		return 1;
+
+	if (xport_load_ifs(xp, &ifc) < 0) {
+		xport_close(xp);
 		return 1;
 	}
 
-	char buf[2];
-	buf[0] = 0x42;
-	buf[1] = 0x43;
-	int bytes_sent = write(skt, buf, 2);
-	if (bytes_sent == -1) {
-		int err = errno;
-		fprintf(stderr, "write failed: %s\n", strerror(err));
+	ifs = calloc(ifc.num + 1, sizeof(*ifs));
+	if (ifs == NULL) {
+		ifcache_free(&ifc);
+		xport_close(xp);
 		return 1;
 	}
-	printf("bytes_sent %d\n", bytes_sent);
 
-	return 0;
+	if (optind == argc) {
+		static char *def[] = { "lora0" };
+		argv = def;
+		argc = 1;
+		optind = 0;
+	}
+
+	for (; optind < argc; optind++) {
+		const char *name = argv[optind];
+		/* patterns only pick LoRa interfaces */
+		int type = ifcache_is_pattern(name) ? ARPHRD_LORA : -1;
+		int found = 0;
+
+		for (e = ifcache_next(&ifc, NULL, name, type); e != NULL;
+		     e = ifcache_next(&ifc, e, name, type)) {
+			found = 1;
+			for (i = 0; i < num_ifs; i++) {
+				if (ifs[i].e == e)
+					break;
+			}
+			if (i < num_ifs)
+				continue;
+			ifs[num_ifs].e = e;
+			hist_init(&ifs[num_ifs].lat);
+			if (open_one(xp, &ifs[num_ifs]) == 0)
+				num_ifs++;
+			else
+				ret = 1;
+		}
+		if (!found) {
+			fprintf(stderr, "%s: no such device\n", name);
+			ret = 1;
+		}
+	}
+
+	if (num_ifs > 0) {
+		ret |= run(ifs, num_ifs, &o);
+		xport_print_stats(xp);
+	}
+
+	for (i = 0; i < num_ifs; i++)
+		xport_sock_close(ifs[i].s);
+	free(ifs);
+	ifcache_free(&ifc);
+	xport_close(xp);
+
+	return ret;
 }
@@ -1,81 +1,329 @@
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <arpa/inet.h>
 #include <linux/if_packet.h>
 #include <linux/socket.h>
 #include <net/if.h>
-#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
-#ifndef ARPHRD_ENOCEAN
-#define ARPHRD_ENOCEAN 832
-#endif
+#include "erp2.h"
+#include "hist.h"
+#include "ifcache.h"
+#include "xport.h"
+#include "include/linux/enocean.h"
 
-#ifndef ETH_P_ERP2
-#define ETH_P_ERP2 0x0100
-#endif
+/*
+ * The TX ring is TPACKET_V2: small fixed-size frames, each with a status
+ * word that userspace flips to TP_STATUS_SEND_REQUEST once the telegram is
+ * in place. A single send() then transmits everything that is pending.
+ * With RADIO_TRANSPORT=fake both paths go to the fake radio instead, see
+ * xport.h.
+ */
 
-int main(void)
+#define RING_FRAME_SIZE		128
+#define RING_BLOCK_SIZE		4096
+#define RING_BLOCK_NR		64
+#define RING_FRAME_NR		(RING_BLOCK_NR * (RING_BLOCK_SIZE / RING_FRAME_SIZE))
+#define RING_DATA_OFFSET	(TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+enum {
+	MODE_WRITE	= 1 << 0,
+	MODE_RING	= 1 << 1,
+};
+
+static const unsigned char telegram[15] = {
+	0xD2, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD, 0xDD,
+	0xDD, 0xDD, 0x00, 0x80, 0x35, 0xC4, 0x00,
+};
+
+/*
+ * With -I, every telegram is a 4BS data telegram from that originator ID
+ * carrying a sequence number, built with a valid CRC straight into the
+ * buffer that is sent.
+ */
+static int fill_telegram(unsigned char *buf, unsigned int size, int64_t id,
+	unsigned long seq)
 {
-	int skt = socket(PF_PACKET, SOCK_DGRAM, htons(ETH_P_ERP2));
-	if (skt == -1) {
-		int err = errno;
-		fprintf(stderr, "socket failed: %s\n", strerror(err));
-		return 1;
+	const uint8_t data[4] = { seq >> 16, seq >> 8, seq, 0x08 };
+	struct erp2_telegram t = {
+		.addr = ERP2_ADDR_ID32,
+		.type = ERP2_TYPE_4BS,
+		.id = id,
+		.data = data,
+		.data_len = sizeof(data),
+	};
+
+	if (id < 0) {
+		memcpy(buf, telegram, sizeof(telegram));
+		return sizeof(telegram);
 	}
-	printf("socket %d\n", skt);
-
-	struct ifreq ifr;
-	strcpy(ifr.ifr_name, "enocean0");
-	int ret = ioctl(skt, SIOCGIFINDEX, &ifr);
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "ioctl failed: %s\n", strerror(err));
-		return 1;
+	return erp2_build(buf, size, &t);
+}
+
+struct tx_result {
+	unsigned long sent;
+	unsigned long syscalls;
+	uint64_t ns;
+};
+
+static struct xport_sock *open_socket(struct xport *xp, const struct ifcache_entry *e)
+{
+	struct xport_sock *s;
+	int ret = xport_socket(xp, e, XPORT_PACKET, ETH_P_ERP2, 0, &s);
+	if (ret < 0) {
+		fprintf(stderr, "socket failed: %s\n", strerror(-ret));
+		return NULL;
+	}
+
+	return s;
+}
+
+static int tx_write(struct xport_sock *s, unsigned long count, int64_t id,
+	struct tx_result *res)
+{
+	unsigned char buf[ERP2_MAX_LEN];
+	uint64_t start = hist_now_ns();
+
+	while (res->sent < count) {
+		int len = fill_telegram(buf, sizeof(buf), id, res->sent);
+		int bytes_sent = xport_send(s, buf, len);
+		res->syscalls++;
+		if (bytes_sent < 0) {
+			int err = -bytes_sent;
+			if (err == EINTR || err == ENOBUFS)
+				continue;
+			fprintf(stderr, "write failed: %s\n", strerror(err));
+			res->ns = hist_now_ns() - start;
+			return 1;
+		}
+		res->sent++;
 	}
-	printf("ifindex %d\n", ifr.ifr_ifindex);
-
-	struct sockaddr_ll addr;
-	memset(&addr, 0, sizeof(addr));
-	addr.sll_family = AF_PACKET;
-	addr.sll_protocol = htons(ETH_P_ERP2);
-	addr.sll_ifindex = ifr.ifr_ifindex;
-	addr.sll_halen = 0;
-
-	ret = bind(skt, (struct sockaddr *)&addr, sizeof(addr));
-	if (ret == -1) {
-		int err = errno;
-		fprintf(stderr, "bind failed: %s\n", strerror(err));
+
+	res->ns = hist_now_ns() - start;
+	return 0;
+}
+
+static int ring_flush(struct xport_sock *s, struct tx_result *res)
+{
+	for (;;) {
+		int ret = xport_flush(s);
+		res->syscalls++;
+		if (ret == 0)
+			return 0;
+		if (ret != -EINTR && ret != -ENOBUFS && ret != -EAGAIN) {
+			fprintf(stderr, "send failed: %s\n", strerror(-ret));
+			return ret;
+		}
+	}
+}
+
+static int tx_ring(struct xport_sock *s, unsigned long count, unsigned int batch, int64_t id,
+	struct tx_result *res)
+{
+	struct tpacket_req req;
+	unsigned int head = 0, pending = 0;
+	unsigned char *ring;
+	unsigned long i;
+	uint64_t start;
+	int ret = 0;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCK_NR;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = RING_FRAME_NR;
+	ret = xport_tx_ring(s, &req, (void **)&ring);
+	if (ret < 0) {
+		fprintf(stderr, "PACKET_TX_RING failed: %s\n", strerror(-ret));
 		return 1;
 	}
+	ret = 0;
+
+	if (batch > RING_FRAME_NR)
+		batch = RING_FRAME_NR;
+
+	start = hist_now_ns();
+	for (i = 0; i < count; i++) {
+		struct tpacket2_hdr *hdr = (void *)(ring + head * RING_FRAME_SIZE);
+
+		/* the slot is still owned by the kernel until it has been sent */
+		while (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+			struct pollfd pfd = { .fd = s->fd, .events = xport_poll_events(s, POLLOUT) };
 
-	char buf[15];
-	buf[0] = 0xD2;
-	buf[1] = 0xDD;
-	buf[2] = 0xDD;
-	buf[3] = 0xDD;
-	buf[4] = 0xDD;
-	buf[5] = 0xDD;
-	buf[6] = 0xDD;
-	buf[7] = 0xDD;
-	buf[8] = 0xDD;
-	buf[9] = 0xDD;
-	buf[10] = 0x00;
-	buf[11] = 0x80;
-	buf[12] = 0x35;
-	buf[13] = 0xC4;
-	buf[14] = 0x00;
-	int bytes_sent = write(skt, buf, 15);
-	if (bytes_sent == -1) {
-		int err = errno;
-		fprintf(stderr, "write failed: %s\n", strerror(err));
+			if (hdr->tp_status == TP_STATUS_WRONG_FORMAT) {
+				fprintf(stderr, "ring frame rejected\n");
+				ret = 1;
+				goto out;
+			}
+			if (pending) {
+				if (ring_flush(s, res) < 0) {
+					ret = 1;
+					goto out;
+				}
+				pending = 0;
+				continue;
+			}
+			poll(&pfd, 1, 1);
+		}
+
+		hdr->tp_len = fill_telegram((unsigned char *)hdr + RING_DATA_OFFSET,
+			RING_FRAME_SIZE - RING_DATA_OFFSET, id, i);
+		__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+		head = (head + 1) % RING_FRAME_NR;
+		res->sent++;
+
+		if (++pending == batch) {
+			if (ring_flush(s, res) < 0) {
+				ret = 1;
+				goto out;
+			}
+			pending = 0;
+		}
+	}
+
+	if (pending && ring_flush(s, res) < 0)
+		ret = 1;
+
+out:
+	/* the ring goes away with the socket */
+	res->ns = hist_now_ns() - start;
+	return ret;
+}
+
+static void report(const char *ifname, const char *mode, const struct tx_result *res)
+{
+	double secs = res->ns / 1e9;
+
+	printf("%s %s: %lu telegrams in %.3f s, %.1f telegrams/s, %lu syscalls\n",
+		ifname, mode, res->sent, secs, secs > 0 ? res->sent / secs : 0.0,
+		res->syscalls);
+}
+
+static int send_one(struct xport *xp, const struct ifcache_entry *e, int mode,
+	unsigned long count, unsigned int batch, int64_t id)
+{
+	struct tx_result wres, rres;
+	struct xport_sock *s;
+	int ret = 0;
+
+	if (mode & MODE_WRITE) {
+		s = open_socket(xp, e);
+		if (s == NULL)
+			return 1;
+		memset(&wres, 0, sizeof(wres));
+		ret |= tx_write(s, count, id, &wres);
+		xport_sock_close(s);
+		report(e->name, "write", &wres);
+	}
+
+	if (mode & MODE_RING) {
+		s = open_socket(xp, e);
+		if (s == NULL)
+			return 1;
+		memset(&rres, 0, sizeof(rres));
+		ret |= tx_ring(s, count, batch, id, &rres);
+		xport_sock_close(s);
+		report(e->name, "ring", &rres);
+	}
+
+	if (mode == (MODE_WRITE | MODE_RING) && wres.ns > 0 && rres.ns > 0)
+		printf("%s ring/write: %.2fx telegrams/s, %.2fx fewer syscalls\n", e->name,
+			((double)rres.sent / rres.ns) / ((double)wres.sent / wres.ns),
+			rres.syscalls ? (double)wres.syscalls / rres.syscalls : 0.0);
+
+	return ret;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-m write|ring|both] [-b batch] [-I id] [ifname|pattern ...]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const struct ifcache_entry *e;
+	struct ifcache ifc;
+	struct xport *xp;
+	unsigned long count = 1;
+	unsigned int batch = 256;
+	int64_t id = -1;
+	int i, opt, found, mode = MODE_WRITE, ret = 0;
+	char *endptr;
+
+	while ((opt = getopt(argc, argv, "n:m:b:I:")) != -1) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || count == 0)
+				return usage(argv[0]);
+			break;
+		case 'm':
+			if (strcmp(optarg, "write") == 0)
+				mode = MODE_WRITE;
+			else if (strcmp(optarg, "ring") == 0)
+				mode = MODE_RING;
+			else if (strcmp(optarg, "both") == 0)
+				mode = MODE_WRITE | MODE_RING;
+			else
+				return usage(argv[0]);
+			break;
+		case 'b':
+			batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || batch == 0)
+				return usage(argv[0]);
+			break;
+		case 'I':
+			id = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || id > UINT32_MAX)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	xp = xport_open(NULL);
+	if (xp == NULL)
+		return 1;
+
+	if (xport_load_ifs(xp, &ifc) < 0) {
+		xport_close(xp);
 		return 1;
 	}
-	printf("bytes_sent %d\n", bytes_sent);
 
-	return 0;
+	if (optind == argc) {
+		static char *def[] = { "enocean0" };
+		argv = def;
+		argc = 1;
+		optind = 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		/* patterns only pick EnOcean interfaces */
+		int type = ifcache_is_pattern(argv[i]) ? ARPHRD_ENOCEAN : -1;
+
+		found = 0;
+		for (e = ifcache_next(&ifc, NULL, argv[i], type); e != NULL;
+		     e = ifcache_next(&ifc, e, argv[i], type)) {
+			found = 1;
+			ret |= send_one(xp, e, mode, count, batch, id);
+		}
+		if (!found) {
+			fprintf(stderr, "%s: no such device\n", argv[i]);
+			ret = 1;
+		}
+	}
+
+	xport_print_stats(xp);
+	ifcache_free(&ifc);
+	xport_close(xp);
+	return ret;
 }
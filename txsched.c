@@ -0,0 +1,628 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/socket.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "airtime.h"
+#include "hist.h"
+#include "ifcache.h"
+#include "include/linux/lora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+/*
+ * Paces frames onto PF_LORA sockets so that every EU868 sub-band stays
+ * within its duty cycle. Each sub-band remembers when its frames went out
+ * and for how long. A frame is released as soon as its radio is idle and
+ * the airtime of the last observation window (-W, one hour by default),
+ * counted up to the end of the frame, stays within the duty cycle with
+ * the frame's exact time on air added. Otherwise the scheduler sleeps
+ * until the earliest of those moments.
+ *
+ * With -x the same scheduler runs against a simulated clock and no
+ * sockets, which turns hours of regulated traffic into a quick benchmark.
+ */
+
+#define MAX_IFS		32
+#define MAX_QUEUE	1024
+#define MAX_PAYLOAD	255
+#define RETRY_NS	1000000ull
+
+struct band_tx {
+	uint64_t start;
+	uint64_t toa;
+};
+
+struct band_state {
+	const struct eu868_band *band;
+	/* airtime in ns allowed in any window */
+	uint64_t budget;
+	uint64_t window;
+	/* the frames that may still be in the window, oldest first */
+	struct band_tx *txs;
+	unsigned int head, len, size;
+	uint64_t used;
+	uint64_t airtime;
+	unsigned long frames;
+	unsigned int num_ifs;
+};
+
+struct sched_if {
+	char name[IFNAMSIZ];
+	int ifindex;
+	uint32_t freq;
+	struct band_state *bs;
+	int skt;
+	uint64_t busy_until;
+	uint64_t retry_at;
+	unsigned int sizes[MAX_QUEUE];
+	uint64_t enqueued[MAX_QUEUE];
+	unsigned int head, len;
+	uint64_t next_arrival;
+	unsigned long offered;
+	unsigned long dropped;
+	unsigned long sent;
+	unsigned long bytes;
+	unsigned long retries;
+	uint64_t airtime;
+	struct hist wait;
+};
+
+struct sched_opts {
+	struct lora_params lp;
+	unsigned int min_size;
+	unsigned int max_size;
+	double rate;
+	unsigned long count;
+	unsigned int duration;
+	unsigned int window;
+	unsigned int queue;
+	int simulate;
+};
+
+static unsigned char payload[MAX_PAYLOAD];
+static uint64_t sim_now;
+static uint64_t start_ns;
+
+static uint64_t now_ns(const struct sched_opts *o)
+{
+	if (o->simulate)
+		return sim_now;
+	return hist_now_ns() - start_ns;
+}
+
+static void sleep_until(const struct sched_opts *o, uint64_t t)
+{
+	struct timespec ts;
+
+	if (o->simulate) {
+		if (t > sim_now)
+			sim_now = t;
+		return;
+	}
+
+	t += start_ns;
+	ts.tv_sec = t / 1000000000ull;
+	ts.tv_nsec = t % 1000000000ull;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static unsigned int frame_size(const struct sched_opts *o)
+{
+	if (o->max_size == o->min_size)
+		return o->min_size;
+	return o->min_size + rand() % (o->max_size - o->min_size + 1);
+}
+
+/* forgets the frames that ended a whole window ago */
+static void band_expire(struct band_state *b, uint64_t now)
+{
+	while (b->len > 0) {
+		const struct band_tx *tx = &b->txs[b->head];
+
+		if (tx->start + tx->toa + b->window > now)
+			break;
+		b->used -= tx->toa;
+		b->head = (b->head + 1) % b->size;
+		b->len--;
+	}
+}
+
+/*
+ * The earliest time from now on that a frame of toa can start, given
+ * nothing else is sent. Frames count in full as long as any of them is
+ * within the window that ends with the new frame, which errs on the
+ * legal side.
+ */
+static uint64_t band_ready_at(const struct band_state *b, uint64_t now, uint64_t toa)
+{
+	uint64_t used = b->used, t = now;
+	unsigned int i;
+
+	/* the budget holds the largest frame, so this ends with an empty window at the latest */
+	for (i = 0; used + toa > b->budget; i++) {
+		const struct band_tx *tx = &b->txs[(b->head + i) % b->size];
+		uint64_t gone = tx->start + tx->toa + b->window - toa;
+
+		used -= tx->toa;
+		if (gone > t)
+			t = gone;
+	}
+	return t;
+}
+
+static int band_add(struct band_state *b, uint64_t start, uint64_t toa)
+{
+	if (b->len == b->size) {
+		unsigned int size = b->size ? b->size * 2 : 256;
+		struct band_tx *txs = malloc(size * sizeof(*txs));
+		unsigned int i;
+
+		if (txs == NULL)
+			return -ENOMEM;
+		for (i = 0; i < b->len; i++)
+			txs[i] = b->txs[(b->head + i) % b->size];
+		free(b->txs);
+		b->txs = txs;
+		b->head = 0;
+		b->size = size;
+	}
+	b->txs[(b->head + b->len) % b->size].start = start;
+	b->txs[(b->head + b->len) % b->size].toa = toa;
+	b->len++;
+	b->used += toa;
+	return 0;
+}
+
+static void enqueue(struct sched_if *s, const struct sched_opts *o, uint64_t t)
+{
+	s->offered++;
+	if (s->len == o->queue) {
+		s->dropped++;
+		return;
+	}
+	s->sizes[(s->head + s->len) % MAX_QUEUE] = frame_size(o);
+	s->enqueued[(s->head + s->len) % MAX_QUEUE] = t;
+	s->len++;
+}
+
+static void generate(struct sched_if *s, const struct sched_opts *o, uint64_t now)
+{
+	uint64_t gap;
+
+	if (o->count && s->offered >= o->count)
+		return;
+
+	/* -r 0 means there is always a frame waiting */
+	if (o->rate == 0) {
+		if (s->len == 0)
+			enqueue(s, o, now);
+		return;
+	}
+
+	gap = 1e9 / o->rate;
+	while (s->next_arrival <= now && (o->count == 0 || s->offered < o->count)) {
+		enqueue(s, o, s->next_arrival);
+		s->next_arrival += gap;
+	}
+}
+
+/* returns 0 on success, 1 to retry later, -1 on errors */
+static int transmit(struct sched_if *s, const struct sched_opts *o, unsigned int size)
+{
+	ssize_t ret;
+
+	if (o->simulate)
+		return 0;
+
+	ret = send(s->skt, payload, size, MSG_DONTWAIT);
+	if (ret == -1) {
+		int err = errno;
+
+		if (err == EAGAIN || err == ENOBUFS || err == EINTR)
+			return 1;
+		fprintf(stderr, "%s: send failed: %s\n", s->name, strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+static int run(struct sched_if *ifs, unsigned int num_ifs,
+	struct band_state *bands, unsigned int num_bands,
+	const struct sched_opts *o)
+{
+	uint64_t deadline = o->duration * 1000000000ull;
+	unsigned int i, rr = 0, last = 0;
+	int ret = 0;
+
+	for (;;) {
+		uint64_t now = now_ns(o), next = deadline;
+		int pending = 0;
+
+		if (now >= deadline)
+			break;
+
+		for (i = 0; i < num_bands; i++)
+			band_expire(&bands[i], now);
+
+		/* start after the last radio that sent, so radios sharing a band take turns */
+		rr = last;
+		for (i = 0; i < num_ifs; i++) {
+			struct sched_if *s = &ifs[(rr + i) % num_ifs];
+			struct band_state *b = s->bs;
+			uint64_t toa, t;
+			unsigned int size;
+			int r;
+
+			generate(s, o, now);
+			if (o->rate > 0 && (o->count == 0 || s->offered < o->count) &&
+			    s->next_arrival < next)
+				next = s->next_arrival;
+			if (s->len == 0)
+				continue;
+			pending = 1;
+
+			size = s->sizes[s->head];
+			toa = lora_airtime_ns(&o->lp, size);
+
+			t = s->busy_until > s->retry_at ? s->busy_until : s->retry_at;
+			if (now < t) {
+				if (t < next)
+					next = t;
+				continue;
+			}
+			t = band_ready_at(b, now, toa);
+			if (t > now) {
+				if (t < next)
+					next = t;
+				continue;
+			}
+
+			r = transmit(s, o, size);
+			if (r < 0) {
+				ret = 1;
+				s->len = 0;
+				continue;
+			}
+			if (r > 0) {
+				s->retries++;
+				s->retry_at = now + RETRY_NS;
+				if (s->retry_at < next)
+					next = s->retry_at;
+				continue;
+			}
+
+			if (band_add(b, now, toa) < 0) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+			b->airtime += toa;
+			b->frames++;
+			s->busy_until = now + toa;
+			s->airtime += toa;
+			s->sent++;
+			s->bytes += size;
+			hist_add(&s->wait, now - s->enqueued[s->head]);
+			s->head = (s->head + 1) % MAX_QUEUE;
+			s->len--;
+			if (s->busy_until < next)
+				next = s->busy_until;
+			last = (rr + i + 1) % num_ifs;
+		}
+
+		/* with -n, stop once every frame has been offered and sent */
+		if (!pending && o->count) {
+			for (i = 0; i < num_ifs; i++) {
+				if (ifs[i].offered < o->count)
+					break;
+			}
+			if (i == num_ifs)
+				break;
+		}
+
+		if (next <= now)
+			next = now + 1;
+		sleep_until(o, next);
+	}
+
+	return ret;
+}
+
+static void report(struct sched_if *ifs, unsigned int num_ifs,
+	struct band_state *bands, unsigned int num_bands,
+	const struct sched_opts *o, uint64_t elapsed)
+{
+	double secs = elapsed / 1e9;
+	unsigned int i;
+
+	printf("SF%u BW%u CR4/%u, %u preamble symbols, %u-%u byte frames: %.3f-%.3f ms on air\n",
+		o->lp.sf, lora_bw_hz[o->lp.bw], o->lp.cr + 4, o->lp.preamble,
+		o->min_size, o->max_size,
+		lora_airtime_ns(&o->lp, o->min_size) / 1e6,
+		lora_airtime_ns(&o->lp, o->max_size) / 1e6);
+
+	for (i = 0; i < num_ifs; i++) {
+		struct sched_if *s = &ifs[i];
+		char name[IFNAMSIZ + sizeof(" queue wait")];
+
+		printf("%s (%u Hz, %s): %lu offered, %lu sent, %lu dropped, %lu retries, "
+			"%.1f bytes/s, %.2f%% airtime\n",
+			s->name, s->freq, s->bs->band->name, s->offered, s->sent,
+			s->dropped, s->retries, secs > 0 ? s->bytes / secs : 0.0,
+			secs > 0 ? 100.0 * s->airtime / elapsed : 0.0);
+		snprintf(name, sizeof(name), "%.*s queue wait", IFNAMSIZ - 1, s->name);
+		hist_print(name, &s->wait);
+	}
+
+	for (i = 0; i < num_bands; i++) {
+		struct band_state *b = &bands[i];
+		/* the radios of a band share its duty cycle */
+		double legal = b->band->permille / 1000.0;
+		double theory = legal < 1 ? legal : 1;
+		double achieved = (double)b->airtime / elapsed;
+
+		printf("band %s (%.1f%% duty): %lu frames, %.3f s on air, utilization %.4f%% of %.4f%% possible (%.1f%%)\n",
+			b->band->name, b->band->permille / 10.0, b->frames,
+			b->airtime / 1e9, 100.0 * achieved, 100.0 * theory,
+			theory > 0 ? 100.0 * achieved / theory : 0.0);
+	}
+}
+
+static int open_one(struct sched_if *s)
+{
+	struct sockaddr_lora addr;
+
+	s->skt = socket(PF_LORA, SOCK_DGRAM, 1);
+	if (s->skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.lora_family = AF_LORA;
+	addr.lora_ifindex = s->ifindex;
+	if (bind(s->skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+		int err = errno;
+		fprintf(stderr, "%s: bind failed: %s\n", s->name, strerror(err));
+		close(s->skt);
+		s->skt = -1;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int add_if(struct sched_if *ifs, unsigned int *num_ifs,
+	struct band_state *bands, unsigned int *num_bands,
+	const char *name, int ifindex, uint32_t freq, const struct sched_opts *o)
+{
+	const struct eu868_band *band = eu868_band_find(freq);
+	struct sched_if *s;
+	unsigned int i;
+
+	if (band == NULL) {
+		fprintf(stderr, "%s: %u Hz is not in an EU868 sub-band\n", name, freq);
+		return 1;
+	}
+	if (*num_ifs == MAX_IFS) {
+		fprintf(stderr, "too many interfaces\n");
+		return 1;
+	}
+
+	for (i = 0; i < *num_bands; i++) {
+		if (bands[i].band == band)
+			break;
+	}
+	if (i == *num_bands) {
+		uint64_t largest = lora_airtime_ns(&o->lp, o->max_size);
+
+		memset(&bands[i], 0, sizeof(bands[i]));
+		bands[i].band = band;
+		bands[i].window = o->window * 1000000000ull;
+		bands[i].budget = o->window * 1000000ull * band->permille;
+		/* a window too short for the largest frame would never send it */
+		if (bands[i].budget < largest)
+			bands[i].budget = largest;
+		(*num_bands)++;
+	}
+	bands[i].num_ifs++;
+
+	s = &ifs[*num_ifs];
+	memset(s, 0, sizeof(*s));
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	s->ifindex = ifindex;
+	s->freq = freq;
+	s->bs = &bands[i];
+	s->skt = -1;
+	hist_init(&s->wait);
+
+	if (!o->simulate && open_one(s))
+		return 1;
+
+	(*num_ifs)++;
+	return 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-S sf] [-B bw] [-C cr] [-P preamble] [-s size[-max]] [-r frames/s]\n"
+		"       [-n count] [-t seconds] [-W window] [-q depth] [-x] [ifname|pattern[@freq] ...]\n",
+		argv0);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct sched_opts o = {
+		.lp = {
+			.sf = 7,
+			.cr = 1,
+			.preamble = 8,
+			.crc = 1,
+			.ldro = -1,
+		},
+		.min_size = 13,
+		.max_size = 13,
+		.duration = 60,
+		.window = 3600,
+		.queue = 64,
+	};
+	static struct sched_if ifs[MAX_IFS];
+	struct band_state bands[MAX_IFS];
+	const struct ifcache_entry *e;
+	struct ifcache ifc;
+	unsigned int i, num_ifs = 0, num_bands = 0;
+	unsigned long bw = 125000;
+	char *endptr;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "S:B:C:P:s:r:n:t:W:q:x")) != -1) {
+		switch (opt) {
+		case 'S':
+			o.lp.sf = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.lp.sf < LORA_SF_MIN || o.lp.sf > LORA_SF_MAX)
+				return usage(argv[0]);
+			break;
+		case 'B':
+			bw = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || lora_bw_index(bw) < 0)
+				return usage(argv[0]);
+			break;
+		case 'C':
+			o.lp.cr = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.lp.cr < 1 || o.lp.cr > 4)
+				return usage(argv[0]);
+			break;
+		case 'P':
+			o.lp.preamble = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.lp.preamble > 65535)
+				return usage(argv[0]);
+			break;
+		case 's':
+			o.min_size = strtoul(optarg, &endptr, 0);
+			o.max_size = o.min_size;
+			if (*endptr == '-')
+				o.max_size = strtoul(endptr + 1, &endptr, 0);
+			if (*endptr != '\0' || o.min_size == 0 ||
+			    o.max_size < o.min_size || o.max_size > MAX_PAYLOAD)
+				return usage(argv[0]);
+			break;
+		case 'r':
+			o.rate = strtod(optarg, &endptr);
+			if (*endptr != '\0' || o.rate < 0)
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 't':
+			o.duration = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.duration == 0)
+				return usage(argv[0]);
+			break;
+		case 'W':
+			o.window = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.window == 0)
+				return usage(argv[0]);
+			break;
+		case 'q':
+			o.queue = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.queue == 0 || o.queue > MAX_QUEUE)
+				return usage(argv[0]);
+			break;
+		case 'x':
+			o.simulate = 1;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	o.lp.bw = lora_bw_index(bw);
+
+	for (i = 0; i < MAX_PAYLOAD; i++)
+		payload[i] = 0x42 + i;
+
+	if (!o.simulate && ifcache_load(&ifc) < 0)
+		return 1;
+
+	if (optind == argc) {
+		static char *def[] = { "lora0" };
+		argv = def;
+		argc = 1;
+		optind = 0;
+	}
+
+	for (; optind < argc && ret == 0; optind++) {
+		char *name = argv[optind];
+		char *at = strchr(name, '@');
+		uint32_t freq = 868100000;
+		int found = 0;
+
+		if (at != NULL) {
+			*at = '\0';
+			freq = strtoul(at + 1, &endptr, 0);
+			if (*endptr != '\0')
+				return usage(argv[0]);
+		}
+
+		if (o.simulate) {
+			ret |= add_if(ifs, &num_ifs, bands, &num_bands, name, 0, freq, &o);
+			continue;
+		}
+
+		/* patterns only pick LoRa interfaces */
+		for (e = ifcache_next(&ifc, NULL, name, ifcache_is_pattern(name) ? ARPHRD_LORA : -1);
+		     e != NULL;
+		     e = ifcache_next(&ifc, e, name, ifcache_is_pattern(name) ? ARPHRD_LORA : -1)) {
+			found = 1;
+			ret |= add_if(ifs, &num_ifs, bands, &num_bands, e->name,
+				e->ifindex, freq, &o);
+		}
+		if (!found) {
+			fprintf(stderr, "%s: no such device\n", name);
+			ret = 1;
+		}
+	}
+
+	if (ret == 0 && num_ifs > 0) {
+		uint64_t end;
+
+		start_ns = hist_now_ns();
+		ret = run(ifs, num_ifs, bands, num_bands, &o);
+		/* count the run until the last frame has left the antenna */
+		end = now_ns(&o);
+		for (i = 0; i < num_ifs; i++) {
+			if (ifs[i].busy_until > end)
+				end = ifs[i].busy_until;
+		}
+		report(ifs, num_ifs, bands, num_bands, &o, end);
+	}
+
+	for (i = 0; i < num_ifs; i++) {
+		if (ifs[i].skt >= 0)
+			close(ifs[i].skt);
+	}
+	for (i = 0; i < num_bands; i++)
+		free(bands[i].txs);
+	if (!o.simulate)
+		ifcache_free(&ifc);
+	return ret;
+}
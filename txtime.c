@@ -0,0 +1,500 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/socket.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+#include "include/linux/lora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME	61
+#define SCM_TXTIME	SO_TXTIME
+#endif
+
+/*
+ * Sends frames at given launch times and measures how far off they left.
+ *
+ * -m txtime hands each frame to the kernel early with its launch time in
+ * an SCM_TXTIME control message; an etf qdisc on the device holds it back
+ * until then. -m fifo does it in userspace instead: a SCHED_FIFO thread
+ * sleeps until shortly before the launch time and spins the rest of the
+ * way. In both modes the software TX timestamp of each frame, taken when
+ * the driver picks it up, is compared with its launch time.
+ *
+ * Launch times are CLOCK_TAI, as etf expects, and TX timestamps are
+ * CLOCK_REALTIME, so the offset between the two is subtracted.
+ */
+
+#define MAX_PAYLOAD	255
+
+enum {
+	MODE_TXTIME,
+	MODE_FIFO,
+};
+
+struct txtime_opts {
+	int mode;
+	unsigned long count;
+	uint64_t interval;
+	uint64_t lead;
+	uint64_t spin;
+	unsigned int size;
+	int prio;
+	int cpu;
+	const struct proto *proto;
+};
+
+struct txtime_state {
+	int skt;
+	struct sockaddr_ll sll;
+	int use_sll;
+	uint64_t *launch;
+	int64_t tai_offset;
+	unsigned long stamped;
+	unsigned long missed;
+	unsigned long send_errors;
+	unsigned long early;
+	unsigned long late;
+	int64_t min_err;
+	int64_t max_err;
+	double sum_err;
+	struct hist early_hist;
+	struct hist late_hist;
+};
+
+static unsigned char payload[MAX_PAYLOAD];
+
+static uint64_t clock_ns(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t t)
+{
+	struct timespec ts = {
+		.tv_sec = t / 1000000000ull,
+		.tv_nsec = t % 1000000000ull,
+	};
+
+	while (clock_nanosleep(CLOCK_TAI, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static int64_t tai_offset(void)
+{
+	uint64_t best = ~0ull;
+	int64_t off = 0;
+	int i;
+
+	/* take the reading with the narrowest window around it */
+	for (i = 0; i < 8; i++) {
+		uint64_t a = clock_ns(CLOCK_REALTIME);
+		uint64_t t = clock_ns(CLOCK_TAI);
+		uint64_t b = clock_ns(CLOCK_REALTIME);
+
+		if (b - a < best) {
+			best = b - a;
+			off = (int64_t)(t - (a + (b - a) / 2));
+		}
+	}
+	return off;
+}
+
+static int open_socket(struct txtime_state *st, const struct ifcache_entry *e,
+	const struct txtime_opts *o)
+{
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	if (o->proto != NULL) {
+		st->skt = socket(PF_PACKET, SOCK_DGRAM, 0);
+		proto_sockaddr_ll(&st->sll, o->proto->eth_p, e->ifindex);
+		st->use_sll = 1;
+	} else {
+		struct sockaddr_lora addr;
+
+		st->skt = socket(PF_LORA, SOCK_DGRAM, 1);
+		if (st->skt != -1) {
+			memset(&addr, 0, sizeof(addr));
+			addr.lora_family = AF_LORA;
+			addr.lora_ifindex = e->ifindex;
+			if (bind(st->skt, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+				int err = errno;
+				fprintf(stderr, "%s: bind failed: %s\n", e->name, strerror(err));
+				close(st->skt);
+				return -1;
+			}
+		}
+	}
+	if (st->skt == -1) {
+		int err = errno;
+		fprintf(stderr, "socket failed: %s\n", strerror(err));
+		return -1;
+	}
+
+	if (setsockopt(st->skt, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+		int err = errno;
+		fprintf(stderr, "SO_TIMESTAMPING failed: %s\n", strerror(err));
+		close(st->skt);
+		return -1;
+	}
+
+	if (o->mode == MODE_TXTIME) {
+		struct sock_txtime cfg = {
+			.clockid = CLOCK_TAI,
+			.flags = SOF_TXTIME_REPORT_ERRORS,
+		};
+
+		if (setsockopt(st->skt, SOL_SOCKET, SO_TXTIME, &cfg, sizeof(cfg)) == -1) {
+			int err = errno;
+			fprintf(stderr, "SO_TXTIME failed: %s\n", strerror(err));
+			close(st->skt);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int send_frame(struct txtime_state *st, const struct txtime_opts *o,
+	uint64_t launch)
+{
+	char control[CMSG_SPACE(sizeof(uint64_t))];
+	struct iovec iov = { payload, o->size };
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (st->use_sll) {
+		msg.msg_name = &st->sll;
+		msg.msg_namelen = sizeof(st->sll);
+	}
+
+	if (o->mode == MODE_TXTIME) {
+		struct cmsghdr *cmsg;
+
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_TXTIME;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+		memcpy(CMSG_DATA(cmsg), &launch, sizeof(launch));
+	}
+
+	if (sendmsg(st->skt, &msg, 0) == -1) {
+		int err = errno;
+
+		if (st->send_errors++ == 0)
+			fprintf(stderr, "sendmsg failed: %s\n", strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+static void record(struct txtime_state *st, unsigned long id, uint64_t ts_real)
+{
+	int64_t err = (int64_t)(ts_real + st->tai_offset) - (int64_t)st->launch[id];
+
+	if (st->stamped == 0 || err < st->min_err)
+		st->min_err = err;
+	if (st->stamped == 0 || err > st->max_err)
+		st->max_err = err;
+	st->sum_err += err;
+	st->stamped++;
+	if (err < 0) {
+		st->early++;
+		hist_add(&st->early_hist, -err);
+	} else {
+		st->late++;
+		hist_add(&st->late_hist, err);
+	}
+}
+
+/* read TX timestamps and etf drop reports; returns how many were read */
+static unsigned long drain_errqueue(struct txtime_state *st, unsigned long count)
+{
+	unsigned long n = 0;
+
+	for (;;) {
+		char control[512];
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		struct sock_extended_err *ee = NULL;
+		uint64_t ts = 0;
+		int have_ts = 0;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(st->skt, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+			return n;
+		n++;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET &&
+			    cmsg->cmsg_type == SO_TIMESTAMPING) {
+				struct scm_timestamping *t = (void *)CMSG_DATA(cmsg);
+
+				ts = (uint64_t)t->ts[0].tv_sec * 1000000000ull + t->ts[0].tv_nsec;
+				have_ts = 1;
+			} else if (cmsg->cmsg_len >= CMSG_LEN(sizeof(*ee))) {
+				/* SOL_PACKET/PACKET_TX_TIMESTAMP or the family's own level */
+				ee = (void *)CMSG_DATA(cmsg);
+			}
+		}
+		if (ee == NULL)
+			continue;
+
+		if (ee->ee_origin == SO_EE_ORIGIN_TXTIME) {
+			st->missed++;
+			continue;
+		}
+		if (ee->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && have_ts &&
+		    ee->ee_data < count)
+			record(st, ee->ee_data, ts);
+	}
+}
+
+static void run(struct txtime_state *st, const struct txtime_opts *o)
+{
+	struct pollfd pfd = { .fd = st->skt, .events = 0 };
+	uint64_t base = clock_ns(CLOCK_TAI) + o->lead + 10000000ull;
+	unsigned long i;
+
+	for (i = 0; i < o->count; i++)
+		st->launch[i] = base + i * o->interval;
+
+	for (i = 0; i < o->count; i++) {
+		uint64_t launch = st->launch[i];
+
+		if (o->mode == MODE_TXTIME) {
+			/* hand the frame over early and let the qdisc hold it */
+			sleep_until(launch - o->lead);
+		} else {
+			if (launch - o->spin > clock_ns(CLOCK_TAI))
+				sleep_until(launch - o->spin);
+			while (clock_ns(CLOCK_TAI) < launch)
+				;
+		}
+		send_frame(st, o, launch);
+		drain_errqueue(st, o->count);
+	}
+
+	/* wait for the last timestamps */
+	while (st->stamped + st->missed < o->count - st->send_errors &&
+	       poll(&pfd, 1, 200 + o->lead / 1000000) > 0)
+		drain_errqueue(st, o->count);
+}
+
+static void *fifo_main(void *arg)
+{
+	void **args = arg;
+
+	run(args[0], args[1]);
+	return NULL;
+}
+
+/*
+ * Runs the send loop on a SCHED_FIFO thread pinned to a CPU. Without the
+ * privileges for that it still runs, just with ordinary scheduling.
+ */
+static void run_fifo(struct txtime_state *st, const struct txtime_opts *o)
+{
+	struct sched_param sp = { .sched_priority = o->prio };
+	void *args[2] = { st, (void *)o };
+	pthread_attr_t attr;
+	pthread_t thread;
+	cpu_set_t set;
+	int ret;
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+		fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &sp);
+	if (o->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(o->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+
+	ret = pthread_create(&thread, &attr, fifo_main, args);
+	if (ret == EPERM) {
+		fprintf(stderr, "no permission for SCHED_FIFO, using normal scheduling\n");
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+		ret = pthread_create(&thread, &attr, fifo_main, args);
+	}
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		fprintf(stderr, "pthread_create failed: %s\n", strerror(ret));
+		return;
+	}
+	pthread_join(thread, NULL);
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-m txtime|fifo] [-n count] [-i interval-us] [-l lead-us] [-w spin-us]\n"
+		"       [-P prio] [-c cpu] [-s size] [-p proto] ifname\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct txtime_opts o = {
+		.mode = MODE_TXTIME,
+		.count = 1000,
+		.interval = 10000000,
+		.lead = 2000000,
+		.spin = 200000,
+		.size = 16,
+		.prio = 80,
+		.cpu = -1,
+	};
+	const struct ifcache_entry *e;
+	struct txtime_state st;
+	struct ifcache ifc;
+	unsigned int i;
+	char *endptr;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:n:i:l:w:P:c:s:p:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (strcmp(optarg, "txtime") == 0)
+				o.mode = MODE_TXTIME;
+			else if (strcmp(optarg, "fifo") == 0)
+				o.mode = MODE_FIFO;
+			else
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.count == 0)
+				return usage(argv[0]);
+			break;
+		case 'i':
+			o.interval = strtoull(optarg, &endptr, 0) * 1000;
+			if (*endptr != '\0' || o.interval == 0)
+				return usage(argv[0]);
+			break;
+		case 'l':
+			o.lead = strtoull(optarg, &endptr, 0) * 1000;
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'w':
+			o.spin = strtoull(optarg, &endptr, 0) * 1000;
+			if (*endptr != '\0')
+				return usage(argv[0]);
+			break;
+		case 'P':
+			o.prio = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.prio < 1 || o.prio > 99)
+				return usage(argv[0]);
+			break;
+		case 'c':
+			o.cpu = strtol(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.cpu < 0)
+				return usage(argv[0]);
+			break;
+		case 's':
+			o.size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.size == 0 || o.size > MAX_PAYLOAD)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.proto = proto_find(optarg);
+			if (o.proto == NULL)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		return usage(argv[0]);
+
+	for (i = 0; i < MAX_PAYLOAD; i++)
+		payload[i] = 0x42 + i;
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+	e = ifcache_find_name(&ifc, argv[optind]);
+	if (e == NULL) {
+		fprintf(stderr, "%s: no such device\n", argv[optind]);
+		ifcache_free(&ifc);
+		return 1;
+	}
+
+	memset(&st, 0, sizeof(st));
+	hist_init(&st.early_hist);
+	hist_init(&st.late_hist);
+	st.launch = calloc(o.count, sizeof(*st.launch));
+	if (st.launch == NULL || open_socket(&st, e, &o) < 0) {
+		free(st.launch);
+		ifcache_free(&ifc);
+		return 1;
+	}
+	st.tai_offset = tai_offset();
+
+	if (o.mode == MODE_FIFO)
+		run_fifo(&st, &o);
+	else
+		run(&st, &o);
+
+	printf("%s %s: %lu frames, %lu timestamped, %lu missed their launch time, %lu send errors\n",
+		e->name, o.mode == MODE_TXTIME ? "txtime" : "fifo", o.count,
+		st.stamped, st.missed, st.send_errors);
+	if (st.stamped) {
+		printf("launch error: min %.3f  avg %.3f  max %.3f us, %lu early, %lu late\n",
+			st.min_err / 1e3, st.sum_err / st.stamped / 1e3, st.max_err / 1e3,
+			st.early, st.late);
+		hist_print("early", &st.early_hist);
+		hist_print("late", &st.late_hist);
+		if (o.mode == MODE_TXTIME && st.early > st.late)
+			fprintf(stderr, "frames left early, is there an etf qdisc on %s?\n",
+				e->name);
+	}
+
+	close(st.skt);
+	free(st.launch);
+	ifcache_free(&ifc);
+	return st.stamped ? 0 : 1;
+}
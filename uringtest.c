@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "hist.h"
+#include "ifcache.h"
+#include "proto.h"
+#include "rio.h"
+#include "include/linux/lora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING	23
+#endif
+
+/*
+ * Pushes frames from a TX socket to an RX socket on each given interface
+ * and reports what that cost: syscalls, frames per syscall and CPU time
+ * per frame. -m uring moves them through the rio engine, -m plain does
+ * one sendto() per frame and drains the receive side with recv() for
+ * comparison.
+ */
+
+#define MAX_IFS		16
+#define MAX_PAYLOAD	255
+#define RX_BUF_SIZE	2048
+
+enum {
+	MODE_URING,
+	MODE_PLAIN,
+};
+
+struct uringtest_state;
+
+struct radio {
+	struct uringtest_state *st;
+	const struct ifcache_entry *e;
+	int rx;
+	int tx;
+	struct sockaddr_ll sll;
+	int use_sll;
+	unsigned long sent;
+	unsigned long received;
+};
+
+struct uringtest_opts {
+	int mode;
+	unsigned long count;
+	unsigned int batch;
+	unsigned int size;
+	const struct proto *proto;
+};
+
+struct uringtest_state {
+	const struct uringtest_opts *o;
+	struct radio radios[MAX_IFS];
+	unsigned int num_radios;
+	unsigned long sent;
+	unsigned long received;
+	unsigned long short_frames;
+	unsigned long tx_errors;
+	unsigned long syscalls;
+	unsigned int in_flight;
+};
+
+static int open_failed(const char *what, const struct radio *r)
+{
+	int err = errno;
+
+	fprintf(stderr, "%s: %s failed: %s\n", r->e->name, what, strerror(err));
+	return -1;
+}
+
+/* on failure the caller closes whatever got opened */
+static int open_radio(struct radio *r, const struct uringtest_opts *o)
+{
+	int on = 1, size = 4 << 20;
+
+	if (o->proto != NULL) {
+		struct sockaddr_ll addr;
+
+		r->rx = socket(PF_PACKET, SOCK_DGRAM, htons(o->proto->eth_p));
+		if (r->rx == -1)
+			return open_failed("socket", r);
+		/* a loopback device shows every frame once in each direction */
+		setsockopt(r->rx, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on));
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(o->proto->eth_p);
+		addr.sll_ifindex = r->e->ifindex;
+		if (bind(r->rx, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+			return open_failed("bind", r);
+
+		r->tx = socket(PF_PACKET, SOCK_DGRAM, 0);
+		if (r->tx == -1)
+			return open_failed("socket", r);
+		proto_sockaddr_ll(&r->sll, o->proto->eth_p, r->e->ifindex);
+		r->use_sll = 1;
+	} else {
+		struct sockaddr_lora addr;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.lora_family = AF_LORA;
+		addr.lora_ifindex = r->e->ifindex;
+
+		r->rx = socket(PF_LORA, SOCK_DGRAM, 1);
+		if (r->rx == -1)
+			return open_failed("socket", r);
+		if (bind(r->rx, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+			return open_failed("bind", r);
+		r->tx = socket(PF_LORA, SOCK_DGRAM, 1);
+		if (r->tx == -1)
+			return open_failed("socket", r);
+		if (bind(r->tx, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+			return open_failed("bind", r);
+	}
+
+	/* let a burst sit in the socket while the receive is rearmed */
+	if (setsockopt(r->rx, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) == -1)
+		setsockopt(r->rx, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	return 0;
+}
+
+static void fill_frame(unsigned char *buf, unsigned int size, unsigned long seq)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = 0x42 + i;
+	memcpy(buf, &seq, size < sizeof(seq) ? size : sizeof(seq));
+}
+
+static void count_rx(struct radio *r, int len)
+{
+	if (len < (int)r->st->o->size)
+		r->st->short_frames++;
+	r->received++;
+	r->st->received++;
+}
+
+static void rx_done(struct rio *rio, void *user, int fd, const unsigned char *data,
+	int len)
+{
+	struct radio *r = user;
+
+	(void)rio;
+	(void)fd;
+	(void)data;
+	if (len < 0) {
+		fprintf(stderr, "%s: receive failed: %s\n", r->e->name, strerror(-len));
+		return;
+	}
+	count_rx(r, len);
+}
+
+static void tx_done(struct rio *rio, void *user, int fd, int res)
+{
+	struct radio *r = user;
+
+	(void)rio;
+	(void)fd;
+	if (res < 0)
+		r->st->tx_errors++;
+	r->st->in_flight--;
+}
+
+static int run_uring(struct uringtest_state *st)
+{
+	const struct uringtest_opts *o = st->o;
+	struct rio_params p = {
+		.entries = 256,
+		.rx_bufs = 256,
+		.rx_buf_size = RX_BUF_SIZE,
+		.tx_bufs = o->batch,
+		.tx_buf_size = MAX_PAYLOAD,
+		.max_socks = st->num_radios,
+	};
+	const struct rio_stats *rs;
+	unsigned int i, next = 0, idle = 0;
+	struct rio *rio;
+	int ret;
+
+	rio = rio_create(&p);
+	if (rio == NULL)
+		return -1;
+	for (i = 0; i < st->num_radios; i++) {
+		ret = rio_add_socket(rio, st->radios[i].rx, rx_done, &st->radios[i]);
+		if (ret < 0) {
+			fprintf(stderr, "rio_add_socket failed: %s\n", strerror(-ret));
+			rio_destroy(rio);
+			return -1;
+		}
+	}
+
+	while (st->received < o->count) {
+		unsigned char *buf;
+
+		/* the TX pool is as big as a batch, so this tops it up */
+		while (st->sent < o->count && (buf = rio_get_tx_buf(rio)) != NULL) {
+			struct radio *r = &st->radios[next];
+
+			next = (next + 1) % st->num_radios;
+			fill_frame(buf, o->size, st->sent);
+			ret = rio_send(rio, r->tx, buf, o->size, r->use_sll ? &r->sll : NULL,
+				r->use_sll ? sizeof(r->sll) : 0, tx_done, r);
+			if (ret < 0) {
+				rio_put_tx_buf(rio, buf);
+				break;
+			}
+			r->sent++;
+			st->sent++;
+			st->in_flight++;
+		}
+
+		ret = rio_run(rio, 100);
+		if (ret < 0) {
+			fprintf(stderr, "rio_run failed: %s\n", strerror(-ret));
+			break;
+		}
+		/* whatever has not arrived a second after the last send is lost */
+		if (ret == 0 && st->sent == o->count && st->in_flight == 0) {
+			if (++idle == 10)
+				break;
+		} else {
+			idle = 0;
+		}
+	}
+
+	rs = rio_get_stats(rio);
+	st->syscalls = rs->enters;
+	printf("rio: %lu rx rearms, %lu rx out of buffers, %lu zero copy sends\n",
+		rs->rx_rearms, rs->rx_nobufs, rs->tx_zc);
+	rio_destroy(rio);
+	return 0;
+}
+
+static void drain_plain(struct uringtest_state *st)
+{
+	unsigned char buf[RX_BUF_SIZE];
+	unsigned int i;
+	ssize_t len;
+
+	for (i = 0; i < st->num_radios; i++) {
+		struct radio *r = &st->radios[i];
+
+		do {
+			len = recv(r->rx, buf, sizeof(buf), MSG_DONTWAIT);
+			st->syscalls++;
+			if (len >= 0)
+				count_rx(r, len);
+		} while (len >= 0);
+	}
+}
+
+static int run_plain(struct uringtest_state *st)
+{
+	const struct uringtest_opts *o = st->o;
+	unsigned char buf[MAX_PAYLOAD];
+	unsigned int i, next = 0, idle = 0;
+	unsigned long before;
+
+	while (st->received < o->count) {
+		for (i = 0; i < o->batch && st->sent < o->count; i++) {
+			struct radio *r = &st->radios[next];
+			ssize_t ret;
+
+			next = (next + 1) % st->num_radios;
+			fill_frame(buf, o->size, st->sent);
+			if (r->use_sll)
+				ret = sendto(r->tx, buf, o->size, 0, (struct sockaddr *)&r->sll,
+					sizeof(r->sll));
+			else
+				ret = send(r->tx, buf, o->size, 0);
+			st->syscalls++;
+			if (ret == -1)
+				st->tx_errors++;
+			r->sent++;
+			st->sent++;
+		}
+
+		before = st->received;
+		drain_plain(st);
+		if (st->received == before && st->sent == o->count) {
+			if (++idle == 10)
+				break;
+			usleep(100000);
+		} else {
+			idle = 0;
+		}
+	}
+	return 0;
+}
+
+static int usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-m uring|plain] [-n count] [-b batch] [-s size] [-p proto] ifname...\n",
+		argv0);
+	proto_print_names(stderr);
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	struct uringtest_opts o = {
+		.mode = MODE_URING,
+		.count = 100000,
+		.batch = 64,
+		.size = 16,
+	};
+	struct uringtest_state st;
+	struct ifcache ifc;
+	uint64_t cpu;
+	unsigned int i;
+	char *endptr;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "m:n:b:s:p:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (strcmp(optarg, "uring") == 0)
+				o.mode = MODE_URING;
+			else if (strcmp(optarg, "plain") == 0)
+				o.mode = MODE_PLAIN;
+			else
+				return usage(argv[0]);
+			break;
+		case 'n':
+			o.count = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.count == 0)
+				return usage(argv[0]);
+			break;
+		case 'b':
+			o.batch = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.batch == 0 || o.batch > 1024)
+				return usage(argv[0]);
+			break;
+		case 's':
+			o.size = strtoul(optarg, &endptr, 0);
+			if (*endptr != '\0' || o.size == 0 || o.size > MAX_PAYLOAD)
+				return usage(argv[0]);
+			break;
+		case 'p':
+			o.proto = proto_find(optarg);
+			if (o.proto == NULL)
+				return usage(argv[0]);
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+	if (optind == argc || argc - optind > MAX_IFS)
+		return usage(argv[0]);
+
+	if (ifcache_load(&ifc) < 0)
+		return 1;
+
+	memset(&st, 0, sizeof(st));
+	st.o = &o;
+	for (; optind < argc; optind++) {
+		struct radio *r = &st.radios[st.num_radios];
+
+		r->st = &st;
+		r->rx = r->tx = -1;
+		r->e = ifcache_find_name(&ifc, argv[optind]);
+		if (r->e == NULL) {
+			fprintf(stderr, "%s: no such device\n", argv[optind]);
+			ret = -1;
+			goto out;
+		}
+		st.num_radios++;
+		if (open_radio(r, &o) < 0) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	cpu = hist_cpu_ns(RUSAGE_SELF);
+	if (o.mode == MODE_URING)
+		ret = run_uring(&st);
+	else
+		ret = run_plain(&st);
+	cpu = hist_cpu_ns(RUSAGE_SELF) - cpu;
+
+	if (ret == 0) {
+		for (i = 0; i < st.num_radios; i++)
+			printf("%s: %lu sent, %lu received\n", st.radios[i].e->name,
+				st.radios[i].sent, st.radios[i].received);
+		printf("%lu frames sent, %lu received, %lu lost, %lu short, %lu send errors\n",
+			st.sent, st.received, st.sent > st.received ? st.sent - st.received : 0,
+			st.short_frames, st.tx_errors);
+		printf("%lu syscalls, %.1f frames in or out per syscall, %.0f ns CPU per frame\n",
+			st.syscalls, st.syscalls ? (double)(st.sent + st.received) / st.syscalls : 0,
+			st.sent ? (double)cpu / st.sent : 0);
+	}
+
+out:
+	for (i = 0; i < st.num_radios; i++) {
+		if (st.radios[i].rx != -1)
+			close(st.radios[i].rx);
+		if (st.radios[i].tx != -1)
+			close(st.radios[i].tx);
+	}
+	ifcache_free(&ifc);
+	return ret == 0 ? 0 : 1;
+}
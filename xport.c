@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <sys/mman.h>
+
+#include "xport.h"
+#include "include/linux/lora.h"
+
+#ifndef AF_LORA
+#define AF_LORA 28
+#endif
+
+#ifndef PF_LORA
+#define PF_LORA AF_LORA
+#endif
+
+#define GENL_CTRL_BUF_SIZE	8192
+
+struct xport *xport_open(const char *spec)
+{
+	static const struct xport_ops *const backends[] = {
+		&xport_kernel_ops,
+		&xport_fake_ops,
+	};
+	const char *args = NULL;
+	struct xport *xp;
+	size_t len;
+	unsigned int i;
+
+	if (spec == NULL)
+		spec = getenv(XPORT_ENV);
+	if (spec == NULL || spec[0] == '\0')
+		spec = "kernel";
+
+	len = strcspn(spec, ":");
+	if (spec[len] == ':')
+		args = spec + len + 1;
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		if (strlen(backends[i]->name) == len &&
+		    strncmp(backends[i]->name, spec, len) == 0)
+			break;
+	}
+	if (i == sizeof(backends) / sizeof(backends[0])) {
+		fprintf(stderr, "unknown transport %.*s\n", (int)len, spec);
+		return NULL;
+	}
+
+	xp = calloc(1, sizeof(*xp));
+	if (xp == NULL)
+		return NULL;
+	xp->ops = backends[i];
+	xp->genl_skt = -1;
+	if (xp->ops->init != NULL && xp->ops->init(xp, args) < 0) {
+		free(xp);
+		return NULL;
+	}
+	return xp;
+}
+
+void xport_close(struct xport *xp)
+{
+	if (xp == NULL)
+		return;
+	xport_genl_close(xp);
+	if (xp->ops->fini != NULL)
+		xp->ops->fini(xp);
+	free(xp);
+}
+
+int xport_load_ifs(struct xport *xp, struct ifcache *cache)
+{
+	return xp->ops->load_ifs(xp, cache);
+}
+
+int xport_socket(struct xport *xp, const struct ifcache_entry *e, int kind,
+	uint16_t eth_p, int flags, struct xport_sock **out)
+{
+	struct xport_sock *s;
+	int ret;
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+		return -ENOMEM;
+	s->xp = xp;
+	strcpy(s->ifname, e->name);
+	s->ifindex = e->ifindex;
+	s->kind = kind;
+	s->eth_p = eth_p;
+	s->flags = flags;
+	s->fd = -1;
+
+	ret = xp->ops->socket(s);
+	if (ret < 0) {
+		free(s);
+		return ret;
+	}
+	*out = s;
+	return 0;
+}
+
+void xport_sock_close(struct xport_sock *s)
+{
+	if (s == NULL)
+		return;
+	s->xp->ops->close(s);
+	free(s);
+}
+
+int xport_send(struct xport_sock *s, const void *buf, size_t len)
+{
+	return s->xp->ops->send(s, buf, len);
+}
+
+int xport_sendmmsg(struct xport_sock *s, struct mmsghdr *msgs, unsigned int num)
+{
+	return s->xp->ops->sendmmsg(s, msgs, num);
+}
+
+int xport_recv(struct xport_sock *s, void *buf, size_t size)
+{
+	return s->xp->ops->recv(s, buf, size);
+}
+
+int xport_poll_events(struct xport_sock *s, int events)
+{
+	return s->xp->ops->poll_events(s, events);
+}
+
+int xport_tx_ring(struct xport_sock *s, const struct tpacket_req *req, void **ring)
+{
+	int ret;
+
+	if (s->ring != NULL)
+		return -EBUSY;
+	s->ring_req = *req;
+	s->ring_size = (size_t)req->tp_block_size * req->tp_block_nr;
+	ret = s->xp->ops->tx_ring(s);
+	if (ret < 0) {
+		s->ring_size = 0;
+		return ret;
+	}
+	*ring = s->ring;
+	return 0;
+}
+
+int xport_flush(struct xport_sock *s)
+{
+	return s->xp->ops->flush(s);
+}
+
+int xport_genl_open(struct xport *xp, int rcvbuf)
+{
+	return xp->ops->genl_open(xp, rcvbuf);
+}
+
+void xport_genl_close(struct xport *xp)
+{
+	xp->ops->genl_close(xp);
+}
+
+int xport_genl_family(struct xport *xp, const char *name)
+{
+	return xp->ops->genl_family(xp, name);
+}
+
+int xport_genl_send(struct xport *xp, const void *buf, size_t len)
+{
+	return xp->ops->genl_send(xp, buf, len);
+}
+
+int xport_genl_recv(struct xport *xp, void *buf, size_t size)
+{
+	return xp->ops->genl_recv(xp, buf, size);
+}
+
+int xport_genl_wait(struct xport *xp, int timeout_ms)
+{
+	return xp->ops->genl_wait(xp, timeout_ms);
+}
+
+void xport_print_stats(struct xport *xp)
+{
+	if (xp->ops->print_stats != NULL)
+		xp->ops->print_stats(xp);
+}
+
+/*
+ * The kernel backend.
+ */
+
+static int kernel_load_ifs(struct xport *xp, struct ifcache *cache)
+{
+	(void)xp;
+	return ifcache_load(cache);
+}
+
+static int kernel_socket(struct xport_sock *s)
+{
+	int type = SOCK_DGRAM | (s->flags & XPORT_NONBLOCK ? SOCK_NONBLOCK : 0);
+	int ret;
+
+	if (s->kind == XPORT_LORA) {
+		struct sockaddr_lora addr;
+
+		s->fd = socket(PF_LORA, type, 1);
+		if (s->fd == -1)
+			return -errno;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.lora_family = AF_LORA;
+		addr.lora_ifindex = s->ifindex;
+		ret = bind(s->fd, (struct sockaddr *)&addr, sizeof(addr));
+	} else {
+		struct sockaddr_ll addr;
+
+		s->fd = socket(PF_PACKET, type, htons(s->eth_p));
+		if (s->fd == -1)
+			return -errno;
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sll_family = AF_PACKET;
+		addr.sll_protocol = htons(s->eth_p);
+		addr.sll_ifindex = s->ifindex;
+		ret = bind(s->fd, (struct sockaddr *)&addr, sizeof(addr));
+	}
+	if (ret == -1) {
+		int err = errno;
+		close(s->fd);
+		return -err;
+	}
+	return 0;
+}
+
+static void kernel_close(struct xport_sock *s)
+{
+	if (s->ring != NULL)
+		munmap(s->ring, s->ring_size);
+	close(s->fd);
+}
+
+static int kernel_send(struct xport_sock *s, const void *buf, size_t len)
+{
+	ssize_t ret = write(s->fd, buf, len);
+
+	return ret == -1 ? -errno : (int)ret;
+}
+
+static int kernel_sendmmsg(struct xport_sock *s, struct mmsghdr *msgs, unsigned int num)
+{
+	int ret = sendmmsg(s->fd, msgs, num, 0);
+
+	return ret == -1 ? -errno : ret;
+}
+
+static int kernel_recv(struct xport_sock *s, void *buf, size_t size)
+{
+	ssize_t ret = recv(s->fd, buf, size, 0);
+
+	return ret == -1 ? -errno : (int)ret;
+}
+
+static int kernel_poll_events(struct xport_sock *s, int events)
+{
+	(void)s;
+	return events;
+}
+
+static int kernel_tx_ring(struct xport_sock *s)
+{
+	int version = TPACKET_V2;
+	void *ring;
+
+	if (setsockopt(s->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+		return -errno;
+	if (setsockopt(s->fd, SOL_PACKET, PACKET_TX_RING, &s->ring_req, sizeof(s->ring_req)) == -1)
+		return -errno;
+
+	ring = mmap(NULL, s->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (ring == MAP_FAILED)
+		return -errno;
+	s->ring = ring;
+	return 0;
+}
+
+static int kernel_flush(struct xport_sock *s)
+{
+	return send(s->fd, NULL, 0, 0) == -1 ? -errno : 0;
+}
+
+static int kernel_genl_open(struct xport *xp, int rcvbuf)
+{
+	struct sockaddr_nl sa;
+
+	if (xp->genl_skt >= 0)
+		return 0;
+
+	xp->genl_skt = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (xp->genl_skt == -1)
+		return -errno;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind(xp->genl_skt, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		int err = errno;
+		close(xp->genl_skt);
+		xp->genl_skt = -1;
+		return -err;
+	}
+
+	/* best effort, capped by net.core.rmem_max */
+	if (rcvbuf > 0)
+		setsockopt(xp->genl_skt, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	return 0;
+}
+
+static void kernel_genl_close(struct xport *xp)
+{
+	if (xp->genl_skt >= 0)
+		close(xp->genl_skt);
+	xp->genl_skt = -1;
+}
+
+static int kernel_genl_send(struct xport *xp, const void *buf, size_t len)
+{
+	struct sockaddr_nl sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	if (sendto(xp->genl_skt, buf, len, 0, (struct sockaddr *)&sa, sizeof(sa)) == -1)
+		return -errno;
+	return 0;
+}
+
+static int kernel_genl_recv(struct xport *xp, void *buf, size_t size)
+{
+	ssize_t ret;
+
+	do {
+		ret = recv(xp->genl_skt, buf, size, 0);
+	} while (ret == -1 && errno == EINTR);
+	return ret == -1 ? -errno : (int)ret;
+}
+
+static int kernel_genl_wait(struct xport *xp, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = xp->genl_skt, .events = POLLIN };
+	int ret = poll(&pfd, 1, timeout_ms);
+
+	return ret == -1 ? -errno : ret;
+}
+
+/* CTRL_CMD_GETFAMILY by hand, the way ifcache does RTM_GETLINK */
+static int kernel_genl_family(struct xport *xp, const char *name)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct genlmsghdr genl;
+		char attrs[NLA_HDRLEN + NLA_ALIGN(GENL_NAMSIZ)];
+	} req;
+	size_t name_len = strlen(name) + 1;
+	struct nlmsghdr *nlh;
+	struct nlattr *nla;
+	char *buf;
+	int len, ret;
+
+	if (name_len > GENL_NAMSIZ)
+		return -EINVAL;
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN + NLA_HDRLEN + name_len);
+	req.nlh.nlmsg_type = GENL_ID_CTRL;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST;
+	req.genl.cmd = CTRL_CMD_GETFAMILY;
+	req.genl.version = 1;
+	nla = (struct nlattr *)req.attrs;
+	nla->nla_len = NLA_HDRLEN + name_len;
+	nla->nla_type = CTRL_ATTR_FAMILY_NAME;
+	memcpy(req.attrs + NLA_HDRLEN, name, name_len);
+
+	ret = kernel_genl_send(xp, &req, req.nlh.nlmsg_len);
+	if (ret < 0)
+		return ret;
+
+	buf = malloc(GENL_CTRL_BUF_SIZE);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	len = kernel_genl_recv(xp, buf, GENL_CTRL_BUF_SIZE);
+	ret = len < 0 ? len : -ENOENT;
+	for (nlh = (struct nlmsghdr *)buf; len > 0 && NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+		int attrlen;
+
+		if (nlh->nlmsg_type == NLMSG_ERROR) {
+			struct nlmsgerr *e = NLMSG_DATA(nlh);
+			ret = e->error ? e->error : -ENOENT;
+			break;
+		}
+		if (nlh->nlmsg_type != GENL_ID_CTRL)
+			continue;
+
+		nla = (struct nlattr *)((char *)NLMSG_DATA(nlh) + GENL_HDRLEN);
+		attrlen = nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+		while (attrlen >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN &&
+		       nla->nla_len <= attrlen) {
+			if ((nla->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID) {
+				ret = *(uint16_t *)((char *)nla + NLA_HDRLEN);
+				break;
+			}
+			attrlen -= NLA_ALIGN(nla->nla_len);
+			nla = (struct nlattr *)((char *)nla + NLA_ALIGN(nla->nla_len));
+		}
+		break;
+	}
+
+	free(buf);
+	return ret;
+}
+
+const struct xport_ops xport_kernel_ops = {
+	.name		= "kernel",
+	.load_ifs	= kernel_load_ifs,
+	.socket		= kernel_socket,
+	.close		= kernel_close,
+	.send		= kernel_send,
+	.sendmmsg	= kernel_sendmmsg,
+	.recv		= kernel_recv,
+	.poll_events	= kernel_poll_events,
+	.tx_ring	= kernel_tx_ring,
+	.flush		= kernel_flush,
+	.genl_open	= kernel_genl_open,
+	.genl_close	= kernel_genl_close,
+	.genl_family	= kernel_genl_family,
+	.genl_send	= kernel_genl_send,
+	.genl_recv	= kernel_genl_recv,
+	.genl_wait	= kernel_genl_wait,
+};
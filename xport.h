@@ -0,0 +1,141 @@
+#ifndef XPORT_H
+#define XPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+
+#include "ifcache.h"
+
+/*
+ * Transport between the tools and the radios. The kernel backend is what
+ * the tools always used: PF_LORA and PF_PACKET sockets and a generic
+ * netlink socket. The fake backend is an in-process radio, see
+ * fakeradio.c, that needs neither the modules nor any hardware.
+ *
+ * xport_open() takes "kernel", "fake" or "fake:key=value,...". Without a
+ * spec it reads XPORT_ENV and falls back to the kernel. Unless noted
+ * otherwise, functions return a negative errno on failure, the errno
+ * the system call they stand for would have set.
+ */
+
+#define XPORT_ENV	"RADIO_TRANSPORT"
+
+/* the kind of socket */
+enum {
+	XPORT_LORA,
+	XPORT_PACKET,
+};
+
+/* xport_socket() flags */
+#define XPORT_NONBLOCK	0x1
+
+struct xport;
+struct mmsghdr;
+
+struct xport_sock {
+	struct xport *xp;
+	char ifname[IFNAMSIZ];
+	int ifindex;
+	int kind;
+	uint16_t eth_p;
+	int flags;
+	/* the socket, or whatever the backend has for the caller to wait on */
+	int fd;
+	void *ring;
+	size_t ring_size;
+	struct tpacket_req ring_req;
+	void *priv;
+};
+
+struct xport_ops {
+	const char *name;
+	int (*init)(struct xport *xp, const char *args);
+	void (*fini)(struct xport *xp);
+	int (*load_ifs)(struct xport *xp, struct ifcache *cache);
+
+	int (*socket)(struct xport_sock *s);
+	void (*close)(struct xport_sock *s);
+	int (*send)(struct xport_sock *s, const void *buf, size_t len);
+	int (*sendmmsg)(struct xport_sock *s, struct mmsghdr *msgs, unsigned int num);
+	int (*recv)(struct xport_sock *s, void *buf, size_t size);
+	int (*poll_events)(struct xport_sock *s, int events);
+	int (*tx_ring)(struct xport_sock *s);
+	int (*flush)(struct xport_sock *s);
+
+	int (*genl_open)(struct xport *xp, int rcvbuf);
+	void (*genl_close)(struct xport *xp);
+	int (*genl_family)(struct xport *xp, const char *name);
+	int (*genl_send)(struct xport *xp, const void *buf, size_t len);
+	int (*genl_recv)(struct xport *xp, void *buf, size_t size);
+	int (*genl_wait)(struct xport *xp, int timeout_ms);
+
+	void (*print_stats)(struct xport *xp);
+};
+
+struct xport {
+	const struct xport_ops *ops;
+	int genl_skt;
+	void *priv;
+};
+
+extern const struct xport_ops xport_kernel_ops;
+extern const struct xport_ops xport_fake_ops;
+
+/* prints what is wrong with the spec and returns NULL */
+struct xport *xport_open(const char *spec);
+void xport_close(struct xport *xp);
+
+static inline const char *xport_name(const struct xport *xp)
+{
+	return xp->ops->name;
+}
+
+/* like ifcache_load(), but the interfaces the backend has */
+int xport_load_ifs(struct xport *xp, struct ifcache *cache);
+
+/*
+ * A datagram socket bound to e: PF_LORA for XPORT_LORA, PF_PACKET for
+ * eth_p with XPORT_PACKET.
+ */
+int xport_socket(struct xport *xp, const struct ifcache_entry *e, int kind,
+	uint16_t eth_p, int flags, struct xport_sock **out);
+void xport_sock_close(struct xport_sock *s);
+
+/* return the bytes or the number of messages sent, like send(2) and sendmmsg(2) */
+int xport_send(struct xport_sock *s, const void *buf, size_t len);
+int xport_sendmmsg(struct xport_sock *s, struct mmsghdr *msgs, unsigned int num);
+int xport_recv(struct xport_sock *s, void *buf, size_t size);
+
+/*
+ * To wait until sending (POLLOUT) or receiving (POLLIN) may go on, poll
+ * s->fd for the events this returns instead.
+ */
+int xport_poll_events(struct xport_sock *s, int events);
+
+/*
+ * Set up a TPACKET_V2 transmit ring as PACKET_TX_RING would, with the
+ * frame data at TPACKET2_HDRLEN - sizeof(struct sockaddr_ll). Frames
+ * marked TP_STATUS_SEND_REQUEST go out on xport_flush().
+ */
+int xport_tx_ring(struct xport_sock *s, const struct tpacket_req *req, void **ring);
+int xport_flush(struct xport_sock *s);
+
+/*
+ * Generic netlink. Requests go out as raw netlink messages, as many as
+ * fit in len, and replies come back the same way, one datagram per
+ * xport_genl_recv().
+ */
+int xport_genl_open(struct xport *xp, int rcvbuf);
+void xport_genl_close(struct xport *xp);
+int xport_genl_family(struct xport *xp, const char *name);
+int xport_genl_send(struct xport *xp, const void *buf, size_t len);
+int xport_genl_recv(struct xport *xp, void *buf, size_t size);
+/* returns 1 once a reply is there to receive, 0 on timeout */
+int xport_genl_wait(struct xport *xp, int timeout_ms);
+
+/* what the fake radio saw; the kernel backend has nothing to add */
+void xport_print_stats(struct xport *xp);
+
+#endif